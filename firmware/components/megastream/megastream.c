@@ -1,6 +1,16 @@
 #include "megastream.h"
 #include <string.h>
 
+//define this to catch footgun violations with assert(). useful when building this file standalone on a host to stress test it
+//#define MEGASTREAM_PARANOID
+
+#ifdef MEGASTREAM_PARANOID
+#include <assert.h>
+#define MEGASTREAM_CHECK(x) assert(x)
+#else
+#define MEGASTREAM_CHECK(x)
+#endif
+
 /*
  * This is based off FreeRTOS StreamBuffers which are really just ring buffers with some rtos-flavored stuff that we don't actually need.
  * 
@@ -9,24 +19,48 @@
  * - Don't write more than will fit
  * - Don't read more than is available, or peek when nothing is available
  * - Make sure nothing is reading or writing when resetting
+ * - Reserve/PeekSpan only hand out the contiguous part before the wraparound, so check the returned size
+ * - Don't Commit more than was reserved, or Consume more than was peeked
 */
 
+#ifndef min
 #define min(a,b) ((a) < (b) ? (a) : (b))
+#endif
+
+/*
+ * Cross-core ordering:
+ * head is only written by the writer and tail only by the reader. Each side publishes its index with a release store after
+ * it's done touching the buffer, and loads the other side's index with an acquire load before touching the buffer. That way
+ * the reader never sees a head that's ahead of the data, and the writer never overwrites bytes the reader is still copying out.
+ * An index's own side can load it relaxed since nobody else writes it.
+ * volatile alone doesn't give us any of that: it stops the compiler caching the index, but doesn't order the memcpy against it.
+*/
+#ifndef MEGASTREAM_ORDER_RELAXED
+#define MS_ACQUIRE __ATOMIC_ACQUIRE
+#define MS_RELEASE __ATOMIC_RELEASE
+#else //control build for the tsan test in utils/megastream_test.c. takes the ordering away so tsan has a race to find. never use this on the device
+#define MS_ACQUIRE __ATOMIC_RELAXED
+#define MS_RELEASE __ATOMIC_RELAXED
+#endif
+#define MS_LOAD_OWN(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define MS_LOAD_OTHER(x) __atomic_load_n(&(x), MS_ACQUIRE)
+#define MS_PUBLISH(x, v) __atomic_store_n(&(x), (v), MS_RELEASE)
 
 void MegaStream_Create(MegaStreamContext_t *ctx, uint8_t *buf, size_t size) {
     ctx->size = size;
     ctx->buf = buf;
-    ctx->head = 0;
-    ctx->tail = 0;
+    MS_PUBLISH(ctx->head, 0);
+    MS_PUBLISH(ctx->tail, 0);
 }
 
 void MegaStream_Reset(MegaStreamContext_t *ctx) {
-    ctx->head = 0;
-    ctx->tail = 0;
+    MS_PUBLISH(ctx->head, 0);
+    MS_PUBLISH(ctx->tail, 0);
 }
 
-void MegaStream_Send(MegaStreamContext_t *ctx, uint8_t *inbuf, size_t insize) {
-    size_t nexthead = ctx->head;
+void MegaStream_Send(MegaStreamContext_t *ctx, const uint8_t *inbuf, size_t insize) {
+    MEGASTREAM_CHECK(insize <= MegaStream_Free(ctx));
+    size_t nexthead = MS_LOAD_OWN(ctx->head);
     size_t firstlength = min(ctx->size-nexthead, insize);
     memcpy(&(ctx->buf[nexthead]), inbuf, firstlength);
     if (insize > firstlength) {
@@ -36,11 +70,12 @@ void MegaStream_Send(MegaStreamContext_t *ctx, uint8_t *inbuf, size_t insize) {
     if (nexthead >= ctx->size) {
         nexthead -= ctx->size;
     }
-    ctx->head = nexthead;
+    MS_PUBLISH(ctx->head, nexthead);
 }
 
 void MegaStream_Recv(MegaStreamContext_t *ctx, uint8_t *outbuf, size_t outsize) {
-    size_t nexttail = ctx->tail;
+    MEGASTREAM_CHECK(outsize <= MegaStream_Used(ctx));
+    size_t nexttail = MS_LOAD_OWN(ctx->tail);
     size_t firstlength = min(ctx->size-nexttail, outsize);
     memcpy(outbuf, &(ctx->buf[nexttail]), firstlength);
     if (outsize > firstlength) {
@@ -50,16 +85,48 @@ void MegaStream_Recv(MegaStreamContext_t *ctx, uint8_t *outbuf, size_t outsize)
     if (nexttail >= ctx->size) {
         nexttail -= ctx->size;
     }
-    ctx->tail = nexttail;
+    MS_PUBLISH(ctx->tail, nexttail);
+}
+
+size_t MegaStream_Reserve(MegaStreamContext_t *ctx, uint8_t **ptr) {
+    size_t head = MS_LOAD_OWN(ctx->head);
+    *ptr = &(ctx->buf[head]);
+    return min(MegaStream_Free(ctx), ctx->size-head);
+}
+
+void MegaStream_Commit(MegaStreamContext_t *ctx, size_t size) {
+    MEGASTREAM_CHECK(size <= ctx->size-MS_LOAD_OWN(ctx->head) && size <= MegaStream_Free(ctx));
+    size_t nexthead = MS_LOAD_OWN(ctx->head) + size;
+    if (nexthead >= ctx->size) {
+        nexthead -= ctx->size;
+    }
+    MS_PUBLISH(ctx->head, nexthead);
+}
+
+size_t MegaStream_PeekSpan(MegaStreamContext_t *ctx, uint8_t **ptr) {
+    size_t tail = MS_LOAD_OWN(ctx->tail);
+    *ptr = &(ctx->buf[tail]);
+    return min(MegaStream_Used(ctx), ctx->size-tail);
+}
+
+void MegaStream_Consume(MegaStreamContext_t *ctx, size_t size) {
+    MEGASTREAM_CHECK(size <= ctx->size-MS_LOAD_OWN(ctx->tail) && size <= MegaStream_Used(ctx));
+    size_t nexttail = MS_LOAD_OWN(ctx->tail) + size;
+    if (nexttail >= ctx->size) {
+        nexttail -= ctx->size;
+    }
+    MS_PUBLISH(ctx->tail, nexttail);
 }
 
 uint8_t MegaStream_Peek(MegaStreamContext_t *ctx) {
-    return ctx->buf[ctx->tail];
+    MEGASTREAM_CHECK(MegaStream_Used(ctx) > 0);
+    return ctx->buf[MS_LOAD_OWN(ctx->tail)];
 }
 
+//Used and Free get called from both sides, so both indices are loaded acquire
 size_t MegaStream_Used(MegaStreamContext_t *ctx) {
-    size_t c = ctx->size + ctx->head;
-    c -= ctx->tail;
+    size_t c = ctx->size + MS_LOAD_OTHER(ctx->head);
+    c -= MS_LOAD_OTHER(ctx->tail);
     if (c >= ctx->size) {
         c -= ctx->size;
     }
@@ -67,8 +134,8 @@ size_t MegaStream_Used(MegaStreamContext_t *ctx) {
 }
 
 size_t MegaStream_Free(MegaStreamContext_t *ctx) {
-    size_t s = ctx->size + ctx->tail;
-    s -= ctx->head;
+    size_t s = ctx->size + MS_LOAD_OTHER(ctx->tail);
+    s -= MS_LOAD_OTHER(ctx->head);
     s--;
     if (s >= ctx->size) {
         s -= ctx->size;
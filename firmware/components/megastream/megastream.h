@@ -6,15 +6,19 @@
 
 typedef struct {
     uint8_t *buf;
-    volatile size_t tail;
-    volatile size_t head;
+    size_t tail; //only written by the reader, only access through the __atomic builtins in megastream.c
+    size_t head; //only written by the writer, ditto
     size_t size;
 } MegaStreamContext_t;
 
 void MegaStream_Create(MegaStreamContext_t *ctx, uint8_t *buf, size_t size);
 void MegaStream_Reset(MegaStreamContext_t *ctx);
-void MegaStream_Send(MegaStreamContext_t *ctx, uint8_t *inbuf, size_t insize);
+void MegaStream_Send(MegaStreamContext_t *ctx, const uint8_t *inbuf, size_t insize);
 void MegaStream_Recv(MegaStreamContext_t *ctx, uint8_t *outbuf, size_t outsize);
+size_t MegaStream_Reserve(MegaStreamContext_t *ctx, uint8_t **ptr);
+void MegaStream_Commit(MegaStreamContext_t *ctx, size_t size);
+size_t MegaStream_PeekSpan(MegaStreamContext_t *ctx, uint8_t **ptr);
+void MegaStream_Consume(MegaStreamContext_t *ctx, size_t size);
 uint8_t MegaStream_Peek(MegaStreamContext_t *ctx);
 size_t MegaStream_Used(MegaStreamContext_t *ctx);
 size_t MegaStream_Free(MegaStreamContext_t *ctx);
@@ -14,6 +14,8 @@
 #include "ui.h"
 #include "ui/modal.h"
 #include "taskmgr.h"
+#include "vgmdecode.h"
+#include "dsarena.h"
 
 static const char* TAG = "DacStream";
 
@@ -24,63 +26,41 @@ static uint8_t DacStream_CurLoop = 0;
 static StaticSemaphore_t DacStream_MutexBuf;
 static SemaphoreHandle_t DacStream_Mutex = NULL;
 static volatile uint8_t DacStream_VgmDataBlockIndex = 0;
-FILE *DacStream_FindFile;
-FILE *DacStream_FillFile;
+TrackFile_t *DacStream_File;
 static VgmInfoStruct_t *DacStream_VgmInfo;
 volatile static VgmDataBlockStruct_t DacStream_VgmDataBlocks[MAX_REALTIME_DATABLOCKS+1];
+static VgmBankIndex_t DacStream_BankIndex;
 EventGroupHandle_t DacStream_FindStatus;
 static StaticEventGroup_t DacStream_FindStatusBuf;
 EventGroupHandle_t DacStream_FillStatus;
 static StaticEventGroup_t DacStream_FillStatusBuf;
-static uint8_t DsFind_VgmBuf[FREAD_LOCAL_BUF];
-static uint16_t DsFind_VgmBufPos = FREAD_LOCAL_BUF;
-static IRAM_ATTR uint32_t DsFind_VgmFilePos = 0;
-
-#define DSFIND_BUF_FILL \
-    fseek(DacStream_FindFile, DsFind_VgmFilePos, SEEK_SET); \
-    fread(&DsFind_VgmBuf[0], 1, sizeof(DsFind_VgmBuf), DacStream_FindFile); \
-    DsFind_VgmBufPos = 0; \
-    if (ferror(DacStream_FindFile)) { \
+static VgmReader_t DsFind_Reader;
+static uint8_t *DsFind_ReaderBuf;
+static DacStreamSample_t DacStream_Samples[DACSTREAM_SAMPLE_COUNT];
+static uint32_t DacStream_SampleUse = 0;
+static DsArena_t DacStream_Arena; //streams are carved out of Driver_PcmBuf as slots are claimed
+
+//these all bail out of the current iteration on io error
+#define DSFIND_BUF_CHECK \
+    if (DsFind_Reader.Error) { \
         file_error(); \
         continue; \
     }
-#define DSFIND_BUF_CHECK \
-    if (DsFind_VgmBufPos >= sizeof(DsFind_VgmBuf)) { \
-        DSFIND_BUF_FILL; \
-    }
 #define DSFIND_BUF_SEEK_SET(offset) \
-    DsFind_VgmFilePos = offset; \
-    DSFIND_BUF_FILL;
+    VgmReader_Seek(&DsFind_Reader, offset);
 #define DSFIND_BUF_SEEK_REL(offset) \
-    DsFind_VgmFilePos += offset; \
-    DsFind_VgmBufPos += offset; \
-    DSFIND_BUF_CHECK;
+    VgmReader_Skip(&DsFind_Reader, offset);
 #define DSFIND_BUF_READ(var) \
-    var = DsFind_VgmBuf[DsFind_VgmBufPos]; \
-    DsFind_VgmBufPos++; \
-    DsFind_VgmFilePos++; \
+    var = VgmReader_Read8(&DsFind_Reader); \
     DSFIND_BUF_CHECK;
 #define DSFIND_BUF_READ4(var) \
-    if (sizeof(DsFind_VgmBuf)-DsFind_VgmBufPos < 4) { \
-        DSFIND_BUF_FILL; \
-    } \
-    _Pragma("GCC diagnostic push") \
-    _Pragma("GCC diagnostic ignored \"-Wstrict-aliasing\"") \
-    var = *(uint32_t*)&DsFind_VgmBuf[DsFind_VgmBufPos]; \
-    _Pragma("GCC diagnostic pop") \
-    DsFind_VgmBufPos += 4; \
-    DsFind_VgmFilePos += 4; \
+    var = VgmReader_Read32(&DsFind_Reader); \
     DSFIND_BUF_CHECK;
 #define DSFIND_BUF_READ2(var) \
-    if (sizeof(DsFind_VgmBuf)-DsFind_VgmBufPos < 2) { \
-        DSFIND_BUF_FILL; \
-    } \
-    _Pragma("GCC diagnostic push") \
-    _Pragma("GCC diagnostic ignored \"-Wstrict-aliasing\"") \
-    var = *(uint16_t*)&DsFind_VgmBuf[DsFind_VgmBufPos]; \
-    _Pragma("GCC diagnostic pop") \
-    DsFind_VgmBufPos += 2; \
-    DsFind_VgmFilePos += 2; \
+    var = VgmReader_Read16(&DsFind_Reader); \
+    DSFIND_BUF_CHECK;
+#define DSFIND_BUF_READ_SETUP \
+    DacStream_CurSetup = DacStream_GetSetup(VgmReader_Read8(&DsFind_Reader)); \
     DSFIND_BUF_CHECK;
 
 bool DacStream_Setup() {
@@ -90,8 +70,10 @@ bool DacStream_Setup() {
     for (uint8_t i=0; i<DACSTREAM_PRE_COUNT; i++) {
         DacStreamEntries[i].SlotFree = true;
         DacStreamEntries[i].Seq = 0;
-        MegaStream_Create((MegaStreamContext_t *)&DacStreamEntries[i].Stream, &Driver_PcmBuf[i*DACSTREAM_BUF_SIZE], DACSTREAM_BUF_SIZE);
+        DacStreamEntries[i].BufSize = 0;
+        MegaStream_Create((MegaStreamContext_t *)&DacStreamEntries[i].Stream, Driver_PcmBuf, 1); //always empty until the find task sizes it
     }
+    DsArena_Init(&DacStream_Arena, sizeof(Driver_PcmBuf));
 
     ESP_LOGI(TAG, "Creating find thread status event group");
     DacStream_FindStatus = xEventGroupCreateStatic(&DacStream_FindStatusBuf);
@@ -112,56 +94,186 @@ bool DacStream_Setup() {
     ESP_LOGI(TAG, "Creating task mutex");
     DacStream_Mutex = xSemaphoreCreateMutexStatic(&DacStream_MutexBuf);
 
+    ESP_LOGI(TAG, "Allocating find reader buffer");
+    DsFind_ReaderBuf = heap_caps_malloc(VGMREADER_BUF_SIZE, MALLOC_CAP_8BIT);
+    if (DsFind_ReaderBuf == NULL) {
+        ESP_LOGE(TAG, "Failed !!");
+        return false;
+    }
+
     ESP_LOGI(TAG, "Ready");
     return true;
 }
 
-uint32_t DacStream_GetDataOffset(uint8_t BankType, uint32_t BankOff) {
-    uint32_t consumed = 0;
-    for (uint8_t i=0;i<DacStream_VgmDataBlockIndex;i++) {
-        if (DacStream_VgmDataBlocks[i].Type == BankType) {
-            if (BankOff >= consumed && BankOff < consumed + DacStream_VgmDataBlocks[i].Size) {
-                return DacStream_VgmDataBlocks[i].Offset + (BankOff - consumed);
-            }
-            consumed += DacStream_VgmDataBlocks[i].Size;
+uint32_t DacStream_GetBlockOffset(uint8_t BankType, uint16_t BlockId) {
+    return VgmBankIndex_GetBlockOffset(&DacStream_BankIndex, BankType, BlockId);
+}
+
+uint32_t DacStream_GetBlockSize(uint8_t BankType, uint16_t BlockId) {
+    return VgmBankIndex_GetBlockSize(&DacStream_BankIndex, BankType, BlockId);
+}
+
+//shared sample pool. everything here happens with DacStream_Mutex held
+static DacStreamSample_t *DacStream_SampleGet(uint8_t Bank, uint32_t Start, uint32_t Length) { //takes a reference. NULL if it has to be streamed
+    uint32_t used = 0;
+    for (uint8_t i=0;i<DACSTREAM_SAMPLE_COUNT;i++) {
+        DacStreamSample_t *s = &DacStream_Samples[i];
+        if (s->Data == NULL) continue;
+        if (s->Bank == Bank && s->Start == Start && s->Length == Length) {
+            s->Refs++;
+            s->LastUse = DacStream_SampleUse++;
+            return s;
         }
+        used += s->Length;
     }
-    return 0xffffffff;
-}
+    if (Length == 0 || Length > DACSTREAM_SAMPLE_BUDGET) return NULL;
 
-uint32_t DacStream_GetBlockOffset(uint8_t BankType, uint16_t BlockId) {
-    uint16_t cblock = 0;
-    uint32_t off = 0;
-    for (uint8_t i=0;i<DacStream_VgmDataBlockIndex;i++) {
-        if (DacStream_VgmDataBlocks[i].Type == BankType) {
-            if (cblock++ == BlockId) {
-                return off;
+    //make room, least recently used first, skipping anything a slot still points at
+    DacStreamSample_t *slot = NULL;
+    while (1) {
+        DacStreamSample_t *lru = NULL;
+        slot = NULL;
+        for (uint8_t i=0;i<DACSTREAM_SAMPLE_COUNT;i++) {
+            DacStreamSample_t *s = &DacStream_Samples[i];
+            if (s->Data == NULL) {
+                if (!slot) slot = s;
+            } else if (s->Refs == 0 && (!lru || s->LastUse < lru->LastUse)) {
+                lru = s;
             }
-            off += DacStream_VgmDataBlocks[i].Size;
         }
+        if (slot && used + Length <= DACSTREAM_SAMPLE_BUDGET) break;
+        if (!lru) return NULL; //everything's in use
+        used -= lru->Length;
+        free(lru->Data);
+        lru->Data = NULL;
     }
-    return 0xffffffff;
+
+    slot->Data = heap_caps_malloc(Length, MALLOC_CAP_8BIT);
+    if (slot->Data == NULL) return NULL; //not the end of the world, it just gets streamed
+    slot->Bank = Bank;
+    slot->Start = Start;
+    slot->Length = Length;
+    slot->Filled = 0;
+    slot->Refs = 1;
+    slot->LastUse = DacStream_SampleUse++;
+    return slot;
 }
 
-uint32_t DacStream_GetBlockSize(uint8_t BankType, uint16_t BlockId) {
-    uint16_t cblock = 0;
-    for (uint8_t i=0;i<DacStream_VgmDataBlockIndex;i++) {
-        if (DacStream_VgmDataBlocks[i].Type == BankType) {
-            if (cblock++ == BlockId) {
-                return DacStream_VgmDataBlocks[i].Size;
-            }
-        }
+static void DacStream_SampleRelease(uint8_t idx) {
+    if (DacStreamEntries[idx].Sample) DacStreamEntries[idx].Sample->Refs--;
+    DacStreamEntries[idx].Sample = NULL;
+}
+
+static void DacStream_SampleReleaseFreed() { //slots the driver has freed don't hold on to their samples until they're claimed again
+    for (uint8_t i=0;i<DACSTREAM_PRE_COUNT;i++) {
+        if (DacStreamEntries[i].Sample && __atomic_load_n(&DacStreamEntries[i].SlotFree, __ATOMIC_ACQUIRE)) DacStream_SampleRelease(i); //driver is done reading it
+    }
+}
+
+static void DacStream_SampleFreeAll() { //new track, none of it applies any more. no slot may point at any of them
+    for (uint8_t i=0;i<DACSTREAM_SAMPLE_COUNT;i++) {
+        if (DacStream_Samples[i].Data) free(DacStream_Samples[i].Data);
+        DacStream_Samples[i].Data = NULL;
+        DacStream_Samples[i].Refs = 0;
+    }
+}
+
+static void DacStream_SampleAttach(uint8_t idx) { //slot was just set up by the find task
+    volatile DacStreamEntry_t *e = &DacStreamEntries[idx];
+    //only the length modes the driver stops at DataLength for, anything else could run past the end
+    if (e->LengthMode == 0 || e->LengthMode == 1 || e->LengthMode == 3) {
+        DacStream_SampleReleaseFreed(); //so their samples can be evicted to make room
+        e->Sample = DacStream_SampleGet(e->DataBankId, e->DataStart, e->DataLength);
+        if (e->Sample) e->ReadOffset = e->Sample->Filled; //if it's already loaded, the fill task won't even look at this slot
     }
-    return 0xffffffff;
 }
 
 static uint8_t d = 0;
 static IRAM_ATTR uint32_t DacStream_Seq = 1;
-static uint32_t DacStream_CurSampleRate = 0;
-static uint8_t DacStream_CurDataBank = 0;
+typedef struct { //what the 0x90~0x92s have set up for one stream id so far
+    uint8_t Id;         //0xff = unused
+    uint8_t ChipType;
+    uint8_t ChipPort;
+    uint8_t ChipCommand;
+    uint8_t DataBank;
+    uint32_t SampleRate;
+} DacStreamSetup_t;
+static DacStreamSetup_t DacStream_Setups[DACSTREAM_STREAMS];
+static DacStreamSetup_t *DacStream_CurSetup = NULL; //the one the command being parsed refers to
 static uint16_t DacStream_CurDataBlock = 0;
-static uint8_t DacStream_CurChipCommand = 0;
-static uint8_t DacStream_CurChipPort = 0;
+static uint32_t DacStream_FindSample = 0; //vgm sample the find task's cursor is at
+static bool DacStream_FoundAny = false;
+
+static DacStreamSetup_t *DacStream_GetSetup(uint8_t id) {
+    DacStreamSetup_t *s = NULL;
+    for (uint8_t i=0;i<DACSTREAM_STREAMS;i++) {
+        if (DacStream_Setups[i].Id == id) return &DacStream_Setups[i];
+        if (s == NULL && DacStream_Setups[i].Id == 0xff) s = &DacStream_Setups[i];
+    }
+    if (s == NULL) {
+        ESP_LOGW(TAG, "More than %d stream ids, id %d shares the last one's setup", DACSTREAM_STREAMS, id);
+        s = &DacStream_Setups[DACSTREAM_STREAMS-1];
+    }
+    s->Id = id;
+    return s;
+}
+
+static void DacStream_ApplySetup(uint8_t idx) { //slot takes on the setup of the stream that starts it
+    DacStreamEntries[idx].StreamId = DacStream_CurSetup->Id;
+    DacStreamEntries[idx].ChipType = DacStream_CurSetup->ChipType;
+    DacStreamEntries[idx].ChipPort = DacStream_CurSetup->ChipPort;
+    DacStreamEntries[idx].ChipCommand = DacStream_CurSetup->ChipCommand;
+    DacStreamEntries[idx].DataBankId = DacStream_CurSetup->DataBank;
+    DacStreamEntries[idx].SampleRate = DacStream_CurSetup->SampleRate;
+}
+
+//give the slot its stream, sized to hold the whole sample if it can. false if there isn't room until older slots are done with theirs
+static bool DacStream_StreamAlloc(uint8_t idx) {
+    volatile DacStreamEntry_t *e = &DacStreamEntries[idx];
+    e->BufSize = 0;
+    if (e->Sample) { //plays from ram, doesn't need one
+        MegaStream_Create((MegaStreamContext_t *)&e->Stream, Driver_PcmBuf, 1);
+        return true;
+    }
+    //slots are claimed and freed in seq order, so the oldest one still holding a stream is where the free space ends
+    bool empty = true;
+    uint32_t oldest = 0;
+    uint32_t tail = 0;
+    for (uint8_t i=0;i<DACSTREAM_PRE_COUNT;i++) {
+        if (DacStreamEntries[i].SlotFree || DacStreamEntries[i].BufSize == 0) continue;
+        if (empty || DacStreamEntries[i].Seq < oldest) {
+            oldest = DacStreamEntries[i].Seq;
+            tail = DacStreamEntries[i].BufStart;
+            empty = false;
+        }
+    }
+    uint32_t want = (e->DataLength < DACSTREAM_SLOT_MAX)?(e->DataLength+1):DACSTREAM_SLOT_MAX; //+1, a megastream holds one less than its size
+    uint32_t got;
+    uint32_t off = DsArena_Alloc(&DacStream_Arena, empty, tail, want, DACSTREAM_SLOT_MIN, &got);
+    if (off == DSARENA_NONE) return false;
+    e->BufStart = off;
+    e->BufSize = got;
+    MegaStream_Create((MegaStreamContext_t *)&e->Stream, &Driver_PcmBuf[off], got);
+    return true;
+}
+
+//slot's parameters are all filled in, hand it over to the fill task and driver
+static bool DacStream_Claim(uint8_t idx) {
+    DacStreamEntries[idx].ReadOffset = 0;
+    DacStreamEntries[idx].BytesFilled = 0;
+    DacStreamEntries[idx].Played = 0;
+    DacStream_SampleRelease(idx);
+    DacStream_SampleAttach(idx);
+    if (!DacStream_StreamAlloc(idx)) {
+        DacStream_SampleRelease(idx);
+        return false;
+    }
+    DacStreamEntries[idx].Seq = DacStream_Seq++;
+    DacStreamEntries[idx].StartSample = DacStream_FindSample;
+    DacStreamEntries[idx].SlotFree = false;
+    DacStream_FoundAny = true;
+    return true;
+}
 
 static volatile bool DacStream_FindRunning = false;
 static volatile bool DacStream_FillRunning = false;
@@ -178,7 +290,6 @@ static void file_error() {
     Sdcard_Invalidate();
     ESP_LOGE(TAG, "IO error");
 }
-static bool DacStream_FoundAny = false;
 void DacStream_FindTask() {
     ESP_LOGI(TAG, "Find task start");
 
@@ -211,68 +322,77 @@ void DacStream_FindTask() {
                 UserLedMgr_DiskState[DISKSTATE_DACSTREAM_FIND] = true;
                 UserLedMgr_Notify();
                 while (xTaskGetTickCount() - start <= pdMS_TO_TICKS(50)) {
+                    uint32_t cmd = DsFind_Reader.Pos;
                     DSFIND_BUF_READ(d)
                     if (!VgmCommandIsFixedSize(d)) {
                         if (d == 0x67) { //datablock
                             if (DacStream_CurLoop == 0) { //only load datablocks on first loop through
-                                VgmParseDataBlock(DacStream_FindFile, (VgmDataBlockStruct_t *)&DacStream_VgmDataBlocks[DacStream_VgmDataBlockIndex++]);
+                                VgmDataBlockStruct_t *block = (VgmDataBlockStruct_t *)&DacStream_VgmDataBlocks[DacStream_VgmDataBlockIndex];
+                                if (VgmParseDataBlock(&DsFind_Reader, block)) {
+                                    VgmBankIndex_Add(&DacStream_BankIndex, block, VgmDecode_Block(&DsFind_Reader, block)); //loader has usually decoded it already
+                                }
+                                DacStream_VgmDataBlockIndex++;
                             } else {
                                 //can't simply skip over the datablock because they're variable-length. use the last entry as a garbage can
-                                VgmParseDataBlock(DacStream_FindFile, (VgmDataBlockStruct_t *)&DacStream_VgmDataBlocks[MAX_REALTIME_DATABLOCKS]);
+                                VgmParseDataBlock(&DsFind_Reader, (VgmDataBlockStruct_t *)&DacStream_VgmDataBlocks[MAX_REALTIME_DATABLOCKS]);
                             }
+                            DSFIND_BUF_CHECK;
                             //todo: bounds check
+                        } else if (d == 0x68) { //pcm ram write, nothing for us here
+                            VgmPcmRamWriteStruct_t write;
+                            VgmParsePcmRamWrite(&DsFind_Reader, &write);
+                            DSFIND_BUF_CHECK;
                         }
                     } else {
-                        if (d == 0x90) { //dacstream setup
-                            DSFIND_BUF_SEEK_REL(2) //skip stream id and chip type
-                            DSFIND_BUF_READ(DacStream_CurChipPort)
-                            DSFIND_BUF_READ(DacStream_CurChipCommand)
+                        if ((d&0xf0) == 0x70) { //4bit wait
+                            DacStream_FindSample += (d&0x0f)+1;
+                        } else if ((d&0xf0) == 0x80) { //ym2612 pcm + wait
+                            DacStream_FindSample += d&0x0f;
+                        } else if (d == 0x61) { //16bit wait
+                            uint16_t w;
+                            DSFIND_BUF_READ2(w)
+                            DacStream_FindSample += w;
+                        } else if (d == 0x62) { //60Hz wait
+                            DacStream_FindSample += 735;
+                        } else if (d == 0x63) { //50Hz wait
+                            DacStream_FindSample += 882;
+                        } else if (d == 0x90) { //dacstream setup
+                            DSFIND_BUF_READ_SETUP
+                            DSFIND_BUF_READ(DacStream_CurSetup->ChipType)
+                            DSFIND_BUF_READ(DacStream_CurSetup->ChipPort)
+                            DSFIND_BUF_READ(DacStream_CurSetup->ChipCommand)
                         } else if (d == 0x91) { //dacstream set data
-                            DSFIND_BUF_SEEK_REL(1) //skip stream id
-                            DSFIND_BUF_READ(DacStream_CurDataBank)
+                            DSFIND_BUF_READ_SETUP
+                            DSFIND_BUF_READ(DacStream_CurSetup->DataBank)
                             DSFIND_BUF_SEEK_REL(2) //skip step size and step base
                         } else if (d == 0x92) { //set sample rate
-                            DSFIND_BUF_SEEK_REL(1) //skip stream id
-                            DSFIND_BUF_READ4(DacStream_CurSampleRate)
+                            DSFIND_BUF_READ_SETUP
+                            DSFIND_BUF_READ4(DacStream_CurSetup->SampleRate)
                         } else if (d == 0x93) { //start
-                            DSFIND_BUF_SEEK_REL(1) //skip stream id
+                            DSFIND_BUF_READ_SETUP
                             DSFIND_BUF_READ4(DacStreamEntries[FreeSlot].DataStart) //todo: figure out what to do with -1
                             DSFIND_BUF_READ(DacStreamEntries[FreeSlot].LengthMode)
                             DSFIND_BUF_READ4(DacStreamEntries[FreeSlot].DataLength)
                             //assign other attributes
-                            DacStreamEntries[FreeSlot].DataBankId = DacStream_CurDataBank;
-                            DacStreamEntries[FreeSlot].ChipCommand = DacStream_CurChipCommand;
-                            DacStreamEntries[FreeSlot].ChipPort = DacStream_CurChipPort;
-                            DacStreamEntries[FreeSlot].SampleRate = DacStream_CurSampleRate;
-                            DacStreamEntries[FreeSlot].Seq = DacStream_Seq++;
-                            //reset
-                            DacStreamEntries[FreeSlot].ReadOffset = 0;
-                            DacStreamEntries[FreeSlot].BytesFilled = 0;
-                            MegaStream_Reset((MegaStreamContext_t *)&DacStreamEntries[FreeSlot].Stream);
-                            DacStreamEntries[FreeSlot].SlotFree = false;
-                            DacStream_FoundAny = true;
+                            DacStream_ApplySetup(FreeSlot);
+                            if (!DacStream_Claim(FreeSlot)) {
+                                DSFIND_BUF_SEEK_SET(cmd) //no room in Driver_PcmBuf yet, come back to it next time
+                            }
                             break;
                         } else if (d == 0x94) { //stop
                             DSFIND_BUF_SEEK_REL(1) //skip stream id
                         } else if (d == 0x95) { //fast start
-                            DSFIND_BUF_SEEK_REL(1) //skip stream id
+                            DSFIND_BUF_READ_SETUP
                             DSFIND_BUF_READ2(DacStream_CurDataBlock)
-                            DacStreamEntries[FreeSlot].DataLength = DacStream_GetBlockSize(DacStream_CurDataBank, DacStream_CurDataBlock);
-                            DacStreamEntries[FreeSlot].DataStart = DacStream_GetBlockOffset(DacStream_CurDataBank, DacStream_CurDataBlock);
+                            DacStreamEntries[FreeSlot].DataLength = DacStream_GetBlockSize(DacStream_CurSetup->DataBank, DacStream_CurDataBlock);
+                            DacStreamEntries[FreeSlot].DataStart = DacStream_GetBlockOffset(DacStream_CurSetup->DataBank, DacStream_CurDataBlock);
                             DSFIND_BUF_SEEK_REL(1) //skip flags
                             //assign other attributes
-                            DacStreamEntries[FreeSlot].DataBankId = DacStream_CurDataBank;
-                            DacStreamEntries[FreeSlot].ChipCommand = DacStream_CurChipCommand;
-                            DacStreamEntries[FreeSlot].ChipPort = DacStream_CurChipPort;
-                            DacStreamEntries[FreeSlot].SampleRate = DacStream_CurSampleRate;
-                            DacStreamEntries[FreeSlot].Seq = DacStream_Seq++;
-                            //reset
+                            DacStream_ApplySetup(FreeSlot);
                             DacStreamEntries[FreeSlot].LengthMode = 0; //always for fast starts
-                            DacStreamEntries[FreeSlot].ReadOffset = 0;
-                            DacStreamEntries[FreeSlot].BytesFilled = 0;
-                            MegaStream_Reset((MegaStreamContext_t *)&DacStreamEntries[FreeSlot].Stream);
-                            DacStreamEntries[FreeSlot].SlotFree = false;
-                            DacStream_FoundAny = true;
+                            if (!DacStream_Claim(FreeSlot)) {
+                                DSFIND_BUF_SEEK_SET(cmd) //no room in Driver_PcmBuf yet, come back to it next time
+                            }
                             break;
                         } else if (d == 0x66) { //end of music, optionally loop
                             ESP_LOGI(TAG, "reached end of music");
@@ -308,64 +428,138 @@ void DacStream_FindTask() {
 
 static uint8_t DacStream_FillBuf[DACSTREAM_BUF_SIZE];
 static IRAM_ATTR uint32_t LastOffset = 0xffffffff;
+static uint32_t LastLen = 0; //how much of the buf is valid, short at the end of a block
+
+//reads never go past the end of the datablock, since a vgz that's still being extracted may not have anything valid there yet
+static uint32_t DacStream_FillRead(uint32_t offset, uint32_t blockleft) {
+    LastOffset = offset;
+    LastLen = TrackFile_Read(DacStream_File, offset, &DacStream_FillBuf[0], (blockleft < DACSTREAM_BUF_SIZE)?blockleft:DACSTREAM_BUF_SIZE);
+    return LastLen;
+}
+
+//where a slot's data goes: its own stream, or the shared sample it points at
+static uint32_t DacStream_SinkFree(uint8_t idx) {
+    DacStreamSample_t *s = DacStreamEntries[idx].Sample;
+    if (s) {
+        uint32_t f = s->Length - s->Filled;
+        return (f > DACSTREAM_BUF_SIZE)?DACSTREAM_BUF_SIZE:f; //a chunk at a time, like everyone else
+    }
+    return MegaStream_Free((MegaStreamContext_t *)&DacStreamEntries[idx].Stream);
+}
+
+static void DacStream_SinkSend(uint8_t idx, const uint8_t *src, uint32_t len) {
+    DacStreamSample_t *s = DacStreamEntries[idx].Sample;
+    if (s) {
+        memcpy(&s->Data[s->Filled], src, len);
+        __atomic_store_n(&s->Filled, s->Filled+len, __ATOMIC_RELEASE); //after the copy, the driver may start reading it straight away
+    } else {
+        MegaStream_Send((MegaStreamContext_t *)&DacStreamEntries[idx].Stream, src, len);
+    }
+    DacStreamEntries[idx].ReadOffset += len;
+}
+
 bool DacStream_FillTask_DoPre(uint8_t idx) { //returns whether or not it had to hit the card
     bool ret = false;
     xSemaphoreTake(DacStream_Mutex, pdMS_TO_TICKS(1000));
     if (!DacStreamEntries[idx].SlotFree) {
-        if (MegaStream_Free((MegaStreamContext_t *)&DacStreamEntries[idx].Stream) > DACSTREAM_BUF_SIZE/3 && DacStreamEntries[idx].ReadOffset < DacStreamEntries[idx].DataLength) {
+        if (DacStreamEntries[idx].Sample) DacStreamEntries[idx].ReadOffset = DacStreamEntries[idx].Sample->Filled; //another slot may have loaded some of it since
+        uint32_t threshold = DacStreamEntries[idx].BufSize/3; //0 for shared samples
+        if (DacStream_SinkFree(idx) > threshold && DacStreamEntries[idx].ReadOffset < DacStreamEntries[idx].DataLength) {
             UserLedMgr_DiskState[DISKSTATE_DACSTREAM_FILL] = true;
             UserLedMgr_Notify();
-            uint32_t o = DacStream_GetDataOffset(DacStreamEntries[idx].DataBankId, DacStreamEntries[idx].DataStart + DacStreamEntries[idx].ReadOffset);
-            uint16_t dsbufused;
-            if (o >= LastOffset && o < LastOffset + DACSTREAM_BUF_SIZE) { //if we're going to end up reading the same chunk, don't bother, reuse the buffer
-                ESP_LOGD(TAG, "Reused buf");
-                dsbufused = o - LastOffset;
-            } else { //it's a different chunk than what's in the buf
-                ESP_LOGD(TAG, "Couldn't reuse buf");
-                fseek(DacStream_FillFile,o,SEEK_SET);
-                fread(&DacStream_FillBuf[0], 1, DACSTREAM_BUF_SIZE, DacStream_FillFile); //slight code repetition, makes flow a bit easier
-                LastOffset = o;
-                dsbufused = 0;
-                ret = true;
-            }
-            uint32_t freespaces = MegaStream_Free((MegaStreamContext_t *)&DacStreamEntries[idx].Stream);
-            //try to find a dead dacstream that has the data we need. has to be a dead one, any active ones might have data removed 
-            while (freespaces && DacStreamEntries[idx].ReadOffset < DacStreamEntries[idx].DataLength) {
-                if (dsbufused == DACSTREAM_BUF_SIZE) {
-                    ESP_LOGD(TAG, "Read past buffer");
-                    fread(&DacStream_FillBuf[0], 1, DACSTREAM_BUF_SIZE, DacStream_FillFile);
+            uint32_t pos = DacStreamEntries[idx].DataStart + DacStreamEntries[idx].ReadOffset;
+            const VgmBankEntry_t *e = VgmBankIndex_Find(&DacStream_BankIndex, DacStreamEntries[idx].DataBankId, pos);
+            if (e != NULL && e->Data != NULL) { //decompressed block, straight out of ram. picks up any following blocks next time around
+                uint32_t writesize = DacStreamEntries[idx].DataLength - DacStreamEntries[idx].ReadOffset;
+                uint32_t blockremaining = e->Start + e->Size - pos;
+                uint32_t freespaces = DacStream_SinkFree(idx);
+                if (blockremaining < writesize) writesize = blockremaining;
+                if (freespaces < writesize) writesize = freespaces;
+                DacStream_SinkSend(idx, &e->Data[pos - e->Start], writesize);
+            } else {
+                uint32_t o = (e != NULL)?(e->Offset + (pos - e->Start)):0xffffffff;
+                uint32_t blockleft = (e != NULL)?(e->Start + e->Size - pos):0; //from o to the end of the block
+                uint16_t dsbufused;
+                if (o >= LastOffset && o < LastOffset + LastLen) { //if we're going to end up reading the same chunk, don't bother, reuse the buffer
+                    ESP_LOGD(TAG, "Reused buf");
+                    dsbufused = o - LastOffset;
+                } else { //it's a different chunk than what's in the buf
+                    ESP_LOGD(TAG, "Couldn't reuse buf");
+                    DacStream_FillRead(o, blockleft);
                     dsbufused = 0;
-                    LastOffset += DACSTREAM_BUF_SIZE;
                     ret = true;
                 }
+                blockleft -= LastLen - dsbufused; //now what's left of the block after the buf
+                uint32_t freespaces = DacStream_SinkFree(idx);
+                //try to find a dead dacstream that has the data we need. has to be a dead one, any active ones might have data removed 
+                while (freespaces && DacStreamEntries[idx].ReadOffset < DacStreamEntries[idx].DataLength) {
+                    if (dsbufused == LastLen) {
+                        if (blockleft == 0) break; //any following block gets picked up next time around
+                        ESP_LOGD(TAG, "Read past buffer");
+                        if (DacStream_FillRead(LastOffset + LastLen, blockleft) == 0) break; //eof or io error
+                        blockleft -= LastLen;
+                        dsbufused = 0;
+                        ret = true;
+                    }
 
-                //we want to write as much to the stream in one shot as we possibly can, so figure out how much we can do!
-                uint32_t streamremaining = DacStreamEntries[idx].DataLength - DacStreamEntries[idx].ReadOffset;
-                uint32_t dsbufremaining = DACSTREAM_BUF_SIZE - dsbufused;
-                uint32_t writesize = streamremaining;
-                if (dsbufremaining < writesize) writesize = dsbufremaining;
-                if (freespaces < writesize) writesize = freespaces;
-                MegaStream_Send((MegaStreamContext_t *)&DacStreamEntries[idx].Stream, &DacStream_FillBuf[dsbufused], writesize);
-                dsbufused += writesize;
-                DacStreamEntries[idx].ReadOffset += writesize;
-                freespaces -= writesize;
+                    //we want to write as much to the stream in one shot as we possibly can, so figure out how much we can do!
+                    uint32_t streamremaining = DacStreamEntries[idx].DataLength - DacStreamEntries[idx].ReadOffset;
+                    uint32_t dsbufremaining = LastLen - dsbufused;
+                    uint32_t writesize = streamremaining;
+                    if (dsbufremaining < writesize) writesize = dsbufremaining;
+                    if (freespaces < writesize) writesize = freespaces;
+                    DacStream_SinkSend(idx, &DacStream_FillBuf[dsbufused], writesize);
+                    dsbufused += writesize;
+                    freespaces -= writesize;
+                }
             }
             UserLedMgr_DiskState[DISKSTATE_DACSTREAM_FILL] = false;
             UserLedMgr_Notify();
         }
     }
     xSemaphoreGive(DacStream_Mutex);
-    if (ferror(DacStream_FillFile)) {
+    if (DacStream_File->Error) {
         ESP_LOGE(TAG, "Pre IO ERROR");
         file_error();
     }
     return ret;
 }
 
+//vgm sample at which this slot's buffered data runs out: from now if it's already playing, otherwise from when it starts
+static uint32_t DacStream_Deadline(uint8_t idx) {
+    volatile DacStreamEntry_t *e = &DacStreamEntries[idx];
+    uint32_t start = (e->Seq <= DacStreamSeq)?Driver_Sample:e->StartSample;
+    uint32_t rate = e->SampleRate?e->SampleRate:44100;
+    uint32_t buffered;
+    if (e->Sample) {
+        buffered = e->Sample->Filled;
+        buffered = (buffered > e->Played)?(buffered - e->Played):0;
+    } else {
+        buffered = MegaStream_Used((MegaStreamContext_t *)&e->Stream);
+    }
+    return start + (uint32_t)(((uint64_t)buffered * 44100) / rate);
+}
+
+static uint8_t DacStream_FillOrder(uint8_t *order) { //slots in use, most urgent first. returns how many
+    uint32_t deadlines[DACSTREAM_PRE_COUNT];
+    uint8_t count = 0;
+    for (uint8_t i=0;i<DACSTREAM_PRE_COUNT;i++) {
+        if (DacStreamEntries[i].SlotFree || DacStreamEntries[i].ReadOffset >= DacStreamEntries[i].DataLength) continue;
+        uint32_t d = DacStream_Deadline(i);
+        uint8_t j = count++;
+        for (;j>0 && deadlines[j-1]>d;j--) { //insertion sort, there's only a handful
+            deadlines[j] = deadlines[j-1];
+            order[j] = order[j-1];
+        }
+        deadlines[j] = d;
+        order[j] = i;
+    }
+    return count;
+}
+
 void DacStream_FillTask() {
     ESP_LOGI(TAG, "Fill task start");
 
-    uint8_t idx = 0;
     while (1) {
         EventBits_t bits = xEventGroupWaitBits(DacStream_FillStatus, DACSTREAM_START_REQUEST | DACSTREAM_RUNNING | DACSTREAM_STOP_REQUEST, false, false, pdMS_TO_TICKS(75));
         if (bits & DACSTREAM_START_REQUEST) {
@@ -373,7 +567,7 @@ void DacStream_FillTask() {
             xEventGroupClearBits(DacStream_FillStatus, DACSTREAM_STOPPED);
             xEventGroupSetBits(DacStream_FillStatus, DACSTREAM_RUNNING);
             xEventGroupClearBits(DacStream_FillStatus, DACSTREAM_START_REQUEST);
-            LastOffset = 0xffffffff; //invalidate - could be at the same pos in the file, but different file now
+            LastLen = 0; //invalidate - could be at the same pos in the file, but different file now
             DacStream_FillRunning = true;
         } else if (bits & DACSTREAM_STOP_REQUEST) {
             ESP_LOGI(TAG, "Fill stopping");
@@ -383,19 +577,20 @@ void DacStream_FillTask() {
             xEventGroupClearBits(DacStream_FillStatus, DACSTREAM_STOP_REQUEST);
         }
         if (DacStream_FillRunning) {
-            if (DacStreamId != 0xff && DacStreamId != idx) DacStream_FillTask_DoPre(DacStreamId);
-            bool ret = DacStream_FillTask_DoPre(idx);
-            if (++idx == DACSTREAM_PRE_COUNT) idx = 0;
-            if (!ret) { //if we didn't hit the card, that pre was basically "free", so go ahead with the next one right away
-                DacStream_FillTask_DoPre(idx);
-                if (++idx == DACSTREAM_PRE_COUNT) idx = 0;
+            //earliest deadline first. slots that don't need anything just return straight away, and ones served from ram are basically "free",
+            //so keep going down the list until the card has been hit DACSTREAM_FILL_CARD_READS times
+            uint8_t order[DACSTREAM_PRE_COUNT];
+            uint8_t count = DacStream_FillOrder(order);
+            uint8_t reads = 0;
+            for (uint8_t i=0;i<count && reads<DACSTREAM_FILL_CARD_READS;i++) {
+                if (DacStream_FillTask_DoPre(order[i])) reads++;
             }
             vTaskDelay(pdMS_TO_TICKS(10));
         }
     }
 }
 
-bool DacStream_Start(FILE *FindFile, FILE *FillFile, VgmInfoStruct_t *info) {
+bool DacStream_Start(TrackFile_t *File, VgmInfoStruct_t *info) {
     if (xEventGroupGetBits(DacStream_FindStatus) & DACSTREAM_RUNNING) {
         //running, can't start
         return false;
@@ -405,14 +600,24 @@ bool DacStream_Start(FILE *FindFile, FILE *FillFile, VgmInfoStruct_t *info) {
         return false;
     }
 
-    DacStream_FindFile = FindFile;
-    DacStream_FillFile = FillFile;
+    DacStream_File = File;
+    for (uint8_t i=0;i<DACSTREAM_PRE_COUNT;i++) {
+        DacStreamEntries[i].Underruns = 0;
+        DacStream_SampleRelease(i);
+    }
+    DacStream_SampleFreeAll();
+    DsArena_Init(&DacStream_Arena, sizeof(Driver_PcmBuf));
+    VgmReader_Init(&DsFind_Reader, File, DsFind_ReaderBuf, VGMREADER_BUF_SIZE);
     DacStream_VgmInfo = info;
 
     DacStream_Seq = 1;
     DacStream_FoundAny = false;
     DacStream_VgmDataBlockIndex = 0;
     DacStream_CurLoop = 0;
+    for (uint8_t i=0;i<DACSTREAM_STREAMS;i++) {
+        memset(&DacStream_Setups[i], 0, sizeof(DacStream_Setups[i]));
+        DacStream_Setups[i].Id = 0xff;
+    }
 
     ESP_LOGI(TAG, "DacStream_Start() requesting fill task start");
     xEventGroupSetBits(DacStream_FillStatus, DACSTREAM_START_REQUEST);
@@ -420,7 +625,7 @@ bool DacStream_Start(FILE *FindFile, FILE *FillFile, VgmInfoStruct_t *info) {
     return true;
 }
 
-bool DacStream_BeginFinding(VgmDataBlockStruct_t *SourceBlocks, uint8_t SourceBlockCount, uint32_t StartOffset) {
+bool DacStream_BeginFinding(VgmDataBlockStruct_t *SourceBlocks, uint8_t SourceBlockCount, uint32_t StartOffset, uint32_t StartSample) {
     ESP_LOGI(TAG, "DacStream_BeginFinding() starting");
     if (xEventGroupGetBits(DacStream_FindStatus) & DACSTREAM_RUNNING) {
         ESP_LOGE(TAG, "Find task already running !!");
@@ -429,12 +634,13 @@ bool DacStream_BeginFinding(VgmDataBlockStruct_t *SourceBlocks, uint8_t SourceBl
     ESP_LOGI(TAG, "Copying datablock array");
     memcpy((VgmDataBlockStruct_t *)&DacStream_VgmDataBlocks[0], SourceBlocks, sizeof(VgmDataBlockStruct_t)*SourceBlockCount);
     DacStream_VgmDataBlockIndex = SourceBlockCount;
-    ESP_LOGI(TAG, "Seek to start offset");
-    uint8_t nastyhack = 1; //this is to avoid having a duplicate version of the buffer fill stuff that doesn't `continue`
-    while (nastyhack) {
-        nastyhack = 0;
-        DSFIND_BUF_SEEK_SET(StartOffset)
+    VgmBankIndex_Reset(&DacStream_BankIndex);
+    for (uint8_t i=0;i<SourceBlockCount;i++) {
+        VgmBankIndex_Add(&DacStream_BankIndex, &SourceBlocks[i], VgmDecode_Find(SourceBlocks[i].Offset));
     }
+    ESP_LOGI(TAG, "Seek to start offset");
+    DSFIND_BUF_SEEK_SET(StartOffset) //no io, that happens on the find task's first read
+    DacStream_FindSample = StartSample;
     ESP_LOGI(TAG, "Requesting find task start");
     xEventGroupSetBits(DacStream_FindStatus, DACSTREAM_START_REQUEST);
     ESP_LOGI(TAG, "Wait for find task start...");
@@ -9,10 +9,25 @@
 #include "esp_system.h"
 #include "vgm.h"
 #include "megastream.h"
+#include "trackfile.h"
+
+//a whole one-shot sample held in ram. slots that play the same data point at the same one, so a sample that keeps getting retriggered
+//only comes off the card the first time. only written by the fill task, and only up to Filled, which the driver reads behind
+typedef struct {
+    uint8_t Bank;
+    uint32_t Start;
+    uint32_t Length;
+    volatile uint32_t Filled; //bytes of Data loaded so far
+    uint8_t Refs;       //slots pointing at it. can't be evicted until this drops to 0
+    uint32_t LastUse;
+    uint8_t *Data;      //NULL if this pool entry is unused
+} DacStreamSample_t;
 
 typedef struct {
     bool SlotFree;
     uint32_t Seq;
+    uint8_t StreamId;   //vgm stream id of the 0x93/0x95 that starts it
+    uint8_t ChipType;   //from that stream's 0x90. bit 7 = second chip
     uint8_t DataBankId;
     uint8_t DataBlockId;
     uint8_t ChipCommand;
@@ -23,6 +38,12 @@ typedef struct {
     uint32_t DataLength;
     uint32_t ReadOffset;
     uint32_t BytesFilled;
+    uint32_t StartSample; //vgm sample the 0x93/0x95 that starts it runs at. the fill task goes by this to decide who's most urgent
+    uint32_t Underruns;   //times the driver ran this slot dry, since DacStream_Start
+    uint32_t Played;      //samples the driver has played from it so far
+    DacStreamSample_t *Sample; //if not NULL, the data comes from here instead of Stream
+    uint32_t BufStart;    //where Stream lives in Driver_PcmBuf
+    uint32_t BufSize;     //0 if it doesn't have any of it
     MegaStreamContext_t Stream;
 } DacStreamEntry_t;
 
@@ -40,8 +61,8 @@ extern EventGroupHandle_t DacStream_FillStatus;
 bool DacStream_Setup();
 void DacStream_FindTask();
 void DacStream_FillTask();
-bool DacStream_Start(FILE *FindFile, FILE *FillFile, VgmInfoStruct_t *info);
-bool DacStream_BeginFinding(VgmDataBlockStruct_t *SourceBlocks, uint8_t SourceBlockCount, uint32_t StartOffset);
+bool DacStream_Start(TrackFile_t *File, VgmInfoStruct_t *info);
+bool DacStream_BeginFinding(VgmDataBlockStruct_t *SourceBlocks, uint8_t SourceBlockCount, uint32_t StartOffset, uint32_t StartSample);
 bool DacStream_Stop();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,34 @@
+#ifndef AGR_DCSGSHADOW_H
+#define AGR_DCSGSHADOW_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+//shadow of the dcsg's attenuation registers, so a latch byte that sets a channel's volume to what it already is can be dropped
+//only attenuation, and only while the latch already points at that register, since the write would have to move the latch otherwise
+//inline because the driver runs it on every dcsg write. no ESP-IDF dependencies, so utils/dcsgshadow_test can build it on a host
+
+typedef struct {
+    uint8_t Att[4]; //per channel, the latch byte that would set the attenuation it has now
+    uint8_t Latch;  //register the dcsg is latched to, bits 4-6 of the last latch byte. 0xff = unknown
+} DcsgShadow_t;
+
+static inline void DcsgShadow_Reset(DcsgShadow_t *s) {
+    memset(s->Att, 0, sizeof(s->Att)); //never a valid attenuation byte
+    s->Latch = 0xff;
+}
+
+static inline bool DcsgShadow_Write(DcsgShadow_t *s, uint8_t Data) { //false if the write can be dropped
+    if (Data & 0x80) {
+        uint8_t latch = Data & 0x70;
+        if ((Data & 0x10) && latch == s->Latch && s->Att[(Data>>5)&3] == Data) return false;
+        s->Latch = latch;
+        if (Data & 0x10) s->Att[(Data>>5)&3] = Data;
+    } else if (s->Latch != 0xff && (s->Latch & 0x10)) { //data byte while latched to an attenuation register, that sets it too
+        s->Att[(s->Latch>>5)&3] = 0x80 | s->Latch | (Data & 0x0f);
+    }
+    return true;
+}
+
+#endif
@@ -15,12 +15,19 @@
 #include "loader.h"
 #include "player.h"
 #include "clk.h"
+#include "taskmgr.h"
+#include "esp_timer.h"
+#include "dcsgshadow.h"
 
 static const char* TAG = "Driver";
 
 #define DRIVER_CLOCK_RATE 240000000 //clock rate of cpu while in playback
 #define DRIVER_VGM_SAMPLE_RATE 44100
 #define DRIVER_CYCLES_PER_SAMPLE (DRIVER_CLOCK_RATE/DRIVER_VGM_SAMPLE_RATE)
+#if DRIVER_QUEUE_SIZE % 4
+#error "DRIVER_QUEUE_SIZE must be a multiple of sizeof(DriverRecord_t)"
+#endif
+#define DRIVER_BATCH_MAX 64 //max records run back to back at one timestamp before giving the dacstream a turn
 
 #if defined HWVER_PORTABLE
 #define SR_CONTROL      0
@@ -46,8 +53,7 @@ uint8_t Driver_SrBuf[2] = {0x00,0xff & ~SR_BIT_IC};
 
 static portMUX_TYPE mux;
 
-MegaStreamContext_t Driver_CommandStream; //queue of incoming vgm data
-MegaStreamContext_t Driver_PcmStream; //queue of attached pcm data (if any)
+MegaStreamContext_t Driver_CommandStream; //queue of incoming pre-decoded records from the loader
 EventGroupHandle_t Driver_CommandEvents; //driver status flags
 EventGroupHandle_t Driver_StreamEvents; //queue status flags
 uint8_t *Driver_CommandStreamBuf;
@@ -56,6 +62,9 @@ uint8_t Driver_PcmBuf[DACSTREAM_BUF_SIZE*DACSTREAM_PRE_COUNT];
 volatile IRAM_ATTR uint32_t Driver_CpuPeriod = 0;
 volatile IRAM_ATTR uint32_t Driver_CpuUsageVgm = 0;
 volatile IRAM_ATTR uint32_t Driver_CpuUsageDs = 0;
+volatile uint32_t Driver_CommandUnderruns = 0; //times the command stream ran dry since the last reset
+volatile uint32_t Driver_WritesSaved = 0; //register writes dropped by the shadow registers since the track started
+static bool Driver_Starved = false;
 
 volatile bool Driver_AssumeSegaDcsg = true;
 volatile bool Driver_MitigateVgmTrim = true;
@@ -83,9 +92,7 @@ spi_device_handle_t Driver_SpiDevice;
 
 //vgm / 2612 pcm stuff
 IRAM_ATTR uint32_t Driver_Sample = 0;     //current sample number
-IRAM_ATTR uint32_t Driver_Sample_Ds = 0;  //current sample number for dacstreams
 uint64_t Driver_Cycle = 0;      //current cycle number
-uint64_t Driver_Cycle_Ds = 0;   //current cycle number for dacstreams
 IRAM_ATTR int32_t Driver_Slip = 0; //originally intended as a sample counter, currently only used as a flag.
 IRAM_ATTR uint32_t Driver_Cc = 0;         //current cycle from the api - just keep it off the stack
 IRAM_ATTR uint32_t Driver_LastCc = 0;     //copy of the above var
@@ -95,7 +102,6 @@ uint8_t Driver_FmAlgo[6] = {0,0,0,0,0,0};
 volatile bool Driver_FirstWait = true;
 uint8_t Driver_FmPans[6] = {0b11000000,0b11000000,0b11000000,0b11000000,0b11000000,0b11000000};
 IRAM_ATTR uint32_t Driver_PauseSample = 0; //sample no before stop
-IRAM_ATTR uint32_t Driver_PauseSample_Ds = 0; //sample no before stop for dacstreams
 uint8_t Driver_DcsgAttenuation[4] = {0b10011111, 0b10111111, 0b11011111, 0b11111111};
 bool Driver_NoLeds = false;
 bool Driver_DcsgNoisePeriodic = false;
@@ -104,17 +110,25 @@ static uint32_t dcsg_freq[3] = {0,0,0};
 static uint8_t dcsg_latched_ch = 0;
 
 //dacstream specific
-IRAM_ATTR uint32_t DacStreamSeq = 0;              //sequence no of the current stream
-IRAM_ATTR uint32_t DacStreamLastSeqPlayed = 0;    //last seq successfully played
-uint8_t DacStreamId = 0;                //index of the currently playing dacstream. should maybe consider using a pointer to the queue instead of keeping this around
-bool DacStreamActive = false;           //actively playing a stream?
-IRAM_ATTR uint32_t DacStreamSampleRate = 0;       //stream current sample rate
-uint8_t DacStreamPort = 0;              //chip port to write to
-uint8_t DacStreamCommand = 0;           //chip command to use
-IRAM_ATTR uint32_t DacStreamSamplesPlayed = 0;    //how many samples played so far
-uint8_t DacStreamLengthMode = 0;
-IRAM_ATTR uint32_t DacStreamDataLength = 0;
-bool DacStreamFailed = false;
+IRAM_ATTR uint32_t DacStreamSeq = 0;              //sequence no of the last stream started
+typedef struct { //one vgm stream id's playback. each runs off its own cycle count, so they all keep their own rate
+    uint8_t StreamId;   //0xff = unused
+    bool Active;        //actively playing?
+    bool Failed;        //ran dry, and the underrun has been counted
+    uint8_t Slot;       //DacStreamEntries index it's playing from
+    uint8_t Device;     //which chip on 2xopn
+    uint8_t Port;       //chip port to write to
+    uint8_t Command;    //chip command to use
+    uint8_t LengthMode;
+    uint32_t Seq;
+    uint32_t SampleRate;
+    uint32_t DataLength;
+    uint32_t Played;    //how many samples played so far
+    uint64_t Cycle;     //cycles since it started
+    DacStreamSample_t *Shared; //the slot's shared sample, if it has one
+} DriverDsVoice_t;
+static DriverDsVoice_t Driver_DsVoices[DACSTREAM_STREAMS];
+
 
 volatile uint8_t Driver_FmMask = 0b01111111;
 volatile uint8_t Driver_DcsgMask = 0b00001111;
@@ -127,7 +141,7 @@ uint8_t Driver_Opna_SsgLevel[3] = {0,0,0}; //todo verify in emu
 
 volatile IRAM_ATTR uint32_t Driver_Opna_PcmUploadId = 0;
 volatile bool Driver_Opna_PcmUpload = false;
-FILE *Driver_Opna_PcmUploadFile = NULL;
+TrackFile_t *Driver_Opna_PcmUploadFile = NULL;
 volatile int16_t Driver_SpeedMult = 0;
 
 static uint8_t TLs[4*6];
@@ -145,7 +159,6 @@ static uint8_t Driver_CurLoop = 0;
 
 static uint8_t DacLastValue = 0;
 static bool DacTouched = false;
-static uint8_t opn2_regs_dedup[256*2];
 
 static bool Driver_BlockOpn2TestReg = false;
 
@@ -158,7 +171,230 @@ static bool reset_flag = false;
 void Driver_ResetChips(bool force);
 void Driver_Sleep(uint32_t us);
 
-void Driver_Output() { //output data to shift registers
+//bus sequences. the chip write routines don't output each shift register state as they go, they queue it up as an edge along with how long
+//it has to stay on the bus, and Driver_BusFlush sends the lot back to back. holds are timed from when each edge went out rather than spun
+//on top of the transfer, and an edge that doesn't change anything is merged into the one before it.
+//between Driver_BusBegin and Driver_BusEnd, whole runs of register writes go out in one flush.
+//ideally that'd be one dma transfer, but the shift registers only latch on the cs edge at the end of each spi transaction, so it's one per edge
+#define DRIVER_BUS_MAX 32 //edges queued before a flush is forced
+#define DRIVER_US(us) ((us)*(DRIVER_CLOCK_RATE/1000000))
+
+//when nothing is due for a while the driver sleeps on a one-shot timer instead of spinning on the cycle counter
+#define DRIVER_SNOOZE_MIN_US 300    //anything closer than this, just keep spinning
+#define DRIVER_SNOOZE_SPIN_US 60    //wake this early and spin the rest, covers the timer task dispatch + context switch
+#define DRIVER_SNOOZE_MAX_US 10000  //never sleep longer than this, so command events and fades still get looked at promptly
+
+//chip write timing, in each chip's own clocks so it follows whatever it's actually being clocked at.
+//instead of spinning after every write, each chip has a "busy until" time, and only a write to that same chip waits on it
+enum {
+    DRIVER_CHIP_OPN2,
+    DRIVER_CHIP_OPNA,
+    DRIVER_CHIP_OPN,    //2xopn first chip
+    DRIVER_CHIP_OPN_2,  //2xopn second chip
+    DRIVER_CHIP_OPL3,
+    DRIVER_CHIP_OPM,
+    DRIVER_CHIP_OPLL,
+    DRIVER_CHIP_DCSG,
+    DRIVER_CHIP_COUNT,
+    DRIVER_CHIP_NONE = 0xff,
+};
+
+typedef struct {
+    uint32_t Clock;     //stock clock, used when the clock channel reads 0
+    uint16_t WrLow;     //minimum /wr low time. the shift register transfer already covers a few hundred ns
+    uint16_t AddrWait;  //after an address write, before the data write
+    uint16_t DataWait;  //after a data write, before the next write
+} DriverChipTiming_t;
+
+//the opn family values are the old hard-coded spins converted to cycles at stock clocks: opn2 5us after the data write, opn 10us
+//after the address and 20us after the data, and opna 10us after the address and nothing after the data. those are known good on
+//real hardware, even though opna's are under what the ym2608 datasheet asks for after data writes - the next write's own spi
+//transfers have always covered that. opl3, opm, opll and dcsg are datasheet minimums with no margin added here. the margin comes
+//from how they're applied: every wait counts from the end of the spi transfer of the edge it follows, so the next edge's own
+//transfer comes on top, and the conversion to cpu cycles rounds up
+static const DriverChipTiming_t Driver_ChipTimings[DRIVER_CHIP_COUNT] = {
+    [DRIVER_CHIP_OPN2]  = {7670453, 0, 0, 38},
+    [DRIVER_CHIP_OPNA]  = {7987200, 0, 80, 0},
+    [DRIVER_CHIP_OPN]   = {3993600, 0, 40, 80},
+    [DRIVER_CHIP_OPN_2] = {3993600, 0, 40, 80},
+    [DRIVER_CHIP_OPL3]  = {14318180, 0, 32, 32},
+    [DRIVER_CHIP_OPM]   = {3579545, 0, 0, 64},
+    [DRIVER_CHIP_OPLL]  = {3579545, 0, 12, 84},
+    [DRIVER_CHIP_DCSG]  = {3579545, 36, 0, 0}, //32, but with wiggle room. but not enough to push us into another write cycle...
+};
+
+typedef struct { //Driver_ChipTimings in cpu cycles, for the clock it was last worked out at
+    uint32_t Clock;
+    uint32_t WrLow;
+    uint32_t AddrWait;
+    uint32_t DataWait;
+} DriverChipCycles_t;
+
+static DriverChipCycles_t Driver_ChipCycles[DRIVER_CHIP_COUNT];
+static uint32_t Driver_ChipBusySince[DRIVER_CHIP_COUNT]; //ccount at the end of the edge that made it busy
+static uint32_t Driver_ChipBusyFor[DRIVER_CHIP_COUNT]; //cpu cycles from then. 0 once a wait has seen it pass, so an old timestamp can't wrap back into looking recent
+
+static uint8_t Driver_ChipClockCh(uint8_t chip) {
+    if (chip == DRIVER_CHIP_DCSG && Driver_DetectedMod != MEGAMOD_OPLLDCSG) return CLK_DCSG; //opll+dcsg megamod only uses one clock line
+    return CLK_FM;
+}
+
+static const DriverChipCycles_t *Driver_ChipTiming(uint8_t chip) {
+    DriverChipCycles_t *c = &Driver_ChipCycles[chip];
+    uint32_t f = Clk_GetCh(Driver_ChipClockCh(chip));
+    if (f == 0) f = Driver_ChipTimings[chip].Clock;
+    if (f != c->Clock) { //only redo the divisions when the clock changes
+        const DriverChipTiming_t *t = &Driver_ChipTimings[chip];
+        c->Clock = f;
+        c->WrLow = (DRIVER_CLOCK_RATE*(uint64_t)t->WrLow + f-1)/f; //rounded up, these are minimums
+        c->AddrWait = (DRIVER_CLOCK_RATE*(uint64_t)t->AddrWait + f-1)/f;
+        c->DataWait = (DRIVER_CLOCK_RATE*(uint64_t)t->DataWait + f-1)/f;
+    }
+    return c;
+}
+
+typedef struct {
+    uint8_t Sr[2];
+    uint8_t Wait;       //chip to wait on before this edge goes out, or DRIVER_CHIP_NONE
+    uint8_t Busy;       //chip this edge makes busy, or DRIVER_CHIP_NONE
+    uint32_t BusyFor;   //cpu cycles, from the end of this edge's transfer
+    uint32_t Hold;      //cpu cycles before the next edge may go out, whatever chip it's for
+} DriverBusEdge_t;
+
+static DriverBusEdge_t Driver_BusEdges[DRIVER_BUS_MAX];
+static uint8_t Driver_BusCount = 0;
+static uint8_t Driver_BusDepth = 0; //Driver_BusBegin nesting
+static uint8_t Driver_BusNextWait = DRIVER_CHIP_NONE;
+
+static void Driver_BusFlush() { //send everything queued, including the last edge's hold
+    if (Driver_BusCount == 0) return;
+    uint32_t s = xthal_get_ccount();
+    uint32_t hold = 0;
+    for (uint8_t i=0;i<Driver_BusCount;i++) {
+        DriverBusEdge_t *e = &Driver_BusEdges[i];
+        while (xthal_get_ccount() - s < hold);
+        if (e->Wait != DRIVER_CHIP_NONE && Driver_ChipBusyFor[e->Wait]) {
+            //a chip left busy and not waited on for a whole ccount wrap can still look busy, but only for one more BusyFor
+            while (xthal_get_ccount() - Driver_ChipBusySince[e->Wait] < Driver_ChipBusyFor[e->Wait]);
+            Driver_ChipBusyFor[e->Wait] = 0;
+        }
+        disp_spi_transfer_data(Driver_SpiDevice, e->Sr, NULL, 2, 0);
+        s = xthal_get_ccount(); //the edge only reaches the chips when the transfer finishes, so its hold and busy time count from here
+        if (e->Busy != DRIVER_CHIP_NONE) {
+            Driver_ChipBusySince[e->Busy] = s;
+            Driver_ChipBusyFor[e->Busy] = e->BusyFor;
+        }
+        hold = e->Hold;
+    }
+    while (xthal_get_ccount() - s < hold);
+    Driver_BusCount = 0;
+}
+
+static void Driver_BusEdge(uint32_t hold) { //queue the current Driver_SrBuf, to be held for at least hold cycles
+    if (Driver_BusCount && Driver_BusNextWait == DRIVER_CHIP_NONE) {
+        DriverBusEdge_t *last = &Driver_BusEdges[Driver_BusCount-1];
+        if (last->Sr[0] == Driver_SrBuf[0] && last->Sr[1] == Driver_SrBuf[1]) {
+            last->Hold += hold;
+            return;
+        }
+    }
+    if (Driver_BusCount == DRIVER_BUS_MAX) Driver_BusFlush();
+    DriverBusEdge_t *e = &Driver_BusEdges[Driver_BusCount++];
+    e->Sr[0] = Driver_SrBuf[0];
+    e->Sr[1] = Driver_SrBuf[1];
+    e->Wait = Driver_BusNextWait;
+    e->Busy = DRIVER_CHIP_NONE;
+    e->Hold = hold;
+    Driver_BusNextWait = DRIVER_CHIP_NONE;
+}
+
+static void Driver_BusWait(uint8_t chip) { //the next edge doesn't go out until the chip's done with the last write
+    Driver_BusNextWait = chip;
+}
+
+static void Driver_BusBusy(uint8_t chip, uint32_t cycles) { //the last edge was a write that keeps the chip busy for a while
+    DriverBusEdge_t *e = &Driver_BusEdges[Driver_BusCount-1];
+    e->Busy = chip;
+    e->BusyFor = cycles;
+}
+
+//shadow registers. a write of the value a register already holds is dropped before it gets anywhere near the bus,
+//except for the ones in Driver_ShadowAlways where the write itself does something. one bank per chip select, since that's
+//what actually has the registers - opn2-on-opna writes and opna writes land in the same one
+static uint8_t Driver_Shadow[2][256*2];
+static uint8_t Driver_ShadowValid[2][(256*2)/8];
+static DcsgShadow_t Driver_DcsgShadow = {.Latch = 0xff};
+
+static bool Driver_ShadowAlways(uint8_t chip, uint8_t Port, uint8_t Register) { //registers where writing the same value again still does something
+    switch (chip) {
+        case DRIVER_CHIP_OPN2:
+            //we must never deduplicate writes to the low bytes of frequency. this is regs A0~A2, and in Ch3 special mode also A8~AA.
+            //could explicitly check only those ranges, but it seemed that adding those checks was slowing it down further than just checking A0~AF and letting duplicate writes to the high byte go through
+            return (Register >> 4) == 0xa;
+        case DRIVER_CHIP_OPNA:
+            if (Port == 1 && Register <= 0x10) return true; //adpcm control, memory data port and flags
+            //fall through
+        case DRIVER_CHIP_OPN:
+        case DRIVER_CHIP_OPN_2:
+            if (Port == 0 && (Register == 0x0d || Register == 0x10 || Register == 0x27 || Register == 0x28)) return true; //ssg env shape restarts it, rhythm key on, timer control, key on
+            return (Register >> 4) == 0xa; //frequency latches, same as opn2
+        case DRIVER_CHIP_OPL3:
+            return Port == 0 && Register == 0x04; //timer control
+        case DRIVER_CHIP_OPM:
+            return Register == 0x01 || Register == 0x08 || Register == 0x14; //test/lfo reset, key on, timer control
+        default:
+            return false;
+    }
+}
+
+static bool Driver_ShadowWrite(uint8_t chip, uint8_t Port, uint8_t Register, uint8_t Value) { //false if the write can't change anything and should be dropped
+    if (Driver_ShadowAlways(chip, Port, Register)) return true;
+    uint8_t bank = (chip == DRIVER_CHIP_OPN_2 || chip == DRIVER_CHIP_OPLL)?1:0; //the ones on the dcsg chip select
+    uint16_t r = ((Port&1)<<8)|Register;
+    if ((Driver_ShadowValid[bank][r>>3] & (1<<(r&7))) && Driver_Shadow[bank][r] == Value) {
+        Driver_WritesSaved++;
+        return false;
+    }
+    Driver_Shadow[bank][r] = Value;
+    Driver_ShadowValid[bank][r>>3] |= 1<<(r&7);
+    return true;
+}
+
+static bool Driver_DcsgShadowWrite(uint8_t Data) { //same idea for the dcsg, see dcsgshadow.h
+    if (DcsgShadow_Write(&Driver_DcsgShadow, Data)) return true;
+    Driver_WritesSaved++;
+    return false;
+}
+
+static void Driver_ShadowReset() { //chips were just reset. nothing is known, except the opn2's reset state which we've always relied on
+    memset(Driver_ShadowValid, 0, sizeof(Driver_ShadowValid));
+    DcsgShadow_Reset(&Driver_DcsgShadow);
+    if (Driver_DetectedMod == MEGAMOD_NONE) {
+        memset(Driver_Shadow[0], 0, sizeof(Driver_Shadow[0]));
+        memset(Driver_ShadowValid[0], 0xff, sizeof(Driver_ShadowValid[0]));
+        Driver_Shadow[0][0xb4] = 0b11000000;
+        Driver_Shadow[0][0xb5] = 0b11000000;
+        Driver_Shadow[0][0xb6] = 0b11000000;
+        Driver_Shadow[0][0x1b4] = 0b11000000;
+        Driver_Shadow[0][0x1b5] = 0b11000000;
+        Driver_Shadow[0][0x1b6] = 0b11000000;
+    }
+}
+
+static void Driver_BusDone() { //end of one register write
+    if (Driver_BusDepth == 0) Driver_BusFlush();
+}
+
+static void Driver_BusBegin() {
+    Driver_BusDepth++;
+}
+
+static void Driver_BusEnd() {
+    if (--Driver_BusDepth == 0) Driver_BusFlush();
+}
+
+void Driver_Output() { //output data to shift registers right now, after anything already queued
+    Driver_BusFlush();
     disp_spi_transfer_data(Driver_SpiDevice, (uint8_t*)&Driver_SrBuf, NULL, 2, 0);
 }
 
@@ -166,6 +402,22 @@ static uint32_t map(uint32_t x, uint32_t in_min, uint32_t in_max, uint32_t out_m
   return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
 }
 
+static esp_timer_handle_t Driver_WakeTimer = NULL;
+
+static void Driver_WakeCb(void *arg) {
+    xTaskNotifyGive(Taskmgr_Handles[TASK_DRIVER]);
+}
+
+static void Driver_Snooze(uint32_t cycles) { //real cpu cycles until the next thing is due
+    if (cycles < DRIVER_US(DRIVER_SNOOZE_MIN_US)) return;
+    uint32_t us = cycles/DRIVER_US(1) - DRIVER_SNOOZE_SPIN_US;
+    if (us > DRIVER_SNOOZE_MAX_US) us = DRIVER_SNOOZE_MAX_US;
+    esp_timer_stop(Driver_WakeTimer); //fails harmlessly if it isn't running
+    ulTaskNotifyTake(pdTRUE, 0); //drop a wakeup left over from last time
+    if (esp_timer_start_once(Driver_WakeTimer, us) != ESP_OK) return;
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(DRIVER_SNOOZE_MAX_US/1000)+1); //timeout only as a backstop
+}
+
 bool Driver_Setup() {
     ESP_LOGI(TAG, "Setting up");
 
@@ -178,7 +430,6 @@ bool Driver_Setup() {
         return false;
     }
     MegaStream_Create(&Driver_CommandStream, Driver_CommandStreamBuf, DRIVER_QUEUE_SIZE);
-    MegaStream_Create(&Driver_PcmStream, Driver_PcmBuf, DRIVER_QUEUE_SIZE);
     Driver_CommandEvents = xEventGroupCreate();
     if (Driver_CommandEvents == NULL) {
         ESP_LOGE(TAG, "Command event group create failed !!");
@@ -189,6 +440,15 @@ bool Driver_Setup() {
         ESP_LOGE(TAG, "Stream event group create failed !!");
         return false;
     }
+    esp_timer_create_args_t wakeargs = {
+        .callback = Driver_WakeCb,
+        .arg = NULL,
+        .name = "Driver wake",
+    };
+    if (esp_timer_create(&wakeargs, &Driver_WakeTimer) != ESP_OK) {
+        ESP_LOGE(TAG, "Wake timer create failed !!");
+        return false;
+    }
 
     //setup the spi stuff
     ESP_LOGI(TAG, "Spi setup...");
@@ -268,25 +528,23 @@ void Driver_ModDetect() {
 }
 
 void Driver_Sleep(uint32_t us) { //quick and dirty spin sleep
+    Driver_BusFlush();
     uint32_t s = xthal_get_ccount();
     uint32_t c = us*(DRIVER_CLOCK_RATE/1000000);
     while (xthal_get_ccount() - s < c);
 }
 
 void Driver_SleepClocks(uint32_t f, uint32_t clks) { //same dirty spin sleep, but timed relative to a certain clock freq and number of clocks
+    Driver_BusFlush();
     uint32_t s = xthal_get_ccount();
     uint64_t c = (DRIVER_CLOCK_RATE*(uint64_t)clks)/f;
     while (xthal_get_ccount() - s < c);
 }
 
 void Driver_DcsgOut(uint8_t Data) {
-    uint32_t clk = 0;
-    if (Driver_DetectedMod != MEGAMOD_OPLLDCSG) { //opll+dcsg megamod only uses one clock line so this check is invalid
-        clk = Clk_GetCh(1);
-        if (clk == 0) return;
-    } else { //we still need to know the clock for delay calculations
-        clk = Clk_GetCh(0);
-    }
+    if (Driver_ChipClockCh(DRIVER_CHIP_DCSG) == CLK_DCSG && Clk_GetCh(CLK_DCSG) == 0) return; //no dcsg
+    if (!Driver_DcsgShadowWrite(Data)) return;
+    const DriverChipCycles_t *t = Driver_ChipTiming(DRIVER_CHIP_DCSG);
 
     if (Driver_DetectedMod == MEGAMOD_OPLLDCSG) {
         #ifdef OPLLDCSG_ORIGINAL_PROTO
@@ -305,15 +563,18 @@ void Driver_DcsgOut(uint8_t Data) {
         }
     }
 
-    Driver_Output();
+    Driver_BusFlush(); //the write below has an upper bound on its timing, so it doesn't get batched with anything
+    Driver_BusWait(DRIVER_CHIP_DCSG);
+    Driver_BusEdge(0);
     Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_DCSG_CS; //!cs low
     Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_WR; //!wr low
-    portENTER_CRITICAL(&mux);
-    Driver_Output();
-    Driver_SleepClocks(clk, 36); //32, but with wiggle room. but not enough to push us into another write cycle...
+    Driver_BusEdge(t->WrLow);
     Driver_SrBuf[SR_CONTROL] |= SR_BIT_DCSG_CS; //!cs high
     Driver_SrBuf[SR_CONTROL] |= SR_BIT_WR; //!wr high
-    Driver_Output();
+    Driver_BusEdge(0);
+    Driver_BusBusy(DRIVER_CHIP_DCSG, t->DataWait);
+    portENTER_CRITICAL(&mux);
+    Driver_BusFlush();
     portEXIT_CRITICAL(&mux);
 
     //channel led stuff
@@ -390,119 +651,129 @@ void Driver_ResetChips(bool force) {
     Driver_SrBuf[SR_CONTROL] |= SR_BIT_IC;
     Driver_Output();
     Driver_Sleep(1000);
-    memset(opn2_regs_dedup, 0, sizeof(opn2_regs_dedup));
-    opn2_regs_dedup[0xb4] = 0b11000000;
-    opn2_regs_dedup[0xb5] = 0b11000000;
-    opn2_regs_dedup[0xb6] = 0b11000000;
-    opn2_regs_dedup[0x1b4] = 0b11000000;
-    opn2_regs_dedup[0x1b5] = 0b11000000;
-    opn2_regs_dedup[0x1b6] = 0b11000000;
+    Driver_ShadowReset();
     reset_flag = true;
 }
 
-void Driver_FmOutopl3(uint8_t Port, uint8_t Register, uint8_t Value) {
+void Driver_FmOutopl3(uint8_t Port, uint8_t Register, uint8_t Value) { //also opm, same bus cycle
+    uint8_t chip = (Driver_DetectedMod == MEGAMOD_OPM)?DRIVER_CHIP_OPM:DRIVER_CHIP_OPL3;
+    if (!Driver_ShadowWrite(chip, Port, Register, Value)) return;
+    const DriverChipCycles_t *t = Driver_ChipTiming(chip);
     if (Port == 0) {
         Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_A1; //clear A1
     } else if (Port == 1) {
         Driver_SrBuf[SR_CONTROL] |= SR_BIT_A1; //set A1
     }
     Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_A0; //clear A0
-    Driver_Output();
-    Driver_Sleep(20);
+    Driver_BusWait(chip);
+    Driver_BusEdge(0);
     Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_FM_CS; // /cs low
     Driver_SrBuf[SR_DATABUS] = Register;
-    Driver_Output();
-    Driver_Sleep(20);
+    Driver_BusEdge(0);
     Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_WR; // /wr low
-    Driver_Output();
-    Driver_Sleep(20);
+    Driver_BusEdge(t->WrLow);
     Driver_SrBuf[SR_CONTROL] |= SR_BIT_WR; // /wr high
-    Driver_Output();
-    Driver_Sleep(20);
+    Driver_BusEdge(0);
+    Driver_BusBusy(chip, t->AddrWait);
     Driver_SrBuf[SR_CONTROL] |= SR_BIT_A0; //set A0
     Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_WR; // /wr low
     Driver_SrBuf[SR_DATABUS] = Value;
-    Driver_Output();
-    Driver_Sleep(20);
+    Driver_BusWait(chip);
+    Driver_BusEdge(t->WrLow);
     Driver_SrBuf[SR_CONTROL] |= SR_BIT_WR; // /wr high
     Driver_SrBuf[SR_CONTROL] |= SR_BIT_FM_CS; // /cs high
-    Driver_Output();
-    Driver_Sleep(20);
+    Driver_BusEdge(0);
+    Driver_BusBusy(chip, t->DataWait);
+    Driver_BusDone();
 }
 
 void Driver_FmOutopll(uint8_t Register, uint8_t Value) {
+    if (!Driver_ShadowWrite(DRIVER_CHIP_OPLL, 0, Register, Value)) return;
+    const DriverChipCycles_t *t = Driver_ChipTiming(DRIVER_CHIP_OPLL);
     Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_A0; //clear A0
-    Driver_Output();
-    Driver_Sleep(20);
+    Driver_BusWait(DRIVER_CHIP_OPLL);
+    Driver_BusEdge(0);
     Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_DCSG_CS; // /cs low
     Driver_SrBuf[SR_DATABUS] = Register;
-    Driver_Output();
-    Driver_Sleep(20);
+    Driver_BusEdge(0);
     Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_WR; // /wr low
-    Driver_Output();
-    Driver_Sleep(20);
+    Driver_BusEdge(t->WrLow);
     Driver_SrBuf[SR_CONTROL] |= SR_BIT_WR; // /wr high
-    Driver_Output();
-    Driver_Sleep(20);
+    Driver_BusEdge(0);
+    Driver_BusBusy(DRIVER_CHIP_OPLL, t->AddrWait);
     Driver_SrBuf[SR_CONTROL] |= SR_BIT_A0; //set A0
     Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_WR; // /wr low
     Driver_SrBuf[SR_DATABUS] = Value;
-    Driver_Output();
-    Driver_Sleep(20);
+    Driver_BusWait(DRIVER_CHIP_OPLL);
+    Driver_BusEdge(t->WrLow);
     Driver_SrBuf[SR_CONTROL] |= SR_BIT_WR; // /wr high
     Driver_SrBuf[SR_CONTROL] |= SR_BIT_DCSG_CS; // /cs high
-    Driver_Output();
-    Driver_Sleep(20);
+    Driver_BusEdge(0);
+    Driver_BusBusy(DRIVER_CHIP_OPLL, t->DataWait);
+    Driver_BusDone();
 }
 
 void Driver_FmOutopn(uint8_t Device, uint8_t Register, uint8_t Value) {
     uint8_t csbit = SR_BIT_FM_CS;
+    uint8_t chip = DRIVER_CHIP_OPN;
     if (Device) {
         csbit = SR_BIT_DCSG_CS;
+        chip = DRIVER_CHIP_OPN_2;
     }
+    if (!Driver_ShadowWrite(chip, 0, Register, Value)) return;
+    const DriverChipCycles_t *t = Driver_ChipTiming(chip);
     Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_A0; //clear A0
-    Driver_Output();
+    Driver_BusWait(chip);
+    Driver_BusEdge(0);
     Driver_SrBuf[SR_CONTROL] &= ~csbit; // /cs low
     Driver_SrBuf[SR_DATABUS] = Register;
-    Driver_Output();
+    Driver_BusEdge(0);
     Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_WR; // /wr low
-    Driver_Output();
+    Driver_BusEdge(t->WrLow);
     Driver_SrBuf[SR_CONTROL] |= SR_BIT_WR; // /wr high
-    Driver_Output();
-    Driver_Sleep(10);
+    Driver_BusEdge(0);
+    Driver_BusBusy(chip, t->AddrWait);
     Driver_SrBuf[SR_CONTROL] |= SR_BIT_A0; //set A0
     Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_WR; // /wr low
     Driver_SrBuf[SR_DATABUS] = Value;
-    Driver_Output();
+    Driver_BusWait(chip);
+    Driver_BusEdge(t->WrLow);
     Driver_SrBuf[SR_CONTROL] |= SR_BIT_WR; // /wr high
     Driver_SrBuf[SR_CONTROL] |= csbit; // /cs high
-    Driver_Output();
-    Driver_Sleep(20);
+    Driver_BusEdge(0);
+    Driver_BusBusy(chip, t->DataWait);
+    Driver_BusDone();
 }
 
 void Driver_FmOutopna(uint8_t Port, uint8_t Register, uint8_t Value) {
+    if (!Driver_ShadowWrite(DRIVER_CHIP_OPNA, Port, Register, Value)) return; //no led update either
+    const DriverChipCycles_t *t = Driver_ChipTiming(DRIVER_CHIP_OPNA);
     if (Port == 0) {
         Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_A1; //clear A1
     } else if (Port == 1) {
         Driver_SrBuf[SR_CONTROL] |= SR_BIT_A1; //set A1
     }
     Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_A0; //clear A0
-    Driver_Output();
+    Driver_BusWait(DRIVER_CHIP_OPNA);
+    Driver_BusEdge(0);
     Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_FM_CS; // /cs low
     Driver_SrBuf[SR_DATABUS] = Register;
-    Driver_Output();
+    Driver_BusEdge(0);
     Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_WR; // /wr low
-    Driver_Output();
+    Driver_BusEdge(t->WrLow);
     Driver_SrBuf[SR_CONTROL] |= SR_BIT_WR; // /wr high
-    Driver_Output();
-    Driver_Sleep(10);
+    Driver_BusEdge(0);
+    Driver_BusBusy(DRIVER_CHIP_OPNA, t->AddrWait);
     Driver_SrBuf[SR_CONTROL] |= SR_BIT_A0; //set A0
     Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_WR; // /wr low
     Driver_SrBuf[SR_DATABUS] = Value;
-    Driver_Output();
+    Driver_BusWait(DRIVER_CHIP_OPNA);
+    Driver_BusEdge(t->WrLow);
     Driver_SrBuf[SR_CONTROL] |= SR_BIT_WR; // /wr high
     Driver_SrBuf[SR_CONTROL] |= SR_BIT_FM_CS; // /cs high
-    Driver_Output();
+    Driver_BusEdge(0);
+    Driver_BusBusy(DRIVER_CHIP_OPNA, t->DataWait);
+    Driver_BusDone();
 
     if (!Driver_NoLeds) {
         uint8_t ch = 0;
@@ -577,26 +848,21 @@ void Driver_FmOutopna(uint8_t Port, uint8_t Register, uint8_t Value) {
         } //todo 0x08/0x0c env freq, 0x0d env wave. will need tracking of if channels have envgen enabled
     }
 
-    if (Port == 0 && Register == 0x10) {
-        Driver_Sleep(100);
-    } else {
-        Driver_Sleep(20);
-    }
 }
 
 void Driver_Opna_PrepareUpload() {
     Driver_SrBuf[SR_CONTROL] |= SR_BIT_A1; //set A1
     Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_A0; //clear A0
-    Driver_Output();
+    Driver_BusEdge(0);
     Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_FM_CS; // /cs low
     Driver_SrBuf[SR_DATABUS] = 0x08;
-    Driver_Output();
+    Driver_BusEdge(0);
     Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_WR; // /wr low
-    Driver_Output();
+    Driver_BusEdge(0);
     Driver_SrBuf[SR_CONTROL] |= SR_BIT_WR; // /wr high
     Driver_SrBuf[SR_CONTROL] |= SR_BIT_FM_CS; // /cs high
-    Driver_Output();
-    Driver_Sleep(5);
+    Driver_BusEdge(DRIVER_US(5));
+    Driver_BusDone();
     Driver_SrBuf[SR_CONTROL] |= SR_BIT_A0; //set A0
 }
 
@@ -605,11 +871,11 @@ void Driver_Opna_UploadByte(uint8_t pair) {
     Driver_SrBuf[SR_DATABUS] = pair;
     //Driver_Output();
     Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_WR; // /wr low
-    Driver_Output();
+    Driver_BusEdge(0);
     Driver_SrBuf[SR_CONTROL] |= SR_BIT_WR; // /wr high
     Driver_SrBuf[SR_CONTROL] |= SR_BIT_FM_CS; // /cs high
-    Driver_Output();
-    Driver_Sleep(Loader_FastOpnaUpload?12:15);
+    Driver_BusEdge(DRIVER_US(Loader_FastOpnaUpload?12:15));
+    Driver_BusDone();
 }
 
 void Driver_FmOut(uint8_t Port, uint8_t Register, uint8_t Value) {
@@ -635,31 +901,33 @@ void Driver_FmOut(uint8_t Port, uint8_t Register, uint8_t Value) {
         }
     }
 
-    //we must never deduplicate writes to the low bytes of frequency. this is regs A0~A2, and in Ch3 special mode also A8~AA.
-    //could explicitly check only those ranges, but it seemed that adding those checks was slowing it down further than just checking A0~AF and letting duplicate writes to the high byte go through
-    if (opn2_regs_dedup[(Port<<8)|Register] != Value || (Register >> 4) == 0xa) {
+    if (Driver_ShadowWrite(DRIVER_CHIP_OPN2, Port, Register, Value)) {
+        const DriverChipCycles_t *t = Driver_ChipTiming(DRIVER_CHIP_OPN2);
         if (Port == 0) {
             Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_A1; //clear A1
         } else if (Port == 1) {
             Driver_SrBuf[SR_CONTROL] |= SR_BIT_A1; //set A1
         }
         Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_A0; //clear A0
-        Driver_Output();
+        Driver_BusWait(DRIVER_CHIP_OPN2);
+        Driver_BusEdge(0);
         Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_FM_CS; // /cs low
         Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_WR; // /wr low
         Driver_SrBuf[SR_DATABUS] = Register;
-        Driver_Output();
+        Driver_BusEdge(t->WrLow);
         Driver_SrBuf[SR_CONTROL] |= SR_BIT_WR; // /wr high
-        Driver_Output();
+        Driver_BusEdge(0);
+        Driver_BusBusy(DRIVER_CHIP_OPN2, t->AddrWait);
         Driver_SrBuf[SR_CONTROL] |= SR_BIT_A0; //set A0
         Driver_SrBuf[SR_CONTROL] &= ~SR_BIT_WR; // /wr low
         Driver_SrBuf[SR_DATABUS] = Value;
-        Driver_Output();
+        Driver_BusWait(DRIVER_CHIP_OPN2);
+        Driver_BusEdge(t->WrLow);
         Driver_SrBuf[SR_CONTROL] |= SR_BIT_WR; // /wr high
         Driver_SrBuf[SR_CONTROL] |= SR_BIT_FM_CS; // /cs high
-        Driver_Output();
-        Driver_Sleep(5);
-        opn2_regs_dedup[(Port<<8)|Register] = Value;
+        Driver_BusEdge(0);
+        Driver_BusBusy(DRIVER_CHIP_OPN2, t->DataWait);
+        Driver_BusDone();
     } else {
         return; //no led update
     }
@@ -1009,6 +1277,35 @@ void Driver_SetFirstWait() {
     Driver_LastCc = Driver_Cc = xthal_get_ccount();
 }
 
+static bool Driver_DsAnyActive() {
+    for (uint8_t i=0;i<DACSTREAM_STREAMS;i++) {
+        if (Driver_DsVoices[i].Active) return true;
+    }
+    return false;
+}
+
+bool Driver_DsSlotPlaying(uint8_t Slot) {
+    for (uint8_t i=0;i<DACSTREAM_STREAMS;i++) {
+        if (Driver_DsVoices[i].Active && Driver_DsVoices[i].Slot == Slot) return true;
+    }
+    return false;
+}
+
+static DriverDsVoice_t *Driver_DsVoice(uint8_t StreamId) { //NULL if that stream id hasn't been started
+    for (uint8_t i=0;i<DACSTREAM_STREAMS;i++) {
+        if (Driver_DsVoices[i].StreamId == StreamId) return &Driver_DsVoices[i];
+    }
+    return NULL;
+}
+
+static void Driver_DsReset() {
+    for (uint8_t i=0;i<DACSTREAM_STREAMS;i++) {
+        Driver_DsVoices[i].StreamId = 0xff;
+        Driver_DsVoices[i].Active = false;
+        Driver_DsVoices[i].Seq = 0;
+    }
+}
+
 uint8_t Driver_SeqToSlot(uint32_t seq) {
     for (uint8_t i=0;i<DACSTREAM_PRE_COUNT;i++) {
         if (!DacStreamEntries[i].SlotFree && DacStreamEntries[i].Seq == seq) {
@@ -1042,327 +1339,445 @@ uint16_t opnastart = 0;
 uint16_t opnastart_hacked = 0;
 uint16_t opnastop = 0;
 uint16_t opnastop_hacked = 0;
-bool Driver_RunCommand(uint8_t CommandLength) { //run the next command in the stream. command length as a parameter just to avoid looking it up a second time
-    uint8_t cmd[CommandLength]; //buffer for command + attached data
-    bool nw = false; //skip write
-    
-    //read command + data from the stream
-    MegaStream_Recv(&Driver_CommandStream, cmd, CommandLength);
-
-    if (cmd[0] == 0x50) { //SN76489
-        //dcsg writes need to be intercepted to fix frequency register differences between TI DCSG <-> SEGA VDP DCSG
-        if ((cmd[1] & 0x80) == 0) { //ch 1~3 frequency high byte write
-            //note: whether or not dcsg_latched_ch is actually still in the latch on the chip (ch3 updates might blow it away) doesn't matter, because we always rewrite the low byte anyway. it's what's latched from *our* POV
-            dcsg_freq[dcsg_latched_ch] = (dcsg_freq[dcsg_latched_ch] & 0b1111) | ((cmd[1] & 0b111111) << 4);
-            //write both registers now
-            if (dcsg_latched_ch == 2) { //ch3
-                Driver_WriteDcsgCh3Freq();
-            } else {
-                uint8_t low = 0x80 | (dcsg_latched_ch<<5) | (dcsg_freq[dcsg_latched_ch] & 0b1111);
-                if (dcsg_freq[dcsg_latched_ch] == 0) low |= 1;
-                Driver_DcsgOut(low);
-                Driver_DcsgOut((dcsg_freq[dcsg_latched_ch] >> 4) & 0b111111);
-            }
-        } else if ((cmd[1] & 0b10010000) == 0b10000000 && (cmd[1]&0b01100000)>>5 != 3) { //ch 1~3 frequency low byte write
-            dcsg_latched_ch = (cmd[1]>>5)&3;
-            dcsg_freq[dcsg_latched_ch] = (dcsg_freq[dcsg_latched_ch] & 0b1111110000) | (cmd[1] & 0b1111);
-            uint8_t val = cmd[1];
-            if ((Driver_VgmDcsgSpecialFreq0 || Driver_AssumeSegaDcsg) && dcsg_freq[dcsg_latched_ch] == 0) {
-                val |= 1;
-            }
-            Driver_DcsgOut(val);
-        } else { //attenuation or noise ch control write
-            if ((cmd[1] & 0b10010000) == 0b10010000) { //attenuation
-                uint8_t ch = (cmd[1]>>5)&0b00000011;
-                Driver_DcsgAttenuation[ch] = cmd[1];
-                cmd[1] = FilterDcsgAttenWrite(cmd[1]);
-                if ((Driver_MitigateVgmTrim && Driver_FirstWait) || Driver_Slip) cmd[1] |= 0b00001111; //if we haven't reached the first wait, force full attenuation
-                if (ch == 2) {
-                    //when ch 3 atten is updated, we also need to write frequency again. this is due to the periodic noise fix.
-                    //TODO: this would be better if it only does it if actually transitioning in or out of mute, rather than on every atten update
-                    Driver_WriteDcsgCh3Freq();
-                }
-            } else if ((cmd[1] & 0b11110000) == 0b11100000) { //noise control
-                Driver_DcsgNoisePeriodic = (cmd[1] & 0b00000100) == 0; //FB
-                Driver_DcsgNoiseSourceCh3 = (cmd[1] & 0b00000011) == 0b00000011; //NF0, NF1
-                //periodic noise fix: update ch3 frequency when noise control settings change
-                //TODO: only update it when it matters :P
-                Driver_WriteDcsgCh3Freq();
-            }
-            Driver_DcsgOut(cmd[1]);
+//command stream handlers. the loader has already turned the vgm into DriverRecord_t's, each handler gets one record and returns how many records it used up
+//handlers are free to modify the record in place
+typedef uint8_t (*Driver_OpHandler_t)(DriverRecord_t *rec);
+
+static uint8_t Driver_OpWait(DriverRecord_t *rec) {
+    uint32_t wait = rec->Reg | ((uint32_t)rec->Val<<8) | ((uint32_t)rec->Arg<<16);
+    Driver_NextSample += wait;
+    if (Driver_FirstWait && wait > 0) {
+        Driver_SetFirstWait();
+    }
+    return 1;
+}
+
+static uint8_t Driver_OpDcsg(DriverRecord_t *rec) { //SN76489
+    //dcsg writes need to be intercepted to fix frequency register differences between TI DCSG <-> SEGA VDP DCSG
+    if ((rec->Val & 0x80) == 0) { //ch 1~3 frequency high byte write
+        //note: whether or not dcsg_latched_ch is actually still in the latch on the chip (ch3 updates might blow it away) doesn't matter, because we always rewrite the low byte anyway. it's what's latched from *our* POV
+        dcsg_freq[dcsg_latched_ch] = (dcsg_freq[dcsg_latched_ch] & 0b1111) | ((rec->Val & 0b111111) << 4);
+        //write both registers now
+        if (dcsg_latched_ch == 2) { //ch3
+            Driver_WriteDcsgCh3Freq();
+        } else {
+            uint8_t low = 0x80 | (dcsg_latched_ch<<5) | (dcsg_freq[dcsg_latched_ch] & 0b1111);
+            if (dcsg_freq[dcsg_latched_ch] == 0) low |= 1;
+            Driver_DcsgOut(low);
+            Driver_DcsgOut((dcsg_freq[dcsg_latched_ch] >> 4) & 0b111111);
         }
-    } else if (cmd[0] == 0x51) {
-        Driver_FmOutopll(cmd[1], cmd[2]);
-    } else if (cmd[0] == 0x54) { //opm
-        Driver_FmOutopl3(0, cmd[1], cmd[2]); //todo: proper timing for this
-    } else if (cmd[0] == 0x5e || cmd[0] == 0x5b || cmd[0] == 0x5a) { //ymf262 port 0, ym3812, ym3526
-        Driver_FmOutopl3(0, cmd[1], cmd[2]);
-    } else if (cmd[0] == 0x5f) { //ymf262 port 1
-        Driver_FmOutopl3(1, cmd[1], cmd[2]);
-    } else if (Driver_DetectedMod == MEGAMOD_2XOPN && (cmd[0] == 0x55 || cmd[0] == 0xa5 || cmd[0] == 0xa0)) { //opn, 2nd opn, ay38910
-        Driver_FmOutopn((cmd[0]&0xf0)==0xa0?1:0, cmd[1], cmd[2]);
-    } else if ((Driver_DetectedMod == MEGAMOD_NONE || Driver_DetectedMod == MEGAMOD_OPNA || Driver_DetectedMod == MEGAMOD_OPNOPLL) && (cmd[0] == 0x56 || cmd[0] == 0x57 || cmd[0] == 0x55 || cmd[0] == 0xa0)) { //opna both banks, opn, AY-3-8910
-        if (cmd[0] == 0x57) {
-            if (cmd[1] == 0x01) { //control/config
-                Driver_Opna_AdpcmConfig = cmd[2]; //don't force type=dram and width=1bit in the backup
-                cmd[2] &= 0b11111100; //but do it on the write
-                //todo vgm_trim mitigation
-                cmd[2] &= (Driver_FmMask&(1<<6))?0b11111111:0b00111111; //muting mask
-                if (Driver_ForceMono && (cmd[2] & 0b11000000)) cmd[2] |= 0b11000000;
-            } else if (cmd[1] == 0x02) { //start L
-                ESP_LOGD(TAG, "start    %02x", cmd[2]);
-                opnastart = (opnastart & 0xff00) | cmd[2];
-                nw = true;
-            } else if (cmd[1] == 0x03) { //start H
-                ESP_LOGD(TAG, "start  %02x", cmd[2]);
-                opnastart = (((uint16_t)cmd[2])<<8) | (opnastart & 0xff);
-                nw = true;
-            } else if (cmd[1] == 0x04) { //stop L
-                ESP_LOGD(TAG, "stop     %02x", cmd[2]);
-                opnastop = (opnastop & 0xff00) | cmd[2];
-                nw = true;
-            } else if (cmd[1] == 0x05) { //stop H
-                ESP_LOGD(TAG, "stop   %02x", cmd[2]);
-                opnastop = (((uint16_t)cmd[2])<<8) | (opnastop & 0xff);
-                nw = true;
-            } else if (cmd[1] == 0x00 && cmd[2] & 0x80) { //pcm start
-                if (Driver_Opna_AdpcmConfig & 0b00000011) { //if in rom or 8bit dram mode, convert addresses
-                    ESP_LOGD(TAG, "converting opna pcm addresses");
-                    opnastart_hacked = opnastart * 8;
-                    Driver_FmOutopna(1,0x02,opnastart_hacked&0xff);
-                    Driver_FmOutopna(1,0x03,opnastart_hacked>>8);
-                    opnastop_hacked = opnastop * 8;
-                    opnastop_hacked |= 0b00000111;
-                    Driver_FmOutopna(1,0x04,opnastop_hacked&0xff);
-                    Driver_FmOutopna(1,0x05,opnastop_hacked>>8);
-                } else { //write as-is
-                    Driver_FmOutopna(1,0x02,opnastart&0xff);
-                    Driver_FmOutopna(1,0x03,opnastart>>8);
-                    Driver_FmOutopna(1,0x04,opnastop&0xff);
-                    Driver_FmOutopna(1,0x05,opnastop>>8);
-                }
-                ChannelMgr_PcmAccu = 127;
-                ChannelMgr_PcmCount = 1;
-            } else if (cmd[1] == 0x0c || cmd[1] == 0x0d) { //limit
-                nw = true;
-            } else if (cmd[1] == 0x0b) { //level
-                cmd[2] = FilterAdpcmLevelWrite(cmd[2]);
-            }
+    } else if ((rec->Val & 0b10010000) == 0b10000000 && (rec->Val&0b01100000)>>5 != 3) { //ch 1~3 frequency low byte write
+        dcsg_latched_ch = (rec->Val>>5)&3;
+        dcsg_freq[dcsg_latched_ch] = (dcsg_freq[dcsg_latched_ch] & 0b1111110000) | (rec->Val & 0b1111);
+        uint8_t val = rec->Val;
+        if ((Driver_VgmDcsgSpecialFreq0 || Driver_AssumeSegaDcsg) && dcsg_freq[dcsg_latched_ch] == 0) {
+            val |= 1;
         }
-        if (cmd[1] >= 0xb4 && cmd[1] <= 0xb6) { //pan, AMS, PMS
-            //todo vgm_trim mitigation
-            uint8_t i = ((cmd[0]&1)?3:0)+cmd[1]-0xb4;
-            Driver_FmPans[i] = cmd[2];
-            cmd[2] &= (Driver_FmMask & (1<<i))?0b11111111:0b00111111;
-            if (Driver_ForceMono && (cmd[2] & 0b11000000)) cmd[2] |= 0b11000000;
-        } else if (cmd[0] == 0x56 && cmd[1] >= 0x18 && cmd[1] <= 0x1d) { //rhythm pan/level
-            //todo vgm_trim mitigation
-            uint8_t i = cmd[1]-0x18;
-            Driver_Opna_RhythmConfig[i] = cmd[2];
-            cmd[2] &= (Driver_FmMask & (1<<6))?0b11111111:0b00111111;
-            if (Driver_ForceMono && (cmd[2] & 0b11000000)) cmd[2] |= 0b11000000;
-        } else if ((cmd[0] == 0x56 || cmd[0] == 0x55 || cmd[0] == 0xa0) && cmd[1] == 0x07) { //ssg tone enable
-            //todo vgm_trim mitigation
-            Driver_Opna_SsgConfig = cmd[2];
-            cmd[2] = Driver_ProcessSsgControlWrite(cmd[2]); //this handles masks
-        } else if (cmd[0] == 0x56 && cmd[1] == 0x10) { //rhythm
-            if (cmd[2] & 0b00111111) {
-                ChannelMgr_PcmAccu = 127;
-                ChannelMgr_PcmCount = 1;
+        Driver_DcsgOut(val);
+    } else { //attenuation or noise ch control write
+        if ((rec->Val & 0b10010000) == 0b10010000) { //attenuation
+            uint8_t ch = (rec->Val>>5)&0b00000011;
+            Driver_DcsgAttenuation[ch] = rec->Val;
+            rec->Val = FilterDcsgAttenWrite(rec->Val);
+            if ((Driver_MitigateVgmTrim && Driver_FirstWait) || Driver_Slip) rec->Val |= 0b00001111; //if we haven't reached the first wait, force full attenuation
+            if (ch == 2) {
+                //when ch 3 atten is updated, we also need to write frequency again. this is due to the periodic noise fix.
+                //TODO: this would be better if it only does it if actually transitioning in or out of mute, rather than on every atten update
+                Driver_WriteDcsgCh3Freq();
             }
-        } else if (cmd[0] == 0x56 && cmd[1] == 0x11) { //rhythm TL
-            cmd[2] = FilterRhythmTLWrite(cmd[2]);
-        } else if ((cmd[0] == 0x56 || cmd[0] == 0x55 || cmd[0] == 0xa0) && cmd[1] >= 0x08 && cmd[1] <= 0x0a) {
-            Driver_Opna_SsgLevel[cmd[1] - 0x08] = cmd[2];
-            
-            //block writes to ssg level registers during mute, to avoid level change pops:
-            if ((Driver_DcsgMask & (1<<(cmd[1]-8))) == 0) nw = true;
-            
-            cmd[2] = FilterSsgLevelWrite(cmd[1], cmd[2]);
-        } else if (cmd[0] >= 0x55 && cmd[0] <= 0x57 && cmd[1] >= 0xb0 && cmd[1] <= 0xb2) { //algo
-            ESP_LOGD(TAG, "algo write");
-            HandleAlgoWrite((cmd[0]==0x57)?1:0, cmd[1], cmd[2]);
+        } else if ((rec->Val & 0b11110000) == 0b11100000) { //noise control
+            Driver_DcsgNoisePeriodic = (rec->Val & 0b00000100) == 0; //FB
+            Driver_DcsgNoiseSourceCh3 = (rec->Val & 0b00000011) == 0b00000011; //NF0, NF1
+            //periodic noise fix: update ch3 frequency when noise control settings change
+            //TODO: only update it when it matters :P
+            Driver_WriteDcsgCh3Freq();
         }
-        if (cmd[0] >= 0x55 && cmd[0] <= 0x57 && ((cmd[1] >= 0x40 && cmd[1] <= 0x42) || (cmd[1] >= 0x48 && cmd[1] <= 0x4a) || (cmd[1] >= 0x44 && cmd[1] <= 0x46) || (cmd[1] >= 0x4c && cmd[1] <= 0x4e))) { //TL
-            ESP_LOGD(TAG, "tl write");
-            cmd[2] = FilterTLWrite((cmd[0]==0x57)?1:0, cmd[1], cmd[2]);
-        }
-        if (!nw) Driver_FmOutopna((cmd[0] == 0x57)?1:0, cmd[1], cmd[2]); //not just checking the low bit because of opn
-    } else if (cmd[0] == 0x52) { //YM2612 port 0
-        if (Driver_DetectedMod == MEGAMOD_OPNA) { //opn2 write when opna mod detected
-            if (!opn2_on_opna_mode) { //insert a command to enable 6ch mode, and enable opn2_on_opna_mode
-                ESP_LOGW(TAG, "Playing OPN2 tune on OPNA hardware");
-                Driver_FmOut(0, 0x29, 0x80);
-                opn2_on_opna_mode = true;
-            } else if (cmd[1] == 0x29) { //mask on the 6ch bit for any writes to this reg, should they exist in the vgm
-                cmd[2] |= 0x80;
+        Driver_DcsgOut(rec->Val);
+    }
+    return 1;
+}
+
+static uint8_t Driver_OpOpll(DriverRecord_t *rec) {
+    Driver_FmOutopll(rec->Reg, rec->Val);
+    return 1;
+}
+
+static uint8_t Driver_OpOpm(DriverRecord_t *rec) {
+    Driver_FmOutopl3(0, rec->Reg, rec->Val); //same bus cycle, it picks the opm timings
+    return 1;
+}
+
+static uint8_t Driver_OpOpl3(DriverRecord_t *rec) { //ymf262 both ports, ym3812, ym3526
+    Driver_FmOutopl3((rec->Op == DRIVER_OP_OPL3_1)?1:0, rec->Reg, rec->Val);
+    return 1;
+}
+
+static uint8_t Driver_OpOpn(DriverRecord_t *rec) { //opn, 2nd opn, opna both banks, AY-3-8910
+    bool nw = false; //skip write
+
+    if (Driver_DetectedMod == MEGAMOD_2XOPN && (rec->Op == DRIVER_OP_OPN || rec->Op == DRIVER_OP_OPN_2 || rec->Op == DRIVER_OP_AY)) {
+        Driver_FmOutopn((rec->Op == DRIVER_OP_OPN)?0:1, rec->Reg, rec->Val);
+        return 1;
+    }
+    if (rec->Op == DRIVER_OP_OPN_2 || !(Driver_DetectedMod == MEGAMOD_NONE || Driver_DetectedMod == MEGAMOD_OPNA || Driver_DetectedMod == MEGAMOD_OPNOPLL)) {
+        ESP_LOGE(TAG, "driver can't play op %d on this megamod !!", rec->Op);
+        return 1;
+    }
+
+    if (rec->Op == DRIVER_OP_OPNA_1) {
+        if (rec->Reg == 0x01) { //control/config
+            Driver_Opna_AdpcmConfig = rec->Val; //don't force type=dram and width=1bit in the backup
+            rec->Val &= 0b11111100; //but do it on the write
+            //todo vgm_trim mitigation
+            rec->Val &= (Driver_FmMask&(1<<6))?0b11111111:0b00111111; //muting mask
+            if (Driver_ForceMono && (rec->Val & 0b11000000)) rec->Val |= 0b11000000;
+        } else if (rec->Reg == 0x02) { //start L
+            ESP_LOGD(TAG, "start    %02x", rec->Val);
+            opnastart = (opnastart & 0xff00) | rec->Val;
+            nw = true;
+        } else if (rec->Reg == 0x03) { //start H
+            ESP_LOGD(TAG, "start  %02x", rec->Val);
+            opnastart = (((uint16_t)rec->Val)<<8) | (opnastart & 0xff);
+            nw = true;
+        } else if (rec->Reg == 0x04) { //stop L
+            ESP_LOGD(TAG, "stop     %02x", rec->Val);
+            opnastop = (opnastop & 0xff00) | rec->Val;
+            nw = true;
+        } else if (rec->Reg == 0x05) { //stop H
+            ESP_LOGD(TAG, "stop   %02x", rec->Val);
+            opnastop = (((uint16_t)rec->Val)<<8) | (opnastop & 0xff);
+            nw = true;
+        } else if (rec->Reg == 0x00 && rec->Val & 0x80) { //pcm start
+            if (Driver_Opna_AdpcmConfig & 0b00000011) { //if in rom or 8bit dram mode, convert addresses
+                ESP_LOGD(TAG, "converting opna pcm addresses");
+                opnastart_hacked = opnastart * 8;
+                Driver_FmOutopna(1,0x02,opnastart_hacked&0xff);
+                Driver_FmOutopna(1,0x03,opnastart_hacked>>8);
+                opnastop_hacked = opnastop * 8;
+                opnastop_hacked |= 0b00000111;
+                Driver_FmOutopna(1,0x04,opnastop_hacked&0xff);
+                Driver_FmOutopna(1,0x05,opnastop_hacked>>8);
+            } else { //write as-is
+                Driver_FmOutopna(1,0x02,opnastart&0xff);
+                Driver_FmOutopna(1,0x03,opnastart>>8);
+                Driver_FmOutopna(1,0x04,opnastop&0xff);
+                Driver_FmOutopna(1,0x05,opnastop>>8);
             }
+            ChannelMgr_PcmAccu = 127;
+            ChannelMgr_PcmCount = 1;
+        } else if (rec->Reg == 0x0c || rec->Reg == 0x0d) { //limit
+            nw = true;
+        } else if (rec->Reg == 0x0b) { //level
+            rec->Val = FilterAdpcmLevelWrite(rec->Val);
         }
-        if (cmd[1] >= 0xb4 && cmd[1] <= 0xb6) { //pan, FMS, AMS
-            Driver_FmPans[cmd[1]-0xb4] = cmd[2];
-            if ((Driver_MitigateVgmTrim && Driver_FirstWait) || Driver_Slip) cmd[2] &= 0b00111111; //if we haven't reached the first wait, disable both L and R
-            cmd[2] &= (Driver_FmMask & (1<<(cmd[1]-0xb4)))?0b11111111:0b00111111;
-            if (Driver_ForceMono && (cmd[2] & 0b11000000)) cmd[2] |= 0b11000000;
-        }
-        if (cmd[1] == 0x2b && (cmd[2] & 0x80) != Driver_DacEn) {
-            Driver_DacEn = cmd[2] & 0x80; //we shouldn't have to mask off the other bits but who knows what kind of crazy shit games do
-            ESP_LOGD(TAG, "dac mode change %02x", Driver_DacEn);
-            Driver_UpdateCh6Muting();
-        }
-        if ((cmd[1] >= 0x40 && cmd[1] <= 0x42) || (cmd[1] >= 0x48 && cmd[1] <= 0x4a) || (cmd[1] >= 0x44 && cmd[1] <= 0x46) || (cmd[1] >= 0x4c && cmd[1] <= 0x4e)) { //TL
-            ESP_LOGD(TAG, "tl write bank0");
-            cmd[2] = FilterTLWrite(0, cmd[1], cmd[2]);
+    }
+    if (rec->Reg >= 0xb4 && rec->Reg <= 0xb6) { //pan, AMS, PMS
+        //todo vgm_trim mitigation
+        uint8_t i = ((rec->Op == DRIVER_OP_OPNA_1 || rec->Op == DRIVER_OP_OPN)?3:0)+rec->Reg-0xb4;
+        Driver_FmPans[i] = rec->Val;
+        rec->Val &= (Driver_FmMask & (1<<i))?0b11111111:0b00111111;
+        if (Driver_ForceMono && (rec->Val & 0b11000000)) rec->Val |= 0b11000000;
+    } else if (rec->Op == DRIVER_OP_OPNA_0 && rec->Reg >= 0x18 && rec->Reg <= 0x1d) { //rhythm pan/level
+        //todo vgm_trim mitigation
+        uint8_t i = rec->Reg-0x18;
+        Driver_Opna_RhythmConfig[i] = rec->Val;
+        rec->Val &= (Driver_FmMask & (1<<6))?0b11111111:0b00111111;
+        if (Driver_ForceMono && (rec->Val & 0b11000000)) rec->Val |= 0b11000000;
+    } else if (rec->Op != DRIVER_OP_OPNA_1 && rec->Reg == 0x07) { //ssg tone enable
+        //todo vgm_trim mitigation
+        Driver_Opna_SsgConfig = rec->Val;
+        rec->Val = Driver_ProcessSsgControlWrite(rec->Val); //this handles masks
+    } else if (rec->Op == DRIVER_OP_OPNA_0 && rec->Reg == 0x10) { //rhythm
+        if (rec->Val & 0b00111111) {
+            ChannelMgr_PcmAccu = 127;
+            ChannelMgr_PcmCount = 1;
         }
-        if (cmd[1] >= 0xb0 && cmd[1] <= 0xb2) { //algorithm
-            ESP_LOGD(TAG, "algo write bank0");
-            HandleAlgoWrite(0, cmd[1], cmd[2]);
+    } else if (rec->Op == DRIVER_OP_OPNA_0 && rec->Reg == 0x11) { //rhythm TL
+        rec->Val = FilterRhythmTLWrite(rec->Val);
+    } else if (rec->Op != DRIVER_OP_OPNA_1 && rec->Reg >= 0x08 && rec->Reg <= 0x0a) {
+        Driver_Opna_SsgLevel[rec->Reg - 0x08] = rec->Val;
+        
+        //block writes to ssg level registers during mute, to avoid level change pops:
+        if ((Driver_DcsgMask & (1<<(rec->Reg-8))) == 0) nw = true;
+        
+        rec->Val = FilterSsgLevelWrite(rec->Reg, rec->Val);
+    } else if (rec->Op != DRIVER_OP_AY && rec->Reg >= 0xb0 && rec->Reg <= 0xb2) { //algo
+        ESP_LOGD(TAG, "algo write");
+        HandleAlgoWrite((rec->Op == DRIVER_OP_OPNA_1)?1:0, rec->Reg, rec->Val);
+    }
+    if (rec->Op != DRIVER_OP_AY && ((rec->Reg >= 0x40 && rec->Reg <= 0x42) || (rec->Reg >= 0x48 && rec->Reg <= 0x4a) || (rec->Reg >= 0x44 && rec->Reg <= 0x46) || (rec->Reg >= 0x4c && rec->Reg <= 0x4e))) { //TL
+        ESP_LOGD(TAG, "tl write");
+        rec->Val = FilterTLWrite((rec->Op == DRIVER_OP_OPNA_1)?1:0, rec->Reg, rec->Val);
+    }
+    if (!nw) Driver_FmOutopna((rec->Op == DRIVER_OP_OPNA_1)?1:0, rec->Reg, rec->Val);
+    return 1;
+}
+
+static uint8_t Driver_OpOpn2Port0(DriverRecord_t *rec) { //YM2612 port 0
+    if (Driver_DetectedMod == MEGAMOD_OPNA) { //opn2 write when opna mod detected
+        if (!opn2_on_opna_mode) { //insert a command to enable 6ch mode, and enable opn2_on_opna_mode
+            ESP_LOGW(TAG, "Playing OPN2 tune on OPNA hardware");
+            Driver_FmOut(0, 0x29, 0x80);
+            opn2_on_opna_mode = true;
+        } else if (rec->Reg == 0x29) { //mask on the 6ch bit for any writes to this reg, should they exist in the vgm
+            rec->Val |= 0x80;
         }
-        Driver_FmOut(0, cmd[1], cmd[2]);
-    } else if (cmd[0] == 0x53) { //YM2612 port 1
-        if (cmd[1] >= 0xb4 && cmd[1] <= 0xb6) { //pan, FMS, AMS
-            Driver_FmPans[3+cmd[1]-0xb4] = cmd[2];
-            if (cmd[1] == 0xb6) { //ch6, we need to check if it's in dac mode or not
-                if (Driver_DacEn) {
-                    cmd[2] &= (Driver_FmMask & (1<<6))?0b11111111:0b00111111;
-                } else {
-                    cmd[2] &= (Driver_FmMask & (1<<5))?0b11111111:0b00111111;
-                }
-            } else { //otherwise apply muting masks as normal
-                cmd[2] &= (Driver_FmMask & (1<<(3+(cmd[1]-0xb4))))?0b11111111:0b00111111;
+    }
+    if (rec->Reg >= 0xb4 && rec->Reg <= 0xb6) { //pan, FMS, AMS
+        Driver_FmPans[rec->Reg-0xb4] = rec->Val;
+        if ((Driver_MitigateVgmTrim && Driver_FirstWait) || Driver_Slip) rec->Val &= 0b00111111; //if we haven't reached the first wait, disable both L and R
+        rec->Val &= (Driver_FmMask & (1<<(rec->Reg-0xb4)))?0b11111111:0b00111111;
+        if (Driver_ForceMono && (rec->Val & 0b11000000)) rec->Val |= 0b11000000;
+    }
+    if (rec->Reg == 0x2b && (rec->Val & 0x80) != Driver_DacEn) {
+        Driver_DacEn = rec->Val & 0x80; //we shouldn't have to mask off the other bits but who knows what kind of crazy shit games do
+        ESP_LOGD(TAG, "dac mode change %02x", Driver_DacEn);
+        Driver_UpdateCh6Muting();
+    }
+    if ((rec->Reg >= 0x40 && rec->Reg <= 0x42) || (rec->Reg >= 0x48 && rec->Reg <= 0x4a) || (rec->Reg >= 0x44 && rec->Reg <= 0x46) || (rec->Reg >= 0x4c && rec->Reg <= 0x4e)) { //TL
+        ESP_LOGD(TAG, "tl write bank0");
+        rec->Val = FilterTLWrite(0, rec->Reg, rec->Val);
+    }
+    if (rec->Reg >= 0xb0 && rec->Reg <= 0xb2) { //algorithm
+        ESP_LOGD(TAG, "algo write bank0");
+        HandleAlgoWrite(0, rec->Reg, rec->Val);
+    }
+    Driver_FmOut(0, rec->Reg, rec->Val);
+    return 1;
+}
+
+static uint8_t Driver_OpOpn2Port1(DriverRecord_t *rec) { //YM2612 port 1
+    if (rec->Reg >= 0xb4 && rec->Reg <= 0xb6) { //pan, FMS, AMS
+        Driver_FmPans[3+rec->Reg-0xb4] = rec->Val;
+        if (rec->Reg == 0xb6) { //ch6, we need to check if it's in dac mode or not
+            if (Driver_DacEn) {
+                rec->Val &= (Driver_FmMask & (1<<6))?0b11111111:0b00111111;
+            } else {
+                rec->Val &= (Driver_FmMask & (1<<5))?0b11111111:0b00111111;
             }
-            if ((Driver_MitigateVgmTrim && Driver_FirstWait) || Driver_Slip) cmd[2] &= 0b00111111; //if we haven't reached the first wait, disable both L and R. do this after the muting logic
-            if (Driver_ForceMono && (cmd[2] & 0b11000000)) cmd[2] |= 0b11000000;
-        }
-        if ((cmd[1] >= 0x40 && cmd[1] <= 0x42) || (cmd[1] >= 0x48 && cmd[1] <= 0x4a) || (cmd[1] >= 0x44 && cmd[1] <= 0x46) || (cmd[1] >= 0x4c && cmd[1] <= 0x4e)) { //TL
-            ESP_LOGD(TAG, "tl write bank1");
-            cmd[2] = FilterTLWrite(1, cmd[1], cmd[2]);
+        } else { //otherwise apply muting masks as normal
+            rec->Val &= (Driver_FmMask & (1<<(3+(rec->Reg-0xb4))))?0b11111111:0b00111111;
         }
-        if (cmd[1] >= 0xb0 && cmd[1] <= 0xb2) { //algorithm
-            ESP_LOGD(TAG, "algo write bank1");
-            HandleAlgoWrite(1, cmd[1], cmd[2]);
+        if ((Driver_MitigateVgmTrim && Driver_FirstWait) || Driver_Slip) rec->Val &= 0b00111111; //if we haven't reached the first wait, disable both L and R. do this after the muting logic
+        if (Driver_ForceMono && (rec->Val & 0b11000000)) rec->Val |= 0b11000000;
+    }
+    if ((rec->Reg >= 0x40 && rec->Reg <= 0x42) || (rec->Reg >= 0x48 && rec->Reg <= 0x4a) || (rec->Reg >= 0x44 && rec->Reg <= 0x46) || (rec->Reg >= 0x4c && rec->Reg <= 0x4e)) { //TL
+        ESP_LOGD(TAG, "tl write bank1");
+        rec->Val = FilterTLWrite(1, rec->Reg, rec->Val);
+    }
+    if (rec->Reg >= 0xb0 && rec->Reg <= 0xb2) { //algorithm
+        ESP_LOGD(TAG, "algo write bank1");
+        HandleAlgoWrite(1, rec->Reg, rec->Val);
+    }
+    Driver_FmOut(1, rec->Reg, rec->Val);
+    return 1;
+}
+
+static uint8_t Driver_OpOpn2Dac(DriverRecord_t *rec) { //YM2612 DAC + wait. loader has already looked up the sample
+    Driver_FmOut(0, 0x2a, rec->Val);
+    Driver_NextSample += rec->Arg;
+    if (Driver_FirstWait && rec->Arg > 0) {
+        Driver_SetFirstWait();
+    }
+    return 1;
+}
+
+static uint8_t Driver_OpDsStart(DriverRecord_t *rec) { //dac stream start. a new start on a stream id replaces whatever that id was playing
+    DacStreamSeq++;
+    DriverDsVoice_t *v = Driver_DsVoice(rec->Reg);
+    if (v == NULL) { //first start on this id. take a voice nothing is playing on, or failing that the one started longest ago
+        v = &Driver_DsVoices[0];
+        for (uint8_t i=0;i<DACSTREAM_STREAMS;i++) {
+            DriverDsVoice_t *c = &Driver_DsVoices[i];
+            if (!c->Active && v->Active) {
+                v = c;
+            } else if (c->Active == v->Active && c->Seq < v->Seq) {
+                v = c;
+            }
         }
-        Driver_FmOut(1, cmd[1], cmd[2]);
-    } else if (cmd[0] == 0x61) { //16bit wait
-        _Pragma("GCC diagnostic push")
-        _Pragma("GCC diagnostic ignored \"-Wstrict-aliasing\"")
-        Driver_NextSample += *(uint16_t*)&cmd[1];
-        if (Driver_FirstWait && *(uint16_t*)&cmd[1] > 0) {
-            Driver_SetFirstWait();
+        if (v->Active) ESP_LOGW(TAG, "More than %d dacstreams at once, stream id %d cut off", DACSTREAM_STREAMS, v->StreamId);
+        v->StreamId = rec->Reg;
+    }
+    v->Active = false;
+    //slots are all started in seq order, so anything older that no voice is still playing is finished with. including any whose start we missed
+    for (uint8_t i=0;i<DACSTREAM_PRE_COUNT;i++) {
+        if (!DacStreamEntries[i].SlotFree && DacStreamEntries[i].Seq < DacStreamSeq && !Driver_DsSlotPlaying(i)) {
+            __atomic_store_n(&DacStreamEntries[i].SlotFree, true, __ATOMIC_RELEASE); //after the last read of its shared sample, which the find task may now evict
         }
-        _Pragma("GCC diagnostic pop")
-    } else if (cmd[0] == 0x62) { //60Hz wait
-        Driver_NextSample += 735;
-        if (Driver_FirstWait) Driver_SetFirstWait();
-    } else if (cmd[0] == 0x63) { //50Hz wait
-        Driver_NextSample += 882;
-        if (Driver_FirstWait) Driver_SetFirstWait();
-    } else if ((cmd[0] & 0xf0) == 0x70) { //4bit wait
-        Driver_NextSample += (cmd[0] & 0x0f) + 1;
-        if (Driver_FirstWait) Driver_SetFirstWait();
-    } else if ((cmd[0] & 0xf0) == 0x80) { //YM2612 DAC + wait
-        uint8_t sample;
-        MegaStream_Recv(&Driver_PcmStream, &sample, 1);
-        Driver_FmOut(0, 0x2a, sample);
-        Driver_NextSample += cmd[0] & 0x0f;
-        if (Driver_FirstWait && (cmd[0] & 0x0f) > 0) {
-            Driver_SetFirstWait();
+    }
+    uint8_t id;
+    id = Driver_SeqToSlot(DacStreamSeq);
+    if (id == 0xff) {
+        ESP_LOGW(TAG, "DacStreamEntries under !!");
+    } else {
+        volatile DacStreamEntry_t *e = &DacStreamEntries[id];
+        v->Slot = id;
+        v->Seq = DacStreamSeq;
+        v->SampleRate = e->SampleRate;
+        v->Device = (Driver_DetectedMod == MEGAMOD_2XOPN && (e->ChipType & 0x80))?1:0;
+        v->Port = e->ChipPort;
+        v->Command = e->ChipCommand;
+        v->Played = 0;
+        v->Cycle = 0;
+        v->Failed = false;
+        v->LengthMode = e->LengthMode;
+        v->DataLength = e->DataLength;
+        v->Shared = e->Sample;
+        ESP_LOGD(TAG, "playing %d on id %d q size %d rate %d LM %d len %d", DacStreamSeq, v->StreamId, MegaStream_Used((MegaStreamContext_t *)&e->Stream), v->SampleRate, v->LengthMode, v->DataLength);
+        v->Active = true;
+    }
+    return 1;
+}
+
+static uint8_t Driver_OpDsStop(DriverRecord_t *rec) { //dac stream stop. id 0xff stops all of them
+    for (uint8_t i=0;i<DACSTREAM_STREAMS;i++) {
+        if (rec->Reg == 0xff || Driver_DsVoices[i].StreamId == rec->Reg) Driver_DsVoices[i].Active = false;
+    }
+    return 1;
+}
+
+static uint8_t Driver_OpDsRate(DriverRecord_t *rec) { //set sample rate. the rate itself is in the next record
+    DriverDsVoice_t *v = Driver_DsVoice(rec->Reg);
+    if (v && v->Active) {
+        uint8_t *r = (uint8_t *)&rec[1];
+        v->SampleRate = r[0] | ((uint32_t)r[1]<<8) | ((uint32_t)r[2]<<16) | ((uint32_t)r[3]<<24);
+        ESP_LOGD(TAG, "Dacstream %d samplerate updated to %d", v->StreamId, v->SampleRate);
+        if (v->SampleRate) v->Cycle = (uint64_t)v->Played*(DRIVER_CLOCK_RATE/v->SampleRate); //carry on from where it is at the new rate
+    } else {
+        ESP_LOGD(TAG, "Not updating dacstream samplerate, not playing");
+    }
+    return 2;
+}
+
+static uint8_t Driver_OpEnd(DriverRecord_t *rec) { //end of music (loop point)
+    ESP_LOGD(TAG, "reached end of music / loop point");
+    if (FadeActive) {
+        ESP_LOGD(TAG, "in fadeout period, not doing anything");
+    } else {
+        if (Loader_VgmInfo->LoopOffset == 0 || (Loader_IgnoreZeroSampleLoops && Loader_VgmInfo->LoopSamples == 0)) { //there is no loop point at all
+            ESP_LOGI(TAG, "no loop point");
+            Stop();
         }
-    } else if (cmd[0] == 0x93 || cmd[0] == 0x95) { //dac stream start
-        DacStreamSeq++;
-        if (DacStreamLastSeqPlayed > 0) {
-            for (uint32_t s=DacStreamLastSeqPlayed;s<DacStreamSeq;s++) {
-                uint8_t id = Driver_SeqToSlot(s);
-                if (id != 0xff) {
-                    DacStreamEntries[id].SlotFree = true;
-                }
+        if (Player_LoopCount != 255 && ++Driver_CurLoop >= Player_LoopCount) {
+            if (Driver_FadeEnabled) {
+                ESP_LOGD(TAG, "looped enough, starting fadeout");
+                StartFade();
+            } else {
+                ESP_LOGI(TAG, "Fading not enabled, just stopping");
+                Stop();
             }
         }
-        uint8_t id;
-        id = Driver_SeqToSlot(DacStreamSeq);
-        if (id == 0xff) {
-            ESP_LOGW(TAG, "DacStreamEntries under !!");
-        } else {
-            DacStreamId = id;
-            DacStreamSampleRate = DacStreamEntries[DacStreamId].SampleRate;
-            DacStreamPort = DacStreamEntries[DacStreamId].ChipPort;
-            DacStreamCommand = DacStreamEntries[DacStreamId].ChipCommand;
-            DacStreamLastSeqPlayed = DacStreamSeq;
-            DacStreamSamplesPlayed = 0;
-            Driver_Cycle_Ds = 0;
-            DacStreamLengthMode = DacStreamEntries[DacStreamId].LengthMode;
-            DacStreamDataLength = DacStreamEntries[DacStreamId].DataLength;
-            ESP_LOGD(TAG, "playing %d q size %d rate %d LM %d len %d", DacStreamSeq, MegaStream_Used((MegaStreamContext_t *)&DacStreamEntries[DacStreamId].Stream), DacStreamSampleRate, DacStreamLengthMode, DacStreamDataLength);
-            DacStreamActive = true;
-        }
-    } else if (cmd[0] == 0x94) { //dac stream stop
-        DacStreamActive = false;
-    } else if (cmd[0] == 0x92) { //set sample rate
-        if (DacStreamActive) {
-            _Pragma("GCC diagnostic push")
-            _Pragma("GCC diagnostic ignored \"-Wstrict-aliasing\"")
-            DacStreamSampleRate = *(uint32_t*)&cmd[2];
-            _Pragma("GCC diagnostic pop")
-            ESP_LOGD(TAG, "Dacstream samplerate updated to %d", DacStreamSampleRate);
-            //TODO: handle the math for updating the current sample number, if sample rate changes mid-stream
-        } else {
-            ESP_LOGD(TAG, "Not updating dacstream samplerate, not playing");
+        if (!Loader_IgnoreZeroSampleLoops || Loader_VgmInfo->LoopSamples > 0) {
+            ESP_LOGD(TAG, "looping");
+            if (Loader_VgmInfo->LoopSamples == 0) ESP_LOGW(TAG, "looping despite LoopSamples == 0 !!");
         }
-    } else if (cmd[0] == 0x90 || cmd[0] == 0x91) { //dacstream commands we don't need to worry about here
-
-    } else if (cmd[0] == 0x4f) { //gamegear dcsg stereo
-        ESP_LOGD(TAG, "Game Gear DCSG stereo not implemented !!");
-    } else if (cmd[0] == 0xb1) {
-        //RF5C164 write, just ignore it...
-    } else if (cmd[0] == 0xb2) {
-        if (cmd[1] & 0b11000000) ESP_LOGW(TAG, "Unsupported 32x pwm reg write %d !!", cmd[1]>>4);
-    } else if (cmd[0] == 0xc2) {
-        //RF5C164 RAM write, just ignore it...
-    } else if (cmd[0] == 0x66) { //end of music (loop point)
-        ESP_LOGD(TAG, "reached end of music / loop point");
-        if (FadeActive) {
-            ESP_LOGD(TAG, "in fadeout period, not doing anything");
-        } else {
-            if (Loader_VgmInfo->LoopOffset == 0 || (Loader_IgnoreZeroSampleLoops && Loader_VgmInfo->LoopSamples == 0)) { //there is no loop point at all
-                ESP_LOGI(TAG, "no loop point");
-                Stop();
+    }
+    return 1;
+}
+
+static uint8_t Driver_OpBadFlags(DriverRecord_t *rec) { //receiving bad flags
+    if (rec->Reg & PLAYER_BADVGM_OPN2_TESTREG) Driver_BlockOpn2TestReg = true;
+    return 1;
+}
+
+static uint8_t Driver_OpNop(DriverRecord_t *rec) {
+    return 1;
+}
+
+static const Driver_OpHandler_t Driver_OpHandlers[DRIVER_OP_COUNT] = {
+    [DRIVER_OP_WAIT] = Driver_OpWait,
+    [DRIVER_OP_DCSG] = Driver_OpDcsg,
+    [DRIVER_OP_OPN2_0] = Driver_OpOpn2Port0,
+    [DRIVER_OP_OPN2_1] = Driver_OpOpn2Port1,
+    [DRIVER_OP_OPN2_DAC] = Driver_OpOpn2Dac,
+    [DRIVER_OP_OPLL] = Driver_OpOpll,
+    [DRIVER_OP_OPM] = Driver_OpOpm,
+    [DRIVER_OP_OPL3_0] = Driver_OpOpl3,
+    [DRIVER_OP_OPL3_1] = Driver_OpOpl3,
+    [DRIVER_OP_OPN] = Driver_OpOpn,
+    [DRIVER_OP_OPN_2] = Driver_OpOpn,
+    [DRIVER_OP_OPNA_0] = Driver_OpOpn,
+    [DRIVER_OP_OPNA_1] = Driver_OpOpn,
+    [DRIVER_OP_AY] = Driver_OpOpn,
+    [DRIVER_OP_DS_START] = Driver_OpDsStart,
+    [DRIVER_OP_DS_STOP] = Driver_OpDsStop,
+    [DRIVER_OP_DS_RATE] = Driver_OpDsRate,
+    [DRIVER_OP_END] = Driver_OpEnd,
+    [DRIVER_OP_BADFLAGS] = Driver_OpBadFlags,
+    [DRIVER_OP_NOP] = Driver_OpNop,
+};
+
+static void Driver_DsTick(DriverDsVoice_t *v, uint64_t diff) { //play this stream's next sample if it's due
+    //todo: gracefully handle the end of a stream
+    //can't just go by bytes played because some play modes are based on time
+    //decide whether those are worth implementing
+    volatile DacStreamEntry_t *e = &DacStreamEntries[v->Slot];
+    bool avail = v->Shared?(v->Played < __atomic_load_n(&v->Shared->Filled, __ATOMIC_ACQUIRE)):(MegaStream_Used((MegaStreamContext_t *)&e->Stream) != 0);
+    if (avail) {
+        v->Cycle += diff;
+        if (v->SampleRate && v->Cycle / (DRIVER_CLOCK_RATE/v->SampleRate) > v->Played) {
+            uint8_t sample;
+            if (v->Shared) {
+                sample = v->Shared->Data[v->Played];
+            } else {
+                MegaStream_Recv((MegaStreamContext_t *)&e->Stream, &sample, 1);
             }
-            if (Player_LoopCount != 255 && ++Driver_CurLoop >= Player_LoopCount) {
-                if (Driver_FadeEnabled) {
-                    ESP_LOGD(TAG, "looped enough, starting fadeout");
-                    StartFade();
-                } else {
-                    ESP_LOGI(TAG, "Fading not enabled, just stopping");
-                    Stop();
+            if (Driver_DetectedMod == MEGAMOD_NONE) {
+                Driver_FmOut(v->Port, v->Command, sample);
+            } else if (Driver_DetectedMod == MEGAMOD_OPNA) {
+                Driver_FmOutopna(v->Port, v->Command, sample);
+            } else if (Driver_DetectedMod == MEGAMOD_2XOPN) {
+                Driver_FmOutopn(v->Device, v->Command, sample);
+            }
+            v->Played++;
+            e->Played = v->Played;
+            if (v->Played == v->DataLength && (v->LengthMode == 0 || v->LengthMode == 1 || v->LengthMode == 3)) {
+                v->Active = false;
+                if (Driver_Slip & (1<<1)) {
+                    Driver_Slip &= ~(1<<1);
+                    Driver_UpdateMuting();
                 }
             }
-            if (!Loader_IgnoreZeroSampleLoops || Loader_VgmInfo->LoopSamples > 0) {
-                ESP_LOGD(TAG, "looping");
-                if (Loader_VgmInfo->LoopSamples == 0) ESP_LOGW(TAG, "looping despite LoopSamples == 0 !!");
+            v->Failed = false;
+        } else {
+            if (Driver_Slip & (1<<1)) {
+                Driver_Slip &= ~(1<<1);
+                Driver_UpdateMuting();
             }
         }
-    } else if (cmd[0] == 0x31) {
-        //ignore AY-3-8910 stereo mask
-    } else if (cmd[0] == 0x30) {
-        //ignore dcsg no.2
-    } else if (cmd[0] == 0xb7) {
-        //ignore msm6258
-    } else if (cmd[0] == 0xb8) {
-        //ignore msm6295
-    } else if (cmd[0] == 0xd2) {
-        //ignore scc
-    } else if (cmd[0] == 0xff) { //receiving bad flags
-        if (cmd[1] & PLAYER_BADVGM_OPN2_TESTREG) Driver_BlockOpn2TestReg = true;
     } else {
-        ESP_LOGE(TAG, "driver unknown command %02x !!", cmd[0]);
-        return false;
+        if (!v->Failed) {
+            ESP_LOGW(TAG, "DacStream sample queue under !! id %d pos %d length %d", v->StreamId, v->Played, v->DataLength);
+            e->Underruns++;
+            v->Failed = true;
+        }
+        if (Driver_Slip & (1<<1)) {
+            Driver_Slip &= ~(1<<1);
+            Driver_UpdateMuting();
+        }
     }
-    return true;
+}
+
+static uint32_t Driver_CyclesUntilDue() { //real cpu cycles until the next command or dacstream sample is due
+    uint64_t due = (uint64_t)Driver_NextSample*DRIVER_CYCLES_PER_SAMPLE;
+    uint64_t wait = (due > Driver_Cycle)?(due - Driver_Cycle):0;
+    for (uint8_t i=0;i<DACSTREAM_STREAMS;i++) {
+        DriverDsVoice_t *v = &Driver_DsVoices[i];
+        if (!v->Active || !v->SampleRate) continue;
+        if (v->Failed) return 0; //starved, keep polling for it to refill
+        uint64_t dsdue = (uint64_t)(v->Played+1)*(DRIVER_CLOCK_RATE/v->SampleRate);
+        uint64_t dswait = (dsdue > v->Cycle)?(dsdue - v->Cycle):0;
+        if (dswait < wait) wait = dswait;
+    }
+    //playback cycles run at 1000+mult per 1000 real ones
+    wait = wait*1000/(1000 + Driver_SpeedMult);
+    return (wait > 0xffffffff)?0xffffffff:wait;
 }
 
 IRAM_ATTR uint32_t Driver_BusyStart = 0;
 //uint32_t Driver_BusyEnd = 0;
 void Driver_Main() {
-    //driver task. never pet watchdog or come up for air at all - nothing else is running on CPU1.
+    //driver task. never pet watchdog - nothing else is running on CPU1. only comes up for air in Driver_Snooze when nothing is due for a while
     ESP_LOGI(TAG, "Task start");
     while (1) {
         Driver_Cc = xthal_get_ccount();
@@ -1374,7 +1789,7 @@ void Driver_Main() {
             Driver_ICycle = 0;
             Driver_LastCc = Driver_Cc;
             Driver_NextSample = 0;
-            DacStreamActive = false;
+            Driver_DsReset();
             DacStreamSeq = 0;
             FadeActive = false;
             FadePos = 0;
@@ -1421,6 +1836,8 @@ void Driver_Main() {
                 ChannelMgr_States[i] = 0;
             }
             Driver_Sample = 0;
+            Driver_CommandUnderruns = 0;
+            Driver_WritesSaved = 0;
             opn2_on_opna_mode = false;
             xEventGroupClearBits(Driver_CommandEvents, DRIVER_EVENT_FINISHED);
             xEventGroupClearBits(Driver_CommandEvents, DRIVER_EVENT_RESET_REQUEST);
@@ -1429,7 +1846,6 @@ void Driver_Main() {
             commandeventbits |= DRIVER_EVENT_RESET_ACK;
         } else if (commandeventbits & DRIVER_EVENT_STOP_REQUEST) {
             Driver_PauseSample = Driver_Sample;
-            Driver_PauseSample_Ds = Driver_Sample_Ds;
             Driver_NoLeds = true;
             if (Driver_DetectedMod == MEGAMOD_NONE) {
                 Driver_FmOut(0, 0xb4, Driver_FmPans[0] & 0b00111111);
@@ -1466,7 +1882,6 @@ void Driver_Main() {
             Driver_NoLeds = false;
             Driver_Cc = Driver_LastCc = xthal_get_ccount();
             Driver_Sample = Driver_PauseSample;
-            Driver_Sample_Ds = Driver_PauseSample_Ds;
             xEventGroupSetBits(Driver_CommandEvents, DRIVER_EVENT_RUNNING);
             xEventGroupClearBits(Driver_CommandEvents, DRIVER_EVENT_RESUME_REQUEST);
             commandeventbits &= ~DRIVER_EVENT_RESUME_REQUEST;
@@ -1474,9 +1889,9 @@ void Driver_Main() {
         } else if (commandeventbits & DRIVER_EVENT_FASTFORWARD) {
             if (!Driver_Slip) {
                 Driver_Cycle += DRIVER_CLOCK_RATE*2;
-                Driver_Cycle_Ds += DRIVER_CLOCK_RATE*2;
+                for (uint8_t i=0;i<DACSTREAM_STREAMS;i++) Driver_DsVoices[i].Cycle += DRIVER_CLOCK_RATE*2;
                 Driver_Slip = (1<<0);
-                if (DacStreamActive) Driver_Slip |= (1<<1);
+                if (Driver_DsAnyActive()) Driver_Slip |= (1<<1);
                 Driver_UpdateMuting();
             }
             xEventGroupClearBits(Driver_CommandEvents, DRIVER_EVENT_FASTFORWARD);
@@ -1511,6 +1926,7 @@ void Driver_Main() {
                 Driver_BusyStart = xthal_get_ccount();
                 uint32_t waiting = MegaStream_Used(&Driver_CommandStream);
                 if (waiting > 0) { //is any data available?
+                    Driver_Starved = false;
                     //update half-empty event bit
                     if ((queueeventbits & DRIVER_EVENT_COMMAND_HALF) == 0 && waiting <= DRIVER_QUEUE_SIZE/2) {
                         xEventGroupSetBits(Driver_StreamEvents, DRIVER_EVENT_COMMAND_HALF);
@@ -1520,32 +1936,35 @@ void Driver_Main() {
                         queueeventbits &= ~DRIVER_EVENT_COMMAND_HALF;
                     }
 
-                    uint8_t peeked = MegaStream_Peek(&Driver_CommandStream);
-                    uint8_t cmdlen = VgmCommandLength(peeked); //look up the length of this command + attached data
-                    if (waiting >= cmdlen) { //if the entire command + data is in the stream
-                        bool ret = Driver_RunCommand(cmdlen);
-                        if (!ret) {
-                            printf("ERR command run fail");
-                            fflush(stdout);
-                            /*xEventGroupSetBits(Driver_CommandEvents, DRIVER_EVENT_ERROR);
-                            commandeventbits |= DRIVER_EVENT_ERROR;*/
-                        }
-                    } else { //not enough data in stream - underrun
-                        xEventGroupSetBits(Driver_StreamEvents, DRIVER_EVENT_COMMAND_UNDERRUN);
-                        queueeventbits |= DRIVER_EVENT_COMMAND_UNDERRUN;
-                        printf("UNDER data\n");
-                        fflush(stdout);
+                    //drain every record that's due right now in one go, instead of one per pass of the main loop
+                    //records never straddle the wraparound, so if we hit the end of the span just pick the rest up next time around
+                    DriverRecord_t *rec;
+                    size_t span = MegaStream_PeekSpan(&Driver_CommandStream, (uint8_t **)&rec)/sizeof(DriverRecord_t);
+                    size_t ran = 0;
+                    uint8_t batch = 0;
+                    Driver_BusBegin(); //everything due at this timestamp goes out in one flush
+                    while (1) {
+                        uint8_t op = rec[ran].Op;
+                        ran += Driver_OpHandlers[op](&rec[ran]);
+                        //stop at the next wait, at end of data (might have stopped playback), or after a burst long enough to start starving the dacstream
+                        if (op == DRIVER_OP_END || ran >= span || Driver_Sample < Driver_NextSample || ++batch == DRIVER_BATCH_MAX) break;
                     }
+                    Driver_BusEnd();
+                    MegaStream_Consume(&Driver_CommandStream, ran*sizeof(DriverRecord_t));
                 } else { //no data at all in stream - underrun
                     xEventGroupSetBits(Driver_StreamEvents, DRIVER_EVENT_COMMAND_UNDERRUN);
                     queueeventbits |= DRIVER_EVENT_COMMAND_UNDERRUN;
+                    if (!Driver_Starved) {
+                        Driver_CommandUnderruns++;
+                        Driver_Starved = true;
+                    }
                     printf("UNDER none\n");
                     fflush(stdout);
                 }
                 Driver_CpuUsageVgm += (xthal_get_ccount() - Driver_BusyStart);
             } else {
                 //not time for next sample yet
-                if (Driver_NextSample - Driver_Sample > 2000 && !DacStreamActive) vTaskDelay(2);
+                Driver_Snooze(Driver_CyclesUntilDue());
                 if (Driver_Slip & (1<<0)) {
                     Driver_Slip &= ~(1<<0);
                     Driver_UpdateMuting();
@@ -1553,57 +1972,19 @@ void Driver_Main() {
             }
 
             //dacstream stuff
-            if (DacStreamActive) {
-                //todo: gracefully handle the end of a stream
-                //can't just go by bytes played because some play modes are based on time
-                //decide whether those are worth implementing
-                Driver_BusyStart = xthal_get_ccount();
-                if (MegaStream_Used((MegaStreamContext_t *)&DacStreamEntries[DacStreamId].Stream)) {
-                    Driver_Cycle_Ds += diff;
-                    Driver_Sample_Ds = Driver_Cycle_Ds / (DRIVER_CLOCK_RATE/DacStreamSampleRate);
-                    if (Driver_Sample_Ds > DacStreamSamplesPlayed) {
-                        uint8_t sample;
-                        MegaStream_Recv((MegaStreamContext_t *)&DacStreamEntries[DacStreamId].Stream, &sample, 1);
-                        if (Driver_DetectedMod == MEGAMOD_NONE) {
-                            Driver_FmOut(DacStreamPort, DacStreamCommand, sample);
-                        } else if (Driver_DetectedMod == MEGAMOD_OPNA) {
-                            Driver_FmOutopna(DacStreamPort, DacStreamCommand, sample);
-                        } else if (Driver_DetectedMod == MEGAMOD_2XOPN) {
-                            //TODO handle second chip
-                            Driver_FmOutopn(DacStreamPort, DacStreamCommand, sample);
-                        }
-                        DacStreamSamplesPlayed++;
-                        if (DacStreamSamplesPlayed == DacStreamDataLength && (DacStreamLengthMode == 0 || DacStreamLengthMode == 1 || DacStreamLengthMode == 3)) {
-                            DacStreamActive = false;
-                            if (Driver_Slip & (1<<1)) {
-                                Driver_Slip &= ~(1<<1);
-                                Driver_UpdateMuting();
-                            }
-                        }
-                        DacStreamFailed = false;
-                    } else {
-                        if (Driver_Slip & (1<<1)) {
-                            Driver_Slip &= ~(1<<1);
-                            Driver_UpdateMuting();
-                        }
-                    }
-                } else {
-                    if (!DacStreamFailed) {
-                        ESP_LOGW(TAG, "DacStream sample queue under !! pos %d length %d", DacStreamSamplesPlayed, DacStreamDataLength);
-                        DacStreamFailed = true;
-                    }
-                    //DacStreamActive = false;
-                    if (Driver_Slip & (1<<1)) {
-                        Driver_Slip &= ~(1<<1);
-                        Driver_UpdateMuting();
-                    }
-                }
-                Driver_CpuUsageDs += (xthal_get_ccount() - Driver_BusyStart);
+            //every stream gets at most one sample per pass, so a fast one can't hold up the rest
+            Driver_BusyStart = xthal_get_ccount();
+            bool dsany = false;
+            for (uint8_t i=0;i<DACSTREAM_STREAMS;i++) {
+                if (!Driver_DsVoices[i].Active) continue;
+                Driver_DsTick(&Driver_DsVoices[i], diff);
+                dsany = true;
             }
+            if (dsany) Driver_CpuUsageDs += (xthal_get_ccount() - Driver_BusyStart);
         } else { //not running
             if (Driver_Opna_PcmUpload) { //loader trying to upload a pcm datablock
                 if (Driver_Opna_PcmUploadFile) {
-                    fseek(Driver_Opna_PcmUploadFile,Loader_VgmDataBlocks[Driver_Opna_PcmUploadId].Offset,SEEK_SET);
+                    uint32_t fileoff = Loader_VgmDataBlocks[Driver_Opna_PcmUploadId].Offset;
                     uint32_t pcmoff = Loader_VgmDataBlocks[Driver_Opna_PcmUploadId].StartAddress;
                     uint32_t pcmsize = Loader_VgmDataBlocks[Driver_Opna_PcmUploadId].Size-8;
 
@@ -1619,14 +2000,20 @@ void Driver_Main() {
                     Driver_FmOutopna(1,0x00,0x60);          //ADPCM reg0 REC | MEMDATA
                     //no need to set adpcm reg1 at this point, it should be zeroed from the reset
                     Driver_Opna_PrepareUpload();
+                    Driver_BusBegin();
+                    uint8_t chunk[64]; //the file is shared and unbuffered, so don't go to it for every byte
+                    uint8_t chunkpos = sizeof(chunk);
                     for (uint32_t i=0;i<pcmsize;i++) {
-                        uint8_t b;
-                        fread(&b, 1, 1, Driver_Opna_PcmUploadFile);
-                        Driver_Opna_UploadByte(b);
+                        if (chunkpos == sizeof(chunk)) {
+                            TrackFile_Read(Driver_Opna_PcmUploadFile, fileoff+i, chunk, (pcmsize-i < sizeof(chunk))?(pcmsize-i):sizeof(chunk)); //not past the block, a streamed vgz may not have anything there yet
+                            chunkpos = 0;
+                        }
+                        Driver_Opna_UploadByte(chunk[chunkpos++]);
                         for (uint8_t j=0;j<=map(i,0,pcmsize,0,6);j++) {
                             ChannelMgr_States[j] |= CHSTATE_PARAM | CHSTATE_KON | CHSTATE_KON_PS;
                         }
                     }
+                    Driver_BusEnd();
                     for (uint8_t j=0;j<6;j++) {
                         ChannelMgr_States[j] = 0;
                     }
@@ -9,6 +9,7 @@
 #include "freertos/event_groups.h"
 #include "mallocs.h"
 #include "megastream.h"
+#include "trackfile.h"
 
 //#define OPLLDCSG_ORIGINAL_PROTO //natalie's original OPLL+DCSG prototype megamod has a different bus bit arrangement...
 
@@ -40,19 +41,53 @@ typedef enum {
 #define DRIVER_EVENT_PCM_UNDERRUN           0x02 //status flag - this should never ever happen, this should throw up a big error if it is ever set
 #define DRIVER_EVENT_COMMAND_HALF           0x04 //status flag
 
+//the loader does all of the vgm parsing and sends the driver fixed-size records, so the driver only has to dispatch on Op
+//DRIVER_QUEUE_SIZE is a multiple of the record size, so records never straddle the command stream's wraparound
+typedef enum {
+    DRIVER_OP_WAIT = 0,     //Reg | Val<<8 | Arg<<16 = samples to wait
+    DRIVER_OP_DCSG,         //Val
+    DRIVER_OP_OPN2_0,       //Reg, Val
+    DRIVER_OP_OPN2_1,
+    DRIVER_OP_OPN2_DAC,     //Val = sample, Arg = samples to wait after
+    DRIVER_OP_OPLL,
+    DRIVER_OP_OPM,
+    DRIVER_OP_OPL3_0,       //ymf262 port 0, ym3812, ym3526
+    DRIVER_OP_OPL3_1,
+    DRIVER_OP_OPN,
+    DRIVER_OP_OPN_2,        //second ym2203
+    DRIVER_OP_OPNA_0,
+    DRIVER_OP_OPNA_1,
+    DRIVER_OP_AY,
+    DRIVER_OP_DS_START,     //Reg = stream id
+    DRIVER_OP_DS_STOP,      //Reg = stream id
+    DRIVER_OP_DS_RATE,      //Reg = stream id, next record is the raw 32bit rate
+    DRIVER_OP_END,          //end of data or loop point
+    DRIVER_OP_BADFLAGS,     //Reg = PLAYER_BADVGM_* flags
+    DRIVER_OP_NOP,          //padding, so a DS_RATE never gets split from its payload by the wraparound
+    DRIVER_OP_COUNT
+} DriverOp_t;
+
+typedef struct {
+    uint8_t Op;
+    uint8_t Reg;
+    uint8_t Val;
+    uint8_t Arg;
+} DriverRecord_t;
+
 extern uint8_t *Driver_CommandStreamBuf;
 extern uint8_t Driver_PcmBuf[DACSTREAM_BUF_SIZE*DACSTREAM_PRE_COUNT];
 
 extern volatile MegaMod_t Driver_DetectedMod;
 
 extern MegaStreamContext_t Driver_CommandStream;
-extern MegaStreamContext_t Driver_PcmStream;
 extern EventGroupHandle_t Driver_CommandEvents;
 extern EventGroupHandle_t Driver_StreamEvents;
-extern uint8_t DacStreamId;
+extern IRAM_ATTR uint32_t DacStreamSeq;
 extern volatile IRAM_ATTR uint32_t Driver_CpuPeriod;
 extern volatile IRAM_ATTR uint32_t Driver_CpuUsageVgm;
 extern volatile IRAM_ATTR uint32_t Driver_CpuUsageDs;
+extern volatile uint32_t Driver_CommandUnderruns;
+extern volatile uint32_t Driver_WritesSaved;
 extern volatile bool Driver_MitigateVgmTrim;
 extern volatile bool Driver_FirstWait;
 extern volatile uint8_t Driver_FmMask;
@@ -60,7 +95,7 @@ extern volatile uint8_t Driver_DcsgMask;
 extern volatile bool Driver_ForceMono;
 extern volatile IRAM_ATTR uint32_t Driver_Opna_PcmUploadId;
 extern volatile bool Driver_Opna_PcmUpload;
-extern FILE *Driver_Opna_PcmUploadFile;
+extern TrackFile_t *Driver_Opna_PcmUploadFile;
 extern volatile int16_t Driver_SpeedMult;
 extern volatile bool Driver_FadeEnabled;
 extern volatile uint8_t Driver_FadeLength;
@@ -75,5 +110,6 @@ bool Driver_Setup();
 void Driver_Main();
 void Driver_ModDetect();
 void Driver_ResetChips(bool force);
+bool Driver_DsSlotPlaying(uint8_t Slot);
 
 #endif
\ No newline at end of file
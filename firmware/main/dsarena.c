@@ -0,0 +1,40 @@
+#include "dsarena.h"
+
+void DsArena_Init(DsArena_t *a, uint32_t Size) {
+    a->Size = Size;
+    a->Head = 0;
+}
+
+//returns the offset of a buffer of at least Min and at most Want bytes, and its actual size in Got. DSARENA_NONE if there isn't room yet
+//Empty: nothing is in use. otherwise Tail is the offset of the oldest buffer still in use
+uint32_t DsArena_Alloc(DsArena_t *a, bool Empty, uint32_t Tail, uint32_t Want, uint32_t Min, uint32_t *Got) {
+    if (Want > a->Size) Want = a->Size;
+    if (Min > Want) Min = Want;
+    if (Empty) a->Head = 0; //start over at the bottom, no point fragmenting for nothing
+
+    uint32_t off;
+    uint32_t space;
+    if (Empty || a->Head > Tail) {
+        //in use: [Tail, Head). free: [Head, Size) and [0, Tail)
+        uint32_t end = a->Size - a->Head;
+        uint32_t start = Empty?0:Tail;
+        if (end >= Want || end >= start) {
+            off = a->Head;
+            space = end;
+        } else { //wrap, leaving the end unused until the tail comes round
+            off = 0;
+            space = start;
+        }
+    } else if (a->Head < Tail) {
+        //in use: [Tail, Size) and [0, Head). free: [Head, Tail)
+        off = a->Head;
+        space = Tail - a->Head;
+    } else { //Head == Tail with something in use, full
+        return DSARENA_NONE;
+    }
+
+    if (space < Min || space == 0) return DSARENA_NONE;
+    *Got = (space < Want)?space:Want;
+    a->Head = off + *Got;
+    return off;
+}
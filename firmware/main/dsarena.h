@@ -0,0 +1,22 @@
+#ifndef AGR_DSARENA_H
+#define AGR_DSARENA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//variable-size dacstream buffers carved out of one block of memory
+//the find task hands buffers out in seq order, and the driver is done with them in the same order, so this is just a ring:
+//the free space is always the gap between the end of the newest buffer (Head) and the start of the oldest one still in use
+//no ESP-IDF dependencies, so utils/dssim can build it on a host
+
+#define DSARENA_NONE 0xffffffff
+
+typedef struct {
+    uint32_t Size;
+    uint32_t Head;
+} DsArena_t;
+
+void DsArena_Init(DsArena_t *a, uint32_t Size);
+uint32_t DsArena_Alloc(DsArena_t *a, bool Empty, uint32_t Tail, uint32_t Want, uint32_t Min, uint32_t *Got);
+
+#endif
@@ -12,6 +12,9 @@
 #include "ui/modal.h"
 #include "sdcard.h"
 #include "queue.h"
+#include "loaderemit.h"
+#include "vgmdecode.h"
+#include <string.h>
 
 static const char* TAG = "Loader";
 
@@ -21,64 +24,36 @@ EventGroupHandle_t Loader_Status;
 StaticEventGroup_t Loader_StatusBuf;
 EventGroupHandle_t Loader_BufStatus;
 StaticEventGroup_t Loader_BufStatusBuf;
-FILE *Loader_File;
-FILE *Loader_PcmFile;
+TrackFile_t *Loader_File;
 VgmInfoStruct_t *Loader_VgmInfo;
 static uint8_t Loader_VgmDataBlockIndex = 0;
 volatile VgmDataBlockStruct_t Loader_VgmDataBlocks[MAX_REALTIME_DATABLOCKS+1];
 static bool Loader_RequestedDacStreamFindStart = false;
-static uint8_t Loader_VgmBuf[FREAD_LOCAL_BUF];
-static uint16_t Loader_VgmBufPos = FREAD_LOCAL_BUF;
-static IRAM_ATTR uint32_t Loader_VgmFilePos = 0;
+static VgmReader_t Loader_Reader;
+static uint8_t *Loader_ReaderBuf;
+static uint8_t *Loader_ReaderSpareBuf;
+static VgmReader_t Loader_PcmReader;
+static uint8_t *Loader_PcmReaderBuf;
 volatile bool Loader_IgnoreZeroSampleLoops = true;
 volatile bool Loader_FastOpnaUpload = false;
 static bool Loader_HitLoop = false;
+static bool Loader_WarnedPcmRamWrite = false;
 static uint8_t Loader_BadFlags = 0;
+static volatile uint8_t Loader_LateBadFlags = 0; //bad flags that only turned up after starting, passed on at the next opportunity
 
-//local buffer thingie. big speedup
-#define LOADER_BUF_FILL \
-    fseek(Loader_File, Loader_VgmFilePos, SEEK_SET); \
-    fread(&Loader_VgmBuf[0], 1, sizeof(Loader_VgmBuf), Loader_File); \
-    Loader_VgmBufPos = 0; \
-    if (ferror(Loader_File)) { \
+//these all bail out of the current iteration on io error
+#define LOADER_BUF_CHECK \
+    if (Loader_Reader.Error) { \
         file_error(); \
         continue; \
     }
-#define LOADER_BUF_FILL_NOLOOP \
-    fseek(Loader_File, Loader_VgmFilePos, SEEK_SET); \
-    fread(&Loader_VgmBuf[0], 1, sizeof(Loader_VgmBuf), Loader_File); \
-    Loader_VgmBufPos = 0; \
-    if (ferror(Loader_File)) { \
-        file_error(); \
-        Loader_VgmBufPos = 0; \
-        return false; \
-    }
-#define LOADER_BUF_CHECK \
-    if (Loader_VgmBufPos >= sizeof(Loader_VgmBuf)) { \
-        LOADER_BUF_FILL; \
-    }
 #define LOADER_BUF_SEEK_SET(offset) \
-    Loader_VgmFilePos = offset; \
-    LOADER_BUF_FILL;
-#define LOADER_BUF_SEEK_REL(offset) \
-    Loader_VgmFilePos += offset; \
-    Loader_VgmBufPos += offset; \
-    LOADER_BUF_CHECK;
+    VgmReader_Seek(&Loader_Reader, offset);
 #define LOADER_BUF_READ(var) \
-    var = Loader_VgmBuf[Loader_VgmBufPos]; \
-    Loader_VgmBufPos++; \
-    Loader_VgmFilePos++; \
+    var = VgmReader_Read8(&Loader_Reader); \
     LOADER_BUF_CHECK;
 #define LOADER_BUF_READ4(var) \
-    if (sizeof(Loader_VgmBuf)-Loader_VgmBufPos < 4) { \
-        LOADER_BUF_FILL; \
-    } \
-    _Pragma("GCC diagnostic push") \
-    _Pragma("GCC diagnostic ignored \"-Wstrict-aliasing\"") \
-    var = *(uint32_t*)&Loader_VgmBuf[Loader_VgmBufPos]; \
-    _Pragma("GCC diagnostic pop") \
-    Loader_VgmBufPos += 4; \
-    Loader_VgmFilePos += 4; \
+    var = VgmReader_Read32(&Loader_Reader); \
     LOADER_BUF_CHECK;
 
 bool Loader_Setup() {
@@ -99,23 +74,103 @@ bool Loader_Setup() {
         return false;
     }
 
+    ESP_LOGI(TAG, "Allocating reader buffers");
+    Loader_ReaderBuf = heap_caps_malloc(VGMREADER_CARRY+VGMREADER_BUF_SIZE, MALLOC_CAP_8BIT);
+    Loader_ReaderSpareBuf = heap_caps_malloc(VGMREADER_CARRY+VGMREADER_BUF_SIZE, MALLOC_CAP_8BIT);
+    Loader_PcmReaderBuf = heap_caps_malloc(VGMREADER_BUF_SIZE, MALLOC_CAP_8BIT);
+    if (Loader_ReaderBuf == NULL || Loader_ReaderSpareBuf == NULL || Loader_PcmReaderBuf == NULL) {
+        ESP_LOGE(TAG, "Failed !!");
+        return false;
+    }
+    //the command stream reader is double buffered: the read-ahead task fetches the next block while we parse this one
+    Loader_ReaderBuf += VGMREADER_CARRY;
+    Loader_ReaderSpareBuf += VGMREADER_CARRY;
+
+    ESP_LOGI(TAG, "Setting up track file cache");
+    if (!TrackFile_Setup()) {
+        ESP_LOGE(TAG, "Failed !!");
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Setting up datablock decoder");
+    if (!VgmDecode_Setup()) {
+        ESP_LOGE(TAG, "Failed !!");
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Setting up read-ahead");
+    if (!VgmReader_SetupReadAhead(&Loader_Reader, Loader_ReaderSpareBuf)) {
+        ESP_LOGE(TAG, "Failed !!");
+        return false;
+    }
 
     return true;
 }
 
 static IRAM_ATTR uint32_t Loader_PcmPos = 0;
 static IRAM_ATTR uint32_t Loader_PcmOff = 0;
+static uint8_t *Loader_PcmCache = NULL; //whole type 0 bank, indexed by PcmPos. NULL if it didn't fit, then samples come from Loader_PcmReader
+static uint32_t Loader_PcmCacheLen = 0;
+static bool Loader_PcmCacheOk = false;
+static const uint8_t *Loader_PcmPtr = NULL; //when the current block was decompressed into ram, samples come from here instead of the reader
+static const uint8_t *Loader_PcmPtrEnd = NULL;
+static VgmBankIndex_t Loader_BankIndex;
 static uint32_t Loader_GetPcmOffset(uint32_t PcmPos) {
-    uint32_t consumed = 0;
-    for (uint8_t i=0;i<Loader_VgmDataBlockIndex;i++) {
-        if (Loader_VgmDataBlocks[i].Type == 0) { //0 = ym2612 pcm
-            if (PcmPos >= consumed && PcmPos < consumed + Loader_VgmDataBlocks[i].Size) {
-                return Loader_VgmDataBlocks[i].Offset + (PcmPos - consumed);
-            }
-            consumed += Loader_VgmDataBlocks[i].Size;
-        }
+    return VgmBankIndex_GetDataOffset(&Loader_BankIndex, 0, PcmPos); //0 = ym2612 pcm
+}
+
+static void Loader_PcmLocate() { //point the sample source at Loader_PcmPos
+    const VgmBankEntry_t *e = VgmBankIndex_Find(&Loader_BankIndex, 0, Loader_PcmPos);
+    if (e != NULL && e->Data != NULL) {
+        Loader_PcmPtr = &e->Data[Loader_PcmPos - e->Start];
+        Loader_PcmPtrEnd = &e->Data[e->Size];
+        Loader_PcmOff = 0;
+    } else {
+        Loader_PcmPtr = NULL;
+        Loader_PcmOff = (e != NULL)?(e->Offset + (Loader_PcmPos - e->Start)):0xffffffff;
+        VgmReader_Seek(&Loader_PcmReader, Loader_PcmOff); //no io unless it's outside the buffered block
+    }
+}
+
+static void Loader_DropPcmCache() {
+    if (Loader_PcmCache) free(Loader_PcmCache);
+    Loader_PcmCache = NULL;
+    Loader_PcmCacheLen = 0;
+    Loader_PcmPtr = NULL;
+    Loader_PcmOff = 0; //make the next sample resync the reader
+}
+
+static bool Loader_CachePcmBlock(VgmDataBlockStruct_t *block) { //append a bank 0 datablock to the ram copy of the bank. returns false on io error only
+    if (!Loader_PcmCacheOk || block->Size == 0) return true;
+    if (block->Type != 0x00) { //compressed. whether it decoded or not, the bank is no longer just the file's bytes in a row
+        ESP_LOGI(TAG, "PCM bank has compressed blocks, not caching it");
+        Loader_PcmCacheOk = false;
+        Loader_DropPcmCache();
+        return true;
+    }
+    if (Loader_PcmCacheLen + block->Size > LOADER_PCM_CACHE_SIZE) {
+        ESP_LOGW(TAG, "PCM bank too big for ram (%d bytes), reading from card", Loader_PcmCacheLen + block->Size);
+        Loader_PcmCacheOk = false;
+        Loader_DropPcmCache();
+        return true;
+    }
+    uint8_t *n = heap_caps_realloc(Loader_PcmCache, Loader_PcmCacheLen + block->Size, MALLOC_CAP_8BIT);
+    if (n == NULL) {
+        ESP_LOGW(TAG, "Couldn't allocate PCM bank cache, reading from card");
+        Loader_PcmCacheOk = false;
+        Loader_DropPcmCache();
+        return true;
     }
-    return 0xffffffff;
+    Loader_PcmCache = n;
+    if (TrackFile_Read(Loader_File, block->Offset, &Loader_PcmCache[Loader_PcmCacheLen], block->Size) != block->Size) {
+        ESP_LOGE(TAG, "PCM bank cache read failed !!");
+        Loader_PcmCacheOk = false;
+        Loader_DropPcmCache();
+        return false;
+    }
+    Loader_PcmCacheLen += block->Size;
+    ESP_LOGI(TAG, "PCM bank cache now %d bytes", Loader_PcmCacheLen);
+    return true;
 }
 
 static uint8_t running = false;
@@ -131,10 +186,10 @@ static void file_error() {
     ESP_LOGE(TAG, "IO error");
 }
 
+static LoaderEmit_t Loader_Emitter;
+
 static IRAM_ATTR uint32_t Loader_Pending = 0;
 static bool Loader_EndReached = false;
-static uint8_t Loader_PcmBuf[FREAD_LOCAL_BUF];
-static uint16_t Loader_PcmBufUsed = FREAD_LOCAL_BUF;
 static IRAM_ATTR uint32_t adjustedprio = false;
 void Loader_Main() {
     ESP_LOGI(TAG, "Task start");
@@ -147,9 +202,7 @@ void Loader_Main() {
             xEventGroupClearBits(Loader_Status, LOADER_START_REQUEST);
             if (Loader_BadFlags) {
                 ESP_LOGW(TAG, "Passing badflags to driver: 0x%02x", Loader_BadFlags);
-                uint8_t badval = 0xff;
-                MegaStream_Send(&Driver_CommandStream, &badval, 1);
-                MegaStream_Send(&Driver_CommandStream, &Loader_BadFlags, 1);
+                LoaderEmit_Record(&Loader_Emitter, DRIVER_OP_BADFLAGS, Loader_BadFlags, 0, 0);
             }
             running = true;
         } else if (bits & LOADER_STOP_REQUEST) {
@@ -184,7 +237,7 @@ void Loader_Main() {
             if (!Loader_EndReached && (spaces > DRIVER_QUEUE_SIZE/16)) {
                 UserLedMgr_DiskState[DISKSTATE_VGM] = true;
                 UserLedMgr_Notify();
-                while (running && MegaStream_Free(&Driver_CommandStream) >= 11) { //11 is the biggest fixed-size vgm command, so make sure there's at least that much space
+                while (running && MegaStream_Free(&Driver_CommandStream) >= LOADEREMIT_MAX_RECORDS*sizeof(DriverRecord_t)) {
                     if (MegaStream_Free(&Driver_CommandStream) > (DRIVER_QUEUE_SIZE/3)) {
                         if (!adjustedprio) {
                             ESP_LOGW(TAG, "Switching to high priority");
@@ -192,26 +245,18 @@ void Loader_Main() {
                             adjustedprio = true;
                         }
                     }
+                    if (Loader_LateBadFlags) {
+                        ESP_LOGW(TAG, "Passing late badflags to driver: 0x%02x", Loader_LateBadFlags);
+                        LoaderEmit_Record(&Loader_Emitter, DRIVER_OP_BADFLAGS, Loader_LateBadFlags, 0, 0);
+                        Loader_LateBadFlags = 0;
+                    }
                     uint8_t d = 0x00;
                     LOADER_BUF_READ(d);
                     if (d == 0xe0) { //pcm seek
                         uint32_t NewPos = 0;
                         LOADER_BUF_READ4(NewPos);
-                        uint32_t NewOff = Loader_GetPcmOffset(NewPos);
-                        if (NewOff != (Loader_PcmOff+1)) {
-                            ESP_LOGD(TAG, "Pcm seeking to NewOff %d BufUsed %d PcmOff %d", NewOff, Loader_PcmBufUsed, Loader_PcmOff);
-                            if (NewOff <= Loader_PcmOff && Loader_PcmOff - NewOff <= Loader_PcmBufUsed) { //don't seek the file if we can just rewind the buffer. todo: possibly handle optimize handling skipping forward within the buf's range?
-                                ESP_LOGD(TAG, "PCM buffer rewind");
-                                Loader_PcmBufUsed -= Loader_PcmOff - NewOff;
-                                Loader_PcmOff = NewOff;
-                            } else { //it's either ahead of our current position, or too far behind that it's not in the buffer
-                                ESP_LOGD(TAG, "PCM actual read");
-                                fseek(Loader_PcmFile, NewOff, SEEK_SET);
-                                Loader_PcmOff = NewOff;
-                                Loader_PcmBufUsed = FREAD_LOCAL_BUF;
-                            }
-                        }
                         Loader_PcmPos = NewPos;
+                        if (!Loader_PcmCache) Loader_PcmLocate();
                     } else if (d == 0x67) { //datablock
                         if (Loader_VgmDataBlockIndex == MAX_REALTIME_DATABLOCKS) {
                             ESP_LOGE(TAG, "loader datablocks over !!");
@@ -222,15 +267,21 @@ void Loader_Main() {
                             xEventGroupSetBits(Loader_BufStatus, LOADER_BUF_OK);
                             xEventGroupClearBits(Loader_BufStatus, 0xff ^ LOADER_BUF_OK);
                         } else {
-                            //here are some hacks to wrap around VgmParseDataBlock not using our local buffer thing
-                            fseek(Loader_File, Loader_VgmFilePos, SEEK_SET); //destroys buf
                             if (Loader_CurLoop == 0) { //only load datablocks on first loop through
-                                VgmParseDataBlock(Loader_File, (VgmDataBlockStruct_t *)&Loader_VgmDataBlocks[Loader_VgmDataBlockIndex++]);
+                                VgmDataBlockStruct_t *block = (VgmDataBlockStruct_t *)&Loader_VgmDataBlocks[Loader_VgmDataBlockIndex++];
+                                if (VgmParseDataBlock(&Loader_Reader, block)) {
+                                    const uint8_t *data = VgmDecode_Block(&Loader_Reader, block);
+                                    VgmBankIndex_Add(&Loader_BankIndex, block, data);
+                                    if (VgmDataBlockBank(block->Type) == 0 && !Loader_CachePcmBlock(block)) {
+                                        file_error();
+                                        continue;
+                                    }
+                                }
                             } else {
                                 //can't simply skip over the datablock because they're variable-length. use the last entry as a garbage can
-                                VgmParseDataBlock(Loader_File, (VgmDataBlockStruct_t *)&Loader_VgmDataBlocks[MAX_REALTIME_DATABLOCKS]);
+                                VgmParseDataBlock(&Loader_Reader, (VgmDataBlockStruct_t *)&Loader_VgmDataBlocks[MAX_REALTIME_DATABLOCKS]);
                             }
-                            LOADER_BUF_SEEK_SET(ftell(Loader_File)); //fix buf
+                            LOADER_BUF_CHECK;
 
                             //handle opna pcm datablocks, since they need to be uploaded
                             if (Loader_VgmDataBlocks[Loader_VgmDataBlockIndex-1].Type == 0x81 && Loader_VgmDataBlocks[Loader_VgmDataBlockIndex-1].Size > 8) {
@@ -246,41 +297,52 @@ void Loader_Main() {
                                 ESP_LOGI(TAG, "Done");
                             }
                         }
-                    } else if (d == 0x68) {
-
+                    } else if (d == 0x68) { //pcm ram write
+                        VgmPcmRamWriteStruct_t write;
+                        VgmParsePcmRamWrite(&Loader_Reader, &write);
+                        LOADER_BUF_CHECK;
+                        //only chips with sample ram use this (rf5cxx, scsp, etc), and none of those are supported. opna adpcm ram goes through 0x81 datablocks instead
+                        if (!Loader_WarnedPcmRamWrite) {
+                            ESP_LOGW(TAG, "Ignoring PCM RAM write(s) for unsupported chip type 0x%02x", write.Type);
+                            Loader_WarnedPcmRamWrite = true;
+                        }
                     } else if ((d&0xf0) == 0x80) { //pcm and wait
-                        if (Loader_PcmOff == 0) { //if this is the first sample being played, need to do an initial seek
-                            Loader_PcmOff = Loader_GetPcmOffset(Loader_PcmPos);
-                            fseek(Loader_PcmFile, Loader_PcmOff, SEEK_SET);
-                            Loader_PcmBufUsed = FREAD_LOCAL_BUF;
+                        uint8_t sample;
+                        if (!Loader_PcmCache && !Loader_PcmPtr && Loader_PcmOff == 0) { //if this is the first sample being played, need to do an initial seek
+                            Loader_PcmLocate();
                         }
-                        if (Loader_PcmBufUsed == FREAD_LOCAL_BUF) {
-                            fread(&Loader_PcmBuf[0], 1, FREAD_LOCAL_BUF, Loader_PcmFile); //todo: fix read past eof
-                            if (ferror(Loader_PcmFile)) {
+                        if (Loader_PcmCache) {
+                            //past the end of the bank would be a read error on the card path. just play silence
+                            sample = (Loader_PcmPos < Loader_PcmCacheLen)?Loader_PcmCache[Loader_PcmPos]:0x80;
+                            Loader_PcmPos++;
+                        } else if (Loader_PcmPtr) { //decompressed block
+                            sample = *Loader_PcmPtr++;
+                            Loader_PcmPos++;
+                            if (Loader_PcmPtr == Loader_PcmPtrEnd) Loader_PcmLocate(); //ran off the end of the block
+                        } else {
+                            sample = VgmReader_Read8(&Loader_PcmReader);
+                            if (Loader_PcmReader.Error) {
                                 file_error();
                                 continue;
                             }
-                            Loader_PcmBufUsed = 0;
-                        }
-                        MegaStream_Send(&Driver_PcmStream, &Loader_PcmBuf[Loader_PcmBufUsed++], 1); //theoretically pcmqueue should never ever be full while there are still spaces in commandqueue
-                        Loader_PcmPos++;
-                        #ifdef PARANOID_THAT_THERE_MIGHT_BE_VGMS_THAT_PLAY_PCM_ACROSS_BLOCK_BOUNDARIES
-                        uint32_t NewOff = Loader_GetPcmOffset(Loader_PcmPos);
-                        if (NewOff != (Loader_PcmOff+1)) {
-                            ESP_LOGI(TAG, "pcm seeking to %d after sample load", NewOff);
-                            fseek(Loader_PcmFile, NewOff, SEEK_SET);
+                            Loader_PcmPos++;
+                            #ifdef PARANOID_THAT_THERE_MIGHT_BE_VGMS_THAT_PLAY_PCM_ACROSS_BLOCK_BOUNDARIES
+                            uint32_t NewOff = Loader_GetPcmOffset(Loader_PcmPos);
+                            if (NewOff != (Loader_PcmOff+1)) {
+                                ESP_LOGI(TAG, "pcm seeking to %d after sample load", NewOff);
+                                VgmReader_Seek(&Loader_PcmReader, NewOff);
+                            }
                             Loader_PcmOff = NewOff;
-                            Loader_PcmBufUsed = FREAD_LOCAL_BUF;
+                            #else
+                            Loader_PcmOff++;
+                            #endif
                         }
-                        #else
-                        Loader_PcmOff++;
-                        #endif
-                        MegaStream_Send(&Driver_CommandStream, &d, 1);
+                        LoaderEmit_Pcm(&Loader_Emitter, sample, d&0x0f);
                     } else if (d == 0x66) { //end of music, optionally loop
                         ESP_LOGI(TAG, "reached end of music");
                         if (Loader_VgmInfo->LoopOffset == 0 || (Loader_IgnoreZeroSampleLoops && Loader_VgmInfo->LoopSamples == 0)) { //there is no loop point at all
                             ESP_LOGI(TAG, "no loop point");
-                            MegaStream_Send(&Driver_CommandStream, &d, 1); //let driver figure out it's the end
+                            LoaderEmit_Record(&Loader_Emitter, DRIVER_OP_END, 0, 0, 0); //let driver figure out it's the end
                             Loader_EndReached = true;
                             break;
                         }
@@ -288,38 +350,35 @@ void Loader_Main() {
                         if (Loader_VgmInfo->LoopSamples == 0) ESP_LOGW(TAG, "looping despite LoopSamples == 0 !!");
                         if (Loader_CurLoop == 0) Loader_HitLoop = true;
                         Loader_CurLoop++; //still need to keep track of this so dacstream loads aren't duplicated
-                        MegaStream_Send(&Driver_CommandStream, &d, 1);
+                        LoaderEmit_Record(&Loader_Emitter, DRIVER_OP_END, 0, 0, 0);
                         LOADER_BUF_SEEK_SET(Loader_VgmInfo->LoopOffset);
                         break;
                     } else if (d >= 0x90 && d <= 0x95) { //dacstream command
                         if (!Loader_RequestedDacStreamFindStart) {
-                            DacStream_BeginFinding((VgmDataBlockStruct_t *)&Loader_VgmDataBlocks, Loader_VgmDataBlockIndex, Loader_VgmFilePos-1);
+                            DacStream_BeginFinding((VgmDataBlockStruct_t *)&Loader_VgmDataBlocks, Loader_VgmDataBlockIndex, Loader_Reader.Pos-1, Loader_Emitter.Sample);
                             Loader_RequestedDacStreamFindStart = true;
                         }
-                        MegaStream_Send(&Driver_CommandStream, &d, 1); //command
+                        uint8_t c[10];
                         uint8_t cmdlen = VgmCommandLength(d);
                         for (uint8_t i=1;i<cmdlen;i++) { //command data
-                            LOADER_BUF_READ(d);
-                            MegaStream_Send(&Driver_CommandStream, &d, 1);
+                            LOADER_BUF_READ(c[i-1]);
                         }
+                        LoaderEmit_DacStream(&Loader_Emitter, d, c);
                     } else { //just a regular command
-                        MegaStream_Send(&Driver_CommandStream, &d, 1); //command
                         uint8_t cmdlen = VgmCommandLength(d)-1; //it's really the command's attached data
-                        if (cmdlen == 0) continue; //don't bother with any of the below if there is no attached data
-
-                        //fill up the fread buf if necessary, so we can copy the whole command in one call
-                        if (Loader_VgmBufPos + cmdlen >= FREAD_LOCAL_BUF) {
-                            LOADER_BUF_FILL;
+                        if (cmdlen == 0) { //don't bother with any of the below if there is no attached data
+                            LoaderEmit_Command(&Loader_Emitter, d, NULL);
+                            continue;
                         }
 
-                        MegaStream_Send(&Driver_CommandStream, &Loader_VgmBuf[Loader_VgmBufPos], cmdlen);
-
-                        //fix up the buffer tracking vars that the LOADER_BUF_READ macro normally handles
-                        Loader_VgmBufPos += cmdlen;
-                        Loader_VgmFilePos += cmdlen;
+                        //get the whole command's data in one go
+                        const uint8_t *c = VgmReader_Peek(&Loader_Reader, cmdlen);
                         LOADER_BUF_CHECK;
+                        LoaderEmit_Command(&Loader_Emitter, d, c);
+                        VgmReader_Skip(&Loader_Reader, cmdlen);
                     }
                 }
+                if (MegaStream_Free(&Driver_CommandStream) >= sizeof(DriverRecord_t)) LoaderEmit_FlushWait(&Loader_Emitter); //don't sit on a wait while we're sleeping, driver needs it to keep time. otherwise it goes out first thing next fill
                 UserLedMgr_DiskState[DISKSTATE_VGM] = false;
                 UserLedMgr_Notify();
                 vTaskDelay(pdMS_TO_TICKS(75)); //just filled, big delay now
@@ -330,33 +389,54 @@ void Loader_Main() {
     }
 }
 
-bool Loader_Start(FILE *File, FILE *PcmFile, VgmInfoStruct_t *info, uint8_t bad_flags) {
+bool Loader_Start(TrackFile_t *File, VgmInfoStruct_t *info, uint8_t bad_flags) {
     if (xEventGroupGetBits(Loader_Status) & LOADER_RUNNING) {
         //running, can't start
         return false;
     }
 
     Loader_File = File;
-    Loader_PcmFile = PcmFile;
     Loader_VgmInfo = info;
     Loader_PcmPos = 0;
     Loader_PcmOff = 0;
+    Loader_PcmPtr = NULL;
     Loader_Pending = 0;
+    LoaderEmit_Init(&Loader_Emitter, &Driver_CommandStream);
     Loader_EndReached = false;
     Loader_RequestedDacStreamFindStart = false;
     Loader_VgmDataBlockIndex = 0;
+    VgmBankIndex_Reset(&Loader_BankIndex);
+    VgmDecode_Clear(); //dacstream find hasn't started yet, so nobody else is using these
+    Loader_DropPcmCache();
+    Loader_PcmCacheOk = true;
+    Loader_WarnedPcmRamWrite = false;
     Loader_CurLoop = 0;
     Loader_BadFlags = bad_flags;
-    Loader_PcmBufUsed = FREAD_LOCAL_BUF;
+    Loader_LateBadFlags = 0;
+    TrackFile_CacheHits = 0;
+    TrackFile_CacheMisses = 0;
 
-    Loader_VgmFilePos = Loader_VgmInfo->DataOffset;
-    LOADER_BUF_FILL_NOLOOP;
+    VgmReader_Init(&Loader_Reader, File, Loader_ReaderBuf, VGMREADER_BUF_SIZE);
+    VgmReader_Init(&Loader_PcmReader, File, Loader_PcmReaderBuf, VGMREADER_BUF_SIZE);
+    VgmReader_Seek(&Loader_Reader, Loader_VgmInfo->DataOffset);
+    if (!VgmReader_Fill(&Loader_Reader, 1)) {
+        file_error();
+        return false;
+    }
 
     xEventGroupSetBits(Loader_Status, LOADER_START_REQUEST);
 
     return true;
 }
 
+void Loader_SetBadFlags(uint8_t bad_flags) { //for when the player only finds out after starting, eg. a vgz that's still being extracted
+    Loader_LateBadFlags = bad_flags;
+}
+
+uint32_t Loader_GetReadMisses() { //command stream refills that had to wait on the card since the last start
+    return Loader_Reader.Misses;
+}
+
 bool Loader_Stop() {
     if (xEventGroupGetBits(Loader_Status) & LOADER_STOPPED) {
         ESP_LOGW(TAG, "Loader_Stop() called but loader is already stopped !!");
@@ -365,12 +445,13 @@ bool Loader_Stop() {
     EventBits_t bits = xEventGroupWaitBits(Loader_Status, LOADER_STOPPED, false, false, pdMS_TO_TICKS(3000));
     if (bits & LOADER_STOPPED) {
         //cleanup stuff
+        VgmReader_StopReadAhead(&Loader_Reader); //player is about to close the file
+        Loader_DropPcmCache();
         Loader_VgmDataBlockIndex = 0;
         xEventGroupSetBits(Loader_BufStatus, LOADER_BUF_EMPTY);
         xEventGroupClearBits(Loader_BufStatus, 0xff & ~LOADER_BUF_EMPTY);
         //resetting streams here is actually unsafe, but we're protected by player ensuring that driver is stopped before getting this far
         MegaStream_Reset(&Driver_CommandStream);
-        MegaStream_Reset(&Driver_PcmStream);
         return true;
     } else {
         ESP_LOGE(TAG, "Loader stop request timeout !!");
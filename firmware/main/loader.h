@@ -11,6 +11,7 @@
 #include "freertos/event_groups.h"
 #include "vgm.h"
 #include "mallocs.h"
+#include "trackfile.h"
 
 enum {
     LOADER_RUNNING = 0x01,
@@ -37,6 +38,8 @@ extern volatile bool Loader_FastOpnaUpload;
 bool Loader_Setup();
 void Loader_Main();
 bool Loader_Stop();
-bool Loader_Start(FILE *File, FILE *PcmFile, VgmInfoStruct_t *info, uint8_t bad_flags);
+uint32_t Loader_GetReadMisses();
+void Loader_SetBadFlags(uint8_t bad_flags);
+bool Loader_Start(TrackFile_t *File, VgmInfoStruct_t *info, uint8_t bad_flags);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,115 @@
+#include "loaderemit.h"
+#include "esp_log.h"
+#include "driver.h"
+#include <string.h>
+
+static const char* TAG = "LoaderEmit";
+
+void LoaderEmit_Init(LoaderEmit_t *e, MegaStreamContext_t *Stream) {
+    e->Stream = Stream;
+    e->PendingWait = 0;
+    e->Sample = 0;
+}
+
+static void LoaderEmit_Put(LoaderEmit_t *e, uint8_t op, uint8_t reg, uint8_t val, uint8_t arg) { //caller makes sure there's room
+    DriverRecord_t *rec;
+    MegaStream_Reserve(e->Stream, (uint8_t **)&rec); //records never straddle the wraparound, so this is always big enough
+    rec->Op = op;
+    rec->Reg = reg;
+    rec->Val = val;
+    rec->Arg = arg;
+    MegaStream_Commit(e->Stream, sizeof(DriverRecord_t));
+}
+
+//consecutive waits get merged into one, and only sent right before the next non-wait record (or when the loader takes a break)
+void LoaderEmit_FlushWait(LoaderEmit_t *e) {
+    if (e->PendingWait) {
+        LoaderEmit_Put(e, DRIVER_OP_WAIT, e->PendingWait&0xff, (e->PendingWait>>8)&0xff, e->PendingWait>>16);
+        e->PendingWait = 0;
+    }
+}
+
+static void LoaderEmit_Wait(LoaderEmit_t *e, uint32_t samples) {
+    if (e->PendingWait + samples > 0xffffff) LoaderEmit_FlushWait(e); //wait records are only 24bit
+    e->PendingWait += samples;
+    e->Sample += samples;
+}
+
+void LoaderEmit_Record(LoaderEmit_t *e, uint8_t op, uint8_t reg, uint8_t val, uint8_t arg) {
+    LoaderEmit_FlushWait(e);
+    LoaderEmit_Put(e, op, reg, val, arg);
+}
+
+void LoaderEmit_Pcm(LoaderEmit_t *e, uint8_t sample, uint8_t wait) { //0x8n, the driver does the wait itself
+    LoaderEmit_Record(e, DRIVER_OP_OPN2_DAC, 0, sample, wait);
+    e->Sample += wait;
+}
+
+static void LoaderEmit_DsRate(LoaderEmit_t *e, uint8_t id, const uint8_t *rate) { //DS_RATE + raw 32bit rate payload record, committed together
+    DriverRecord_t *rec;
+    LoaderEmit_FlushWait(e);
+    if (MegaStream_Reserve(e->Stream, (uint8_t **)&rec) < 2*sizeof(DriverRecord_t)) { //only one record left before the wraparound, pad it out
+        LoaderEmit_Put(e, DRIVER_OP_NOP, 0, 0, 0);
+        MegaStream_Reserve(e->Stream, (uint8_t **)&rec);
+    }
+    rec[0].Op = DRIVER_OP_DS_RATE;
+    rec[0].Reg = id;
+    rec[0].Val = 0;
+    rec[0].Arg = 0;
+    memcpy(&rec[1], rate, 4);
+    MegaStream_Commit(e->Stream, 2*sizeof(DriverRecord_t));
+}
+
+void LoaderEmit_DacStream(LoaderEmit_t *e, uint8_t d, const uint8_t *c) { //0x90-0x95. c points at the attached data
+    if (d == 0x93 || d == 0x95) { //start
+        LoaderEmit_Record(e, DRIVER_OP_DS_START, c[0], 0, 0);
+    } else if (d == 0x94) { //stop
+        LoaderEmit_Record(e, DRIVER_OP_DS_STOP, c[0], 0, 0);
+    } else if (d == 0x92) { //set sample rate
+        LoaderEmit_DsRate(e, c[0], &c[1]);
+    } //0x90 and 0x91 are stream setup, only dacstream find cares about those
+}
+
+void LoaderEmit_Command(LoaderEmit_t *e, uint8_t d, const uint8_t *c) { //translate a fixed-size vgm command into a driver record. c points at the attached data
+    if ((d&0xf0) == 0x70) { //4bit wait
+        LoaderEmit_Wait(e, (d&0x0f)+1);
+    } else if (d == 0x61) { //16bit wait
+        LoaderEmit_Wait(e, c[0] | ((uint16_t)c[1]<<8));
+    } else if (d == 0x62) { //60Hz wait
+        LoaderEmit_Wait(e, 735);
+    } else if (d == 0x63) { //50Hz wait
+        LoaderEmit_Wait(e, 882);
+    } else if (d == 0x50) { //SN76489
+        LoaderEmit_Record(e, DRIVER_OP_DCSG, 0, c[0], 0);
+    } else if (d == 0x51) {
+        LoaderEmit_Record(e, DRIVER_OP_OPLL, c[0], c[1], 0);
+    } else if (d == 0x52) { //YM2612 port 0
+        LoaderEmit_Record(e, DRIVER_OP_OPN2_0, c[0], c[1], 0);
+    } else if (d == 0x53) { //YM2612 port 1
+        LoaderEmit_Record(e, DRIVER_OP_OPN2_1, c[0], c[1], 0);
+    } else if (d == 0x54) { //opm
+        LoaderEmit_Record(e, DRIVER_OP_OPM, c[0], c[1], 0);
+    } else if (d == 0x55) { //opn
+        LoaderEmit_Record(e, DRIVER_OP_OPN, c[0], c[1], 0);
+    } else if (d == 0x56) { //opna port 0
+        LoaderEmit_Record(e, DRIVER_OP_OPNA_0, c[0], c[1], 0);
+    } else if (d == 0x57) { //opna port 1
+        LoaderEmit_Record(e, DRIVER_OP_OPNA_1, c[0], c[1], 0);
+    } else if (d == 0xa0) { //AY-3-8910
+        LoaderEmit_Record(e, DRIVER_OP_AY, c[0], c[1], 0);
+    } else if (d == 0xa5) { //2nd opn
+        LoaderEmit_Record(e, DRIVER_OP_OPN_2, c[0], c[1], 0);
+    } else if (d == 0x5a || d == 0x5b || d == 0x5e) { //ym3526, ym3812, ymf262 port 0
+        LoaderEmit_Record(e, DRIVER_OP_OPL3_0, c[0], c[1], 0);
+    } else if (d == 0x5f) { //ymf262 port 1
+        LoaderEmit_Record(e, DRIVER_OP_OPL3_1, c[0], c[1], 0);
+    } else if (d == 0x4f) { //gamegear dcsg stereo
+        ESP_LOGD(TAG, "Game Gear DCSG stereo not implemented !!");
+    } else if (d == 0xb2) {
+        if (c[0] & 0b11000000) ESP_LOGW(TAG, "Unsupported 32x pwm reg write %d !!", c[0]>>4);
+    } else if (d == 0x30 || d == 0x31 || d == 0xb1 || d == 0xb7 || d == 0xb8 || d == 0xc2 || d == 0xd2) {
+        //dcsg no.2, AY-3-8910 stereo mask, RF5C164, msm6258, msm6295, RF5C164 RAM, scc. just drop them
+    } else {
+        ESP_LOGE(TAG, "loader unknown command %02x !!", d);
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef AGR_LOADEREMIT_H
+#define AGR_LOADEREMIT_H
+
+#include <stdint.h>
+#include "megastream.h"
+
+//turns parsed vgm commands into driver records. the loader does the file io and datablocks and calls in here with each command
+//no io and no waiting in here, so the host tests in utils/ can run the real thing (decode_bench.c, emit_test.c)
+
+#define LOADEREMIT_MAX_RECORDS 4 //most records one vgm command turns into: pending wait + NOP + DS_RATE + payload. check for this much room first
+
+typedef struct {
+    MegaStreamContext_t *Stream;
+    uint32_t PendingWait; //merged waits not sent yet
+    uint32_t Sample;      //vgm sample the command being parsed runs at
+} LoaderEmit_t;
+
+void LoaderEmit_Init(LoaderEmit_t *e, MegaStreamContext_t *Stream);
+void LoaderEmit_FlushWait(LoaderEmit_t *e);
+void LoaderEmit_Record(LoaderEmit_t *e, uint8_t op, uint8_t reg, uint8_t val, uint8_t arg);
+void LoaderEmit_Pcm(LoaderEmit_t *e, uint8_t sample, uint8_t wait);
+void LoaderEmit_DacStream(LoaderEmit_t *e, uint8_t d, const uint8_t *c);
+void LoaderEmit_Command(LoaderEmit_t *e, uint8_t d, const uint8_t *c);
+
+#endif
@@ -1,14 +1,29 @@
 #ifndef AGR_MALLOCS_H
 #define AGR_MALLOCS_H
 
-#define DRIVER_QUEUE_SIZE 40000 //also used for old-style 2612 pcm. must be less than DACSTREAM_BUF_SIZE*DACSTREAM_PRE_COUNT!!
+#define DRIVER_QUEUE_SIZE 40000 //must be a multiple of sizeof(DriverRecord_t)!!
 #define DACSTREAM_BUF_SIZE 5000
 #define DACSTREAM_PRE_COUNT 16
+#define DACSTREAM_SLOT_MIN 1024 //smallest stream the find task will settle for while Driver_PcmBuf is busy
+#define DACSTREAM_SLOT_MAX 16384 //streams are sized to hold the whole sample, up to this
+#define DACSTREAM_FILL_CARD_READS 2 //per fill task pass, going by deadline
+#define DACSTREAM_STREAMS 4 //vgm stream ids that can be set up and playing at the same time
+#define DACSTREAM_SAMPLE_COUNT 8 //shared one-shot samples kept in ram
+#define DACSTREAM_SAMPLE_BUDGET 8192 //total heap for them, allocated as samples come up
 #define MAX_OPEN_FILES 24
 #define IOEXP_PORTA_QUEUE_SIZE 8
 #define MAX_REALTIME_DATABLOCKS 40
-#define FREAD_LOCAL_BUF 512
+#define VGMREADER_BUF_SIZE 2048 //must be a multiple of TRACKFILE_CACHE_BLOCK_SIZE
+#define TRACKFILE_CACHE_BLOCK_SIZE 1024 //multiple of 512, and no bigger than UNVGZ_READ_SLACK
+#define TRACKFILE_CACHE_SETS 4 //power of 2
+#define TRACKFILE_CACHE_WAYS 2
+#define UNVGZ_IN_BUF_SIZE 2048 //compressed input buffer for streaming vgz extraction, allocated only while extracting
+#define UNVGZ_CACHE_MAX_ENTRIES 64 //extracted vgzs kept on the card
+#define UNVGZ_CACHE_UNIT_MB 32 //the cache size option counts in these
+#define VGM_DECODE_BUF_SIZE 16384 //total ram for decompressed datablocks
+#define LOADER_PCM_CACHE_SIZE 16384 //ym2612 pcm banks up to this size are kept in ram instead of being read from the card per sample
 #define PLAYER_GD3_FIELD_SIZES 128
+#define PLAYER_PRELOAD_SECONDS 5 //open and parse the next track this long before the current one ends
 #define UI_KEYQUEUE_SIZE 4
 #define PCM_SBUF_COUNT 6
 #define PCM_SBUF_SIZE (((DACSTREAM_PRE_COUNT*DACSTREAM_BUF_SIZE)-DRIVER_QUEUE_SIZE)/PCM_SBUF_COUNT)
@@ -15,6 +15,7 @@
 #include "sdcard.h"
 #include "ui/modal.h"
 #include "logmgr.h"
+#include "unvgz.h"
 
 static const char* TAG = "OptionsMgr";
 
@@ -45,7 +46,7 @@ static void wrap_leddrv_updatebrightness() {
 
 static bool loaded[OPTION_COUNT];
 
-//last used: 0018
+//last used: 0019
 const option_t Options[OPTION_COUNT] = {
     {
         0x0001,
@@ -290,6 +291,18 @@ const option_t Options[OPTION_COUNT] = {
         NULL,
         NULL
     },
+    {
+        0x0019,
+        "VGZ cache size",
+        "When VGZ files aren't being overwritten, keep this much of the most recently played extracted VGZs on the SD card, so they load instantly next time.",
+        OPTION_CATEGORY_GENERAL,
+        OPTION_TYPE_NUMERIC,
+        OPTION_SUBTYPE_CACHESIZE,
+        &Unvgz_CacheSize,
+        8,
+        NULL,
+        NULL
+    },
     {
         0x000c,
         "Narrow font",
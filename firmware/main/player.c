@@ -19,6 +19,13 @@
 #include "sdcard.h"
 #include "ui.h"
 #include "taskmgr.h"
+#include "vgmdecode.h"
+#include "unvgz.h"
+#include "trackfile.h"
+
+//the known bad vgm checksums cover the header, plus everything from the gd3 to eof if that's no longer than this
+//it was the size of the buffer the tail used to be read into. the lists were made with it, so it can't change
+#define PLAYER_BADVGM_GD3_MAX 80000
 
 //vgms with the project 2612 test register issue
 static const uint32_t known_bad_testreg_vgms[] = {
@@ -73,10 +80,7 @@ static const uint32_t known_bad_other_vgms[] = {
 
 static const char* TAG = "Player";
 
-FILE *Player_VgmFile;
-FILE *Player_PcmFile;
-FILE *Player_DsFindFile;
-FILE *Player_DsFillFile;
+TrackFile_t *Player_File;
 VgmInfoStruct_t Player_Info;
 static IRAM_ATTR uint32_t notif = 0;
 
@@ -100,6 +104,42 @@ static IRAM_ATTR uint32_t failed_plays = 0;
 static uint32_t Player_StartTrack(char *FilePath);
 static bool Player_StopTrack();
 
+typedef struct {
+    char Path[512]; //queue entry this was opened for
+    char OpenPath[512]; //what actually got opened, after the vgz -> vgm fallback
+    TrackFile_t *File;  //the one handle everything reads the track through
+    FILE *VgmFile;      //what the parsing reads through: File's own stdio handle, or a separate one in Player_StreamCheck
+    VgmInfoStruct_t Info;
+    uint8_t Header[0x100]; //everything the clock setup looks at, zero-filled past the data offset
+    uint8_t BadFlags;
+    bool BadOther;
+    char Gd3_Title[PLAYER_GD3_FIELD_SIZES+1];
+    char Gd3_Game[PLAYER_GD3_FIELD_SIZES+1];
+    char Gd3_Author[PLAYER_GD3_FIELD_SIZES+1];
+    uint8_t State;
+} PlayerTrack_t;
+
+enum {
+    PLAYER_PRELOAD_NONE,
+    PLAYER_PRELOAD_READY,
+    PLAYER_PRELOAD_FAILED,
+};
+
+//the next track, opened during the tail of the current one. also used as scratch by Player_StartTrack when there's no usable preload
+static PlayerTrack_t Player_Preload;
+static char Player_PreloadPeek[512];
+static void Player_PreloadCheck();
+static void Player_DropPreload();
+
+//streaming vgz extraction of the playing track, see unvgz.c
+static bool Player_Streaming = false;
+static bool Player_StreamPending = false; //gd3 and bad vgm check still to do once extraction finishes
+static bool Player_StreamReplace = false;
+static char Player_StreamSrc[512];
+static const char *Player_StreamPath = NULL; //unvgztmp or Player_CachePath
+static char Player_CachePath[UNVGZ_CACHE_PATH_LEN];
+static void Player_StreamCheck();
+
 #define PLAYER_ERR (1<<0) //flag for any failure
 #define PLAYER_UNSUPPORTED_CHIPS (1<<1) //unsupported chips present (synth type)
 #define PLAYER_UNSUPPORTED_CHIPS_ARE_PCM (1<<2) //unsupported chips present (ONLY "addon" pcm type) - TODO
@@ -191,6 +231,7 @@ void Player_Main() {
                     ESP_LOGI(TAG, "player running, stopping track");
                     Player_StopTrack();
                 }
+                Player_DropPreload();
                 xEventGroupClearBits(Player_Status, PLAYER_STATUS_RUNNING);
                 xEventGroupClearBits(Player_Status, PLAYER_STATUS_PAUSED);
                 xEventGroupSetBits(Player_Status, PLAYER_STATUS_NOT_RUNNING);
@@ -275,7 +316,8 @@ void Player_Main() {
                 if (Player_EnableFastForward) xEventGroupSetBits(Driver_CommandEvents, DRIVER_EVENT_FASTFORWARD);
             }
         } else { //no incoming notification
-
+            Player_StreamCheck();
+            Player_PreloadCheck();
         }
         if ((xEventGroupGetBits(Player_Status) & PLAYER_STATUS_RUNNING) && (xEventGroupGetBits(Driver_CommandEvents) & DRIVER_EVENT_FINISHED)) { //still running, but driver reached end
             ESP_LOGI(TAG, "Driver finished, starting next track");
@@ -328,20 +370,28 @@ bool Player_Setup() {
     return true;
 }
 
+static bool Player_UnvgzReplace(const char *FilePath) { //swap the original vgz for the finished temp file
+    char vgmfn[513];
+    strcpy(vgmfn, FilePath);
+    //actually check if last char is z, in case it's a compressed file with .vgm extension
+    if (vgmfn[strlen(vgmfn)-1] == 'z' || vgmfn[strlen(vgmfn)-1] == 'Z') {
+        vgmfn[strlen(vgmfn)-1] -= 0x0d;
+    }
+    ESP_LOGW(TAG, "Unvgz: Deleting original file");
+    int ret = remove(FilePath);
+    if (ret != 0) return false;
+    ESP_LOGW(TAG, "Unvgz: Renaming temp file to %s", vgmfn);
+    ret = rename(unvgztmp, vgmfn);
+    return ret == 0;
+}
+
 static tinfl_decompressor decomp;
 static tinfl_status Player_Unvgz(char *FilePath, bool ReplaceOriginalFile) {
     FILE *reader;
     FILE *writer;
 
-    char vgmfn[513];
     if (ReplaceOriginalFile) {
-        strcpy(vgmfn, FilePath);
-        //actually check if last char is z, in case it's a compressed file with .vgm extension
-        if (vgmfn[strlen(vgmfn)-1] == 'z' || vgmfn[strlen(vgmfn)-1] == 'Z') {
-            vgmfn[strlen(vgmfn)-1] -= 0x0d;
-        }
-        
-        ESP_LOGW(TAG, "Unvgz: Decompressing %s to %s using temp file", FilePath, vgmfn);
+        ESP_LOGW(TAG, "Unvgz: Decompressing %s, replacing it using temp file", FilePath);
     } else {
         ESP_LOGW(TAG, "Unvgz: Decompressing %s to temp file", FilePath);
     }
@@ -355,37 +405,12 @@ static tinfl_status Player_Unvgz(char *FilePath, bool ReplaceOriginalFile) {
     }
     fseek(writer, 0, SEEK_SET);
 
-    //get compressed size
-    fseek(reader, 0, SEEK_END);
-    size_t in_remaining = ftell(reader) - 18; //18 = base gzip header size + crc32 & isize at end
-
-    //read in the header to do flags check
-    fseek(reader, 0, SEEK_SET);
-    fread(Driver_CommandStreamBuf, 1, 10, reader);
-    uint8_t gzip_flags = Driver_CommandStreamBuf[3];
-    ESP_LOGI(TAG, "gzip flags: %02x", gzip_flags);
-    if (gzip_flags & (1<<2)) { //FEXTRA
-        uint16_t xlen = 0;
-        fread(&xlen, 1, 2, reader);
-        fseek(reader, xlen, SEEK_CUR);
-        in_remaining -= 2 + xlen;
-    }
-    uint8_t z = 0xff;
-    if (gzip_flags & (1<<3)) { //FNAME
-        do {
-            fread(&z, 1, 1, reader);
-            in_remaining--;
-        } while (z);
-    }
-    if (gzip_flags & (1<<4)) { //FCOMMENT
-        do {
-            fread(&z, 1, 1, reader);
-            in_remaining--;
-        } while (z);
-    }
-    if (gzip_flags & (1<<1)) { //FHCRC
-        fseek(reader, 2, SEEK_CUR);
-        in_remaining -= 2;
+    size_t in_remaining = 0;
+    if (!Unvgz_SkipGzipHeader(reader, &in_remaining)) {
+        file_error(false);
+        fclose(reader);
+        fclose(writer);
+        return 0x12345678;
     }
 
     //after flags check, file pos is in the right place
@@ -456,19 +481,9 @@ static tinfl_status Player_Unvgz(char *FilePath, bool ReplaceOriginalFile) {
     fclose(reader);
     fclose(writer);
     if (status != TINFL_STATUS_DONE) return status;
-    if (ReplaceOriginalFile) {
-        ESP_LOGW(TAG, "Unvgz: Deleting original file");
-        int ret = remove(FilePath);
-        if (ret != 0) {
-            file_error(true);
-            return 0x12345678;
-        }
-        ESP_LOGW(TAG, "Unvgz: Renaming temp file to %s", vgmfn);
-        ret = rename(unvgztmp, vgmfn);
-        if (ret != 0) {
-            file_error(true);
-            return 0x12345678;
-        }
+    if (ReplaceOriginalFile && !Player_UnvgzReplace(FilePath)) {
+        file_error(true);
+        return 0x12345678;
     }
     return status;
 }
@@ -485,9 +500,8 @@ static tinfl_status Player_Unvgz(char *FilePath, bool ReplaceOriginalFile) {
         ESP_LOGI(TAG, "Chip at %08x", offset);\
     }
 
-static uint32_t Player_StartTrack(char *FilePath) {
-    const char *OpenFilePath = FilePath;
-
+//checks that the file exists, falling back from .vgz to .vgm (FilePath is modified if so), and gets its magic
+static bool Player_ProbeFile(char *FilePath, uint16_t *Magic) {
     ESP_LOGI(TAG, "Checking file type of %s", FilePath);
     FILE *test = fopen(FilePath, "r");
     //note that errors here could be the user's fault - for example, a playlist specifying non-existent files
@@ -498,129 +512,320 @@ static uint32_t Player_StartTrack(char *FilePath) {
             test = fopen(FilePath, "r");
             if (!test) {
                 ESP_LOGE(TAG, "vgm doesn't exist either");
-                return PLAYER_ERR;
+                return false;
             }
         } else {
             ESP_LOGE(TAG, "file doesn't exist");
-            return PLAYER_ERR;
+            return false;
         }
     }
 
-    uint16_t magic = 0;
+    *Magic = 0;
     fseek(test, 0, SEEK_SET);
-    fread(&magic, 2, 1, test);
+    fread(Magic, 2, 1, test);
     fclose(test);
-    if (magic == 0x8b1f) {
-        ESP_LOGI(TAG, "Compressed");
-        Ui_StatusBar_SetExtract(true);
-        tinfl_status u = Player_Unvgz(FilePath, Player_UnvgzReplaceOriginal);
-        if (u != TINFL_STATUS_DONE) {
-            //do this silly 0x12345678 thing to avoid blowing away any modal that was popped up in Player_Unvgz. yeah, i don't like it either...
-            if (u != 0x12345678) modal_show_simple(TAG, "VGZ Extraction Failed", "An error occurred while extracting this VGZ file. The file may be corrupt.", LV_SYMBOL_OK " OK");
-
-            //get the last track's info off of nowplaying
-            Player_Gd3_Title[0] = 0;
-            Player_Gd3_Game[0] = 0;
-            Player_Gd3_Author[0] = 0;
-            Player_Info.TotalSamples = 0;
-            Player_Info.LoopOffset = 0;
-            Player_Info.LoopSamples = 0;
-            Ui_NowPlaying_DataAvail = true;
-
-            Ui_StatusBar_SetExtract(false); //we won't make it to the one below
+    return true;
+}
 
-            return PLAYER_ERR;
-        }
-        if (Player_UnvgzReplaceOriginal) {
-            if (*(FilePath+(strlen(FilePath)-1)) == 'z' || *(FilePath+(strlen(FilePath)-1)) == 'Z') {
-                *(FilePath+(strlen(FilePath)-1)) -= 0x0d;
-            }
-        } else {
-            OpenFilePath = unvgztmp;
-        }
-        Ui_StatusBar_SetExtract(false);
-    } else if (magic == 0x6756) {
-        ESP_LOGI(TAG, "Uncompressed");
-    } else {
-        ESP_LOGI(TAG, "Unknown");
-        return PLAYER_ERR;
-    }
-    ESP_LOGI(TAG, "opening files");
-    Player_VgmFile = fopen(OpenFilePath, "r");
-    Player_PcmFile = fopen(OpenFilePath, "r");
-    Player_DsFindFile = fopen(OpenFilePath, "r");
-    Player_DsFillFile = fopen(OpenFilePath, "r");
-    Driver_Opna_PcmUploadFile = fopen(OpenFilePath, "r");
-    if (!Player_VgmFile || !Player_PcmFile || !Player_DsFillFile || !Player_DsFindFile || !Driver_Opna_PcmUploadFile) {
-        file_error(false);
-        if (Player_VgmFile) fclose(Player_VgmFile);
-        if (Player_PcmFile) fclose(Player_PcmFile);
-        if (Player_DsFindFile) fclose(Player_DsFindFile);
-        if (Player_DsFillFile) fclose(Player_DsFillFile);
-        if (Driver_Opna_PcmUploadFile) fclose(Driver_Opna_PcmUploadFile);
-        return PLAYER_ERR | PLAYER_ERR_INTERNAL;
-    }
-    fseek(Player_VgmFile, 0, SEEK_SET);
-    fseek(Player_DsFindFile, 0, SEEK_SET);
+static void Player_CloseTrack(PlayerTrack_t *t) {
+    TrackFile_Close(t->File);
+    t->File = NULL;
+    t->VgmFile = NULL;
+}
 
-    ESP_LOGI(TAG, "parsing header");
-    VgmParseHeader(Player_VgmFile, &Player_Info);
-    if (ferror(Player_VgmFile)) { //good time for a check
-        file_error(false);
-        return PLAYER_ERR | PLAYER_ERR_INTERNAL;
+//crc a range of the file through a small stack buffer - Driver_PcmBuf is still in use if a track is playing
+static uint32_t Player_CrcRange(FILE *f, uint32_t Offset, uint32_t Len, uint32_t crc) {
+    uint8_t buf[256];
+    fseek(f, Offset, SEEK_SET);
+    while (Len) {
+        uint32_t rd = (Len<sizeof(buf))?Len:sizeof(buf);
+        if (fread(buf, 1, rd, f) != rd) break;
+        crc = crc32_le(crc, buf, rd);
+        Len -= rd;
     }
+    return crc;
+}
 
-    ESP_LOGI(TAG, "VGM VER = %d", Player_Info.Version);
-
+//the parts of the file after the vgm data: known bad vgm checksum (header + gd3) and the gd3 strings
+static uint32_t Player_ParseTail(PlayerTrack_t *t, bool Interactive) {
     //known bad vgm header checksum
-    fseek(Player_VgmFile, 0, SEEK_SET);
-    fread(Driver_PcmBuf, 1, Player_Info.DataOffset, Player_VgmFile);
-    uint32_t headercrc = 0;
-    headercrc = crc32_le(headercrc, Driver_PcmBuf, Player_Info.DataOffset);
-    uint32_t eof = Player_Info.EofOffset+4;
-    if (Player_Info.Gd3Offset && eof-Player_Info.Gd3Offset <= sizeof(Driver_PcmBuf)) {
-        fseek(Player_VgmFile, Player_Info.Gd3Offset, SEEK_SET);
-        fread(Driver_PcmBuf, 1, eof-Player_Info.Gd3Offset, Player_VgmFile);
-        headercrc = crc32_le(headercrc, Driver_PcmBuf, eof-Player_Info.Gd3Offset);
+    uint32_t headercrc = Player_CrcRange(t->VgmFile, 0, t->Info.DataOffset, 0);
+    uint32_t eof = t->Info.EofOffset+4;
+    if (t->Info.Gd3Offset && eof-t->Info.Gd3Offset <= PLAYER_BADVGM_GD3_MAX) {
+        headercrc = Player_CrcRange(t->VgmFile, t->Info.Gd3Offset, eof-t->Info.Gd3Offset, headercrc);
     }
     ESP_LOGI(TAG, "File header CRC = 0x%08x", headercrc);
-    uint8_t badflags = 0;
+    t->BadFlags = 0;
     for (uint32_t i=0;i<sizeof(known_bad_testreg_vgms)/sizeof(uint32_t);i++) {
         if (headercrc == known_bad_testreg_vgms[i]) {
             ESP_LOGW(TAG, "Known bad vgm - test register");
-            badflags |= PLAYER_BADVGM_OPN2_TESTREG;
+            t->BadFlags |= PLAYER_BADVGM_OPN2_TESTREG;
             break;
         }
     }
+    t->BadOther = false;
     for (uint32_t i=0;i<sizeof(known_bad_other_vgms)/sizeof(uint32_t);i++) {
         if (headercrc == known_bad_other_vgms[i]) {
             ESP_LOGW(TAG, "Known bad vgm - other reason");
-            modal_show_simple(TAG, "Warning", "This VGM is known to be incorrectly logged or have other playback issues. Please report this issue to the pack author as it is not a MegaGRRL bug.", LV_SYMBOL_OK " OK");
+            t->BadOther = true; //the caller shows the warning, this may not be the playing track yet
             break;
         }
     }
 
-    if (ferror(Player_VgmFile)) { //good time for a check
-        file_error(false);
+    if (ferror(t->VgmFile)) { //good time for a check
+        if (Interactive) file_error(false);
         return PLAYER_ERR | PLAYER_ERR_INTERNAL;
     }
 
     Gd3Descriptor_t desc;
-    Gd3ParseDescriptor(Player_VgmFile, &Player_Info, &desc);
+    Gd3ParseDescriptor(t->VgmFile, &t->Info, &desc);
     if (desc.parsed) {
-        Gd3GetStringChars(Player_VgmFile, &desc, GD3STRING_TRACK_EN, &Player_Gd3_Title[0], PLAYER_GD3_FIELD_SIZES);
-        Gd3GetStringChars(Player_VgmFile, &desc, GD3STRING_GAME_EN, &Player_Gd3_Game[0], PLAYER_GD3_FIELD_SIZES);
-        Gd3GetStringChars(Player_VgmFile, &desc, GD3STRING_AUTHOR_EN, &Player_Gd3_Author[0], PLAYER_GD3_FIELD_SIZES);
-        if (ferror(Player_VgmFile)) { //better check before telling nowplaying to use garbage gd3 data...
-            file_error(false);
+        Gd3GetStringChars(t->VgmFile, &desc, GD3STRING_TRACK_EN, &t->Gd3_Title[0], PLAYER_GD3_FIELD_SIZES);
+        Gd3GetStringChars(t->VgmFile, &desc, GD3STRING_GAME_EN, &t->Gd3_Game[0], PLAYER_GD3_FIELD_SIZES);
+        Gd3GetStringChars(t->VgmFile, &desc, GD3STRING_AUTHOR_EN, &t->Gd3_Author[0], PLAYER_GD3_FIELD_SIZES);
+        if (ferror(t->VgmFile)) { //better check before telling nowplaying to use garbage gd3 data...
+            if (Interactive) file_error(false);
             return PLAYER_ERR | PLAYER_ERR_INTERNAL;
         }
     } else {
-        Player_Gd3_Title[0] = 0;
-        Player_Gd3_Game[0] = 0;
-        Player_Gd3_Author[0] = 0;
+        t->Gd3_Title[0] = 0;
+        t->Gd3_Game[0] = 0;
+        t->Gd3_Author[0] = 0;
     }
 
+    return 0;
+}
+
+//opens the files for a track and does all the parsing that doesn't touch the driver, clocks, loader or dacstreams.
+//when not Interactive (preloading while another track plays), no ui is shown - the error will come up again when the track is actually started
+//when Streaming, the file is a vgz still being extracted, and only the header is read
+static uint32_t Player_OpenTrack(const char *OpenFilePath, PlayerTrack_t *t, bool Interactive, bool Streaming) {
+    ESP_LOGI(TAG, "opening files");
+    t->File = TrackFile_Open(OpenFilePath);
+    if (!t->File) {
+        if (Interactive) file_error(false);
+        return PLAYER_ERR | PLAYER_ERR_INTERNAL;
+    }
+    t->VgmFile = t->File->File; //nothing else is reading it yet, so the parsing can use it directly
+
+    ESP_LOGI(TAG, "parsing header");
+    VgmParseHeader(t->VgmFile, &t->Info);
+    if (ferror(t->VgmFile)) { //good time for a check
+        if (Interactive) file_error(false);
+        Player_CloseTrack(t);
+        return PLAYER_ERR | PLAYER_ERR_INTERNAL;
+    }
+
+    ESP_LOGI(TAG, "VGM VER = %d", t->Info.Version);
+
+    if (!Streaming) {
+        uint32_t err = Player_ParseTail(t, Interactive);
+        if (err) {
+            Player_CloseTrack(t);
+            return err;
+        }
+    } else { //gd3 and the crc are at the end of the file, which isn't there yet. see Player_StreamCheck
+        t->BadFlags = 0;
+        t->BadOther = false;
+        t->Gd3_Title[0] = 0;
+        t->Gd3_Game[0] = 0;
+        t->Gd3_Author[0] = 0;
+    }
+
+    //read in the clock section of the header with all unused sections zero-filled
+    fseek(t->VgmFile, 0, SEEK_SET);
+    memset(t->Header, 0, sizeof(t->Header));
+    size_t maxread = t->Info.DataOffset;
+    if (maxread > sizeof(t->Header)) maxread = sizeof(t->Header);
+    fread(t->Header, 1, maxread, t->VgmFile);
+    if (ferror(t->VgmFile)) {
+        if (Interactive) file_error(false);
+        Player_CloseTrack(t);
+        return PLAYER_ERR | PLAYER_ERR_INTERNAL;
+    }
+
+    return 0;
+}
+
+static void Player_DropPreload() {
+    if (Player_Preload.State == PLAYER_PRELOAD_READY) {
+        ESP_LOGI(TAG, "Dropping preload of %s", Player_Preload.Path);
+        Player_CloseTrack(&Player_Preload);
+    }
+    Player_Preload.State = PLAYER_PRELOAD_NONE;
+}
+
+//called while idle. during the last few seconds of a track, open and parse whatever Player_NextTrk(false) is going to pick, so the gap is just the chip reset and buffer fill
+static void Player_PreloadCheck() {
+    if ((xEventGroupGetBits(Player_Status) & (PLAYER_STATUS_RUNNING | PLAYER_STATUS_PAUSED)) != PLAYER_STATUS_RUNNING) return;
+    if ((xEventGroupGetBits(Driver_CommandEvents) & DRIVER_EVENT_RUNNING) == 0 || Driver_FirstWait) return;
+
+    uint32_t total = Player_Info.TotalSamples;
+    if (Player_Info.LoopOffset && Player_Info.LoopSamples) {
+        if (Player_LoopCount == 255) return; //loops forever, never gets to the next track by itself
+        total = (Player_Info.TotalSamples - Player_Info.LoopSamples) + (Player_Info.LoopSamples * Player_LoopCount);
+        if (Driver_FadeEnabled) total += Driver_FadeLength*44100;
+    }
+    if (Driver_Sample + (PLAYER_PRELOAD_SECONDS*44100) < total) return;
+
+    //same choice as Player_NextTrk(false)
+    if (Player_RepeatMode == REPEAT_ONE) {
+        strcpy(Player_PreloadPeek, QueuePlayingFilename);
+    } else {
+        uint32_t pos = QueuePosition+1;
+        if (QueuePosition == QueueLength-1) {
+            if (Player_RepeatMode == REPEAT_NONE) return;
+            pos = 0;
+        }
+        if (!QueuePeekEntry(pos, Player_PreloadPeek)) return;
+    }
+
+    if (Player_Preload.State != PLAYER_PRELOAD_NONE) {
+        if (strcmp(Player_PreloadPeek, Player_Preload.Path) == 0) return; //already done (or already failed) this one
+        Player_DropPreload(); //user changed something, start over
+    }
+
+    ESP_LOGI(TAG, "Preloading %s", Player_PreloadPeek);
+    strcpy(Player_Preload.Path, Player_PreloadPeek);
+    strcpy(Player_Preload.OpenPath, Player_PreloadPeek);
+    Player_Preload.State = PLAYER_PRELOAD_FAILED; //until proven otherwise, so it isn't retried every time around
+    uint16_t magic = 0;
+    if (!Player_ProbeFile(Player_Preload.OpenPath, &magic)) return;
+    const char *OpenFilePath = Player_Preload.OpenPath;
+    char cachepath[UNVGZ_CACHE_PATH_LEN]; //Player_CachePath may still be in use by the playing track
+    if (magic == 0x8b1f && !Player_UnvgzReplaceOriginal && Unvgz_CacheFind(Player_PreloadPeek, cachepath)) {
+        ESP_LOGI(TAG, "Preloading from the vgz cache");
+        OpenFilePath = cachepath;
+    } else if (magic != 0x6756) {
+        //uncached vgz extraction goes through Driver_PcmBuf and the single temp file, both of which the playing track may be using
+        ESP_LOGI(TAG, "Not preloading, not an uncompressed vgm");
+        return;
+    }
+    if (Player_OpenTrack(OpenFilePath, &Player_Preload, false, false) & PLAYER_ERR) {
+        ESP_LOGW(TAG, "Preload failed, will retry when the track starts");
+        return;
+    }
+    Player_Preload.State = PLAYER_PRELOAD_READY;
+    ESP_LOGI(TAG, "Preload done");
+}
+
+//called while idle. once a streamed vgz is fully extracted, do the gd3 and bad vgm check that Player_OpenTrack had to skip
+static void Player_StreamCheck() {
+    if (!Player_StreamPending || Unvgz_State == UNVGZ_RUNNING) return;
+    Player_StreamPending = false;
+    Ui_StatusBar_SetExtract(false);
+    if (Unvgz_State != UNVGZ_DONE) return; //the loader runs into this on its own and reports it
+
+    PlayerTrack_t *t = heap_caps_malloc(sizeof(PlayerTrack_t), MALLOC_CAP_8BIT);
+    if (t == NULL) {
+        ESP_LOGE(TAG, "Tail check alloc failed !!");
+        return;
+    }
+    t->VgmFile = fopen(Player_StreamPath, "r"); //the loader's handles are busy
+    if (t->VgmFile) {
+        memcpy(&t->Info, &Player_Info, sizeof(Player_Info));
+        if ((Player_ParseTail(t, false) & PLAYER_ERR) == 0) {
+            strcpy(Player_Gd3_Title, t->Gd3_Title);
+            strcpy(Player_Gd3_Game, t->Gd3_Game);
+            strcpy(Player_Gd3_Author, t->Gd3_Author);
+            Ui_NowPlaying_DataAvail = true;
+            if (t->BadFlags) Loader_SetBadFlags(t->BadFlags);
+            if (t->BadOther) {
+                modal_show_simple(TAG, "Warning", "This VGM is known to be incorrectly logged or have other playback issues. Please report this issue to the pack author as it is not a MegaGRRL bug.", LV_SYMBOL_OK " OK");
+            }
+        }
+        fclose(t->VgmFile);
+    }
+    free(t);
+}
+
+static uint32_t Player_StartTrack(char *FilePath) {
+    if (Player_Preload.State == PLAYER_PRELOAD_READY && strcmp(FilePath, Player_Preload.Path) == 0) {
+        ESP_LOGI(TAG, "Using preloaded %s", Player_Preload.OpenPath);
+        strcpy(FilePath, Player_Preload.OpenPath); //pick up the vgz -> vgm fallback if there was one
+    } else {
+        Player_DropPreload();
+
+        const char *OpenFilePath = FilePath;
+        bool streaming = false;
+        uint16_t magic = 0;
+        if (!Player_ProbeFile(FilePath, &magic)) return PLAYER_ERR;
+        bool cached = false;
+        Player_CachePath[0] = 0;
+        Player_StreamPath = NULL;
+        if (magic == 0x8b1f && !Player_UnvgzReplaceOriginal) { //nothing to keep around if the original is getting replaced anyway
+            cached = Unvgz_CacheFind(FilePath, Player_CachePath);
+            if (!cached && Player_CachePath[0] && Unvgz_Start(FilePath, Player_CachePath)) Player_StreamPath = Player_CachePath;
+        }
+        if (magic == 0x8b1f && !cached && !Player_StreamPath && Unvgz_Start(FilePath, unvgztmp)) Player_StreamPath = unvgztmp;
+        if (cached) {
+            ESP_LOGI(TAG, "Compressed, already extracted");
+            OpenFilePath = Player_CachePath;
+        } else if (Player_StreamPath) {
+            ESP_LOGI(TAG, "Compressed, streaming");
+            Ui_StatusBar_SetExtract(true); //cleared once the extraction finishes
+            OpenFilePath = Player_StreamPath;
+            streaming = true;
+            Player_Streaming = true;
+            Player_StreamPending = true;
+            Player_StreamReplace = Player_UnvgzReplaceOriginal; //done when the track stops, can't rename it while it's open
+            strcpy(Player_StreamSrc, FilePath);
+        } else if (magic == 0x8b1f) { //couldn't stream it, extract the whole thing first
+            ESP_LOGI(TAG, "Compressed");
+            Ui_StatusBar_SetExtract(true);
+            tinfl_status u = Player_Unvgz(FilePath, Player_UnvgzReplaceOriginal);
+            if (u != TINFL_STATUS_DONE) {
+                //do this silly 0x12345678 thing to avoid blowing away any modal that was popped up in Player_Unvgz. yeah, i don't like it either...
+                if (u != 0x12345678) modal_show_simple(TAG, "VGZ Extraction Failed", "An error occurred while extracting this VGZ file. The file may be corrupt.", LV_SYMBOL_OK " OK");
+
+                //get the last track's info off of nowplaying
+                Player_Gd3_Title[0] = 0;
+                Player_Gd3_Game[0] = 0;
+                Player_Gd3_Author[0] = 0;
+                Player_Info.TotalSamples = 0;
+                Player_Info.LoopOffset = 0;
+                Player_Info.LoopSamples = 0;
+                Ui_NowPlaying_DataAvail = true;
+
+                Ui_StatusBar_SetExtract(false); //we won't make it to the one below
+
+                return PLAYER_ERR;
+            }
+            if (Player_UnvgzReplaceOriginal) {
+                if (*(FilePath+(strlen(FilePath)-1)) == 'z' || *(FilePath+(strlen(FilePath)-1)) == 'Z') {
+                    *(FilePath+(strlen(FilePath)-1)) -= 0x0d;
+                }
+            } else {
+                OpenFilePath = unvgztmp;
+            }
+            Ui_StatusBar_SetExtract(false);
+        } else if (magic == 0x6756) {
+            ESP_LOGI(TAG, "Uncompressed");
+        } else {
+            ESP_LOGI(TAG, "Unknown");
+            return PLAYER_ERR;
+        }
+
+        uint32_t err = Player_OpenTrack(OpenFilePath, &Player_Preload, true, streaming);
+        if (err) return err;
+    }
+
+    //hand the opened track over to the loader/dacstream file handles
+    Player_File = Player_Preload.File;
+    Driver_Opna_PcmUploadFile = Player_File;
+    Player_Preload.File = NULL;
+    Player_Preload.VgmFile = NULL;
+    Player_Preload.State = PLAYER_PRELOAD_NONE;
+    memcpy(&Player_Info, &Player_Preload.Info, sizeof(Player_Info));
+    uint8_t badflags = Player_Preload.BadFlags;
+
+    if (Player_Preload.BadOther) {
+        modal_show_simple(TAG, "Warning", "This VGM is known to be incorrectly logged or have other playback issues. Please report this issue to the pack author as it is not a MegaGRRL bug.", LV_SYMBOL_OK " OK");
+    }
+
+    strcpy(Player_Gd3_Title, Player_Preload.Gd3_Title);
+    strcpy(Player_Gd3_Game, Player_Preload.Gd3_Game);
+    strcpy(Player_Gd3_Author, Player_Preload.Gd3_Author);
     Ui_NowPlaying_DataAvail = true;
 
     /* todo here:
@@ -629,12 +834,7 @@ static uint32_t Player_StartTrack(char *FilePath) {
 
     ESP_LOGI(TAG, "vgm rate: %d", Player_Info.Rate);
 
-    //read in the entire header with all unused sections zero-filled. TODO: prevent double-reading this (see bad vgm checksum)
-    fseek(Player_VgmFile, 0, SEEK_SET);
-    memset(Driver_PcmBuf, 0, sizeof(Driver_PcmBuf));
-    size_t maxread = Player_Info.DataOffset;
-    if (maxread > sizeof(Driver_PcmBuf)) maxread = sizeof(Driver_PcmBuf); //catch anything too wacky happening
-    fread(Driver_PcmBuf, 1, maxread, Player_VgmFile);
+    memcpy(Driver_PcmBuf, Player_Preload.Header, sizeof(Player_Preload.Header));
 
     //go through the header and figure out how many chip clocks are specified
     uint8_t clocks_specified = 0;
@@ -924,7 +1124,7 @@ static uint32_t Player_StartTrack(char *FilePath) {
         ESP_LOGI(TAG, "Clock clamped: %d", opm);
         Clk_Set(CLK_FM, opm);
     }
-    if (ferror(Player_VgmFile)) { //final check after all the clock stuff
+    if (ferror(Player_File->File)) { //final check after all the clock stuff
         file_error(false);
         return PLAYER_ERR | PLAYER_ERR_INTERNAL;
     }
@@ -943,14 +1143,14 @@ static uint32_t Player_StartTrack(char *FilePath) {
 
     ESP_LOGI(TAG, "Starting dacstreams");
     bool ret;
-    ret = DacStream_Start(Player_DsFindFile, Player_DsFillFile, &Player_Info);
+    ret = DacStream_Start(Player_File, &Player_Info);
     if (!ret) {
         ESP_LOGE(TAG, "Dacstreams failed to start !!");
         return PLAYER_ERR | PLAYER_ERR_SYS;
     }
 
     ESP_LOGI(TAG, "Starting loader");
-    ret = Loader_Start(Player_VgmFile, Player_PcmFile, &Player_Info, badflags);
+    ret = Loader_Start(Player_File, &Player_Info, badflags);
     if (!ret) {
         ESP_LOGE(TAG, "Loader failed to start !!");
         return PLAYER_ERR | PLAYER_ERR_SYS;
@@ -1003,6 +1203,27 @@ static uint32_t Player_StartTrack(char *FilePath) {
     return 0;
 }
 
+//null-safe, since a failed start can leave nothing open for Player_StopTrack to close
+//Leak is for when the loader or dacstream didn't stop in time and may still be reading: the handle stays open rather than being freed under them
+static void Player_CloseFiles(bool Leak) {
+    if (Leak) {
+        if (Player_File) ESP_LOGW(TAG, "Leaving track file open, something may still be reading it");
+    } else {
+        TrackFile_Close(Player_File);
+    }
+    Player_File = NULL;
+    Driver_Opna_PcmUploadFile = NULL;
+
+    if (Player_Streaming) {
+        Player_Streaming = false;
+        Player_StreamPending = false;
+        Ui_StatusBar_SetExtract(false);
+        if (Unvgz_Stop() == UNVGZ_DONE && Player_StreamReplace && !Leak) { //don't move the extracted file out from under a leaked handle
+            if (!Player_UnvgzReplace(Player_StreamSrc)) ESP_LOGE(TAG, "Couldn't replace original vgz !!");
+        }
+    }
+}
+
 static bool Player_StopTrack() {
     Ui_NowPlaying_DataAvail = false;
 
@@ -1021,11 +1242,7 @@ static bool Player_StopTrack() {
     bool ret = Loader_Stop();
     if (!ret) {
         ESP_LOGE(TAG, "Loader stop timeout !!");
-        fclose(Player_VgmFile);
-        fclose(Player_PcmFile);
-        fclose(Player_DsFindFile);
-        fclose(Player_DsFillFile);
-        fclose(Driver_Opna_PcmUploadFile);
+        Player_CloseFiles(true);
         return false;
     }
 
@@ -1033,13 +1250,10 @@ static bool Player_StopTrack() {
     ret = DacStream_Stop();
     if (!ret) {
         ESP_LOGE(TAG, "Dacstream stop timeout !!");
-        fclose(Player_VgmFile);
-        fclose(Player_PcmFile);
-        fclose(Player_DsFindFile);
-        fclose(Player_DsFillFile);
-        fclose(Driver_Opna_PcmUploadFile);
+        Player_CloseFiles(true);
         return false;
     }
+    VgmDecode_Clear(); //loader and dacstream are both done with decompressed datablocks
 
     ESP_LOGI(TAG, "Wait for driver to reset...");
     EventBits_t bits = xEventGroupWaitBits(Driver_CommandEvents, DRIVER_EVENT_RESET_ACK, false, false, pdMS_TO_TICKS(3000));
@@ -1049,11 +1263,7 @@ static bool Player_StopTrack() {
     }
     xEventGroupClearBits(Driver_CommandEvents, DRIVER_EVENT_RESET_ACK);
 
-    fclose(Player_VgmFile);
-    fclose(Player_PcmFile);
-    fclose(Player_DsFindFile);
-    fclose(Player_DsFillFile);
-    fclose(Driver_Opna_PcmUploadFile);
+    Player_CloseFiles(false);
 
     return true;
 }
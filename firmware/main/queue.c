@@ -121,41 +121,56 @@ bool QueuePrev() {
 }
 
 
+//reads the entry at pos into dest. dest is left alone for blank lines, and for comments unless ReturnComments is set. returns false on io error, without any ui
+static bool QueueReadEntry(uint32_t pos, bool ReturnComments, bool ProcessShuffle, char *dest) {
+    uint32_t off = 5 + (pos*4);
+    //note here: queue length is stored in the file, but we don't actually need to use it, we can use the one in mem
+    if (ProcessShuffle && Queue_Shuffle) off += (5+(QueueLength*4)); //skip to the second half if we're shufflin'
+    fseek(cachefile, off, SEEK_SET); //ver and entry count + file offset
+    if (ferror(cachefile)) return false;
+    fread(&off, 4, 1, cachefile);
+    if (ferror(cachefile)) return false;
+    ESP_LOGD(TAG, "Entry at m3u file offset %d", off);
+    if (QueueM3uFile == NULL) QueueM3uFile = fopen(&QueueM3uFilename[0], "r");
+    fseek(QueueM3uFile, off, SEEK_SET);
+    if (ferror(cachefile)) return false;
+    fgets(&QueueLine[0], 255, QueueM3uFile);
+    if (ferror(cachefile)) return false;
+    for (uint8_t i=0;i<255;i++) {
+        if (QueueLine[i] == 0x0d || QueueLine[i] == 0x0a) QueueLine[i] = 0;
+    }
+    if (QueueLine[0] != '#' && QueueLine[0] != 0) {
+        if (QueueLine[0] != '/') { //build absolute path
+            strcpy(dest, QueueM3uPath);
+            strcat(dest, "/");
+            strcat(dest, QueueLine);
+        } else { //already absolute
+            strcpy(dest, QueueLine);
+        }
+    } else if (QueueLine[0] == '#') {
+        if (ReturnComments) {
+            strcpy(dest, QueueLine);
+        }
+    }
+    return true;
+}
+
 void QueueSetupEntry(bool ReturnComments, bool ProcessShuffle) {
     if (QueueSource == QUEUE_SOURCE_M3U) {
-        uint32_t off = 5 + (QueuePosition*4);
-        //note here: queue length is stored in the file, but we don't actually need to use it, we can use the one in mem
-        if (ProcessShuffle && Queue_Shuffle) off += (5+(QueueLength*4)); //skip to the second half if we're shufflin'
-        fseek(cachefile, off, SEEK_SET); //ver and entry count + file offset
-        check_ferror(cachefile);
-        fread(&off, 4, 1, cachefile);
-        check_ferror(cachefile);
-        ESP_LOGD(TAG, "Entry at m3u file offset %d", off);
-        if (QueueM3uFile == NULL) QueueM3uFile = fopen(&QueueM3uFilename[0], "r");
-        fseek(QueueM3uFile, off, SEEK_SET);
-        check_ferror(cachefile);
-        fgets(&QueueLine[0], 255, QueueM3uFile);
-        check_ferror(cachefile);
-        for (uint8_t i=0;i<255;i++) {
-            if (QueueLine[i] == 0x0d || QueueLine[i] == 0x0a) QueueLine[i] = 0;
-        }
-        if (QueueLine[0] != '#' && QueueLine[0] != 0) {
-            if (QueueLine[0] != '/') { //build absolute path
-                strcpy(QueuePlayingFilename, QueueM3uPath);
-                strcat(QueuePlayingFilename, "/");
-                strcat(QueuePlayingFilename, QueueLine);
-            } else { //already absolute
-                strcpy(QueuePlayingFilename, QueueLine);
-            }
-            //fclose(QueueM3uFile);
+        if (!QueueReadEntry(QueuePosition, ReturnComments, ProcessShuffle, QueuePlayingFilename)) {
+            file_error();
             return;
-        } else if (QueueLine[0] == '#') {
-            if (ReturnComments) {
-                strcpy(QueuePlayingFilename, QueueLine);
-                //fclose(QueueM3uFile);
-                return;
-            }
         }
-        //fclose(QueueM3uFile);
     }
 }
+
+//like QueueSetupEntry(false, true), but for any position and without touching QueuePlayingFilename. returns false if there's no playable entry there. never pops up ui, for use in the background
+bool QueuePeekEntry(uint32_t pos, char *dest) {
+    if (QueueSource != QUEUE_SOURCE_M3U || pos >= QueueLength) return false;
+    dest[0] = 0;
+    if (!QueueReadEntry(pos, false, true, dest)) {
+        ESP_LOGW(TAG, "Peek at %d failed", pos);
+        return false;
+    }
+    return dest[0] != 0;
+}
@@ -23,5 +23,6 @@ void QueueLoadM3u(const char *M3uPath, const char *M3uFilename, uint32_t pos, bo
 bool QueueNext();
 bool QueuePrev();
 void QueueSetupEntry(bool ReturnComments, bool ProcessShuffle);
+bool QueuePeekEntry(uint32_t pos, char *dest);
 
 #endif
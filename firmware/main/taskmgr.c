@@ -13,6 +13,8 @@
 #include "ui.h"
 #include "userled.h"
 #include "options.h"
+#include "vgmreader.h"
+#include "unvgz.h"
 
 //static const char* TAG = "Taskmgr";
 
@@ -27,6 +29,8 @@ void Taskmgr_CreateTasks() {
     xTaskCreatePinnedToCore(Loader_Main, "Loader", 2560, NULL, LOADER_TASK_PRIO_NORM, &Taskmgr_Handles[TASK_LOADER], 0);
     xTaskCreatePinnedToCore(IoExp_Main, "IoExp ", 2048, NULL, 19, &Taskmgr_Handles[TASK_IOEXP], 0);
     xTaskCreatePinnedToCore(KeyMgr_Main, "KeyMgr", 2048, NULL, 19, &Taskmgr_Handles[TASK_KEYMGR], 0);
+    xTaskCreatePinnedToCore(VgmReader_ReadAheadMain, "RdAhed", 2560, NULL, 13, &Taskmgr_Handles[TASK_READAHEAD], 0); //above the loader even when it's boosted, it spends nearly all its time blocked on the card anyway
+    xTaskCreatePinnedToCore(Unvgz_Main, "Unvgz ", 2560, NULL, 4, &Taskmgr_Handles[TASK_UNVGZ], 0); //below the player, it's cpu bound and runs for seconds. the loader just waits on it if it ever catches up
     xTaskCreatePinnedToCore(DacStream_FindTask, "DsFind", 2560, NULL, 9, &Taskmgr_Handles[TASK_DACSTREAM_FIND], 0);
     xTaskCreatePinnedToCore(DacStream_FillTask, "DsFill", 2560, NULL, 14, &Taskmgr_Handles[TASK_DACSTREAM_FILL], 0);
     xTaskCreatePinnedToCore(Player_Main, "Player", 3072, NULL, 5, &Taskmgr_Handles[TASK_PLAYER], 0);
@@ -20,6 +20,8 @@ enum Tasks {
     TASK_UI,
     TASK_USERLED,
     TASK_OPTIONS,
+    TASK_READAHEAD,
+    TASK_UNVGZ,
     TASK_COUNT
 };
 
@@ -0,0 +1,171 @@
+#include "trackfile.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "mallocs.h"
+#include "unvgz.h"
+#include <string.h>
+
+static const char* TAG = "TrackFile";
+
+typedef struct {
+    uint32_t Id;        //0 = empty
+    uint32_t Block;     //file offset / TRACKFILE_CACHE_BLOCK_SIZE
+    uint32_t Len;       //valid bytes, only short for the last block of the file
+    uint32_t LastUse;
+    uint8_t *Data;
+} TrackFileLine_t;
+
+static StaticSemaphore_t TrackFile_LockBuf;
+static SemaphoreHandle_t TrackFile_Lock = NULL; //held for cache lookups and any io through a handle
+static TrackFileLine_t TrackFile_Lines[TRACKFILE_CACHE_SETS][TRACKFILE_CACHE_WAYS];
+static uint32_t TrackFile_NextId = 1;
+static uint32_t TrackFile_Use = 0;
+volatile uint32_t TrackFile_CacheHits = 0;
+volatile uint32_t TrackFile_CacheMisses = 0;
+
+bool TrackFile_Setup() {
+    ESP_LOGI(TAG, "Creating lock");
+    TrackFile_Lock = xSemaphoreCreateMutexStatic(&TrackFile_LockBuf);
+    if (TrackFile_Lock == NULL) {
+        ESP_LOGE(TAG, "Failed !!");
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Allocating block cache");
+    uint8_t *data = heap_caps_malloc(TRACKFILE_CACHE_SETS*TRACKFILE_CACHE_WAYS*TRACKFILE_CACHE_BLOCK_SIZE, MALLOC_CAP_8BIT);
+    if (data == NULL) {
+        ESP_LOGE(TAG, "Failed !!");
+        return false;
+    }
+    for (uint8_t s=0;s<TRACKFILE_CACHE_SETS;s++) {
+        for (uint8_t w=0;w<TRACKFILE_CACHE_WAYS;w++) {
+            TrackFile_Lines[s][w].Id = 0;
+            TrackFile_Lines[s][w].Data = data;
+            data += TRACKFILE_CACHE_BLOCK_SIZE;
+        }
+    }
+
+    return true;
+}
+
+TrackFile_t *TrackFile_Open(const char *path) { //NULL on failure
+    TrackFile_t *t = heap_caps_malloc(sizeof(TrackFile_t), MALLOC_CAP_8BIT);
+    if (t == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate handle !!");
+        return NULL;
+    }
+    t->File = fopen(path, "r");
+    if (t->File == NULL) {
+        ESP_LOGE(TAG, "Failed to open %s !!", path);
+        free(t);
+        return NULL;
+    }
+    setvbuf(t->File, NULL, _IONBF, 0); //before any io, so stdio never allocates a buffer for it
+    t->Id = TrackFile_NextId++; //anything cached under an older id just ages out
+    if (TrackFile_NextId == 0) TrackFile_NextId = 1;
+    t->Error = false;
+    return t;
+}
+
+void TrackFile_Close(TrackFile_t *t) { //whoever was reading it has to be stopped first
+    if (t == NULL) return;
+    xSemaphoreTake(TrackFile_Lock, portMAX_DELAY); //at least don't close it in the middle of someone's read
+    fclose(t->File);
+    xSemaphoreGive(TrackFile_Lock);
+    free(t);
+}
+
+static size_t TrackFile_ReadRaw(TrackFile_t *t, uint32_t offset, void *buf, size_t len) {
+    size_t ret = 0;
+    if (fseek(t->File, offset, SEEK_SET) == 0) ret = fread(buf, 1, len, t->File);
+    if (ferror(t->File)) {
+        ESP_LOGE(TAG, "Read error at %d !!", offset);
+        clearerr(t->File);
+        t->Error = true;
+    }
+    return ret;
+}
+
+static TrackFileLine_t *TrackFile_Lookup(TrackFile_t *t, uint32_t block) {
+    TrackFileLine_t *set = TrackFile_Lines[block & (TRACKFILE_CACHE_SETS-1)];
+    for (uint8_t w=0;w<TRACKFILE_CACHE_WAYS;w++) {
+        if (set[w].Id == t->Id && set[w].Block == block) {
+            set[w].LastUse = TrackFile_Use++;
+            return &set[w];
+        }
+    }
+    return NULL;
+}
+
+static TrackFileLine_t *TrackFile_Victim(TrackFile_t *t, uint32_t block) { //least recently used line in the block's set, retagged for it
+    TrackFileLine_t *set = TrackFile_Lines[block & (TRACKFILE_CACHE_SETS-1)];
+    TrackFileLine_t *l = &set[0];
+    for (uint8_t w=0;w<TRACKFILE_CACHE_WAYS;w++) {
+        if (set[w].Id != t->Id) { //stale or empty, take it straight away
+            l = &set[w];
+            break;
+        }
+        if (set[w].LastUse < l->LastUse) l = &set[w];
+    }
+    l->Id = t->Id;
+    l->Block = block;
+    l->LastUse = TrackFile_Use++;
+    return l;
+}
+
+size_t TrackFile_Read(TrackFile_t *t, uint32_t offset, void *buf, size_t len) { //returns bytes read, short at eof or on error
+    uint8_t *dst = buf;
+    uint32_t pos = offset;
+    uint32_t end = offset + len;
+    //a streamed vgz is preallocated, so anything past what's been extracted reads back fine but isn't the track yet. the wait
+    //covers the whole block a line gets filled from, so a line is never cached with those bytes in it
+    if (!Unvgz_WaitAvail(end)) {
+        ESP_LOGE(TAG, "Read at %d will never be extracted !!", offset);
+        t->Error = true;
+        return 0;
+    }
+    xSemaphoreTake(TrackFile_Lock, portMAX_DELAY);
+    while (pos < end) {
+        uint32_t block = pos / TRACKFILE_CACHE_BLOCK_SIZE;
+        uint32_t boff = pos % TRACKFILE_CACHE_BLOCK_SIZE;
+        uint32_t n = TRACKFILE_CACHE_BLOCK_SIZE - boff;
+        if (n > end - pos) n = end - pos;
+        TrackFileLine_t *l = TrackFile_Lookup(t, block);
+        if (l) {
+            TrackFile_CacheHits++;
+        } else if (boff == 0 && n == TRACKFILE_CACHE_BLOCK_SIZE) {
+            //whole blocks wanted. read the run of misses straight into the caller's buffer in one go, then copy it into the cache
+            uint32_t run = 1;
+            while (pos + (run+1)*TRACKFILE_CACHE_BLOCK_SIZE <= end && TrackFile_Lookup(t, block+run) == NULL) run++;
+            TrackFile_CacheMisses += run;
+            size_t rd = TrackFile_ReadRaw(t, pos, dst, run*TRACKFILE_CACHE_BLOCK_SIZE);
+            if (!t->Error) {
+                for (uint32_t i=0;i<rd/TRACKFILE_CACHE_BLOCK_SIZE;i++) {
+                    l = TrackFile_Victim(t, block+i);
+                    memcpy(l->Data, &dst[i*TRACKFILE_CACHE_BLOCK_SIZE], TRACKFILE_CACHE_BLOCK_SIZE);
+                    l->Len = TRACKFILE_CACHE_BLOCK_SIZE;
+                }
+            }
+            pos += rd;
+            dst += rd;
+            if (rd < run*TRACKFILE_CACHE_BLOCK_SIZE) break; //eof or error
+            continue;
+        } else {
+            TrackFile_CacheMisses++;
+            l = TrackFile_Victim(t, block);
+            l->Len = TrackFile_ReadRaw(t, block*TRACKFILE_CACHE_BLOCK_SIZE, l->Data, TRACKFILE_CACHE_BLOCK_SIZE);
+            if (t->Error) {
+                l->Id = 0;
+                break;
+            }
+        }
+        if (boff >= l->Len) break; //past eof
+        if (n > l->Len - boff) n = l->Len - boff;
+        memcpy(dst, &l->Data[boff], n);
+        pos += n;
+        dst += n;
+        if (l->Len < TRACKFILE_CACHE_BLOCK_SIZE) break; //that was the last block
+    }
+    xSemaphoreGive(TrackFile_Lock);
+    return pos - offset;
+}
@@ -0,0 +1,29 @@
+#ifndef AGR_TRACKFILE_H
+#define AGR_TRACKFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+//the one open handle on the playing track, shared by the loader, the pcm reader, dacstream find & fill and opna upload
+//reads say where they want to read from, so nobody has to care where anyone else left the file position
+//stdio buffering is off. instead, reads go through a small set-associative block cache shared by everyone, so a region that
+//more than one of them reads (datablocks, mostly - the loader, find task and fill task all go over them) only comes off the card once
+
+typedef struct {
+    FILE *File;         //only use directly before the handle is shared out, eg. parsing at open time
+    uint32_t Id;        //cache tag, unique per open
+    volatile bool Error; //io error on any read. sticky
+} TrackFile_t;
+
+extern volatile uint32_t TrackFile_CacheHits; //in blocks, since the last track started
+extern volatile uint32_t TrackFile_CacheMisses;
+
+bool TrackFile_Setup();
+TrackFile_t *TrackFile_Open(const char *path);
+void TrackFile_Close(TrackFile_t *t);
+size_t TrackFile_Read(TrackFile_t *t, uint32_t offset, void *buf, size_t len);
+
+#endif
@@ -11,6 +11,8 @@
 #include "../driver.h"
 #include "../mallocs.h"
 #include "../dacstream.h"
+#include "../loader.h"
+#include "../trackfile.h"
 
 static const char* TAG = "Ui_Debug";
 
@@ -20,11 +22,11 @@ static IRAM_ATTR lv_obj_t *tasklabel;
 static lv_style_t tasklabel_style;
 static IRAM_ATTR lv_obj_t *driverbuflabel;
 static IRAM_ATTR lv_obj_t *heaplabel;
+static IRAM_ATTR lv_obj_t *cachelabel;
 static IRAM_ATTR lv_obj_t *dslabel;
 static lv_style_t bar_style;
 static lv_style_t bar_style_idle;
 static IRAM_ATTR lv_obj_t *driverbuf;
-static IRAM_ATTR lv_obj_t *driverbufpcm;
 static IRAM_ATTR lv_obj_t *ds[DACSTREAM_PRE_COUNT];
 static char tasklabel_buf[(50*TASK_COUNT)+50];
 static TaskStatus_t taskstatus[TASK_COUNT+6]; //6 = IDLE0, IDLE1, Tmr Svc, ipc0, ipc1, esp_timer
@@ -35,7 +37,9 @@ static IRAM_ATTR uint32_t tasklastruntime[TASK_COUNT+6];
 static IRAM_ATTR uint32_t tasklasttrt = 0;
 static char heapbuf[100] = "";
 static char drvbuf[100] = "";
-static char samplebuf1[50] = "";
+static char cachebuf[100] = "";
+static char dsbuf[50+DACSTREAM_PRE_COUNT] = "";
+static char samplebuf1[75] = "";
 static char samplebuf2[75] = "";
 static IRAM_ATTR lv_obj_t *samplelabel1;
 static IRAM_ATTR lv_obj_t *samplelabel2;
@@ -54,13 +58,15 @@ static void draw() {
     LcdDma_Mutex_Take(pdMS_TO_TICKS(1000));
 
     uint16_t d = MegaStream_Used(&Driver_CommandStream);
-    uint16_t p = MegaStream_Used(&Driver_PcmStream);
-    sprintf(drvbuf, "#00007f DrvBuf# %5d/%5d #00007f PCM# %5d/%5d", d, DRIVER_QUEUE_SIZE, p, DRIVER_QUEUE_SIZE);
+    sprintf(drvbuf, "#00007f DrvBuf# %5d/%5d #00007f und# %d #00007f rm# %d", d, DRIVER_QUEUE_SIZE, Driver_CommandUnderruns, Loader_GetReadMisses());
     lv_label_set_static_text(driverbuflabel, drvbuf);
     lv_obj_set_size(driverbuf, map(d,0,DRIVER_QUEUE_SIZE,0,240), 1);
     lv_label_set_static_text(driverbuflabel, drvbuf);
-    lv_obj_set_size(driverbufpcm, map(p,0,DRIVER_QUEUE_SIZE,0,240), 1);
-    sprintf(samplebuf1, "#00007f Driver cur sample:# %d", Driver_Sample);
+    uint32_t hits = TrackFile_CacheHits;
+    uint32_t misses = TrackFile_CacheMisses;
+    sprintf(cachebuf, "#00007f Blk cache hit# %d #00007f miss# %d #00007f (%d%%)#", hits, misses, (hits+misses)?(hits*100/(hits+misses)):0);
+    lv_label_set_static_text(cachelabel, cachebuf);
+    sprintf(samplebuf1, "#00007f Driver cur sample:# %d #00007f dedup# %d", Driver_Sample, Driver_WritesSaved);
     lv_label_set_static_text(samplelabel1, samplebuf1);
     uint32_t s = Driver_Sample;
     uint32_t ns = Driver_NextSample+1;
@@ -75,9 +81,19 @@ static void draw() {
     }
     lv_label_set_static_text(samplelabel2, samplebuf2);
 
+    //per-slot underruns, one digit each
+    char *dp = dsbuf + sprintf(dsbuf, "#00007f DAC Streams# und ");
     for (uint8_t i=0;i<DACSTREAM_PRE_COUNT;i++) {
-        lv_obj_set_style(ds[i], (i==DacStreamId)?&bar_style:&bar_style_idle);
-        lv_obj_set_size(ds[i], map(MegaStream_Used((MegaStreamContext_t *)&DacStreamEntries[i].Stream), 0, DACSTREAM_BUF_SIZE, 0, 240), 1);
+        uint32_t u = DacStreamEntries[i].Underruns;
+        *dp++ = (u>9)?'+':('0'+u);
+    }
+    *dp = 0;
+    lv_label_set_static_text(dslabel, dsbuf);
+
+    for (uint8_t i=0;i<DACSTREAM_PRE_COUNT;i++) {
+        lv_obj_set_style(ds[i], Driver_DsSlotPlaying(i)?&bar_style:&bar_style_idle);
+        uint32_t sz = DacStreamEntries[i].BufSize; //each slot's stream is its own size now
+        lv_obj_set_size(ds[i], sz?map(MegaStream_Used((MegaStreamContext_t *)&DacStreamEntries[i].Stream), 0, sz, 0, 240):0, 1);
     }
 
     LcdDma_Mutex_Give();
@@ -171,13 +187,13 @@ void Ui_Debug_Setup(lv_obj_t *uiscreen) {
     lv_obj_set_size(driverbuf, 240, 1);
     lv_obj_set_style(driverbuf, &bar_style);
 
-    y += 1; //spacer
+    y += 2; //spacer
 
-    driverbufpcm = lv_obj_create(container, NULL);
-    lv_obj_set_pos(driverbufpcm, 0, y-1);
-    y += 1;
-    lv_obj_set_size(driverbufpcm, 240, 1);
-    lv_obj_set_style(driverbufpcm, &bar_style);
+    cachelabel = lv_label_create(container, NULL);
+    lv_obj_set_pos(cachelabel, 1, y);
+    y += 9;
+    lv_label_set_style(cachelabel, LV_LABEL_STYLE_MAIN, &tasklabel_style);
+    lv_label_set_recolor(cachelabel, true);
 
     samplelabel1 = lv_label_create(container, NULL);
     lv_obj_set_pos(samplelabel1, 1, y);
@@ -11,6 +11,7 @@
 #include "../userled.h" //for user led source defs
 #include "filebrowser.h" //for sort dir defs
 #include "../driver.h" //to know what megamod we have
+#include "../mallocs.h" //for vgz cache size unit
 #include <string.h>
 
 static IRAM_ATTR lv_obj_t *container;
@@ -175,6 +176,13 @@ static void displayvalue(char *buf, bool def) {
                             break;
                     }
                     break;
+                case OPTION_SUBTYPE_CACHESIZE:
+                    if (val) {
+                        sprintf(buf, "%d MB", val*UNVGZ_CACHE_UNIT_MB);
+                    } else {
+                        strcpy(buf, "Off");
+                    }
+                    break;
                 default:
                     strcpy(buf, "OPTION_TYPE_NUMERIC");
                     break;
@@ -313,6 +321,17 @@ static void changevalue(bool inc) {
                         }
                     }
                     break;
+                case OPTION_SUBTYPE_CACHESIZE:
+                    if (inc) {
+                        if (*var < 32) {
+                            *var += 1;
+                        }
+                    } else {
+                        if (*var > 0) {
+                            *var -= 1;
+                        }
+                    }
+                    break;
                 default:
                     //uh oh
                     break;
@@ -0,0 +1,408 @@
+#include "unvgz.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "rom/miniz.h"
+#include "taskmgr.h"
+#include "mallocs.h"
+#include <rom/crc.h>
+#include <unistd.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+static const char* TAG = "Unvgz";
+
+volatile uint8_t Unvgz_State = UNVGZ_IDLE;
+static volatile uint32_t Unvgz_Avail = 0; //bytes at the start of the output file that are written out and safe to read
+static volatile bool Unvgz_Abort = false;
+static uint32_t Unvgz_Size = 0; //final output size, from the gzip trailer
+static FILE *Unvgz_Reader = NULL;
+static FILE *Unvgz_Writer = NULL;
+static tinfl_decompressor *Unvgz_Decomp = NULL;
+static uint8_t *Unvgz_InBuf = NULL;
+static uint8_t *Unvgz_OutBuf = NULL; //one lz dictionary, written out every time it fills up
+static const uint8_t *Unvgz_InNext;
+static size_t Unvgz_InAvail;
+static size_t Unvgz_InRemaining;
+static char Unvgz_Dest[UNVGZ_CACHE_PATH_LEN];
+
+typedef struct {
+    uint32_t PathCrc;   //of the vgz's path
+    uint32_t StatCrc;   //of the vgz's size and mtime, so an edited file doesn't get stale data
+    uint32_t Size;      //extracted size
+    uint32_t LastUse;
+} UnvgzCacheEntry_t;
+
+volatile uint8_t Unvgz_CacheSize = 8;
+static const char Unvgz_CacheDir[] = "/sd/.mega/unvgz";
+static const char Unvgz_CacheIndex[] = "/sd/.mega/unvgz/index.bin";
+#define UNVGZ_CACHE_VER 1
+static UnvgzCacheEntry_t Unvgz_CacheEntries[UNVGZ_CACHE_MAX_ENTRIES];
+static uint8_t Unvgz_CacheCount = 0;
+static uint32_t Unvgz_CacheUse = 0; //next LastUse value
+static UnvgzCacheEntry_t Unvgz_CacheKey; //entry for what's being extracted, when Unvgz_Dest is in the cache
+static bool Unvgz_Caching = false;
+
+//a reader may pull in a little more than it asked for, through the stdio buffer or fatfs' sector window. keep it all below what's been written
+#define UNVGZ_READ_SLACK 1024
+
+bool Unvgz_SkipGzipHeader(FILE *reader, size_t *in_remaining) { //leaves reader at the start of the deflate stream
+    uint8_t hdr[10];
+
+    //get compressed size
+    fseek(reader, 0, SEEK_END);
+    *in_remaining = ftell(reader) - 18; //18 = base gzip header size + crc32 & isize at end
+
+    //read in the header to do flags check
+    fseek(reader, 0, SEEK_SET);
+    if (fread(hdr, 1, 10, reader) != 10) return false;
+    uint8_t gzip_flags = hdr[3];
+    ESP_LOGI(TAG, "gzip flags: %02x", gzip_flags);
+    if (gzip_flags & (1<<2)) { //FEXTRA
+        uint16_t xlen = 0;
+        fread(&xlen, 1, 2, reader);
+        fseek(reader, xlen, SEEK_CUR);
+        *in_remaining -= 2 + xlen;
+    }
+    uint8_t z = 0xff;
+    if (gzip_flags & (1<<3)) { //FNAME
+        do {
+            fread(&z, 1, 1, reader);
+            *in_remaining -= 1;
+        } while (z && !feof(reader));
+    }
+    if (gzip_flags & (1<<4)) { //FCOMMENT
+        do {
+            fread(&z, 1, 1, reader);
+            *in_remaining -= 1;
+        } while (z && !feof(reader));
+    }
+    if (gzip_flags & (1<<1)) { //FHCRC
+        fseek(reader, 2, SEEK_CUR);
+        *in_remaining -= 2;
+    }
+
+    return !ferror(reader) && !feof(reader);
+}
+
+static void Unvgz_CacheName(const UnvgzCacheEntry_t *e, char *buf) {
+    sprintf(buf, "%s/%08x%08x.vgm", Unvgz_CacheDir, e->PathCrc, e->StatCrc);
+}
+
+static void Unvgz_CacheWipe() { //index lost, so anything in the directory is unaccounted for
+    ESP_LOGW(TAG, "Wiping cache");
+    DIR *dir = opendir(Unvgz_CacheDir);
+    if (!dir) return;
+    char path[UNVGZ_CACHE_PATH_LEN];
+    struct dirent *ent;
+    while ((ent=readdir(dir))!=NULL) {
+        if (ent->d_type != DT_REG || strlen(Unvgz_CacheDir)+1+strlen(ent->d_name) >= sizeof(path)) continue;
+        sprintf(path, "%s/%s", Unvgz_CacheDir, ent->d_name);
+        remove(path);
+    }
+    closedir(dir);
+}
+
+static void Unvgz_CacheLoad() { //read the index fresh each time, it's tiny and the card may have been swapped since last time
+    Unvgz_CacheCount = 0;
+    Unvgz_CacheUse = 0;
+    DIR *test = opendir(Unvgz_CacheDir);
+    if (!test) {
+        ESP_LOGW(TAG, "Cache dir doesn't exist, creating");
+        mkdir(Unvgz_CacheDir, S_IRWXU);
+        return;
+    }
+    closedir(test);
+    FILE *f = fopen(Unvgz_CacheIndex, "r");
+    if (!f) {
+        Unvgz_CacheWipe();
+        return;
+    }
+    uint8_t ver = 0;
+    uint8_t count = 0;
+    fread(&ver, 1, 1, f);
+    fread(&count, 1, 1, f);
+    if (ver != UNVGZ_CACHE_VER || count > UNVGZ_CACHE_MAX_ENTRIES || fread(Unvgz_CacheEntries, sizeof(UnvgzCacheEntry_t), count, f) != count) {
+        ESP_LOGW(TAG, "Bad cache index");
+        fclose(f);
+        Unvgz_CacheWipe();
+        return;
+    }
+    fclose(f);
+    Unvgz_CacheCount = count;
+    for (uint8_t i=0;i<count;i++) {
+        if (Unvgz_CacheEntries[i].LastUse >= Unvgz_CacheUse) Unvgz_CacheUse = Unvgz_CacheEntries[i].LastUse+1;
+    }
+}
+
+static void Unvgz_CacheSave() {
+    FILE *f = fopen(Unvgz_CacheIndex, "w");
+    if (!f) {
+        ESP_LOGE(TAG, "Couldn't write cache index !!");
+        return;
+    }
+    uint8_t hdr[2] = {UNVGZ_CACHE_VER, Unvgz_CacheCount};
+    fwrite(hdr, 1, 2, f);
+    fwrite(Unvgz_CacheEntries, sizeof(UnvgzCacheEntry_t), Unvgz_CacheCount, f);
+    if (ferror(f)) ESP_LOGE(TAG, "Couldn't write cache index !!");
+    fclose(f);
+}
+
+static void Unvgz_CacheRemove(uint8_t idx) {
+    char path[UNVGZ_CACHE_PATH_LEN];
+    Unvgz_CacheName(&Unvgz_CacheEntries[idx], path);
+    ESP_LOGI(TAG, "Evicting %s", path);
+    remove(path);
+    Unvgz_CacheEntries[idx] = Unvgz_CacheEntries[--Unvgz_CacheCount];
+}
+
+static bool Unvgz_CacheMakeRoom(uint32_t size) { //evict least recently used entries until size more bytes fit in the budget
+    uint64_t budget = (uint64_t)Unvgz_CacheSize*UNVGZ_CACHE_UNIT_MB*1024*1024;
+    if (size > budget) return false;
+    Unvgz_CacheLoad();
+    uint64_t total = size;
+    for (uint8_t i=0;i<Unvgz_CacheCount;i++) total += Unvgz_CacheEntries[i].Size;
+    bool changed = false;
+    while (Unvgz_CacheCount && (total > budget || Unvgz_CacheCount == UNVGZ_CACHE_MAX_ENTRIES)) {
+        uint8_t lru = 0;
+        for (uint8_t i=1;i<Unvgz_CacheCount;i++) {
+            if (Unvgz_CacheEntries[i].LastUse < Unvgz_CacheEntries[lru].LastUse) lru = i;
+        }
+        total -= Unvgz_CacheEntries[lru].Size;
+        Unvgz_CacheRemove(lru);
+        changed = true;
+    }
+    if (changed) Unvgz_CacheSave();
+    return true;
+}
+
+static void Unvgz_CacheAdd() { //Unvgz_CacheKey finished extracting
+    Unvgz_CacheLoad();
+    if (Unvgz_CacheCount == UNVGZ_CACHE_MAX_ENTRIES) return; //only if something else filled it up meanwhile. just leave the file, it gets wiped with the next bad index
+    Unvgz_CacheKey.Size = Unvgz_Size;
+    Unvgz_CacheKey.LastUse = Unvgz_CacheUse++;
+    Unvgz_CacheEntries[Unvgz_CacheCount++] = Unvgz_CacheKey;
+    Unvgz_CacheSave();
+    ESP_LOGI(TAG, "Cached, %d entries", Unvgz_CacheCount);
+}
+
+//looks Src up in the cache. on a hit, CachePath is the extracted vgm, ready to play. on a miss, it's where to extract to with Unvgz_Start
+//CachePath is empty if caching is off or Src can't be keyed
+bool Unvgz_CacheFind(const char *Src, char *CachePath) {
+    CachePath[0] = 0;
+    if (Unvgz_CacheSize == 0) return false;
+    struct stat st;
+    if (stat(Src, &st) != 0) return false;
+    UnvgzCacheEntry_t key;
+    key.PathCrc = crc32_le(0, (const uint8_t *)Src, strlen(Src));
+    uint32_t sz = st.st_size;
+    uint32_t mt = st.st_mtime;
+    key.StatCrc = crc32_le(crc32_le(0, (const uint8_t *)&sz, 4), (const uint8_t *)&mt, 4);
+    Unvgz_CacheName(&key, CachePath);
+
+    Unvgz_CacheLoad();
+    for (uint8_t i=0;i<Unvgz_CacheCount;i++) {
+        UnvgzCacheEntry_t *e = &Unvgz_CacheEntries[i];
+        if (e->PathCrc == key.PathCrc && e->StatCrc == key.StatCrc) {
+            if (stat(CachePath, &st) != 0 || st.st_size != e->Size) { //deleted or truncated behind our back
+                ESP_LOGW(TAG, "Cache entry %s is bad", CachePath);
+                Unvgz_CacheRemove(i);
+                Unvgz_CacheSave();
+                return false;
+            }
+            e->LastUse = Unvgz_CacheUse++;
+            Unvgz_CacheSave();
+            ESP_LOGI(TAG, "Cache hit %s", CachePath);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void Unvgz_Cleanup() {
+    if (Unvgz_Reader) fclose(Unvgz_Reader);
+    if (Unvgz_Writer) fclose(Unvgz_Writer);
+    if (Unvgz_Decomp) free(Unvgz_Decomp);
+    if (Unvgz_InBuf) free(Unvgz_InBuf);
+    if (Unvgz_OutBuf) free(Unvgz_OutBuf);
+    Unvgz_Reader = NULL;
+    Unvgz_Writer = NULL;
+    Unvgz_Decomp = NULL;
+    Unvgz_InBuf = NULL;
+    Unvgz_OutBuf = NULL;
+}
+
+static uint8_t Unvgz_Step() { //inflate one dictionary's worth and write it out. returns the new state
+    size_t out_pos = 0;
+    tinfl_status status;
+    do {
+        if (!Unvgz_InAvail && Unvgz_InRemaining) {
+            size_t rd = (Unvgz_InRemaining<UNVGZ_IN_BUF_SIZE)?Unvgz_InRemaining:UNVGZ_IN_BUF_SIZE;
+            if (fread(Unvgz_InBuf, 1, rd, Unvgz_Reader) != rd) {
+                ESP_LOGE(TAG, "read fail !!");
+                return UNVGZ_FAILED;
+            }
+            Unvgz_InNext = Unvgz_InBuf;
+            Unvgz_InAvail = rd;
+            Unvgz_InRemaining -= rd;
+        }
+        size_t in_bytes = Unvgz_InAvail;
+        size_t out_bytes = TINFL_LZ_DICT_SIZE - out_pos;
+        status = tinfl_decompress(Unvgz_Decomp, Unvgz_InNext, &in_bytes, Unvgz_OutBuf, &Unvgz_OutBuf[out_pos], &out_bytes, Unvgz_InRemaining?TINFL_FLAG_HAS_MORE_INPUT:0);
+        Unvgz_InAvail -= in_bytes;
+        Unvgz_InNext += in_bytes;
+        out_pos += out_bytes;
+    } while (status > TINFL_STATUS_DONE && out_pos < TINFL_LZ_DICT_SIZE);
+
+    if (status < TINFL_STATUS_DONE) {
+        ESP_LOGE(TAG, "decomp fail %d", status);
+        return UNVGZ_FAILED;
+    }
+    if (Unvgz_Avail + out_pos > Unvgz_Size) {
+        ESP_LOGE(TAG, "output bigger than the gzip trailer says !!");
+        return UNVGZ_FAILED;
+    }
+
+    //flush all the way down to the card before anyone is allowed to read it
+    fwrite(Unvgz_OutBuf, 1, out_pos, Unvgz_Writer);
+    fflush(Unvgz_Writer);
+    fsync(fileno(Unvgz_Writer));
+    if (ferror(Unvgz_Writer)) {
+        ESP_LOGE(TAG, "write fail !!");
+        return UNVGZ_FAILED;
+    }
+    Unvgz_Avail += out_pos;
+
+    if (status == TINFL_STATUS_DONE) {
+        ESP_LOGI(TAG, "decomp ok, %d bytes", Unvgz_Avail);
+        return UNVGZ_DONE;
+    }
+    return UNVGZ_RUNNING;
+}
+
+//returns once the start of Dest is readable, with the rest being extracted in the background. false if it couldn't be set up, in which case the caller should extract the old way
+bool Unvgz_Start(const char *Src, const char *Dest) {
+    Unvgz_Stop();
+    ESP_LOGI(TAG, "Streaming %s to %s", Src, Dest);
+
+    //cache paths carry their own key, see Unvgz_CacheName
+    size_t dirlen = strlen(Unvgz_CacheDir);
+    Unvgz_Caching = strlen(Dest) < sizeof(Unvgz_Dest) && strncmp(Dest, Unvgz_CacheDir, dirlen) == 0 && Dest[dirlen] == '/'
+        && sscanf(&Dest[dirlen+1], "%8x%8x", &Unvgz_CacheKey.PathCrc, &Unvgz_CacheKey.StatCrc) == 2;
+    if (Unvgz_Caching) strcpy(Unvgz_Dest, Dest);
+
+    Unvgz_Reader = fopen(Src, "r");
+    if (!Unvgz_Reader) {
+        ESP_LOGE(TAG, "open fail !!");
+        Unvgz_Caching = false;
+        return false;
+    }
+
+    //isize from the trailer, so the output can be allocated up front. anything that opens it later sees the final size
+    Unvgz_Size = 0;
+    fseek(Unvgz_Reader, -4, SEEK_END);
+    fread(&Unvgz_Size, 4, 1, Unvgz_Reader);
+    if (!Unvgz_SkipGzipHeader(Unvgz_Reader, &Unvgz_InRemaining) || Unvgz_Size == 0) {
+        ESP_LOGE(TAG, "bad gzip header !!");
+        Unvgz_Cleanup();
+        Unvgz_Caching = false;
+        return false;
+    }
+    ESP_LOGI(TAG, "Output size %d", Unvgz_Size);
+    if (Unvgz_Caching && !Unvgz_CacheMakeRoom(Unvgz_Size)) {
+        ESP_LOGW(TAG, "Too big for the cache");
+        Unvgz_Cleanup();
+        Unvgz_Caching = false;
+        return false;
+    }
+    Unvgz_Writer = fopen(Dest, "w");
+    if (!Unvgz_Writer) {
+        ESP_LOGE(TAG, "open fail !!");
+        Unvgz_Cleanup();
+        Unvgz_Caching = false;
+        return false;
+    }
+    fseek(Unvgz_Writer, Unvgz_Size-1, SEEK_SET);
+    fputc(0, Unvgz_Writer);
+    fflush(Unvgz_Writer);
+    fsync(fileno(Unvgz_Writer));
+    fseek(Unvgz_Writer, 0, SEEK_SET);
+    if (ferror(Unvgz_Writer)) {
+        ESP_LOGE(TAG, "preallocate fail !!");
+        Unvgz_Cleanup();
+        remove(Dest);
+        Unvgz_Caching = false;
+        return false;
+    }
+
+    Unvgz_Decomp = heap_caps_malloc(sizeof(tinfl_decompressor), MALLOC_CAP_8BIT);
+    Unvgz_InBuf = heap_caps_malloc(UNVGZ_IN_BUF_SIZE, MALLOC_CAP_8BIT);
+    Unvgz_OutBuf = heap_caps_malloc(TINFL_LZ_DICT_SIZE, MALLOC_CAP_8BIT);
+    if (!Unvgz_Decomp || !Unvgz_InBuf || !Unvgz_OutBuf) {
+        ESP_LOGW(TAG, "Not enough memory to stream");
+        Unvgz_Cleanup();
+        remove(Dest);
+        Unvgz_Caching = false;
+        return false;
+    }
+
+    tinfl_init(Unvgz_Decomp);
+    Unvgz_InAvail = 0;
+    Unvgz_Avail = 0;
+    Unvgz_Abort = false;
+    Unvgz_State = UNVGZ_RUNNING;
+    xTaskNotifyGive(Taskmgr_Handles[TASK_UNVGZ]);
+
+    if (!Unvgz_WaitAvail(0)) { //the first dictionary's worth covers the header
+        Unvgz_Stop();
+        return false;
+    }
+    return true;
+}
+
+//aborts any extraction still in progress. returns how the last one ended (UNVGZ_IDLE if there wasn't one), and goes back to idle
+//cache bookkeeping happens here rather than in the task, so the index is only ever touched from the player's side
+uint8_t Unvgz_Stop() {
+    if (Unvgz_State == UNVGZ_RUNNING) {
+        ESP_LOGW(TAG, "Aborting extraction");
+        Unvgz_Abort = true;
+        while (Unvgz_State == UNVGZ_RUNNING) vTaskDelay(pdMS_TO_TICKS(10));
+        Unvgz_State = UNVGZ_FAILED;
+    }
+    uint8_t ret = Unvgz_State;
+    Unvgz_State = UNVGZ_IDLE;
+    if (Unvgz_Caching) {
+        if (ret == UNVGZ_DONE) {
+            Unvgz_CacheAdd();
+        } else if (ret == UNVGZ_FAILED) {
+            remove(Unvgz_Dest); //don't leave a partial file behind
+        }
+        Unvgz_Caching = false;
+    }
+    return ret;
+}
+
+bool Unvgz_WaitAvail(uint32_t end) { //blocks until everything before end can be read from the output. false if that's never going to happen
+    if (Unvgz_State == UNVGZ_IDLE) return true; //not streaming anything, files are complete
+    end += UNVGZ_READ_SLACK;
+    if (end > Unvgz_Size) end = Unvgz_Size;
+    while (Unvgz_Avail < end) {
+        if (Unvgz_State != UNVGZ_RUNNING) return false;
+        vTaskDelay(pdMS_TO_TICKS(5));
+    }
+    return true;
+}
+
+void Unvgz_Main() {
+    ESP_LOGI(TAG, "Task start");
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        while (Unvgz_State == UNVGZ_RUNNING) {
+            uint8_t s = Unvgz_Abort?UNVGZ_IDLE:Unvgz_Step();
+            if (s != UNVGZ_RUNNING) {
+                Unvgz_Cleanup();
+                Unvgz_State = s;
+            }
+        }
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef AGR_UNVGZ_H
+#define AGR_UNVGZ_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+
+//streaming vgz extraction. the output file is preallocated to its final size, then filled in by the unvgz task while the track plays
+//anything reading it has to call Unvgz_WaitAvail first for data past the first chunk - TrackFile_Read does for everything going through it
+//extracting into a path from Unvgz_CacheFind keeps the result in the cache directory, which is trimmed back to the size option least recently used first
+
+#define UNVGZ_CACHE_PATH_LEN 48
+
+enum {
+    UNVGZ_IDLE,
+    UNVGZ_RUNNING,
+    UNVGZ_DONE,
+    UNVGZ_FAILED,
+};
+
+extern volatile uint8_t Unvgz_State;
+extern volatile uint8_t Unvgz_CacheSize; //in UNVGZ_CACHE_UNIT_MB, 0 = off
+
+bool Unvgz_SkipGzipHeader(FILE *reader, size_t *in_remaining);
+bool Unvgz_Start(const char *Src, const char *Dest);
+uint8_t Unvgz_Stop();
+bool Unvgz_WaitAvail(uint32_t end);
+void Unvgz_Main();
+bool Unvgz_CacheFind(const char *Src, char *CachePath);
+
+#endif
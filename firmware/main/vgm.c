@@ -1,6 +1,8 @@
 #include "vgm.h"
 #include "esp_log.h"
 #include "math.h"
+#include "unvgz.h"
+#include <string.h>
 
 static const char* TAG = "Vgm";
 
@@ -123,22 +125,22 @@ bool VgmParseDataBlocks(FILE *f, VgmInfoStruct_t *info, VgmDataBlockStruct_t *bl
     return false;
 }
 
-bool VgmParseDataBlock(FILE *f, VgmDataBlockStruct_t *block) {
-    fseek(f,1,SEEK_CUR); //skip 0x66
-    fread(&block->Type,1,1,f);
-    fread(&block->Size,4,1,f);
+bool VgmParseDataBlock(VgmReader_t *r, VgmDataBlockStruct_t *block) {
+    VgmReader_Skip(r, 1); //skip 0x66
+    block->Type = VgmReader_Read8(r);
+    block->Size = VgmReader_Read32(r);
     uint8_t seekoff = 0;
     if (block->Type <= 0x3f) { //uncompressed data
         //nothing fancy to do here...
         seekoff = 0;
         ESP_LOGI(TAG, "Parsed uncompressed datablock: type %02x, size %d", block->Type, block->Size);
     } else if (block->Type <= 0x7e) { //compressed data
-        fread(&block->CompressionType,1,1,f);
-        fread(&block->UncompressedSize,4,1,f);
-        fread(&block->BitsDecompressed,1,1,f);
-        fread(&block->BitsCompressed,1,1,f);
-        fread(&block->Subtype,1,1,f);
-        fread(&block->CompValue,2,1,f);
+        block->CompressionType = VgmReader_Read8(r);
+        block->UncompressedSize = VgmReader_Read32(r);
+        block->BitsDecompressed = VgmReader_Read8(r);
+        block->BitsCompressed = VgmReader_Read8(r);
+        block->Subtype = VgmReader_Read8(r);
+        block->CompValue = VgmReader_Read16(r);
         if (block->CompressionType == 0x01 && block->Subtype != 0) {
             ESP_LOGE(TAG, "Error parsing datablock: DPCM subtype != 0");
             return false;
@@ -146,31 +148,134 @@ bool VgmParseDataBlock(FILE *f, VgmDataBlockStruct_t *block) {
         seekoff = 10;
         ESP_LOGI(TAG, "Parsed compressed datablock: type %02x, size %d, compression type %02x, uncompressed size %d, bitsD %d, bitsC %d, subtype %02x, CompValue %d", block->Type, block->Size, block->CompressionType, block->UncompressedSize, block->BitsDecompressed, block->BitsCompressed, block->Subtype, block->CompValue);
     } else if (block->Type == 0x7f) {
-        fread(&block->CompressionType,1,1,f);
-        fread(&block->Subtype,1,1,f);
-        fread(&block->BitsDecompressed,1,1,f);
-        fread(&block->BitsCompressed,1,1,f);
-        fread(&block->CompValue,2,1,f);
+        block->CompressionType = VgmReader_Read8(r);
+        block->Subtype = VgmReader_Read8(r);
+        block->BitsDecompressed = VgmReader_Read8(r);
+        block->BitsCompressed = VgmReader_Read8(r);
+        block->CompValue = VgmReader_Read16(r);
         seekoff = 6;
         ESP_LOGI(TAG, "Parsed datablock decompression table: size %d, comp type %02x, subtype %02x, bitsD %d, bitsC %d, CompValue %d", block->Size, block->CompressionType, block->Subtype, block->BitsDecompressed, block->BitsCompressed, block->CompValue);
     } else if (block->Type == 0x81) {
-        fread(&block->RomSize,4,1,f);
-        fread(&block->StartAddress,4,1,f);
+        block->RomSize = VgmReader_Read32(r);
+        block->StartAddress = VgmReader_Read32(r);
         seekoff = 8;
         ESP_LOGI(TAG, "Parsed OPNA ADPCM datablock: rom size %d, offset %d, adpcm data size %d", block->RomSize, block->StartAddress, block->Size-8);
     } else if (block->Type == 0xc1) {
-        fread(&block->StartAddress,4,1,f);
+        block->StartAddress = VgmReader_Read32(r);
         seekoff = 4;
         ESP_LOGI(TAG, "Parsed RF5C164 datablock: offset %d, size %d", block->StartAddress, block->Size-4);
     } else {
         seekoff = 0;
         ESP_LOGW(TAG, "Found unsupported datablock");
     }
-    block->Offset = ftell(f);
-    if (feof(f)) {
-        ESP_LOGE(TAG, "Eof parsing datablock !!");
+    block->Offset = r->Pos;
+    if (r->Error) {
+        ESP_LOGE(TAG, "Error parsing datablock !!");
         return false;
     }
-    fseek(f,block->Size - seekoff,SEEK_CUR); //skip to end of block
+    //the data gets read later by the pcm reader, dacstream fill and opna upload. TrackFile_Read would wait for it too, but the driver
+    //task shouldn't end up sleeping on the extraction, so it has to be on the card before anyone hears about the block
+    if (!Unvgz_WaitAvail(block->Offset + block->Size - seekoff)) {
+        ESP_LOGE(TAG, "Datablock data never got extracted !!");
+        r->Error = true;
+        return false;
+    }
+    VgmReader_Skip(r, block->Size - seekoff); //skip to end of block. no io, the reader only refills when something's actually read
     return true;
-}
\ No newline at end of file
+}
+static uint32_t VgmReadU24(VgmReader_t *r) {
+    uint32_t v = VgmReader_Read16(r);
+    v |= (uint32_t)VgmReader_Read8(r)<<16;
+    return v;
+}
+
+bool VgmParsePcmRamWrite(VgmReader_t *r, VgmPcmRamWriteStruct_t *write) { //cursor just after the 0x68
+    VgmReader_Skip(r, 1); //skip 0x66
+    write->Type = VgmReader_Read8(r);
+    write->ReadOffset = VgmReadU24(r);
+    write->WriteOffset = VgmReadU24(r);
+    write->Size = VgmReadU24(r);
+    if (write->Size == 0) write->Size = 0x1000000; //per spec
+    return !r->Error;
+}
+
+void VgmBankIndex_Reset(VgmBankIndex_t *idx) {
+    memset(idx->BankOf, 0xff, sizeof(idx->BankOf));
+    idx->BankCount = 0;
+    idx->EntryCount = 0;
+}
+
+uint8_t VgmDataBlockBank(uint8_t Type) { //compressed blocks decompress into the same bank as their uncompressed type
+    if (Type >= 0x40 && Type <= 0x7e) return Type - 0x40;
+    return Type;
+}
+
+bool VgmBankIndex_Add(VgmBankIndex_t *idx, const VgmDataBlockStruct_t *block, const uint8_t *data) { //call in file order. data = decompressed copy, if any
+    if (idx->EntryCount == MAX_REALTIME_DATABLOCKS) {
+        ESP_LOGE(TAG, "Bank index full !!");
+        return false;
+    }
+    uint8_t type = VgmDataBlockBank(block->Type);
+    bool compressed = type != block->Type;
+    uint32_t size = compressed?block->UncompressedSize:block->Size;
+    uint8_t b = idx->BankOf[type];
+    if (b == 0xff) {
+        b = idx->BankCount++;
+        idx->BankOf[type] = b;
+        idx->Banks[b].First = idx->EntryCount;
+        idx->Banks[b].Count = 0;
+        idx->Banks[b].Total = 0;
+    }
+    VgmBank_t *bank = &idx->Banks[b];
+    //make room at the end of this bank. only happens while datablocks are being parsed, never on the lookup path
+    uint8_t e = bank->First + bank->Count;
+    memmove(&idx->Entries[e+1], &idx->Entries[e], (idx->EntryCount - e)*sizeof(VgmBankEntry_t));
+    for (uint8_t i=0;i<idx->BankCount;i++) {
+        if (i != b && idx->Banks[i].First >= e) idx->Banks[i].First++;
+    }
+    idx->Entries[e].Start = bank->Total;
+    idx->Entries[e].Size = size;
+    idx->Entries[e].Offset = (compressed && data == NULL)?0xffffffff:block->Offset;
+    idx->Entries[e].Data = data;
+    bank->Total += size;
+    bank->Count++;
+    idx->EntryCount++;
+    return true;
+}
+
+const VgmBankEntry_t *VgmBankIndex_Find(const VgmBankIndex_t *idx, uint8_t BankType, uint32_t BankOff) { //block containing BankOff, NULL if none or it's unusable
+    uint8_t b = idx->BankOf[BankType];
+    if (b == 0xff || BankOff >= idx->Banks[b].Total) return NULL;
+    //find the last block starting at or before BankOff
+    const VgmBankEntry_t *e = &idx->Entries[idx->Banks[b].First];
+    uint8_t lo = 0;
+    uint8_t hi = idx->Banks[b].Count-1;
+    while (lo < hi) {
+        uint8_t mid = (lo+hi+1)/2;
+        if (e[mid].Start <= BankOff) {
+            lo = mid;
+        } else {
+            hi = mid-1;
+        }
+    }
+    if (e[lo].Data == NULL && e[lo].Offset == 0xffffffff) return NULL;
+    return &e[lo];
+}
+
+uint32_t VgmBankIndex_GetDataOffset(const VgmBankIndex_t *idx, uint8_t BankType, uint32_t BankOff) { //file offset, only meaningful for blocks without Data
+    const VgmBankEntry_t *e = VgmBankIndex_Find(idx, BankType, BankOff);
+    if (e == NULL) return 0xffffffff;
+    return e->Offset + (BankOff - e->Start);
+}
+
+uint32_t VgmBankIndex_GetBlockOffset(const VgmBankIndex_t *idx, uint8_t BankType, uint16_t BlockId) {
+    uint8_t b = idx->BankOf[BankType];
+    if (b == 0xff || BlockId >= idx->Banks[b].Count) return 0xffffffff;
+    return idx->Entries[idx->Banks[b].First + BlockId].Start;
+}
+
+uint32_t VgmBankIndex_GetBlockSize(const VgmBankIndex_t *idx, uint8_t BankType, uint16_t BlockId) {
+    uint8_t b = idx->BankOf[BankType];
+    if (b == 0xff || BlockId >= idx->Banks[b].Count) return 0xffffffff;
+    return idx->Entries[idx->Banks[b].First + BlockId].Size;
+}
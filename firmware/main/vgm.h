@@ -5,6 +5,8 @@
 #include <stdint.h>
 #include "freertos/FreeRTOS.h"
 #include "esp_system.h"
+#include "vgmreader.h"
+#include "mallocs.h"
 
 enum VgmDeviceType {
     VGM_DEVICE_SN76489,
@@ -99,9 +101,46 @@ typedef struct {
     uint16_t CompValue; //decomp table = num values, nbit = added value, dpcm = start value
 } VgmDataBlockStruct_t;
 
+typedef struct {
+    uint8_t Type;        //chip, same numbering as datablock types 0x00-0x3f
+    uint32_t ReadOffset; //in the datablock bank
+    uint32_t WriteOffset; //in chip ram
+    uint32_t Size;
+} VgmPcmRamWriteStruct_t;
+
+//datablocks grouped into banks by type, with running offsets, so resolving a bank offset doesn't have to walk every block
+typedef struct {
+    uint32_t Start;  //offset of the block within its bank
+    uint32_t Size;
+    uint32_t Offset; //in vgm file. 0xffffffff if the data isn't usable (compressed and couldn't be decoded)
+    const uint8_t *Data; //decompressed copy in ram, NULL if it's read straight from the file
+} VgmBankEntry_t;
+
+typedef struct {
+    uint8_t First;   //first entry of this bank. a bank's entries are contiguous and in bank order
+    uint8_t Count;
+    uint32_t Total;  //bank size
+} VgmBank_t;
+
+typedef struct {
+    uint8_t BankOf[0x100]; //bank for each datablock type, 0xff = none seen yet
+    uint8_t BankCount;
+    uint8_t EntryCount;
+    VgmBank_t Banks[MAX_REALTIME_DATABLOCKS];
+    VgmBankEntry_t Entries[MAX_REALTIME_DATABLOCKS];
+} VgmBankIndex_t;
+
 uint8_t VgmCommandLength(uint8_t Command);
 bool VgmCommandIsFixedSize(uint8_t Command);
 bool VgmParseHeader(FILE *f, VgmInfoStruct_t *info);
-bool VgmParseDataBlock(FILE *f, VgmDataBlockStruct_t *block);
+bool VgmParseDataBlock(VgmReader_t *r, VgmDataBlockStruct_t *block);
+bool VgmParsePcmRamWrite(VgmReader_t *r, VgmPcmRamWriteStruct_t *write);
+void VgmBankIndex_Reset(VgmBankIndex_t *idx);
+uint8_t VgmDataBlockBank(uint8_t Type);
+bool VgmBankIndex_Add(VgmBankIndex_t *idx, const VgmDataBlockStruct_t *block, const uint8_t *data);
+const VgmBankEntry_t *VgmBankIndex_Find(const VgmBankIndex_t *idx, uint8_t BankType, uint32_t BankOff);
+uint32_t VgmBankIndex_GetDataOffset(const VgmBankIndex_t *idx, uint8_t BankType, uint32_t BankOff);
+uint32_t VgmBankIndex_GetBlockOffset(const VgmBankIndex_t *idx, uint8_t BankType, uint16_t BlockId);
+uint32_t VgmBankIndex_GetBlockSize(const VgmBankIndex_t *idx, uint8_t BankType, uint16_t BlockId);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,176 @@
+#include "vgmdecode.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "mallocs.h"
+#include <string.h>
+
+static const char* TAG = "VgmDecode";
+
+typedef struct {
+    uint32_t Offset; //of the compressed block in the vgm file, used as the key
+    uint8_t *Data;
+} VgmDecodedBlock_t;
+
+static StaticSemaphore_t VgmDecode_MutexBuf;
+static SemaphoreHandle_t VgmDecode_Mutex = NULL;
+static VgmDecodedBlock_t VgmDecode_Blocks[MAX_REALTIME_DATABLOCKS];
+static uint8_t VgmDecode_BlockCount = 0;
+static uint32_t VgmDecode_Used = 0;
+
+//last 0x7f block seen. only 8bit output is supported, so entries are one byte each
+static bool VgmDecode_TableValid = false;
+static uint8_t VgmDecode_TableType;
+static uint8_t VgmDecode_TableSubtype;
+static uint8_t VgmDecode_TableBitsD;
+static uint8_t VgmDecode_TableBitsC;
+static uint16_t VgmDecode_TableCount;
+static uint8_t VgmDecode_Table[256];
+
+bool VgmDecode_Setup() {
+    VgmDecode_Mutex = xSemaphoreCreateMutexStatic(&VgmDecode_MutexBuf);
+    return VgmDecode_Mutex != NULL;
+}
+
+void VgmDecode_Clear() { //only once nobody's holding on to decoded data any more
+    xSemaphoreTake(VgmDecode_Mutex, portMAX_DELAY);
+    for (uint8_t i=0;i<VgmDecode_BlockCount;i++) {
+        free(VgmDecode_Blocks[i].Data);
+    }
+    VgmDecode_BlockCount = 0;
+    VgmDecode_Used = 0;
+    VgmDecode_TableValid = false;
+    xSemaphoreGive(VgmDecode_Mutex);
+}
+
+static const uint8_t *VgmDecode_Lookup(uint32_t Offset) {
+    for (uint8_t i=0;i<VgmDecode_BlockCount;i++) {
+        if (VgmDecode_Blocks[i].Offset == Offset) return VgmDecode_Blocks[i].Data;
+    }
+    return NULL;
+}
+
+const uint8_t *VgmDecode_Find(uint32_t Offset) { //decoded copy of the block at Offset, if it's been decoded already
+    xSemaphoreTake(VgmDecode_Mutex, portMAX_DELAY);
+    const uint8_t *ret = VgmDecode_Lookup(Offset);
+    xSemaphoreGive(VgmDecode_Mutex);
+    return ret;
+}
+
+static void VgmDecode_LoadTable(VgmReader_t *r, const VgmDataBlockStruct_t *block) {
+    VgmDecode_TableValid = false;
+    if (block->BitsDecompressed > 8) {
+        ESP_LOGW(TAG, "Decompression table with %d bit values unsupported", block->BitsDecompressed);
+        return;
+    }
+    VgmDecode_TableType = block->CompressionType;
+    VgmDecode_TableSubtype = block->Subtype;
+    VgmDecode_TableBitsD = block->BitsDecompressed;
+    VgmDecode_TableBitsC = block->BitsCompressed;
+    VgmDecode_TableCount = (block->CompValue > sizeof(VgmDecode_Table))?sizeof(VgmDecode_Table):block->CompValue;
+    VgmReader_Seek(r, block->Offset);
+    for (uint16_t i=0;i<VgmDecode_TableCount;i++) {
+        VgmDecode_Table[i] = VgmReader_Read8(r);
+    }
+    VgmDecode_TableValid = !r->Error;
+}
+
+static bool VgmDecode_TableFits(const VgmDataBlockStruct_t *block, uint16_t codes) {
+    if (!VgmDecode_TableValid || VgmDecode_TableType != block->CompressionType || VgmDecode_TableBitsD != block->BitsDecompressed || VgmDecode_TableBitsC != block->BitsCompressed || VgmDecode_TableCount < codes) {
+        ESP_LOGE(TAG, "No matching decompression table !!");
+        return false;
+    }
+    if (block->CompressionType == 0x00 && VgmDecode_TableSubtype != block->Subtype) {
+        ESP_LOGE(TAG, "No matching decompression table !!");
+        return false;
+    }
+    return true;
+}
+
+static bool VgmDecode_Run(VgmReader_t *r, const VgmDataBlockStruct_t *block, uint8_t *out) {
+    uint8_t bitsd = block->BitsDecompressed;
+    uint8_t bitsc = block->BitsCompressed;
+    if (bitsd == 0 || bitsd > 8 || bitsc == 0 || bitsc > 8) {
+        ESP_LOGW(TAG, "Unsupported bit widths: %d -> %d", bitsc, bitsd);
+        return false;
+    }
+    uint16_t codes = 1<<bitsc;
+
+    //everything turns into a lookup on the compressed code: the output value for n-bit, the delta for dpcm
+    uint8_t lut[256];
+    bool dpcm = false;
+    if (block->CompressionType == 0x00) { //n-bit
+        if (block->Subtype == 0x00) { //copy
+            for (uint16_t i=0;i<codes;i++) lut[i] = block->CompValue + i;
+        } else if (block->Subtype == 0x01) { //shift left
+            for (uint16_t i=0;i<codes;i++) lut[i] = block->CompValue + (i << (bitsd - bitsc));
+        } else if (block->Subtype == 0x02) { //table
+            if (!VgmDecode_TableFits(block, codes)) return false;
+            memcpy(lut, VgmDecode_Table, codes);
+        } else {
+            ESP_LOGW(TAG, "Unsupported n-bit subtype %02x", block->Subtype);
+            return false;
+        }
+    } else if (block->CompressionType == 0x01) { //dpcm
+        if (!VgmDecode_TableFits(block, codes)) return false;
+        memcpy(lut, VgmDecode_Table, codes);
+        dpcm = true;
+    } else {
+        ESP_LOGW(TAG, "Unsupported compression type %02x", block->CompressionType);
+        return false;
+    }
+
+    //codes are packed msb first
+    uint8_t outmask = (1<<bitsd)-1;
+    uint8_t codemask = codes-1;
+    uint8_t val = block->CompValue; //dpcm start value
+    uint32_t acc = 0;
+    uint8_t bits = 0;
+    VgmReader_Seek(r, block->Offset);
+    for (uint32_t i=0;i<block->UncompressedSize;i++) {
+        if (bits < bitsc) {
+            acc = (acc<<8) | VgmReader_Read8(r);
+            bits += 8;
+        }
+        bits -= bitsc;
+        uint8_t code = (acc >> bits) & codemask;
+        if (dpcm) {
+            val = (val + lut[code]) & outmask;
+            out[i] = val;
+        } else {
+            out[i] = lut[code];
+        }
+    }
+    return !r->Error;
+}
+
+const uint8_t *VgmDecode_Block(VgmReader_t *r, const VgmDataBlockStruct_t *block) { //call right after parsing a datablock. returns its decompressed data, NULL if it's not compressed or couldn't be decoded
+    if (block->Type != 0x7f && (VgmDataBlockBank(block->Type) == block->Type || block->UncompressedSize == 0)) return NULL; //plain data, nothing to do
+    xSemaphoreTake(VgmDecode_Mutex, portMAX_DELAY);
+    uint32_t pos = r->Pos;
+    const uint8_t *ret = NULL;
+    if (block->Type == 0x7f) {
+        VgmDecode_LoadTable(r, block);
+    } else if ((ret = VgmDecode_Lookup(block->Offset)) != NULL) {
+        //someone else already got it
+    } else if (VgmDecode_BlockCount == MAX_REALTIME_DATABLOCKS || VgmDecode_Used + block->UncompressedSize > VGM_DECODE_BUF_SIZE) {
+        ESP_LOGE(TAG, "No room to decompress %d byte datablock !!", block->UncompressedSize);
+    } else {
+        uint8_t *out = heap_caps_malloc(block->UncompressedSize, MALLOC_CAP_8BIT);
+        if (out == NULL) {
+            ESP_LOGE(TAG, "Couldn't allocate %d bytes for decompressed datablock !!", block->UncompressedSize);
+        } else if (!VgmDecode_Run(r, block, out)) {
+            free(out);
+        } else {
+            VgmDecode_Blocks[VgmDecode_BlockCount].Offset = block->Offset;
+            VgmDecode_Blocks[VgmDecode_BlockCount].Data = out;
+            VgmDecode_BlockCount++;
+            VgmDecode_Used += block->UncompressedSize;
+            ESP_LOGI(TAG, "Decompressed datablock type %02x: %d -> %d bytes", block->Type, block->Size, block->UncompressedSize);
+            ret = out;
+        }
+    }
+    VgmReader_Seek(r, pos); //back to the end of the block, like nothing happened
+    xSemaphoreGive(VgmDecode_Mutex);
+    return ret;
+}
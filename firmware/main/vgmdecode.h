@@ -0,0 +1,17 @@
+#ifndef AGR_VGMDECODE_H
+#define AGR_VGMDECODE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "vgm.h"
+#include "vgmreader.h"
+
+//decompression of n-bit and dpcm datablocks (types 0x40-0x7e), using the 0x7f decompression table where needed
+//each block is expanded once into ram, and shared between the loader and dacstream, which both parse the datablocks
+
+bool VgmDecode_Setup();
+void VgmDecode_Clear();
+const uint8_t *VgmDecode_Block(VgmReader_t *r, const VgmDataBlockStruct_t *block);
+const uint8_t *VgmDecode_Find(uint32_t Offset);
+
+#endif
@@ -0,0 +1,142 @@
+#include "vgmreader.h"
+#include "esp_log.h"
+#include "taskmgr.h"
+#include "unvgz.h"
+#include <string.h>
+
+static const char* TAG = "VgmReader";
+
+static VgmReader_t *VgmReader_ReadAheadTarget = NULL;
+
+void VgmReader_Init(VgmReader_t *r, TrackFile_t *f, uint8_t *buf, uint32_t bufsize) {
+    if (r->Spare == buf) r->Spare = r->Cur; //the two read-ahead buffers may have traded places during the last run
+    r->File = f;
+    r->Buf = buf;
+    r->Cur = buf;
+    r->BufSize = bufsize;
+    r->BufStart = 0;
+    r->BufLen = 0;
+    r->Pos = 0;
+    r->Error = false;
+    r->SpareState = VGMREADER_SPARE_EMPTY;
+    r->Misses = 0;
+}
+
+//both this reader's buffers (the one passed to VgmReader_Init and spare) need VGMREADER_CARRY bytes of headroom in front of them
+bool VgmReader_SetupReadAhead(VgmReader_t *r, uint8_t *spare) {
+    r->Lock = xSemaphoreCreateMutex();
+    if (r->Lock == NULL) return false;
+    r->Spare = spare;
+    r->SpareState = VGMREADER_SPARE_EMPTY;
+    VgmReader_ReadAheadTarget = r;
+    return true;
+}
+
+void VgmReader_StopReadAhead(VgmReader_t *r) { //call before closing the file
+    if (r->Lock == NULL) return;
+    xSemaphoreTake(r->Lock, portMAX_DELAY); //wait out any read in progress
+    r->SpareState = VGMREADER_SPARE_EMPTY;
+    xSemaphoreGive(r->Lock);
+}
+
+static bool VgmReader_Load(VgmReader_t *r, uint32_t need) { //synchronous refill of the block containing the cursor
+    uint32_t start = r->Pos - (r->Pos % VGMREADER_ALIGN);
+    r->Buf = r->Cur;
+    if (!Unvgz_WaitAvail(start + r->BufSize)) { //only waits if the file is still being extracted
+        ESP_LOGE(TAG, "Extraction failed before %d !!", start);
+        r->BufLen = 0;
+        r->Error = true;
+        return false;
+    }
+    r->BufLen = TrackFile_Read(r->File, start, r->Buf, r->BufSize);
+    r->BufStart = start;
+    if (r->File->Error) {
+        ESP_LOGE(TAG, "Read error at %d !!", start);
+        r->BufLen = 0;
+        r->Error = true;
+        return false;
+    }
+    if (r->Pos + need > r->BufStart + r->BufLen) {
+        ESP_LOGE(TAG, "Read past eof at %d !!", r->Pos);
+        r->Error = true;
+        return false;
+    }
+    return true;
+}
+
+static bool VgmReader_Swap(VgmReader_t *r, uint32_t need) { //switch over to the spare block if it has what we need
+    uint32_t carry = 0;
+    if (r->Pos + need > r->SpareStart + r->SpareLen) return false;
+    if (r->Pos < r->SpareStart) {
+        //straddles the two blocks. copy the tail of this one in front of the spare one
+        if (r->Pos < r->BufStart || r->SpareStart != r->BufStart + r->BufLen) return false;
+        carry = r->SpareStart - r->Pos;
+        if (carry > VGMREADER_CARRY) return false;
+        memcpy(r->Spare - carry, &r->Buf[r->Pos - r->BufStart], carry);
+    }
+    uint8_t *old = r->Cur;
+    r->Cur = r->Spare;
+    r->Spare = old;
+    r->Buf = r->Cur - carry;
+    r->BufStart = r->SpareStart - carry;
+    r->BufLen = r->SpareLen + carry;
+    return true;
+}
+
+bool VgmReader_Fill(VgmReader_t *r, uint32_t need) { //make sure `need` bytes at the cursor are in the buffer
+    if (r->Error) return false;
+    if (r->Pos >= r->BufStart && r->Pos + need <= r->BufStart + r->BufLen) return true;
+    if (r->Lock == NULL) return VgmReader_Load(r, need);
+
+    xSemaphoreTake(r->Lock, portMAX_DELAY); //if the read-ahead task is busy on the block we want, this waits for it
+    bool ret;
+    if (r->SpareState == VGMREADER_SPARE_READY && VgmReader_Swap(r, need)) {
+        ret = true;
+    } else {
+        r->Misses++;
+        ret = VgmReader_Load(r, need);
+    }
+    if (ret) {
+        r->SpareStart = r->BufStart + r->BufLen;
+        r->SpareState = VGMREADER_SPARE_WANTED;
+    } else {
+        r->SpareState = VGMREADER_SPARE_EMPTY;
+    }
+    xSemaphoreGive(r->Lock);
+    if (ret) xTaskNotifyGive(Taskmgr_Handles[TASK_READAHEAD]);
+    return ret;
+}
+
+uint16_t VgmReader_Read16(VgmReader_t *r) {
+    const uint8_t *p = VgmReader_Peek(r, 2);
+    if (p == NULL) return 0;
+    r->Pos += 2;
+    return p[0] | ((uint16_t)p[1]<<8);
+}
+
+uint32_t VgmReader_Read32(VgmReader_t *r) {
+    const uint8_t *p = VgmReader_Peek(r, 4);
+    if (p == NULL) return 0;
+    r->Pos += 4;
+    return p[0] | ((uint32_t)p[1]<<8) | ((uint32_t)p[2]<<16) | ((uint32_t)p[3]<<24);
+}
+
+void VgmReader_ReadAheadMain() {
+    ESP_LOGI(TAG, "Read-ahead task start");
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        VgmReader_t *r = VgmReader_ReadAheadTarget;
+        if (r == NULL) continue;
+        xSemaphoreTake(r->Lock, portMAX_DELAY);
+        if (r->SpareState == VGMREADER_SPARE_WANTED) {
+            if (Unvgz_WaitAvail(r->SpareStart + r->BufSize)) {
+                r->SpareLen = TrackFile_Read(r->File, r->SpareStart, r->Spare, r->BufSize);
+                if (r->File->Error) r->SpareLen = 0; //leave it to the foreground refill to notice and report it
+            } else {
+                r->SpareLen = 0;
+            }
+            r->SpareState = VGMREADER_SPARE_READY;
+        }
+        xSemaphoreGive(r->Lock);
+    }
+}
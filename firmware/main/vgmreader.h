@@ -0,0 +1,69 @@
+#ifndef AGR_VGMREADER_H
+#define AGR_VGMREADER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "trackfile.h"
+#include "mallocs.h"
+
+//buffered cursor over a file. refills are whole aligned cache blocks, so a miss is read straight into our buffer in one go
+//seeking is free as long as the new position is still inside the buffered block
+//optionally, a second block can be read ahead by the read-ahead task, so sequential parsing only ever waits on the card if it outruns it
+
+#define VGMREADER_ALIGN TRACKFILE_CACHE_BLOCK_SIZE
+#define VGMREADER_CARRY 64 //headroom in front of read-ahead buffers, so a read that straddles two blocks can still be handed out contiguously
+
+enum {
+    VGMREADER_SPARE_EMPTY,
+    VGMREADER_SPARE_WANTED,
+    VGMREADER_SPARE_READY,
+};
+
+typedef struct {
+    TrackFile_t *File;
+    uint8_t *Buf;
+    uint32_t BufSize;   //multiple of VGMREADER_ALIGN
+    uint32_t BufStart;  //file offset of Buf[0]
+    uint32_t BufLen;    //valid bytes in Buf
+    uint32_t Pos;       //file offset of the cursor
+    bool Error;         //io error, or tried to read past eof. sticky until the next VgmReader_Init
+    uint8_t *Cur;       //buffer in use. Buf may point up to VGMREADER_CARRY bytes in front of it
+    //read-ahead, only used after VgmReader_SetupReadAhead
+    SemaphoreHandle_t Lock; //held while reading into either buffer
+    uint8_t *Spare;
+    uint32_t SpareStart;
+    uint32_t SpareLen;
+    volatile uint8_t SpareState;
+    uint32_t Misses;    //refills that had to go to the card instead of using the spare block
+} VgmReader_t;
+
+void VgmReader_Init(VgmReader_t *r, TrackFile_t *f, uint8_t *buf, uint32_t bufsize);
+bool VgmReader_SetupReadAhead(VgmReader_t *r, uint8_t *spare);
+void VgmReader_StopReadAhead(VgmReader_t *r);
+void VgmReader_ReadAheadMain();
+bool VgmReader_Fill(VgmReader_t *r, uint32_t need);
+uint16_t VgmReader_Read16(VgmReader_t *r);
+uint32_t VgmReader_Read32(VgmReader_t *r);
+
+static inline void VgmReader_Seek(VgmReader_t *r, uint32_t pos) {
+    r->Pos = pos;
+}
+
+static inline void VgmReader_Skip(VgmReader_t *r, uint32_t len) {
+    r->Pos += len;
+}
+
+static inline uint8_t VgmReader_Read8(VgmReader_t *r) {
+    if (r->Pos - r->BufStart >= r->BufLen && !VgmReader_Fill(r, 1)) return 0; //unsigned, so this also catches Pos < BufStart
+    return r->Buf[r->Pos++ - r->BufStart];
+}
+
+static inline const uint8_t *VgmReader_Peek(VgmReader_t *r, uint32_t len) { //pointer to len contiguous bytes at the cursor, doesn't advance. NULL on error
+    if (!VgmReader_Fill(r, len)) return NULL;
+    return &r->Buf[r->Pos - r->BufStart];
+}
+
+#endif
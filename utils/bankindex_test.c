@@ -0,0 +1,192 @@
+/*
+ * bankindex_test - host test of VgmBankIndex against the linear datablock searches it replaced
+ *
+ * build: cc -O2 -Iutils/host -Ifirmware/main -o bankindex_test utils/bankindex_test.c firmware/main/vgm.c firmware/main/vgmreader.c firmware/main/trackfile.c utils/host/host.c -lpthread -lm
+ * usage: bankindex_test [-n rounds] [-r seed]
+ *
+ *  - each round makes a random list of up to MAX_REALTIME_DATABLOCKS uncompressed datablocks of a handful of types, interleaved the
+ *    way vgms interleave them, zero size blocks included. every one goes into a VgmBankIndex in file order like the loader and
+ *    dacstream find do it
+ *  - then both sides of every block boundary, random offsets inside each bank, offsets past the end, and every block id (plus some
+ *    past the end) are looked up in the index and with the old Loader_GetPcmOffset / DacStream_GetDataOffset /
+ *    DacStream_GetBlockOffset / DacStream_GetBlockSize, copied as they were with the block array passed in. the answers have to match
+ *  - compressed blocks aren't in the old searches at all (they were never decompressed), so those get their own checks: a decoded
+ *    one goes in the bank of its uncompressed type at its uncompressed size and hands out its ram copy, one that couldn't be decoded
+ *    takes up its space in the bank but can't be looked up
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include "vgm.h"
+
+static uint32_t Rounds = 20000;
+static uint32_t Seed = 1;
+
+static uint32_t Rand() { //xorshift32
+    Seed ^= Seed << 13;
+    Seed ^= Seed >> 17;
+    Seed ^= Seed << 5;
+    return Seed;
+}
+
+static void Fail(const char *what, uint32_t round, uint8_t type, uint32_t arg, uint32_t want, uint32_t got) {
+    fprintf(stderr, "FAIL: round %u: %s type %02x, %u: linear says %u, index says %u\n", round, what, type, arg, want, got);
+    exit(1);
+}
+
+//the old linear searches, as they were. the block arrays they went over were volatile
+
+static uint32_t Linear_GetDataOffset(const volatile VgmDataBlockStruct_t *blocks, uint8_t count, uint8_t BankType, uint32_t BankOff) {
+    uint32_t consumed = 0;
+    for (uint8_t i=0;i<count;i++) {
+        if (blocks[i].Type == BankType) {
+            if (BankOff >= consumed && BankOff < consumed + blocks[i].Size) {
+                return blocks[i].Offset + (BankOff - consumed);
+            }
+            consumed += blocks[i].Size;
+        }
+    }
+    return 0xffffffff;
+}
+
+static uint32_t Linear_GetBlockOffset(const volatile VgmDataBlockStruct_t *blocks, uint8_t count, uint8_t BankType, uint16_t BlockId) {
+    uint16_t cblock = 0;
+    uint32_t off = 0;
+    for (uint8_t i=0;i<count;i++) {
+        if (blocks[i].Type == BankType) {
+            if (cblock++ == BlockId) {
+                return off;
+            }
+            off += blocks[i].Size;
+        }
+    }
+    return 0xffffffff;
+}
+
+static uint32_t Linear_GetBlockSize(const volatile VgmDataBlockStruct_t *blocks, uint8_t count, uint8_t BankType, uint16_t BlockId) {
+    uint16_t cblock = 0;
+    for (uint8_t i=0;i<count;i++) {
+        if (blocks[i].Type == BankType) {
+            if (cblock++ == BlockId) {
+                return blocks[i].Size;
+            }
+        }
+    }
+    return 0xffffffff;
+}
+
+//random datablock lists
+
+static const uint8_t Types[] = {0x00, 0x00, 0x00, 0x01, 0x02, 0x07, 0x81, 0x82, 0xc0}; //mostly ym2612 pcm, like real vgms
+
+static uint8_t MakeBlocks(VgmDataBlockStruct_t *blocks) {
+    uint8_t count = 1 + Rand()%MAX_REALTIME_DATABLOCKS;
+    uint8_t ntypes = 1 + Rand()%sizeof(Types); //some rounds only use one or two types
+    uint32_t offset = 0x100;
+    memset(blocks, 0, count*sizeof(VgmDataBlockStruct_t));
+    for (uint8_t i=0;i<count;i++) {
+        blocks[i].Type = Types[Rand()%ntypes];
+        uint32_t r = Rand()%16;
+        blocks[i].Size = (r == 0)?0:(r < 4?1+Rand()%16:Rand()%20000);
+        blocks[i].Offset = offset + 7;
+        offset += 7 + blocks[i].Size + Rand()%64; //commands in between
+    }
+    return count;
+}
+
+static void CheckRound(uint32_t round) {
+    VgmDataBlockStruct_t blocks[MAX_REALTIME_DATABLOCKS];
+    VgmBankIndex_t idx;
+    uint8_t count = MakeBlocks(blocks);
+    VgmBankIndex_Reset(&idx);
+    for (uint8_t i=0;i<count;i++) {
+        if (!VgmBankIndex_Add(&idx, &blocks[i], NULL)) Fail("add", round, blocks[i].Type, i, 1, 0);
+    }
+    for (uint32_t t=0;t<sizeof(Types);t++) {
+        uint8_t type = Types[t];
+        uint32_t total = 0, n = 0;
+        for (uint8_t i=0;i<count;i++) {
+            if (blocks[i].Type == type) {
+                total += blocks[i].Size;
+                n++;
+            }
+        }
+        uint32_t offs[MAX_REALTIME_DATABLOCKS*4+64+3];
+        uint32_t no = 0, start = 0;
+        for (uint8_t i=0;i<count;i++) { //both sides of every block boundary
+            if (blocks[i].Type != type) continue;
+            offs[no++] = start-1;
+            offs[no++] = start;
+            offs[no++] = start+1;
+            offs[no++] = start+blocks[i].Size-1;
+            start += blocks[i].Size;
+        }
+        for (uint32_t i=0;i<64;i++) offs[no++] = total?Rand()%total:0; //anywhere inside
+        offs[no++] = total;
+        offs[no++] = total+1;
+        offs[no++] = 0xffffffff;
+        for (uint32_t i=0;i<no;i++) {
+            uint32_t want = Linear_GetDataOffset(blocks, count, type, offs[i]);
+            uint32_t got = VgmBankIndex_GetDataOffset(&idx, type, offs[i]);
+            if (want != got) Fail("data offset", round, type, offs[i], want, got);
+        }
+        for (uint32_t id=0;id<n+3;id++) {
+            uint32_t want = Linear_GetBlockOffset(blocks, count, type, id);
+            uint32_t got = VgmBankIndex_GetBlockOffset(&idx, type, id);
+            if (want != got) Fail("block offset", round, type, id, want, got);
+            want = Linear_GetBlockSize(blocks, count, type, id);
+            got = VgmBankIndex_GetBlockSize(&idx, type, id);
+            if (want != got) Fail("block size", round, type, id, want, got);
+        }
+    }
+    //a type that never turned up
+    if (VgmBankIndex_GetDataOffset(&idx, 0x03, 0) != 0xffffffff || VgmBankIndex_GetBlockSize(&idx, 0x03, 0) != 0xffffffff) Fail("missing bank", round, 0x03, 0, 0xffffffff, 0);
+}
+
+static void CheckCompressed() {
+    static const uint8_t data[300];
+    VgmDataBlockStruct_t blocks[4];
+    VgmBankIndex_t idx;
+    memset(blocks, 0, sizeof(blocks));
+    blocks[0].Type = 0x00; blocks[0].Size = 100; blocks[0].Offset = 1000;
+    blocks[1].Type = 0x40; blocks[1].Size = 50; blocks[1].Offset = 2000; blocks[1].UncompressedSize = 300; //decoded
+    blocks[2].Type = 0x40; blocks[2].Size = 60; blocks[2].Offset = 3000; blocks[2].UncompressedSize = 200; //couldn't be
+    blocks[3].Type = 0x00; blocks[3].Size = 10; blocks[3].Offset = 4000;
+    VgmBankIndex_Reset(&idx);
+    VgmBankIndex_Add(&idx, &blocks[0], NULL);
+    VgmBankIndex_Add(&idx, &blocks[1], data);
+    VgmBankIndex_Add(&idx, &blocks[2], NULL);
+    VgmBankIndex_Add(&idx, &blocks[3], NULL);
+    const VgmBankEntry_t *e = VgmBankIndex_Find(&idx, 0x00, 150);
+    if (e == NULL || e->Data != data || e->Start != 100 || e->Size != 300) Fail("decoded block", 0, 0x40, 150, 100, e?e->Start:0);
+    if (VgmBankIndex_Find(&idx, 0x00, 400) != NULL) Fail("undecoded block", 0, 0x40, 400, 0, 1);
+    if (VgmBankIndex_GetDataOffset(&idx, 0x00, 605) != 4005) Fail("block after compressed ones", 0, 0x00, 605, 4005, VgmBankIndex_GetDataOffset(&idx, 0x00, 605));
+    if (VgmBankIndex_GetBlockSize(&idx, 0x00, 2) != 200 || VgmBankIndex_GetBlockOffset(&idx, 0x00, 3) != 600) Fail("compressed block ids", 0, 0x00, 2, 200, VgmBankIndex_GetBlockSize(&idx, 0x00, 2));
+    if (VgmBankIndex_GetBlockSize(&idx, 0x40, 0) != 0xffffffff) Fail("compressed type has its own bank", 0, 0x40, 0, 0xffffffff, 0);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+        switch (opt) {
+            case 'n': Rounds = strtoul(optarg, NULL, 0); break;
+            case 'r': Seed = strtoul(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr, "usage: %s [-n rounds] [-r seed]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (Seed == 0) {
+        fprintf(stderr, "seed must be nonzero\n");
+        return 1;
+    }
+    for (uint32_t i=0;i<Rounds;i++) CheckRound(i);
+    printf("%u random datablock lists, index matches the linear searches: ok\n", Rounds);
+    CheckCompressed();
+    printf("compressed blocks: ok\n");
+    return 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * dcsgshadow_test - host test of the driver's dcsg attenuation shadow against a model of the sn76489's registers
+ *
+ * build: cc -O2 -Ifirmware/main -o dcsgshadow_test utils/dcsgshadow_test.c
+ * usage: dcsgshadow_test [-n writes] [-r seed]
+ *
+ *  - fixed sequences first: 0x90 0x0f 0x90 (the data byte changed channel 0's volume, so the second 0x90 has to go out), a plain
+ *    repeated 0x90 (has to be dropped), 0x90 0x0f 0x9f (the 0x9f changes nothing and can be dropped), data bytes while latched to a
+ *    tone register (don't touch the volumes, but the next volume latch still has to go out to move the latch back), and 0x90 0x7f 0x9f
+ *    (only the low 4 bits of a data byte count, so the 0x9f can be dropped)
+ *  - then random writes, mostly latch and data bytes for the volumes like vgms are full of, fed to DcsgShadow_Write and to the model.
+ *    the model starts with random registers and a random latch, since that's what the shadow gets after a reset. every write the
+ *    shadow drops has to leave every register and the latch exactly as they were
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include "dcsgshadow.h"
+
+static uint32_t Writes = 2000000;
+static uint32_t Seed = 1;
+
+static uint32_t Rand() { //xorshift32
+    Seed ^= Seed << 13;
+    Seed ^= Seed >> 17;
+    Seed ^= Seed << 5;
+    return Seed;
+}
+
+//the chip, as far as the shadow is concerned: 3 10 bit tone registers, 4 bit volumes and noise control, and the latch
+
+typedef struct {
+    uint16_t Reg[8]; //tone 0, att 0, tone 1, att 1, tone 2, att 2, noise, att 3
+    uint8_t Latch;
+} Dcsg_t;
+
+static void Dcsg_Write(Dcsg_t *c, uint8_t Data) {
+    if (Data & 0x80) {
+        c->Latch = (Data>>4)&7;
+        if (c->Latch & 1 || c->Latch == 6) c->Reg[c->Latch] = Data & 0x0f;
+        else c->Reg[c->Latch] = (c->Reg[c->Latch] & 0x3f0) | (Data & 0x0f);
+    } else {
+        if (c->Latch & 1 || c->Latch == 6) c->Reg[c->Latch] = Data & 0x0f;
+        else c->Reg[c->Latch] = (c->Reg[c->Latch] & 0x0f) | ((Data & 0x3f)<<4);
+    }
+}
+
+static bool Dcsg_Same(const Dcsg_t *a, const Dcsg_t *b) {
+    return a->Latch == b->Latch && memcmp(a->Reg, b->Reg, sizeof(a->Reg)) == 0;
+}
+
+static void Fail(const char *what, uint32_t i, uint8_t data) {
+    fprintf(stderr, "FAIL: %s, write %u (0x%02x)\n", what, i, data);
+    exit(1);
+}
+
+static void CheckSequence(const char *name, const uint8_t *seq, const bool *want, uint8_t len) {
+    DcsgShadow_t s;
+    DcsgShadow_Reset(&s);
+    for (uint8_t i=0;i<len;i++) {
+        bool sent = DcsgShadow_Write(&s, seq[i]);
+        if (sent != want[i]) {
+            fprintf(stderr, "FAIL: %s: write %u (0x%02x) %s\n", name, i, seq[i], sent?"went out, should have been dropped":"was dropped, should have gone out");
+            exit(1);
+        }
+    }
+}
+
+static void CheckSequences() {
+    static const uint8_t s1[] = {0x90, 0x0f, 0x90};
+    static const bool w1[] = {true, true, true};
+    CheckSequence("volume set by a data byte", s1, w1, sizeof(s1));
+    static const uint8_t s2[] = {0x90, 0x90};
+    static const bool w2[] = {true, false};
+    CheckSequence("repeated volume", s2, w2, sizeof(s2));
+    static const uint8_t s3[] = {0x90, 0x0f, 0x9f};
+    static const bool w3[] = {true, true, false};
+    CheckSequence("volume set by a data byte, then the same again", s3, w3, sizeof(s3));
+    static const uint8_t s4[] = {0x95, 0xa0, 0x0f, 0x95, 0x95}; //the 2nd 0x95 has to move the latch back, the 3rd is a repeat
+    static const bool w4[] = {true, true, true, true, false};
+    CheckSequence("data bytes to tone registers", s4, w4, sizeof(s4));
+    static const uint8_t s5[] = {0xff, 0x05, 0xf5};
+    static const bool w5[] = {true, true, false};
+    CheckSequence("channel 3 volume", s5, w5, sizeof(s5));
+    static const uint8_t s6[] = {0x90, 0x7f, 0x9f}; //only the low 4 bits of a data byte reach a volume
+    static const bool w6[] = {true, true, false};
+    CheckSequence("data byte with the upper bits set", s6, w6, sizeof(s6));
+}
+
+static uint8_t RandomWrite() {
+    uint32_t r = Rand();
+    uint8_t ch = (r>>8)&3;
+    switch (r%8) {
+        case 0: case 1: case 2: return 0x90 | (ch<<5) | ((r>>12)&(((r>>16)&1)?0x0f:0x01)); //volume latch, often one of two values
+        case 3: case 4: return (r>>12)&(((r>>16)&1)?0x7f:0x01); //data byte
+        case 5: return 0x80 | (ch<<5) | ((r>>12)&0x0f); //tone latch
+        case 6: return 0xe0 | ((r>>12)&0x07); //noise
+        default: return Rand()&0xff; //anything
+    }
+}
+
+static void CheckRandom() {
+    DcsgShadow_t s;
+    Dcsg_t chip;
+    for (uint8_t i=0;i<8;i++) chip.Reg[i] = Rand()&((i&1 || i == 6)?0x0f:0x3ff);
+    chip.Latch = Rand()&7;
+    DcsgShadow_Reset(&s);
+    uint32_t dropped = 0;
+    for (uint32_t i=0;i<Writes;i++) {
+        uint8_t d = RandomWrite();
+        if (i%100000 == 0) DcsgShadow_Reset(&s); //chip reset as far as the shadow knows, the chip keeps what it had
+        if (DcsgShadow_Write(&s, d)) {
+            Dcsg_Write(&chip, d);
+        } else {
+            Dcsg_t after = chip;
+            Dcsg_Write(&after, d);
+            if (!Dcsg_Same(&chip, &after)) Fail("dropped a write that would have changed something", i, d);
+            dropped++;
+        }
+    }
+    printf("%u random writes, %u dropped, none of them would have changed anything: ok\n", Writes, dropped);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+        switch (opt) {
+            case 'n': Writes = strtoul(optarg, NULL, 0); break;
+            case 'r': Seed = strtoul(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr, "usage: %s [-n writes] [-r seed]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (Seed == 0) {
+        fprintf(stderr, "seed must be nonzero\n");
+        return 1;
+    }
+    CheckSequences();
+    printf("fixed sequences: ok\n");
+    CheckRandom();
+    return 0;
+}
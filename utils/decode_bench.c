@@ -0,0 +1,434 @@
+/*
+ * decode_bench - host benchmark of the loader -> driver command path: raw vgm bytes vs pre-decoded records
+ *
+ * build: cc -O2 -Iutils/host -Ifirmware/main -Ifirmware/components/megastream -o decode_bench utils/decode_bench.c firmware/main/loaderemit.c firmware/main/vgm.c firmware/main/vgmreader.c firmware/main/trackfile.c utils/host/host.c firmware/components/megastream/megastream.c -lpthread -lm
+ * usage: decode_bench [-n commands] [-i iterations] [-r seed] [file.vgm ...]
+ *
+ *  - with no files, runs -n commands of a synthetic mix that looks like a busy genesis vgm: ym2612 writes, dcsg, short and long
+ *    waits, 0x8n dac, the odd dacstream command. uncompressed .vgm files on the command line are run as well (vgz isn't supported,
+ *    gunzip them first). only the fixed-size commands are used: datablocks, pcm ram writes and pcm seeks aren't on either path
+ *  - "old" is the path before the record stream, copied from the last tree that had it: the loader sent the raw command bytes into
+ *    the command stream, and the driver peeked the command byte, looked up VgmCommandLength, pulled the command out and went down
+ *    the if/else chain in Driver_RunCommand. "new" is the real LoaderEmit code into fixed 4 byte records, and the driver's record
+ *    loop dispatching through an op table
+ *  - chip writes, muting/fade filters and the dcsg frequency fix are the same work on both paths and aren't what changed, so on both
+ *    sides every write goes to one sink. the sink hashes every write in order along with the sample it lands on, and the two paths
+ *    have to come out with the same hash and the same end sample, or the benchmark is comparing different work and fails
+ *  - only the decode is timed. the old path also took one whole Driver_Main pass per command (timing update, dacstream tick) which
+ *    this leaves out, so the real difference is bigger than what's reported
+ *  - both sides run on one thread in fill/drain rounds through a DRIVER_QUEUE_SIZE ring, timed separately: the loader side is the
+ *    cost moved onto core 0, the driver side is what's left on core 1
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "megastream.h"
+#include "driver.h"
+#include "vgm.h"
+#include "loaderemit.h"
+
+static uint32_t Commands = 2000000;
+static uint32_t Iterations = 5;
+static uint32_t Seed = 1;
+
+static double Now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec/1e9;
+}
+
+static uint32_t Rand() { //xorshift32
+    Seed ^= Seed << 13;
+    Seed ^= Seed >> 17;
+    Seed ^= Seed << 5;
+    return Seed;
+}
+
+//the chip side. same on both paths
+
+static uint32_t Sink;
+static uint32_t NextSample;
+static volatile MegaMod_t DetectedMod = MEGAMOD_NONE; //volatile so the old chain's mod checks aren't folded away
+static uint8_t Pcm[4096]; //stands in for the type 0 bank the 0x8n samples come out of
+static uint32_t PcmPos;
+
+static __attribute__((noinline)) void Write(uint8_t op, uint8_t reg, uint32_t val) { //hashed with the sample it lands on, so merged waits come out the same
+    Sink = (Sink*31 + ((uint32_t)op<<24 | (uint32_t)reg<<16) + val)*31 + NextSample;
+}
+
+static __attribute__((noinline)) void Wait(uint32_t samples) {
+    NextSample += samples;
+}
+
+//old path
+
+static MegaStreamContext_t OldStream, OldPcmStream;
+
+static bool OldLoad(const uint8_t *c) { //what the loader did per command: send the raw bytes. false if it didn't fit
+    uint8_t len = VgmCommandLength(c[0]);
+    if (MegaStream_Free(&OldStream) < len || MegaStream_Free(&OldPcmStream) == 0) return false;
+    if ((c[0]&0xf0) == 0x80) {
+        uint8_t sample = Pcm[PcmPos++ % sizeof(Pcm)];
+        MegaStream_Send(&OldPcmStream, &sample, 1);
+    }
+    MegaStream_Send(&OldStream, c, 1); //command
+    if (len > 1) MegaStream_Send(&OldStream, &c[1], len-1); //attached data
+    return true;
+}
+
+static bool OldRunCommand(uint8_t CommandLength) { //Driver_RunCommand's chain, in its order, with the bodies down to the sink calls
+    uint8_t cmd[CommandLength];
+    MegaStream_Recv(&OldStream, cmd, CommandLength);
+    if (cmd[0] == 0x50) {
+        Write(DRIVER_OP_DCSG, 0, cmd[1]);
+    } else if (cmd[0] == 0x51) {
+        Write(DRIVER_OP_OPLL, cmd[1], cmd[2]);
+    } else if (cmd[0] == 0x54) {
+        Write(DRIVER_OP_OPM, cmd[1], cmd[2]);
+    } else if (cmd[0] == 0x5e || cmd[0] == 0x5b || cmd[0] == 0x5a) {
+        Write(DRIVER_OP_OPL3_0, cmd[1], cmd[2]);
+    } else if (cmd[0] == 0x5f) {
+        Write(DRIVER_OP_OPL3_1, cmd[1], cmd[2]);
+    } else if (DetectedMod == MEGAMOD_2XOPN && (cmd[0] == 0x55 || cmd[0] == 0xa5 || cmd[0] == 0xa0)) {
+        Write(cmd[0] == 0x55?DRIVER_OP_OPN:(cmd[0] == 0xa5?DRIVER_OP_OPN_2:DRIVER_OP_AY), cmd[1], cmd[2]);
+    } else if ((DetectedMod == MEGAMOD_NONE || DetectedMod == MEGAMOD_OPNA || DetectedMod == MEGAMOD_OPNOPLL) && (cmd[0] == 0x56 || cmd[0] == 0x57 || cmd[0] == 0x55 || cmd[0] == 0xa0)) {
+        Write(cmd[0] == 0x56?DRIVER_OP_OPNA_0:(cmd[0] == 0x57?DRIVER_OP_OPNA_1:(cmd[0] == 0x55?DRIVER_OP_OPN:DRIVER_OP_AY)), cmd[1], cmd[2]);
+    } else if (cmd[0] == 0x52) {
+        Write(DRIVER_OP_OPN2_0, cmd[1], cmd[2]);
+    } else if (cmd[0] == 0x53) {
+        Write(DRIVER_OP_OPN2_1, cmd[1], cmd[2]);
+    } else if (cmd[0] == 0x61) {
+        Wait(cmd[1] | ((uint16_t)cmd[2]<<8));
+    } else if (cmd[0] == 0x62) {
+        Wait(735);
+    } else if (cmd[0] == 0x63) {
+        Wait(882);
+    } else if ((cmd[0] & 0xf0) == 0x70) {
+        Wait((cmd[0] & 0x0f) + 1);
+    } else if ((cmd[0] & 0xf0) == 0x80) {
+        uint8_t sample;
+        MegaStream_Recv(&OldPcmStream, &sample, 1);
+        Write(DRIVER_OP_OPN2_DAC, 0x2a, sample);
+        Wait(cmd[0] & 0x0f);
+    } else if (cmd[0] == 0x93 || cmd[0] == 0x95) {
+        Write(DRIVER_OP_DS_START, cmd[1], 0);
+    } else if (cmd[0] == 0x94) {
+        Write(DRIVER_OP_DS_STOP, cmd[1], 0);
+    } else if (cmd[0] == 0x92) {
+        Write(DRIVER_OP_DS_RATE, cmd[1], cmd[2] | ((uint32_t)cmd[3]<<8) | ((uint32_t)cmd[4]<<16) | ((uint32_t)cmd[5]<<24));
+    } else if (cmd[0] == 0x90 || cmd[0] == 0x91) {
+    } else if (cmd[0] == 0x4f) {
+    } else if (cmd[0] == 0xb1) {
+    } else if (cmd[0] == 0xb2) {
+    } else if (cmd[0] == 0xc2) {
+    } else if (cmd[0] == 0x31) {
+    } else if (cmd[0] == 0x30) {
+    } else if (cmd[0] == 0xb7) {
+    } else if (cmd[0] == 0xb8) {
+    } else if (cmd[0] == 0xd2) {
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void OldDrive() { //Driver_Main's part: one command per pass until the stream is empty
+    uint32_t waiting;
+    while ((waiting = MegaStream_Used(&OldStream)) > 0) {
+        uint8_t peeked = MegaStream_Peek(&OldStream);
+        uint8_t cmdlen = VgmCommandLength(peeked);
+        if (waiting < cmdlen || !OldRunCommand(cmdlen)) {
+            fprintf(stderr, "FAIL: old path choked on command %02x\n", peeked);
+            exit(1);
+        }
+    }
+}
+
+//new path
+
+static MegaStreamContext_t NewStream;
+static LoaderEmit_t Emitter;
+
+static bool NewLoad(const uint8_t *c) { //what Loader_Main does per fixed-size command now
+    if (MegaStream_Free(&NewStream) < LOADEREMIT_MAX_RECORDS*sizeof(DriverRecord_t)) return false;
+    uint8_t d = c[0];
+    if ((d&0xf0) == 0x80) {
+        LoaderEmit_Pcm(&Emitter, Pcm[PcmPos++ % sizeof(Pcm)], d&0x0f);
+    } else if (d >= 0x90 && d <= 0x95) {
+        LoaderEmit_DacStream(&Emitter, d, &c[1]);
+    } else {
+        LoaderEmit_Command(&Emitter, d, &c[1]);
+    }
+    return true;
+}
+
+typedef uint8_t (*OpHandler_t)(DriverRecord_t *rec);
+
+static uint8_t OpWait(DriverRecord_t *rec) {
+    Wait(rec->Reg | ((uint32_t)rec->Val<<8) | ((uint32_t)rec->Arg<<16));
+    return 1;
+}
+
+static uint8_t OpWrite(DriverRecord_t *rec) {
+    Write(rec->Op, rec->Reg, rec->Val);
+    return 1;
+}
+
+static uint8_t OpDcsg(DriverRecord_t *rec) {
+    Write(DRIVER_OP_DCSG, 0, rec->Val);
+    return 1;
+}
+
+static uint8_t OpDac(DriverRecord_t *rec) {
+    Write(DRIVER_OP_OPN2_DAC, 0x2a, rec->Val);
+    Wait(rec->Arg);
+    return 1;
+}
+
+static uint8_t OpDs(DriverRecord_t *rec) {
+    Write(rec->Op, rec->Reg, 0);
+    return 1;
+}
+
+static uint8_t OpDsRate(DriverRecord_t *rec) {
+    uint8_t *r = (uint8_t *)&rec[1];
+    Write(DRIVER_OP_DS_RATE, rec->Reg, r[0] | ((uint32_t)r[1]<<8) | ((uint32_t)r[2]<<16) | ((uint32_t)r[3]<<24));
+    return 2;
+}
+
+static uint8_t OpNop(DriverRecord_t *rec) {
+    return 1;
+}
+
+static const OpHandler_t OpHandlers[DRIVER_OP_COUNT] = {
+    [DRIVER_OP_WAIT] = OpWait,
+    [DRIVER_OP_DCSG] = OpDcsg,
+    [DRIVER_OP_OPN2_0] = OpWrite,
+    [DRIVER_OP_OPN2_1] = OpWrite,
+    [DRIVER_OP_OPN2_DAC] = OpDac,
+    [DRIVER_OP_OPLL] = OpWrite,
+    [DRIVER_OP_OPM] = OpWrite,
+    [DRIVER_OP_OPL3_0] = OpWrite,
+    [DRIVER_OP_OPL3_1] = OpWrite,
+    [DRIVER_OP_OPN] = OpWrite,
+    [DRIVER_OP_OPN_2] = OpWrite,
+    [DRIVER_OP_OPNA_0] = OpWrite,
+    [DRIVER_OP_OPNA_1] = OpWrite,
+    [DRIVER_OP_AY] = OpWrite,
+    [DRIVER_OP_DS_START] = OpDs,
+    [DRIVER_OP_DS_STOP] = OpDs,
+    [DRIVER_OP_DS_RATE] = OpDsRate,
+    [DRIVER_OP_END] = OpNop,
+    [DRIVER_OP_BADFLAGS] = OpNop,
+    [DRIVER_OP_NOP] = OpNop,
+};
+
+static void NewDrive() { //Driver_Main's record loop, minus the stop at the next due wait: there's no clock here
+    DriverRecord_t *rec;
+    size_t span;
+    while ((span = MegaStream_PeekSpan(&NewStream, (uint8_t **)&rec)/sizeof(DriverRecord_t)) > 0) {
+        size_t ran = 0;
+        while (ran < span) {
+            uint8_t op = rec[ran].Op;
+            if (op >= DRIVER_OP_COUNT) {
+                fprintf(stderr, "FAIL: new path got op %d\n", op);
+                exit(1);
+            }
+            ran += OpHandlers[op](&rec[ran]);
+        }
+        MegaStream_Consume(&NewStream, ran*sizeof(DriverRecord_t));
+    }
+}
+
+//running it
+
+typedef struct {
+    double Load, Drive; //seconds
+    uint64_t Bytes;     //through the command stream
+    uint32_t Sink, NextSample;
+} Result_t;
+
+static void Run(const uint8_t *cmds, size_t len, bool new, Result_t *r) {
+    static uint8_t buf[DRIVER_QUEUE_SIZE], pcmbuf[DRIVER_QUEUE_SIZE];
+    memset(r, 0, sizeof(*r));
+    for (uint32_t it=0;it<Iterations;it++) {
+        Sink = NextSample = PcmPos = 0;
+        MegaStream_Create(&OldStream, buf, sizeof(buf));
+        MegaStream_Create(&OldPcmStream, pcmbuf, sizeof(pcmbuf));
+        MegaStream_Create(&NewStream, buf, sizeof(buf));
+        LoaderEmit_Init(&Emitter, &NewStream);
+        size_t pos = 0;
+        while (pos < len) {
+            double t = Now();
+            size_t used = new?MegaStream_Used(&NewStream):MegaStream_Used(&OldStream);
+            while (pos < len && (new?NewLoad(&cmds[pos]):OldLoad(&cmds[pos]))) pos += VgmCommandLength(cmds[pos]);
+            if (new && pos == len) LoaderEmit_FlushWait(&Emitter); //loader does this before it sleeps. there's always room, NewLoad left 4 records
+            r->Bytes += (new?MegaStream_Used(&NewStream):MegaStream_Used(&OldStream)) - used;
+            double t2 = Now();
+            r->Load += t2 - t;
+            if (new) NewDrive(); else OldDrive();
+            r->Drive += Now() - t2;
+        }
+        if (it && (Sink != r->Sink || NextSample != r->NextSample)) {
+            fprintf(stderr, "FAIL: iterations disagree\n");
+            exit(1);
+        }
+        r->Sink = Sink;
+        r->NextSample = NextSample;
+    }
+    r->Bytes /= Iterations;
+}
+
+static void Compare(const char *name, const uint8_t *cmds, size_t len) {
+    uint32_t n = 0;
+    for (size_t pos=0;pos<len;pos+=VgmCommandLength(cmds[pos])) n++;
+    if (n == 0) {
+        printf("%s: no commands\n", name);
+        return;
+    }
+    Result_t o, w;
+    Run(cmds, len, false, &o);
+    Run(cmds, len, true, &w);
+    if (o.Sink != w.Sink || o.NextSample != w.NextSample) {
+        fprintf(stderr, "FAIL: %s: paths disagree, old sink %08x end sample %u, new sink %08x end sample %u\n", name, o.Sink, o.NextSample, w.Sink, w.NextSample);
+        exit(1);
+    }
+    double per = 1e9/((double)n*Iterations);
+    printf("%s: %u commands, %u samples, same writes and waits on both paths\n", name, n, o.NextSample);
+    printf("  old: loader %6.2f ns/cmd, driver %6.2f ns/cmd, %5.2f stream bytes/cmd\n", o.Load*per, o.Drive*per, (double)o.Bytes/n);
+    printf("  new: loader %6.2f ns/cmd, driver %6.2f ns/cmd, %5.2f stream bytes/cmd\n", w.Load*per, w.Drive*per, (double)w.Bytes/n);
+    printf("  driver side %.2fx faster\n", o.Drive/w.Drive);
+}
+
+static uint8_t *Synth(uint32_t n, size_t *len) { //busy genesis-ish mix
+    uint8_t *c = malloc((size_t)n*11); //0x93 is the longest
+    if (!c) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    size_t p = 0;
+    for (uint32_t i=0;i<n;i++) {
+        uint32_t r = Rand()%100;
+        if (r < 30) { //fm writes
+            c[p++] = 0x52;
+            c[p++] = 0x20 + Rand()%0x90;
+            c[p++] = Rand();
+        } else if (r < 42) {
+            c[p++] = 0x53;
+            c[p++] = 0x30 + Rand()%0x80;
+            c[p++] = Rand();
+        } else if (r < 52) {
+            c[p++] = 0x50;
+            c[p++] = Rand();
+        } else if (r < 70) { //dac. mostly 0x80 followed by short waits, like the vgm_cmp'd drums are
+            c[p++] = 0x80 + Rand()%4;
+        } else if (r < 85) {
+            c[p++] = 0x70 + Rand()%16;
+        } else if (r < 92) {
+            c[p++] = 0x61;
+            c[p++] = Rand();
+            c[p++] = Rand()%8;
+        } else if (r < 97) {
+            c[p++] = 0x62 + Rand()%2;
+        } else if (r < 98) { //dacstream start, either kind
+            uint8_t d = (Rand()%2)?0x93:0x95;
+            memset(&c[p], 0, VgmCommandLength(d));
+            c[p] = d;
+            c[p+1] = Rand()%4;
+            p += VgmCommandLength(d);
+        } else if (r < 99) {
+            c[p++] = 0x92;
+            c[p++] = Rand()%4;
+            c[p++] = Rand(); c[p++] = Rand(); c[p++] = 0; c[p++] = 0;
+        } else {
+            c[p++] = 0x94;
+            c[p++] = Rand()%4;
+        }
+    }
+    *len = p;
+    return c;
+}
+
+static uint8_t *Load(const char *path, size_t *len) { //the fixed-size commands of an uncompressed vgm, 0x66 not included
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long sz = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *v = malloc(sz);
+    uint8_t *c = malloc(sz);
+    if (!v || !c || sz < 0x40 || fread(v, 1, sz, f) != (size_t)sz || memcmp(v, "Vgm ", 4)) {
+        fclose(f);
+        fprintf(stderr, "%s: not an uncompressed vgm\n", path);
+        exit(1);
+    }
+    fclose(f);
+    uint32_t ver = v[8] | (v[9]<<8);
+    uint32_t off = v[0x34] | (v[0x35]<<8) | (v[0x36]<<16) | ((uint32_t)v[0x37]<<24);
+    size_t p = (ver >= 0x150 && off)?0x34+off:0x40;
+    size_t o = 0;
+    while (p < (size_t)sz && v[p] != 0x66) {
+        uint8_t d = v[p];
+        if (d == 0x67) { //datablock
+            if (p+7 > (size_t)sz) break;
+            p += 7 + ((v[p+3] | (v[p+4]<<8) | (v[p+5]<<16) | ((uint32_t)v[p+6]<<24)) & 0x7fffffff);
+        } else if (d == 0x68) { //pcm ram write
+            p += 12;
+        } else if (d == 0xe0) { //pcm seek
+            p += 5;
+        } else {
+            uint8_t l = VgmCommandLength(d);
+            if (l == 0xff || p+l > (size_t)sz) {
+                fprintf(stderr, "%s: bad command %02x at 0x%zx\n", path, d, p);
+                exit(1);
+            }
+            memcpy(&c[o], &v[p], l);
+            o += l;
+            p += l;
+        }
+    }
+    free(v);
+    *len = o;
+    return c;
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:i:r:")) != -1) {
+        switch (opt) {
+            case 'n': Commands = strtoul(optarg, NULL, 0); break;
+            case 'i': Iterations = strtoul(optarg, NULL, 0); break;
+            case 'r': Seed = strtoul(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr, "usage: %s [-n commands] [-i iterations] [-r seed] [file.vgm ...]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (Seed == 0 || Iterations == 0) {
+        fprintf(stderr, "seed and iterations must be nonzero\n");
+        return 1;
+    }
+    for (uint32_t i=0;i<sizeof(Pcm);i++) Pcm[i] = Rand();
+    size_t len;
+    uint8_t *cmds;
+    if (optind == argc) {
+        cmds = Synth(Commands, &len);
+        Compare("synthetic", cmds, len);
+        free(cmds);
+    }
+    for (int i=optind;i<argc;i++) {
+        cmds = Load(argv[i], &len);
+        if (!cmds) {
+            fprintf(stderr, "%s: can't open\n", argv[i]);
+            return 1;
+        }
+        Compare(argv[i], cmds, len);
+        free(cmds);
+    }
+    return 0;
+}
@@ -0,0 +1,350 @@
+/*
+ * dssim - replays the dacstream starts in a vgm through a model of the firmware's dacstream find/fill tasks and driver,
+ * once with the old fixed slots and once with the DsArena allocator, and reports the underruns for each
+ *
+ * build: cc -O2 -Ifirmware/main -o dssim utils/dssim.c firmware/main/dsarena.c
+ * usage: dssim [-r reads per pass] [-s stall ms] [-v] [-d] file.vgm   (uncompressed, gunzip vgzs first)
+ *        dssim [-r reads per pass] [-s stall ms] [-v] -t trace.txt    (one "sample length rate" start per line, like -d prints)
+ *
+ * the model, same granularity as the firmware:
+ *  - find task: every 25ms, claims the next start into a free slot if it can (the arena one may have to wait for room)
+ *  - fill task: every 10ms, earliest deadline first, up to -r card reads of DACSTREAM_BUF_SIZE bytes, refilling slots below 2/3 full
+ *  - the card stops answering for -s ms once a second, which is what actually runs the buffers dry on real cards
+ *  - driver: one stream at a time. a start frees every older slot. a dry stream stalls, counted once per dry spell like the driver's
+ *  - -v lists each underrun, -d just prints the starts found in the vgm as a trace
+ *  - shared samples and ram-decoded blocks aren't modelled, everything comes off the card
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "dsarena.h"
+
+//must match mallocs.h
+#define DACSTREAM_BUF_SIZE 5000
+#define DACSTREAM_PRE_COUNT 16
+#define DACSTREAM_SLOT_MIN 1024
+#define DACSTREAM_SLOT_MAX 16384
+
+#define PASS_SAMPLES 441 //10ms
+#define FIND_PASSES 2 //close enough to the find task's 25ms
+
+typedef struct {
+    uint32_t Sample;
+    uint32_t Length;
+    uint32_t Rate;
+} Start_t;
+
+typedef struct {
+    bool Free;
+    uint32_t Start;     //index into the start list
+    uint32_t BufStart;
+    uint32_t BufSize;
+    uint32_t Used;
+    uint32_t ReadOffset;
+} Slot_t;
+
+static Start_t *Starts = NULL;
+static uint32_t StartCount = 0;
+static bool Verbose = false;
+
+static void AddStart(uint32_t sample, uint32_t length, uint32_t rate) {
+    Starts = realloc(Starts, (StartCount+1)*sizeof(Start_t));
+    if (!Starts) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    Starts[StartCount].Sample = sample;
+    Starts[StartCount].Length = length;
+    Starts[StartCount].Rate = rate?rate:44100;
+    StartCount++;
+}
+
+static uint32_t Get32(const uint8_t *p) {
+    return p[0] | (p[1]<<8) | (p[2]<<16) | ((uint32_t)p[3]<<24);
+}
+
+static uint32_t CommandLength(uint8_t c) { //fixed size commands only, including the command itself
+    if (c >= 0x30 && c <= 0x3f) return 2;
+    if (c == 0x4f || c == 0x50) return 2;
+    if (c >= 0x40 && c <= 0x5f) return 3;
+    if (c == 0x61) return 3;
+    if (c >= 0x70 && c <= 0x8f) return 1;
+    if (c == 0x90 || c == 0x91 || c == 0x95) return 5;
+    if (c == 0x92) return 6;
+    if (c == 0x93) return 11;
+    if (c == 0x94) return 2;
+    if (c >= 0xa0 && c <= 0xbf) return 3;
+    if (c >= 0xc0 && c <= 0xdf) return 4;
+    if (c >= 0xe0) return 5;
+    return 1;
+}
+
+static bool LoadVgm(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long sz = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *v = malloc(sz);
+    if (!v || fread(v, 1, sz, f) != (size_t)sz || sz < 0x40 || Get32(v) != 0x206d6756) {
+        fprintf(stderr, "%s: not an uncompressed vgm\n", path);
+        fclose(f);
+        return false;
+    }
+    fclose(f);
+
+    uint32_t pos = 0x40;
+    if (Get32(&v[8]) >= 0x150 && Get32(&v[0x34])) pos = 0x34 + Get32(&v[0x34]);
+    static uint32_t blocksizes[0x100][256]; //per bank type, for fast starts
+    static uint16_t blockcount[0x100];
+    uint32_t sample = 0;
+    uint8_t bank = 0;
+    uint32_t rate = 0;
+    while (pos < (uint32_t)sz) {
+        uint8_t c = v[pos];
+        if (c == 0x66) break;
+        if (c == 0x67) {
+            if (pos + 7 > (uint32_t)sz) break;
+            uint8_t type = v[pos+2];
+            uint32_t len = Get32(&v[pos+3]) & 0x7fffffff;
+            uint32_t data = len;
+            if (type >= 0x40 && type <= 0x7e && pos + 12 <= (uint32_t)sz) data = Get32(&v[pos+8]); //compressed, goes by the decoded size
+            if (type < 0xc0 && blockcount[type] < 256) blocksizes[type][blockcount[type]++] = data;
+            pos += 7 + len;
+            continue;
+        }
+        if (c == 0x68) {
+            pos += 12;
+            continue;
+        }
+        if (pos + CommandLength(c) > (uint32_t)sz) break;
+        const uint8_t *p = &v[pos+1];
+        if ((c&0xf0) == 0x70) sample += (c&0x0f)+1;
+        else if ((c&0xf0) == 0x80) sample += c&0x0f;
+        else if (c == 0x61) sample += p[0] | (p[1]<<8);
+        else if (c == 0x62) sample += 735;
+        else if (c == 0x63) sample += 882;
+        else if (c == 0x91) bank = p[1];
+        else if (c == 0x92) rate = Get32(&p[1]);
+        else if (c == 0x93) AddStart(sample, Get32(&p[6]), rate);
+        else if (c == 0x95) {
+            uint16_t block = p[1] | (p[2]<<8);
+            AddStart(sample, (block < blockcount[bank])?blocksizes[bank][block]:0, rate);
+        }
+        pos += CommandLength(c);
+    }
+    free(v);
+    return true;
+}
+
+static bool LoadTrace(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    char line[128];
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long s, l, r;
+        if (line[0] == '#') continue;
+        if (sscanf(line, "%lu %lu %lu", &s, &l, &r) == 3) AddStart(s, l, r);
+    }
+    fclose(f);
+    return true;
+}
+
+typedef struct {
+    uint32_t Underruns;
+    uint32_t StallMs;   //counted in samples until the end
+    uint32_t Late;      //starts the driver got to before the find task had a slot for them
+    uint32_t ArenaWaits;
+    uint32_t PeakSlots;
+} Result_t;
+
+static uint32_t Deadline(Slot_t *s, uint32_t now, uint32_t playing) {
+    Start_t *st = &Starts[s->Start];
+    uint32_t start = (s->Start == playing)?now:st->Sample;
+    return start + (uint32_t)(((uint64_t)s->Used*44100)/st->Rate);
+}
+
+static bool Claim(Slot_t *slots, uint8_t idx, uint32_t start, bool arena, DsArena_t *a) {
+    Slot_t *s = &slots[idx];
+    if (arena) {
+        bool empty = true;
+        uint32_t oldest = 0, tail = 0;
+        for (uint8_t i=0;i<DACSTREAM_PRE_COUNT;i++) {
+            if (slots[i].Free) continue;
+            if (empty || slots[i].Start < oldest) {
+                oldest = slots[i].Start;
+                tail = slots[i].BufStart;
+                empty = false;
+            }
+        }
+        uint32_t len = Starts[start].Length;
+        uint32_t want = (len < DACSTREAM_SLOT_MAX)?(len+1):DACSTREAM_SLOT_MAX;
+        uint32_t got;
+        uint32_t off = DsArena_Alloc(a, empty, tail, want, DACSTREAM_SLOT_MIN, &got);
+        if (off == DSARENA_NONE) return false;
+        s->BufStart = off;
+        s->BufSize = got;
+    } else {
+        s->BufStart = idx*DACSTREAM_BUF_SIZE;
+        s->BufSize = DACSTREAM_BUF_SIZE;
+    }
+    s->Free = false;
+    s->Start = start;
+    s->Used = 0;
+    s->ReadOffset = 0;
+    return true;
+}
+
+static Result_t Run(bool arena, uint8_t reads, uint32_t stall) {
+    Result_t res = {0};
+    Slot_t slots[DACSTREAM_PRE_COUNT];
+    DsArena_t a;
+    DsArena_Init(&a, DACSTREAM_BUF_SIZE*DACSTREAM_PRE_COUNT);
+    for (uint8_t i=0;i<DACSTREAM_PRE_COUNT;i++) slots[i].Free = true;
+
+    uint32_t next = 0;              //next start for the find task
+    uint32_t started = 0;           //next start for the driver
+    uint32_t playing = 0xffffffff;  //start index the driver is on
+    uint64_t played = 0;            //bytes of it played
+    uint64_t due = 0;               //in 1/44100ths of a byte, so slow rates don't round away
+    bool dry = false;
+    uint32_t end = StartCount?(Starts[StartCount-1].Sample + (uint32_t)(((uint64_t)Starts[StartCount-1].Length*44100)/Starts[StartCount-1].Rate)):0;
+
+    for (uint32_t pass=0, now=0;now<=end+PASS_SAMPLES;pass++, now+=PASS_SAMPLES) {
+        //find
+        if (pass % FIND_PASSES == 0 && next < StartCount) {
+            for (uint8_t i=0;i<DACSTREAM_PRE_COUNT;i++) {
+                if (!slots[i].Free) continue;
+                if (Claim(slots, i, next, arena, &a)) next++;
+                else res.ArenaWaits++;
+                break;
+            }
+        }
+
+        //fill
+        uint8_t order[DACSTREAM_PRE_COUNT];
+        uint32_t deadlines[DACSTREAM_PRE_COUNT];
+        uint8_t count = 0;
+        for (uint8_t i=0;i<DACSTREAM_PRE_COUNT;i++) {
+            if (slots[i].Free || slots[i].ReadOffset >= Starts[slots[i].Start].Length) continue;
+            uint32_t d = Deadline(&slots[i], now, playing);
+            uint8_t j = count++;
+            for (;j>0 && deadlines[j-1]>d;j--) {
+                deadlines[j] = deadlines[j-1];
+                order[j] = order[j-1];
+            }
+            deadlines[j] = d;
+            order[j] = i;
+        }
+        uint8_t done = (((uint64_t)now*1000/44100) % 1000 < stall)?reads:0;
+        for (uint8_t i=0;i<count && done<reads;i++) {
+            Slot_t *s = &slots[order[i]];
+            uint32_t free = s->BufSize - 1 - s->Used;
+            if (free <= s->BufSize/3) continue;
+            uint32_t n = Starts[s->Start].Length - s->ReadOffset;
+            if (n > free) n = free;
+            if (n > DACSTREAM_BUF_SIZE) n = DACSTREAM_BUF_SIZE; //one read's worth. the real thing can reuse its read buffer, this is pessimistic
+            s->Used += n;
+            s->ReadOffset += n;
+            done++;
+        }
+
+        //driver, over the next 10ms
+        for (uint32_t t=now;t<now+PASS_SAMPLES;t++) {
+            while (started < StartCount && Starts[started].Sample <= t) {
+                bool have = false;
+                for (uint8_t i=0;i<DACSTREAM_PRE_COUNT;i++) {
+                    if (slots[i].Free) continue;
+                    if (slots[i].Start < started) slots[i].Free = true;
+                    else if (slots[i].Start == started) have = true;
+                }
+                if (!have) { //the find task fell behind. the firmware loses the start, here it just gets claimed late. everything older was just freed, so there's room
+                    res.Late++;
+                    for (uint8_t i=0;i<DACSTREAM_PRE_COUNT;i++) {
+                        if (slots[i].Free && Claim(slots, i, started, arena, &a)) break;
+                    }
+                    next = started+1;
+                }
+                playing = started++;
+                played = 0;
+                due = 0;
+                dry = false;
+            }
+            if (playing == 0xffffffff || played >= Starts[playing].Length) continue;
+            Slot_t *s = NULL;
+            for (uint8_t i=0;i<DACSTREAM_PRE_COUNT;i++) {
+                if (!slots[i].Free && slots[i].Start == playing) s = &slots[i];
+            }
+            if (!s) continue;
+            if (s->Used == 0) { //stall, doesn't move on
+                if (!dry) {
+                    res.Underruns++;
+                    if (Verbose) printf("%s: underrun at sample %u, start %u (length %u, rate %u), %lu played, stream size %u\n", arena?"arena":"fixed", t, playing, Starts[playing].Length, Starts[playing].Rate, (unsigned long)played, s->BufSize);
+                }
+                dry = true;
+                res.StallMs++; //in samples for now
+                continue;
+            }
+            dry = false;
+            due += Starts[playing].Rate;
+            while (due >= 44100 && s->Used && played < Starts[playing].Length) {
+                due -= 44100;
+                s->Used--;
+                played++;
+            }
+        }
+
+        uint32_t inuse = 0;
+        for (uint8_t i=0;i<DACSTREAM_PRE_COUNT;i++) if (!slots[i].Free) inuse++;
+        if (inuse > res.PeakSlots) res.PeakSlots = inuse;
+    }
+    res.StallMs /= 44;
+    return res;
+}
+
+static void Usage() {
+    fprintf(stderr, "usage: dssim [-r reads per pass] [-s stall ms] [-v] [-d] file.vgm\n       dssim [-r reads per pass] [-s stall ms] [-v] -t trace.txt\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    uint8_t reads = 2;
+    uint32_t stall = 0;
+    bool dump = false;
+    bool trace = false;
+    const char *path = NULL;
+    for (int i=1;i<argc;i++) {
+        if (!strcmp(argv[i], "-r") && i+1 < argc) reads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-s") && i+1 < argc) stall = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-d")) dump = true;
+        else if (!strcmp(argv[i], "-v")) Verbose = true;
+        else if (!strcmp(argv[i], "-t")) trace = true;
+        else if (argv[i][0] == '-') Usage();
+        else path = argv[i];
+    }
+    if (!path || !reads) Usage();
+    if (!(trace?LoadTrace(path):LoadVgm(path))) return 1;
+
+    if (dump) {
+        printf("#sample length rate\n");
+        for (uint32_t i=0;i<StartCount;i++) printf("%u %u %u\n", Starts[i].Sample, Starts[i].Length, Starts[i].Rate);
+        return 0;
+    }
+
+    printf("%u dacstream starts, %u card reads per 10ms, %ums card stall a second\n", StartCount, reads, stall);
+    printf("%-8s %10s %10s %6s %12s %6s\n", "alloc", "underruns", "stall ms", "late", "arena waits", "slots");
+    for (int arena=0;arena<2;arena++) {
+        Result_t r = Run(arena, reads, stall);
+        printf("%-8s %10u %10u %6u %12u %6u\n", arena?"arena":"fixed", r.Underruns, r.StallMs, r.Late, r.ArenaWaits, r.PeakSlots);
+    }
+    return 0;
+}
@@ -0,0 +1,394 @@
+/*
+ * emit_test - host test that merging waits in the loader doesn't move anything in time
+ *
+ * build: cc -O2 -Iutils/host -Ifirmware/main -Ifirmware/components/megastream -o emit_test utils/emit_test.c firmware/main/loaderemit.c firmware/main/vgm.c firmware/main/vgmreader.c firmware/main/trackfile.c utils/host/host.c firmware/components/megastream/megastream.c -lpthread -lm
+ * usage: emit_test [-n commands] [-c corpus size] [-r seed] [file.vgm ...]
+ *
+ *  - every vgm in the corpus is walked twice. the reference walk is the unmerged stream: every wait command is its own wait, and
+ *    every write, dac sample and dacstream command is logged with the sample it happens at. the other walk runs the commands through
+ *    the real LoaderEmit code into a small record ring, and plays the records back the way the driver does (WAIT and the DAC's Arg
+ *    move time on, DS_RATE takes its payload from the next record, NOP is skipped). both logs and the end sample have to match
+ *  - the ring is 37 records, so DS_RATE lands on the last record before the wraparound all the time and the NOP padding gets used.
+ *    it's drained whenever there's less than LOADEREMIT_MAX_RECORDS free like Loader_Main does, and the pending wait is flushed at
+ *    random points too, like the loader does when it goes to sleep
+ *  - the corpus is -c synthetic vgms of -n commands each, made from a few profiles: wait runs, runs of 0xffff waits long enough
+ *    to overflow a 24bit wait record, dac with short waits, and dacstream commands. uncompressed .vgm files on the command line are
+ *    added to it (only their fixed-size commands: datablocks, pcm ram writes and seeks don't go through LoaderEmit)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include "megastream.h"
+#include "driver.h"
+#include "vgm.h"
+#include "loaderemit.h"
+
+static uint32_t Commands = 200000;
+static uint32_t Corpus = 40;
+static uint32_t Seed = 1;
+
+static uint32_t Rand() { //xorshift32
+    Seed ^= Seed << 13;
+    Seed ^= Seed >> 17;
+    Seed ^= Seed << 5;
+    return Seed;
+}
+
+static void *Alloc(size_t size) {
+    void *p = malloc(size);
+    if (!p) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+//event logs
+
+typedef struct {
+    uint32_t Sample;
+    uint8_t Op;
+    uint8_t Reg;
+    uint32_t Val;
+} Event_t;
+
+typedef struct {
+    Event_t *Events;
+    size_t Count, Size;
+    uint32_t Sample; //where the stream ends up
+    uint32_t Waits;  //wait records (or commands, for the reference)
+    uint32_t Records;
+} Log_t;
+
+static void LogInit(Log_t *l) {
+    memset(l, 0, sizeof(*l));
+}
+
+static void LogEvent(Log_t *l, uint8_t op, uint8_t reg, uint32_t val) {
+    if (l->Count == l->Size) {
+        l->Size = l->Size?l->Size*2:4096;
+        l->Events = realloc(l->Events, l->Size*sizeof(Event_t));
+        if (!l->Events) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    Event_t *e = &l->Events[l->Count++];
+    e->Sample = l->Sample;
+    e->Op = op;
+    e->Reg = reg;
+    e->Val = val;
+}
+
+static uint8_t PcmSample(uint32_t i) { //what the 0x8n samples are, same on both walks
+    return i*37 + (i>>8);
+}
+
+//reference: the unmerged stream, one wait per wait command
+
+static void Reference(const uint8_t *cmds, size_t len, Log_t *l) {
+    uint32_t pcm = 0;
+    LogInit(l);
+    for (size_t p=0;p<len;p+=VgmCommandLength(cmds[p])) {
+        uint8_t d = cmds[p];
+        const uint8_t *c = &cmds[p+1];
+        uint32_t wait = 0;
+        if ((d&0xf0) == 0x70) wait = (d&0x0f)+1;
+        else if (d == 0x61) wait = c[0] | ((uint16_t)c[1]<<8);
+        else if (d == 0x62) wait = 735;
+        else if (d == 0x63) wait = 882;
+        if (wait || d == 0x61) { //0x61 0000 is still a wait command
+            l->Sample += wait;
+            l->Waits++;
+            l->Records++;
+            continue;
+        }
+        if ((d&0xf0) == 0x80) {
+            LogEvent(l, DRIVER_OP_OPN2_DAC, 0, PcmSample(pcm++));
+            l->Sample += d&0x0f;
+        } else if (d == 0x93 || d == 0x95) {
+            LogEvent(l, DRIVER_OP_DS_START, c[0], 0);
+        } else if (d == 0x94) {
+            LogEvent(l, DRIVER_OP_DS_STOP, c[0], 0);
+        } else if (d == 0x92) {
+            LogEvent(l, DRIVER_OP_DS_RATE, c[0], c[1] | ((uint32_t)c[2]<<8) | ((uint32_t)c[3]<<16) | ((uint32_t)c[4]<<24));
+        } else if (d == 0x50) {
+            LogEvent(l, DRIVER_OP_DCSG, 0, c[0]);
+        } else if (d == 0x52) {
+            LogEvent(l, DRIVER_OP_OPN2_0, c[0], c[1]);
+        } else if (d == 0x53) {
+            LogEvent(l, DRIVER_OP_OPN2_1, c[0], c[1]);
+        } else if (d == 0x51) {
+            LogEvent(l, DRIVER_OP_OPLL, c[0], c[1]);
+        } else if (d == 0x54) {
+            LogEvent(l, DRIVER_OP_OPM, c[0], c[1]);
+        } else if (d == 0x55) {
+            LogEvent(l, DRIVER_OP_OPN, c[0], c[1]);
+        } else if (d == 0x56) {
+            LogEvent(l, DRIVER_OP_OPNA_0, c[0], c[1]);
+        } else if (d == 0x57) {
+            LogEvent(l, DRIVER_OP_OPNA_1, c[0], c[1]);
+        } else if (d == 0xa0) {
+            LogEvent(l, DRIVER_OP_AY, c[0], c[1]);
+        } else if (d == 0xa5) {
+            LogEvent(l, DRIVER_OP_OPN_2, c[0], c[1]);
+        } else if (d == 0x5a || d == 0x5b || d == 0x5e) {
+            LogEvent(l, DRIVER_OP_OPL3_0, c[0], c[1]);
+        } else if (d == 0x5f) {
+            LogEvent(l, DRIVER_OP_OPL3_1, c[0], c[1]);
+        } else {
+            continue; //dropped on both walks
+        }
+        l->Records++;
+    }
+}
+
+//merged: the real LoaderEmit, played back like the driver does
+
+#define RING_RECORDS 37
+
+static void Drain(MegaStreamContext_t *ms, Log_t *l) {
+    DriverRecord_t *rec;
+    size_t span;
+    while ((span = MegaStream_PeekSpan(ms, (uint8_t **)&rec)/sizeof(DriverRecord_t)) > 0) {
+        size_t ran = 0;
+        while (ran < span) {
+            DriverRecord_t *r = &rec[ran];
+            ran++;
+            l->Records++;
+            if (r->Op == DRIVER_OP_WAIT) {
+                uint32_t w = r->Reg | ((uint32_t)r->Val<<8) | ((uint32_t)r->Arg<<16);
+                if (w == 0) {
+                    fprintf(stderr, "FAIL: empty wait record\n");
+                    exit(1);
+                }
+                l->Sample += w;
+                l->Waits++;
+            } else if (r->Op == DRIVER_OP_OPN2_DAC) {
+                LogEvent(l, DRIVER_OP_OPN2_DAC, 0, r->Val);
+                l->Sample += r->Arg;
+            } else if (r->Op == DRIVER_OP_DS_RATE) {
+                if (ran == span) { //the padding is there so this can't happen
+                    fprintf(stderr, "FAIL: DS_RATE split from its payload by the wraparound\n");
+                    exit(1);
+                }
+                uint8_t *p = (uint8_t *)&rec[ran++];
+                LogEvent(l, DRIVER_OP_DS_RATE, r->Reg, p[0] | ((uint32_t)p[1]<<8) | ((uint32_t)p[2]<<16) | ((uint32_t)p[3]<<24));
+            } else if (r->Op == DRIVER_OP_NOP) {
+                l->Records--;
+            } else if (r->Op == DRIVER_OP_DCSG) {
+                LogEvent(l, r->Op, 0, r->Val);
+            } else if (r->Op == DRIVER_OP_DS_START || r->Op == DRIVER_OP_DS_STOP) {
+                LogEvent(l, r->Op, r->Reg, 0);
+            } else if (r->Op < DRIVER_OP_COUNT) {
+                LogEvent(l, r->Op, r->Reg, r->Val);
+            } else {
+                fprintf(stderr, "FAIL: bad op %d\n", r->Op);
+                exit(1);
+            }
+        }
+        MegaStream_Consume(ms, ran*sizeof(DriverRecord_t));
+    }
+}
+
+static void Merged(const uint8_t *cmds, size_t len, Log_t *l) {
+    static uint8_t buf[RING_RECORDS*sizeof(DriverRecord_t)];
+    MegaStreamContext_t ms;
+    LoaderEmit_t e;
+    uint32_t pcm = 0;
+    MegaStream_Create(&ms, buf, sizeof(buf));
+    LoaderEmit_Init(&e, &ms);
+    LogInit(l);
+    for (size_t p=0;p<len;p+=VgmCommandLength(cmds[p])) {
+        if (MegaStream_Free(&ms) < LOADEREMIT_MAX_RECORDS*sizeof(DriverRecord_t)) {
+            Drain(&ms, l);
+            if (Rand()%4 == 0) LoaderEmit_FlushWait(&e); //loader going to sleep
+        }
+        uint8_t d = cmds[p];
+        if ((d&0xf0) == 0x80) {
+            LoaderEmit_Pcm(&e, PcmSample(pcm++), d&0x0f);
+        } else if (d >= 0x90 && d <= 0x95) {
+            LoaderEmit_DacStream(&e, d, &cmds[p+1]);
+        } else {
+            LoaderEmit_Command(&e, d, &cmds[p+1]);
+        }
+    }
+    if (MegaStream_Free(&ms) < sizeof(DriverRecord_t)) Drain(&ms, l);
+    uint32_t sample = e.Sample;
+    LoaderEmit_FlushWait(&e); //end of the track
+    Drain(&ms, l);
+    if (sample != l->Sample) {
+        fprintf(stderr, "FAIL: loader thinks it's at sample %u, driver ended up at %u\n", sample, l->Sample);
+        exit(1);
+    }
+}
+
+static void Check(const char *name, const uint8_t *cmds, size_t len, bool verbose, uint64_t *refrecs, uint64_t *recs) {
+    Log_t ref, got;
+    Reference(cmds, len, &ref);
+    Merged(cmds, len, &got);
+    if (ref.Count != got.Count) {
+        fprintf(stderr, "FAIL: %s: %zu events unmerged, %zu merged\n", name, ref.Count, got.Count);
+        exit(1);
+    }
+    for (size_t i=0;i<ref.Count;i++) {
+        Event_t *a = &ref.Events[i], *b = &got.Events[i];
+        if (a->Sample != b->Sample || a->Op != b->Op || a->Reg != b->Reg || a->Val != b->Val) {
+            fprintf(stderr, "FAIL: %s: event %zu is op %d reg %02x val %x at sample %u unmerged, op %d reg %02x val %x at sample %u merged\n", name, i, a->Op, a->Reg, a->Val, a->Sample, b->Op, b->Reg, b->Val, b->Sample);
+            exit(1);
+        }
+    }
+    if (ref.Sample != got.Sample) {
+        fprintf(stderr, "FAIL: %s: ends at sample %u unmerged, %u merged\n", name, ref.Sample, got.Sample);
+        exit(1);
+    }
+    if (got.Records > ref.Records) {
+        fprintf(stderr, "FAIL: %s: merging made more records (%u vs %u)\n", name, got.Records, ref.Records);
+        exit(1);
+    }
+    *refrecs += ref.Records;
+    *recs += got.Records;
+    if (verbose) printf("%s: %zu events, %u samples, %u wait commands -> %u wait records: ok\n", name, ref.Count, ref.Sample, ref.Waits, got.Waits);
+    free(ref.Events);
+    free(got.Events);
+}
+
+//corpus
+
+enum {
+    PROFILE_MIXED,     //fm, dcsg, dac, every kind of wait
+    PROFILE_WAITRUNS,  //long runs of short waits between writes, like a vgm_cmp'd psg track
+    PROFILE_LONGWAITS, //runs of 0xffff waits, past what one wait record holds
+    PROFILE_DACSTREAM, //dacstream commands between waits, lots of DS_RATE
+    PROFILE_COUNT
+};
+
+static size_t Put(uint8_t *c, uint8_t d) { //a command with random attached data
+    uint8_t l = VgmCommandLength(d);
+    c[0] = d;
+    for (uint8_t i=1;i<l;i++) c[i] = Rand();
+    return l;
+}
+
+static uint8_t *Synth(uint32_t profile, uint32_t n, size_t *len) {
+    static const uint8_t writes[] = {0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57, 0x5a, 0x5b, 0x5e, 0x5f, 0xa0, 0xa5, 0x4f, 0x31, 0xb1, 0xd2};
+    uint8_t *c = Alloc((size_t)n*11); //0x93 is the longest
+    size_t p = 0;
+    for (uint32_t i=0;i<n;i++) {
+        uint32_t r = Rand()%100;
+        uint8_t d;
+        if (profile == PROFILE_WAITRUNS) {
+            d = (r < 80)?0x70+Rand()%16:(r < 85?0x61:writes[Rand()%sizeof(writes)]);
+        } else if (profile == PROFILE_LONGWAITS) {
+            if (r < 2) { //a run of 256-511 of them is 16.7-33.5M samples, past one wait record
+                for (uint32_t j=256+Rand()%256;j>0 && i<n;j--,i++) {
+                    c[p++] = 0x61;
+                    c[p++] = 0xff;
+                    c[p++] = 0xff;
+                }
+                i--;
+                continue;
+            }
+            d = (r < 60)?0x61:(r < 80?0x63:0x52);
+        } else if (profile == PROFILE_DACSTREAM) {
+            static const uint8_t ds[] = {0x90, 0x91, 0x92, 0x92, 0x92, 0x93, 0x94, 0x95};
+            d = (r < 50)?ds[Rand()%sizeof(ds)]:(r < 80?0x70+Rand()%16:0x62);
+        } else {
+            if (r < 40) d = writes[Rand()%sizeof(writes)];
+            else if (r < 60) d = 0x80+Rand()%16;
+            else if (r < 80) d = 0x70+Rand()%16;
+            else if (r < 90) d = 0x61;
+            else if (r < 95) d = 0x62+Rand()%2;
+            else d = 0x90+Rand()%6;
+        }
+        p += Put(&c[p], d);
+        if (d == 0x61 && Rand()%8 == 0) c[p-2] = c[p-1] = 0; //the odd zero wait
+    }
+    *len = p;
+    return c;
+}
+
+static uint8_t *Load(const char *path, size_t *len) { //the fixed-size commands of an uncompressed vgm, 0x66 not included
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "%s: can't open\n", path);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    long sz = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *v = Alloc(sz);
+    uint8_t *c = Alloc(sz);
+    if (sz < 0x40 || fread(v, 1, sz, f) != (size_t)sz || memcmp(v, "Vgm ", 4)) {
+        fprintf(stderr, "%s: not an uncompressed vgm\n", path);
+        exit(1);
+    }
+    fclose(f);
+    uint32_t ver = v[8] | (v[9]<<8);
+    uint32_t off = v[0x34] | (v[0x35]<<8) | (v[0x36]<<16) | ((uint32_t)v[0x37]<<24);
+    size_t p = (ver >= 0x150 && off)?0x34+off:0x40;
+    size_t o = 0;
+    while (p < (size_t)sz && v[p] != 0x66) {
+        uint8_t d = v[p];
+        if (d == 0x67) { //datablock
+            if (p+7 > (size_t)sz) break;
+            p += 7 + ((v[p+3] | (v[p+4]<<8) | (v[p+5]<<16) | ((uint32_t)v[p+6]<<24)) & 0x7fffffff);
+        } else if (d == 0x68) { //pcm ram write
+            p += 12;
+        } else if (d == 0xe0) { //pcm seek
+            p += 5;
+        } else {
+            uint8_t l = VgmCommandLength(d);
+            if (l == 0xff || p+l > (size_t)sz) {
+                fprintf(stderr, "%s: bad command %02x at 0x%zx\n", path, d, p);
+                exit(1);
+            }
+            memcpy(&c[o], &v[p], l);
+            o += l;
+            p += l;
+        }
+    }
+    free(v);
+    *len = o;
+    return c;
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:c:r:")) != -1) {
+        switch (opt) {
+            case 'n': Commands = strtoul(optarg, NULL, 0); break;
+            case 'c': Corpus = strtoul(optarg, NULL, 0); break;
+            case 'r': Seed = strtoul(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr, "usage: %s [-n commands] [-c corpus size] [-r seed] [file.vgm ...]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (Seed == 0) {
+        fprintf(stderr, "seed must be nonzero\n");
+        return 1;
+    }
+    uint64_t refrecs = 0, recs = 0;
+    size_t len;
+    uint8_t *cmds;
+    for (uint32_t i=0;i<Corpus;i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "synthetic vgm %u", i);
+        cmds = Synth(i%PROFILE_COUNT, Commands, &len);
+        Check(name, cmds, len, false, &refrecs, &recs);
+        free(cmds);
+    }
+    if (Corpus) printf("synthetic: %u vgms of %u commands, same timeline merged and unmerged: ok\n", Corpus, Commands);
+    for (int i=optind;i<argc;i++) {
+        cmds = Load(argv[i], &len);
+        Check(argv[i], cmds, len, true, &refrecs, &recs);
+        free(cmds);
+    }
+    printf("%llu records unmerged, %llu merged (%.1f%%)\n", (unsigned long long)refrecs, (unsigned long long)recs, refrecs?100.0*recs/refrecs:0);
+    return 0;
+}
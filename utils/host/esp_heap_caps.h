@@ -0,0 +1,13 @@
+#ifndef HOST_ESP_HEAP_CAPS_H
+#define HOST_ESP_HEAP_CAPS_H
+
+#include <stdlib.h>
+
+#define MALLOC_CAP_8BIT 0
+#define MALLOC_CAP_32BIT 0
+#define MALLOC_CAP_DMA 0
+
+#define heap_caps_malloc(size, caps) malloc(size)
+#define heap_caps_realloc(ptr, size, caps) realloc(ptr, size)
+
+#endif
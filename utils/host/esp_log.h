@@ -0,0 +1,14 @@
+#ifndef HOST_ESP_LOG_H
+#define HOST_ESP_LOG_H
+
+//host stand-in for the esp-idf logger. quiet unless a test turns Host_LogLevel up
+extern int Host_LogLevel; //0 = nothing, 1 = errors, 2 = +warnings, 3 = +info, 4 = +debug
+void Host_Log(int level, char c, const char *tag, const char *fmt, ...);
+
+#define ESP_LOGE(tag, fmt, ...) Host_Log(1, 'E', tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) Host_Log(2, 'W', tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) Host_Log(3, 'I', tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) Host_Log(4, 'D', tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGV(tag, fmt, ...) Host_Log(5, 'V', tag, fmt, ##__VA_ARGS__)
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef HOST_ESP_SYSTEM_H
+#define HOST_ESP_SYSTEM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h> //esp_err.h brings it in on the device, and the firmware relies on that
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+#endif
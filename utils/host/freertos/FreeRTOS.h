@@ -0,0 +1,22 @@
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+//host stand-in for the bits of freertos the firmware modules under test use. one tick is 1ms
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_heap_caps.h" //the idf one gets this in through portmacro.h, and firmware sources count on it
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xffffffff
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define configMAX_PRIORITIES 25
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef HOST_QUEUE_H
+#define HOST_QUEUE_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct Host_Queue *QueueHandle_t;
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef HOST_SEMPHR_H
+#define HOST_SEMPHR_H
+
+#include <pthread.h>
+#include "freertos/FreeRTOS.h"
+
+typedef struct {
+    pthread_mutex_t Mutex;
+} StaticSemaphore_t;
+typedef StaticSemaphore_t *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex();
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buf);
+void vSemaphoreDelete(SemaphoreHandle_t s);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t ticks); //any timeout but 0 waits forever
+BaseType_t xSemaphoreGive(SemaphoreHandle_t s);
+
+#endif
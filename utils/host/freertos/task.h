@@ -0,0 +1,16 @@
+#ifndef HOST_TASK_H
+#define HOST_TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct Host_Task *TaskHandle_t;
+
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
+void xTaskNotifyGive(TaskHandle_t t);
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks); //only portMAX_DELAY and 0 timeouts
+
+//tests start firmware task mains on their own pthread with this, so the notify calls have a task to go to
+void Host_TaskStart(void (*main)(), TaskHandle_t *handle);
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ * host.c - the esp-idf and freertos calls the firmware modules under test make, done with libc and pthreads
+ *
+ * linked into the host tests in utils/ (build lines at the top of each). the headers next to this file stand in for the idf ones,
+ * so firmware sources compile unchanged with -Iutils/host ahead of -Ifirmware/main
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "taskmgr.h"
+#include "unvgz.h"
+
+int Host_LogLevel = 0;
+
+void Host_Log(int level, char c, const char *tag, const char *fmt, ...) {
+    if (level > Host_LogLevel) return;
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "%c (%s) ", c, tag);
+    vfprintf(stderr, fmt, ap);
+    fputc('\n', stderr);
+    va_end(ap);
+}
+
+//semaphores
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buf) {
+    pthread_mutex_init(&buf->Mutex, NULL);
+    return buf;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+    StaticSemaphore_t *s = malloc(sizeof(StaticSemaphore_t));
+    if (!s) return NULL;
+    return xSemaphoreCreateMutexStatic(s);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t s) { //only for ones from xSemaphoreCreateMutex
+    pthread_mutex_destroy(&s->Mutex);
+    free(s);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t ticks) {
+    if (ticks == 0) return pthread_mutex_trylock(&s->Mutex) == 0 ? pdTRUE : pdFALSE;
+    pthread_mutex_lock(&s->Mutex);
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t s) {
+    pthread_mutex_unlock(&s->Mutex);
+    return pdTRUE;
+}
+
+//tasks
+
+struct Host_Task {
+    pthread_t Thread;
+    pthread_mutex_t Lock;
+    pthread_cond_t Cond;
+    uint32_t Notify;
+    void (*Main)();
+};
+
+static struct Host_Task Host_MainTask = {.Lock = PTHREAD_MUTEX_INITIALIZER, .Cond = PTHREAD_COND_INITIALIZER};
+static __thread struct Host_Task *Host_CurrentTask;
+
+static struct Host_Task *Host_Current() {
+    if (!Host_CurrentTask) Host_CurrentTask = &Host_MainTask; //anything not started with Host_TaskStart shares one
+    return Host_CurrentTask;
+}
+
+static void *Host_TaskThread(void *arg) {
+    Host_CurrentTask = arg;
+    Host_CurrentTask->Main();
+    return NULL;
+}
+
+void Host_TaskStart(void (*main)(), TaskHandle_t *handle) {
+    struct Host_Task *t = calloc(1, sizeof(struct Host_Task));
+    if (!t) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    pthread_mutex_init(&t->Lock, NULL);
+    pthread_cond_init(&t->Cond, NULL);
+    t->Main = main;
+    *handle = t;
+    pthread_create(&t->Thread, NULL, Host_TaskThread, t);
+    pthread_detach(t->Thread);
+}
+
+void xTaskNotifyGive(TaskHandle_t t) {
+    pthread_mutex_lock(&t->Lock);
+    t->Notify++;
+    pthread_cond_signal(&t->Cond);
+    pthread_mutex_unlock(&t->Lock);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+    struct Host_Task *t = Host_Current();
+    pthread_mutex_lock(&t->Lock);
+    while (t->Notify == 0 && ticks != 0) pthread_cond_wait(&t->Cond, &t->Lock);
+    uint32_t n = t->Notify;
+    if (n) t->Notify = clear ? 0 : n-1;
+    pthread_mutex_unlock(&t->Lock);
+    return n;
+}
+
+void vTaskDelay(TickType_t ticks) {
+    usleep(ticks*1000);
+}
+
+TickType_t xTaskGetTickCount() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1000 + t.tv_nsec/1000000;
+}
+
+//firmware globals the modules under test reach for. no taskmgr or unvgz on the host: every file is a plain one
+
+TaskHandle_t Taskmgr_Handles[TASK_COUNT];
+
+bool Unvgz_WaitAvail(uint32_t end) {
+    return true;
+}
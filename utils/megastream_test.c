@@ -0,0 +1,271 @@
+/*
+ * megastream_test - host test and benchmark for the MegaStream ring buffer
+ *
+ * build: cc -O2 -pthread -DMEGASTREAM_PARANOID -Ifirmware/components/megastream -o megastream_test utils/megastream_test.c firmware/components/megastream/megastream.c
+ * tsan:  cc -O1 -g -fsanitize=thread -pthread -Ifirmware/components/megastream -o megastream_tsan utils/megastream_test.c firmware/components/megastream/megastream.c
+ *        ./megastream_tsan -x -n 4000000 -s 61   (must finish with no warnings)
+ *        the same build with -DMEGASTREAM_ORDER_RELAXED is the control: it drops the acquire/release on head/tail, and tsan has to
+ *        report a data race between the producer's writes into the ring and the consumer's reads, or the test isn't proving anything
+ * usage: megastream_test [-n bytes] [-s ring size] [-r seed] [-e] [-x] [-b]
+ *
+ *  - -e runs only the single threaded edge cases: full, empty, every wraparound offset, reserve/peekspan spans
+ *  - -x runs only the two thread stress test: a producer and a consumer thread move -n bytes through a -s byte ring, each picking
+ *    random sizes and randomly using Send or Reserve/Commit, Recv or PeekSpan/Consume or Peek/Consume. every byte is a function of
+ *    its position in the stream so the consumer checks all of them
+ *  - -b runs only the benchmark: -n bytes through the ring with Send/Recv at a few fixed chunk sizes, reported in MB/s
+ *  - nothing runs all three. exits nonzero on the first mismatch. MEGASTREAM_PARANOID turns footgun violations into asserts
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "megastream.h"
+
+static uint64_t Bytes = 64*1024*1024;
+static size_t RingSize = 4099; //odd so chunk sizes never line up with the wraparound
+static uint32_t Seed = 1;
+
+static uint8_t StreamByte(uint64_t pos) { //what the byte at this position in the stream should be
+    uint64_t x = pos*0x9e3779b97f4a7c15ULL;
+    x ^= x >> 29;
+    return x ^ (x >> 8);
+}
+
+static uint32_t Rand(uint32_t *s) { //xorshift32, one state per thread
+    uint32_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *s = x;
+}
+
+static void Fail(const char *what, uint64_t pos) {
+    fprintf(stderr, "FAIL: %s at stream byte %llu\n", what, (unsigned long long)pos);
+    exit(1);
+}
+
+static double Now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec/1e9;
+}
+
+//single threaded edge cases
+
+static void EdgeCheck(MegaStreamContext_t *ms, size_t used, const char *what) {
+    if (MegaStream_Used(ms) != used) Fail(what, used);
+    if (MegaStream_Free(ms) != ms->size-1-used) Fail(what, used);
+}
+
+static void EdgeTests() {
+    uint8_t buf[17];
+    uint8_t in[64], out[64];
+    MegaStreamContext_t ms;
+    for (uint32_t i=0;i<sizeof(in);i++) in[i] = StreamByte(i);
+
+    //every starting offset, every fill level up to full, in one go and back out
+    for (size_t start=0;start<sizeof(buf);start++) {
+        for (size_t n=0;n<sizeof(buf);n++) {
+            MegaStream_Create(&ms, buf, sizeof(buf));
+            MegaStream_Send(&ms, in, start); //walk the indices round to start
+            MegaStream_Recv(&ms, out, start);
+            EdgeCheck(&ms, 0, "empty after offset");
+            MegaStream_Send(&ms, in, n);
+            EdgeCheck(&ms, n, "used after send");
+            memset(out, 0, sizeof(out));
+            MegaStream_Recv(&ms, out, n);
+            if (memcmp(in, out, n)) Fail("wrapped send/recv data", start);
+            EdgeCheck(&ms, 0, "empty after recv");
+        }
+    }
+
+    //a ring of size n holds n-1
+    MegaStream_Create(&ms, buf, sizeof(buf));
+    MegaStream_Send(&ms, in, sizeof(buf)-1);
+    EdgeCheck(&ms, sizeof(buf)-1, "full");
+    uint8_t *p;
+    if (MegaStream_Reserve(&ms, &p) != 0) Fail("reserve when full", 0);
+    MegaStream_Recv(&ms, out, sizeof(buf)-1);
+    if (MegaStream_PeekSpan(&ms, &p) != 0) Fail("peekspan when empty", 0);
+
+    //reserve/peekspan only ever hand out up to the wraparound
+    for (size_t start=0;start<sizeof(buf);start++) {
+        MegaStream_Create(&ms, buf, sizeof(buf));
+        MegaStream_Send(&ms, in, start);
+        MegaStream_Recv(&ms, out, start);
+        size_t span = MegaStream_Reserve(&ms, &p);
+        size_t want = sizeof(buf)-start;
+        if (want > sizeof(buf)-1) want = sizeof(buf)-1;
+        if (span != want || p != &buf[start]) Fail("reserve span", start);
+        memcpy(p, in, span);
+        MegaStream_Commit(&ms, span);
+        EdgeCheck(&ms, span, "used after commit");
+        if (MegaStream_PeekSpan(&ms, &p) != span || p != &buf[start]) Fail("peekspan span", start);
+        if (MegaStream_Peek(&ms) != in[0]) Fail("peek", start);
+        if (memcmp(p, in, span)) Fail("reserve/peekspan data", start);
+        MegaStream_Consume(&ms, span);
+        EdgeCheck(&ms, 0, "empty after consume");
+    }
+
+    MegaStream_Send(&ms, in, 5);
+    MegaStream_Reset(&ms);
+    EdgeCheck(&ms, 0, "empty after reset");
+    printf("edge cases: ok\n");
+}
+
+//two thread stress
+
+typedef struct {
+    MegaStreamContext_t *Ms;
+    uint64_t Bytes;
+    uint32_t Seed;
+    size_t MaxChunk;
+    bool Random;    //random sizes and calls, otherwise fixed MaxChunk Send/Recv for the benchmark
+    uint64_t Stalls; //times it found nothing to do and had to yield
+} Side_t;
+
+static void *Producer(void *arg) {
+    Side_t *s = arg;
+    uint8_t chunk[4096];
+    uint64_t pos = 0;
+    while (pos < s->Bytes) {
+        size_t n = MegaStream_Free(s->Ms);
+        if (n == 0) {
+            s->Stalls++;
+            sched_yield();
+            continue;
+        }
+        if (n > s->MaxChunk) n = s->MaxChunk;
+        if (n > s->Bytes - pos) n = s->Bytes - pos;
+        if (s->Random) n = 1 + Rand(&s->Seed)%n;
+        if (s->Random && (Rand(&s->Seed) & 1)) { //straight into the ring
+            uint8_t *p;
+            size_t span = MegaStream_Reserve(s->Ms, &p);
+            if (n > span) n = span;
+            for (size_t i=0;i<n;i++) p[i] = StreamByte(pos+i);
+            MegaStream_Commit(s->Ms, n);
+        } else {
+            if (s->Random) {
+                for (size_t i=0;i<n;i++) chunk[i] = StreamByte(pos+i);
+            }
+            MegaStream_Send(s->Ms, chunk, n);
+        }
+        pos += n;
+    }
+    return NULL;
+}
+
+static void *Consumer(void *arg) {
+    Side_t *s = arg;
+    uint8_t chunk[4096];
+    uint64_t pos = 0;
+    while (pos < s->Bytes) {
+        size_t n = MegaStream_Used(s->Ms);
+        if (n == 0) {
+            s->Stalls++;
+            sched_yield();
+            continue;
+        }
+        if (n > s->MaxChunk) n = s->MaxChunk;
+        if (!s->Random) {
+            MegaStream_Recv(s->Ms, chunk, n);
+            pos += n;
+            continue;
+        }
+        n = 1 + Rand(&s->Seed)%n;
+        uint32_t how = Rand(&s->Seed)%3;
+        if (how == 0) {
+            MegaStream_Recv(s->Ms, chunk, n);
+            for (size_t i=0;i<n;i++) {
+                if (chunk[i] != StreamByte(pos+i)) Fail("recv data", pos+i);
+            }
+        } else if (how == 1) { //straight out of the ring
+            uint8_t *p;
+            size_t span = MegaStream_PeekSpan(s->Ms, &p);
+            if (n > span) n = span;
+            for (size_t i=0;i<n;i++) {
+                if (p[i] != StreamByte(pos+i)) Fail("peekspan data", pos+i);
+            }
+            MegaStream_Consume(s->Ms, n);
+        } else {
+            n = 1;
+            if (MegaStream_Peek(s->Ms) != StreamByte(pos)) Fail("peek data", pos);
+            MegaStream_Consume(s->Ms, 1);
+        }
+        pos += n;
+    }
+    return NULL;
+}
+
+static double Run(size_t ring, uint64_t bytes, size_t maxchunk, bool random, uint64_t *stalls) {
+    uint8_t *buf = malloc(ring);
+    if (!buf) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    MegaStreamContext_t ms;
+    MegaStream_Create(&ms, buf, ring);
+    Side_t p = {&ms, bytes, Seed, maxchunk, random, 0};
+    Side_t c = {&ms, bytes, Seed*2+1, maxchunk, random, 0};
+    pthread_t pt, ct;
+    double t = Now();
+    pthread_create(&ct, NULL, Consumer, &c);
+    pthread_create(&pt, NULL, Producer, &p);
+    pthread_join(pt, NULL);
+    pthread_join(ct, NULL);
+    t = Now() - t;
+    if (MegaStream_Used(&ms) != 0) Fail("left over after stress", bytes);
+    if (stalls) *stalls = p.Stalls + c.Stalls;
+    free(buf);
+    return t;
+}
+
+static void StressTest() {
+    uint64_t stalls;
+    double t = Run(RingSize, Bytes, RingSize, true, &stalls);
+    printf("stress: %llu bytes through a %zu byte ring in %.2fs, %llu empty/full stalls: ok\n", (unsigned long long)Bytes, RingSize, t, (unsigned long long)stalls);
+}
+
+static void Benchmark() {
+    static const size_t chunks[] = {1, 4, 16, 64, 256, 1024, 4096};
+    size_t ring = 40000; //same as DRIVER_QUEUE_SIZE
+    for (uint32_t i=0;i<sizeof(chunks)/sizeof(chunks[0]);i++) {
+        uint64_t bytes = Bytes;
+        if (chunks[i] < 64) bytes /= 64/chunks[i]; //the small ones are slow, don't take all day
+        double t = Run(ring, bytes, chunks[i], false, NULL);
+        printf("bench: %4zu byte chunks, %.1f MB/s\n", chunks[i], bytes/t/1e6);
+    }
+}
+
+int main(int argc, char **argv) {
+    bool edge = false, stress = false, bench = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:r:exb")) != -1) {
+        switch (opt) {
+            case 'n': Bytes = strtoull(optarg, NULL, 0); break;
+            case 's': RingSize = strtoul(optarg, NULL, 0); break;
+            case 'r': Seed = strtoul(optarg, NULL, 0); break;
+            case 'e': edge = true; break;
+            case 'x': stress = true; break;
+            case 'b': bench = true; break;
+            default:
+                fprintf(stderr, "usage: %s [-n bytes] [-s ring size] [-r seed] [-e] [-x] [-b]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (RingSize < 2 || Seed == 0) {
+        fprintf(stderr, "ring size must be at least 2 and seed nonzero\n");
+        return 1;
+    }
+    if (!edge && !stress && !bench) edge = stress = bench = true;
+    if (edge) EdgeTests();
+    if (stress) StressTest();
+    if (bench) Benchmark();
+    return 0;
+}
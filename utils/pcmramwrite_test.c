@@ -0,0 +1,180 @@
+/*
+ * pcmramwrite_test - host test of VgmParsePcmRamWrite (vgm 0x68) on synthetic vgm command streams
+ *
+ * build: cc -O2 -Iutils/host -Ifirmware/main -o pcmramwrite_test utils/pcmramwrite_test.c firmware/main/vgm.c firmware/main/vgmreader.c firmware/main/trackfile.c utils/host/host.c -lpthread -lm
+ * usage: pcmramwrite_test [-n rounds] [-c commands per round] [-r seed]
+ *
+ *  - each round writes a temp file of random fixed size commands (chip writes, waits, pcm+wait, pcm seeks) with 0x68 pcm ram writes
+ *    mixed in, a good share of them with size 0 or with fields right at the 24 bit edges, and enough of them that plenty straddle
+ *    a VgmReader buffer refill
+ *  - the file is then walked through the real vgmreader.c / trackfile.c the way Loader_Main's ignore path does it: 0x68 goes to
+ *    VgmParsePcmRamWrite, everything else is skipped by VgmCommandLength. every command has to turn up at the offset it was written
+ *    at, so a 0x68 that eats one byte too many or too few throws off everything after it, and every 0x68 has to decode to the fields
+ *    that were written, size 0 coming back as 0x1000000
+ *  - then a 0x68 cut short by the end of the file has to fail instead of handing back half read fields
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include "vgm.h"
+#include "vgmreader.h"
+#include "trackfile.h"
+
+static uint32_t Rounds = 50;
+static uint32_t Commands = 20000;
+static uint32_t Seed = 1;
+
+static uint32_t Rand() { //xorshift32
+    Seed ^= Seed << 13;
+    Seed ^= Seed >> 17;
+    Seed ^= Seed << 5;
+    return Seed;
+}
+
+static void Fail(const char *what, uint32_t round, uint32_t cmd, uint32_t want, uint32_t got) {
+    fprintf(stderr, "FAIL: round %u, command %u: %s: wrote 0x%x, parsed 0x%x\n", round, cmd, what, want, got);
+    exit(1);
+}
+
+typedef struct {
+    uint32_t Offset;
+    uint8_t Command;
+    VgmPcmRamWriteStruct_t Write; //as written, size 0 already turned into 0x1000000
+} Expected_t;
+
+static const uint8_t Fixed[] = {0x50, 0x52, 0x53, 0x61, 0x62, 0x63, 0x70, 0x7f, 0x80, 0x8f, 0xe0};
+
+static uint32_t Field24() {
+    switch (Rand()%8) {
+        case 0: return 0;
+        case 1: return 0xffffff;
+        case 2: return 0x00ffff + Rand()%3; //crosses into the top byte
+        default: return Rand()&0xffffff;
+    }
+}
+
+static void Put24(FILE *f, uint32_t v) {
+    fputc(v&0xff, f);
+    fputc((v>>8)&0xff, f);
+    fputc((v>>16)&0xff, f);
+}
+
+static uint32_t MakeFile(const char *path, Expected_t *exp) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) Fail("temp file", 0, 0, 0, 0);
+    uint32_t off = 0;
+    for (uint32_t i=0;i<Commands;i++) {
+        exp[i].Offset = off;
+        if (Rand()%4 == 0) {
+            VgmPcmRamWriteStruct_t *w = &exp[i].Write;
+            exp[i].Command = 0x68;
+            w->Type = Rand()&0xff;
+            w->ReadOffset = Field24();
+            w->WriteOffset = Field24();
+            w->Size = (Rand()%4 == 0)?0:Field24();
+            fputc(0x68, f);
+            fputc(0x66, f);
+            fputc(w->Type, f);
+            Put24(f, w->ReadOffset);
+            Put24(f, w->WriteOffset);
+            Put24(f, w->Size);
+            if (w->Size == 0) w->Size = 0x1000000;
+            off += 12;
+        } else {
+            uint8_t c = Fixed[Rand()%sizeof(Fixed)];
+            uint8_t len = VgmCommandLength(c);
+            exp[i].Command = c;
+            fputc(c, f);
+            for (uint8_t j=1;j<len;j++) fputc(Rand()&0xff, f);
+            off += len;
+        }
+    }
+    fputc(0x66, f);
+    fclose(f);
+    return off;
+}
+
+static void CheckRound(uint32_t round) {
+    static uint8_t buf[VGMREADER_BUF_SIZE];
+    static Expected_t exp[1000000];
+    char path[] = "/tmp/pcmramwrite_testXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) Fail("temp file", round, 0, 0, 0);
+    close(fd);
+    uint32_t end = MakeFile(path, exp);
+
+    TrackFile_t *f = TrackFile_Open(path);
+    if (f == NULL) Fail("open", round, 0, 0, 0);
+    VgmReader_t r;
+    memset(&r, 0, sizeof(r));
+    VgmReader_Init(&r, f, buf, sizeof(buf));
+    for (uint32_t i=0;i<Commands;i++) {
+        if (r.Pos != exp[i].Offset) Fail("command offset", round, i, exp[i].Offset, r.Pos);
+        uint8_t d = VgmReader_Read8(&r);
+        if (d != exp[i].Command) Fail("command", round, i, exp[i].Command, d);
+        if (d == 0x68) {
+            VgmPcmRamWriteStruct_t w;
+            if (!VgmParsePcmRamWrite(&r, &w)) Fail("parse", round, i, 1, 0);
+            if (w.Type != exp[i].Write.Type) Fail("chip type", round, i, exp[i].Write.Type, w.Type);
+            if (w.ReadOffset != exp[i].Write.ReadOffset) Fail("read offset", round, i, exp[i].Write.ReadOffset, w.ReadOffset);
+            if (w.WriteOffset != exp[i].Write.WriteOffset) Fail("write offset", round, i, exp[i].Write.WriteOffset, w.WriteOffset);
+            if (w.Size != exp[i].Write.Size) Fail("size", round, i, exp[i].Write.Size, w.Size);
+        } else {
+            VgmReader_Skip(&r, VgmCommandLength(d)-1);
+        }
+    }
+    if (r.Pos != end || VgmReader_Read8(&r) != 0x66 || r.Error) Fail("end of data", round, Commands, end, r.Pos);
+    TrackFile_Close(f);
+    unlink(path);
+}
+
+static void CheckTruncated() {
+    static uint8_t buf[VGMREADER_BUF_SIZE];
+    static const uint8_t cmd[12] = {0x68, 0x66, 0x07, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99};
+    for (uint32_t len=2;len<sizeof(cmd);len++) { //everything from just the 0x68 0x66 to one byte short
+        char path[] = "/tmp/pcmramwrite_testXXXXXX";
+        int fd = mkstemp(path);
+        FILE *f = (fd < 0)?NULL:fdopen(fd, "wb");
+        if (f == NULL) Fail("temp file", 0, 0, 0, 0);
+        fwrite(cmd, 1, len, f);
+        fclose(f);
+        TrackFile_t *t = TrackFile_Open(path);
+        if (t == NULL) Fail("open", 0, 0, 0, 0);
+        VgmReader_t r;
+        VgmPcmRamWriteStruct_t w;
+        memset(&r, 0, sizeof(r));
+        VgmReader_Init(&r, t, buf, sizeof(buf));
+        VgmReader_Read8(&r);
+        if (VgmParsePcmRamWrite(&r, &w)) Fail("truncated 0x68 parsed ok", 0, 0, len, sizeof(cmd));
+        TrackFile_Close(t);
+        unlink(path);
+    }
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:c:r:")) != -1) {
+        switch (opt) {
+            case 'n': Rounds = strtoul(optarg, NULL, 0); break;
+            case 'c': Commands = strtoul(optarg, NULL, 0); break;
+            case 'r': Seed = strtoul(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr, "usage: %s [-n rounds] [-c commands per round] [-r seed]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (Seed == 0 || Commands == 0 || Commands > 1000000) {
+        fprintf(stderr, "seed must be nonzero, commands 1 to 1000000\n");
+        return 1;
+    }
+    if (!TrackFile_Setup()) Fail("trackfile setup", 0, 0, 0, 0);
+    for (uint32_t i=0;i<Rounds;i++) CheckRound(i);
+    printf("%u rounds of %u commands, 0x68 fields and command sync: ok\n", Rounds, Commands);
+    CheckTruncated();
+    printf("truncated 0x68: ok\n");
+    return 0;
+}
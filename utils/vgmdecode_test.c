@@ -0,0 +1,342 @@
+/*
+ * vgmdecode_test - host test and benchmark of VgmDecode against a reference n-bit / dpcm decoder
+ *
+ * build: cc -O2 -Iutils/host -Ifirmware/main -o vgmdecode_test utils/vgmdecode_test.c firmware/main/vgmdecode.c firmware/main/vgm.c firmware/main/vgmreader.c firmware/main/trackfile.c utils/host/host.c -lpthread -lm
+ * usage: vgmdecode_test [-n rounds] [-b benchmark passes] [-r seed]
+ *
+ *  - blocks are written into a temp file as real 0x67 datablocks (with a 0x7f table block in front where one's needed), parsed with
+ *    VgmParseDataBlock and decoded with VgmDecode_Block, same as the loader does it
+ *  - known answer vectors worked out by hand from the vgm spec: n-bit copy, shift left and table, dpcm with 8 and 6 bit output,
+ *    codes that straddle bytes. then blocks that have to be turned down: no table, a table for other bit widths, more than 8 bits,
+ *    data cut short by the end of the file
+ *  - then random blocks of every mode and bit width against Ref_Decode, which does it the way vgmplay's DecompressDataBlk does:
+ *    codes pulled out a few bits at a time with a shift counter instead of one accumulator, and the value worked out per sample
+ *    instead of from a lookup
+ *  - -b times VgmDecode_Block (through the reader and trackfile cache, like on the device) and Ref_Decode (straight from ram) on a
+ *    full VGM_DECODE_BUF_SIZE block of each mode. the numbers are only for comparing changes on the same machine
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "vgm.h"
+#include "vgmreader.h"
+#include "vgmdecode.h"
+#include "trackfile.h"
+#include "mallocs.h"
+
+static uint32_t Rounds = 3000;
+static uint32_t BenchPasses = 0;
+static uint32_t Seed = 1;
+
+static uint32_t Rand() { //xorshift32
+    Seed ^= Seed << 13;
+    Seed ^= Seed >> 17;
+    Seed ^= Seed << 5;
+    return Seed;
+}
+
+typedef struct {
+    const char *Name;
+    uint8_t CompressionType; //0 n-bit, 1 dpcm
+    uint8_t Subtype;         //n-bit: 0 copy, 1 shift left, 2 table
+    uint8_t BitsD;
+    uint8_t BitsC;
+    uint16_t CompValue;      //added value, or dpcm start value
+    uint32_t UncompressedSize;
+    const uint8_t *Data;
+    uint32_t DataLen;
+    const uint8_t *Table;    //NULL for no 0x7f block in front
+    uint16_t TableCount;
+    uint8_t TableBitsD;      //what the 0x7f block says it's for
+    uint8_t TableBitsC;
+} Block_t;
+
+static void Fail(const char *name, const char *what, uint32_t i, uint32_t want, uint32_t got) {
+    fprintf(stderr, "FAIL: %s: %s at %u: want 0x%02x, got 0x%02x\n", name, what, i, want, got);
+    exit(1);
+}
+
+//the reference, after vgmplay's DecompressDataBlk. only 8 bit table entries, same as the firmware
+
+static void Ref_Decode(const Block_t *b, uint8_t *out) {
+    uint32_t inpos = 0;
+    uint8_t inshift = 0;
+    uint8_t outshift = b->BitsD - b->BitsC;
+    uint16_t outmask = (1<<b->BitsD)-1;
+    uint16_t addval = b->CompValue;
+    for (uint32_t o=0;o<b->UncompressedSize;o++) {
+        uint16_t code = 0;
+        uint8_t bitstoread = b->BitsC;
+        while (bitstoread) {
+            uint8_t readval = (bitstoread >= 8)?8:bitstoread;
+            bitstoread -= readval;
+            uint8_t mask = (1<<readval)-1;
+            inshift += readval;
+            uint16_t inval = ((uint16_t)b->Data[inpos] << inshift >> 8) & mask;
+            if (inshift >= 8) {
+                inshift -= 8;
+                inpos++;
+                if (inshift) inval |= ((uint16_t)b->Data[inpos] << inshift >> 8) & mask;
+            }
+            code |= inval << bitstoread;
+        }
+        uint16_t val;
+        if (b->CompressionType == 0x00) {
+            if (b->Subtype == 0x00) val = b->CompValue + code;
+            else if (b->Subtype == 0x01) val = (code << outshift) + b->CompValue;
+            else val = b->Table[code];
+        } else {
+            addval = (addval + b->Table[code]) & outmask;
+            val = addval;
+        }
+        out[o] = val;
+    }
+}
+
+//files with real datablocks in them
+
+static char Path[] = "/tmp/vgmdecode_testXXXXXX";
+
+static void Put(FILE *f, uint32_t v, uint8_t len) {
+    for (uint8_t i=0;i<len;i++) fputc((v>>(i*8))&0xff, f);
+}
+
+static void WriteFile(const Block_t *b, bool truncate) {
+    FILE *f = fopen(Path, "wb");
+    if (f == NULL) Fail(b->Name, "temp file", 0, 0, 0);
+    if (b->Table) {
+        fputc(0x67, f); fputc(0x66, f); fputc(0x7f, f);
+        Put(f, 6+b->TableCount, 4);
+        fputc(b->CompressionType, f);
+        fputc(b->Subtype, f);
+        fputc(b->TableBitsD, f);
+        fputc(b->TableBitsC, f);
+        Put(f, b->TableCount, 2);
+        fwrite(b->Table, 1, b->TableCount, f);
+    }
+    fputc(0x67, f); fputc(0x66, f); fputc(0x40, f); //compressed ym2612 pcm
+    Put(f, 10+b->DataLen, 4);
+    fputc(b->CompressionType, f);
+    Put(f, b->UncompressedSize, 4);
+    fputc(b->BitsD, f);
+    fputc(b->BitsC, f);
+    fputc(b->Subtype, f);
+    Put(f, b->CompValue, 2);
+    fwrite(b->Data, 1, truncate?b->DataLen/2:b->DataLen, f);
+    fputc(0x66, f);
+    fclose(f);
+}
+
+static const uint8_t *Parse(const Block_t *b) { //parses every block in the file like the loader, returns what the last one decoded to
+    static uint8_t buf[VGMREADER_BUF_SIZE];
+    static TrackFile_t *f = NULL;
+    static VgmReader_t r;
+    if (f) TrackFile_Close(f);
+    f = TrackFile_Open(Path);
+    if (f == NULL) Fail(b->Name, "open", 0, 0, 0);
+    VgmDecode_Clear();
+    memset(&r, 0, sizeof(r));
+    VgmReader_Init(&r, f, buf, sizeof(buf));
+    const uint8_t *ret = NULL;
+    while (VgmReader_Read8(&r) == 0x67) {
+        VgmDataBlockStruct_t block;
+        memset(&block, 0, sizeof(block));
+        if (!VgmParseDataBlock(&r, &block)) Fail(b->Name, "datablock parse", r.Pos, 1, 0);
+        ret = VgmDecode_Block(&r, &block);
+    }
+    return ret;
+}
+
+static const uint8_t *Decode(const Block_t *b, bool truncate) {
+    WriteFile(b, truncate);
+    return Parse(b);
+}
+
+static void Check(const Block_t *b, const uint8_t *want) {
+    static uint8_t ref[VGM_DECODE_BUF_SIZE];
+    const uint8_t *got = Decode(b, false);
+    if (got == NULL) Fail(b->Name, "not decoded", 0, 1, 0);
+    if (want == NULL) {
+        Ref_Decode(b, ref);
+        want = ref;
+    }
+    for (uint32_t i=0;i<b->UncompressedSize;i++) {
+        if (got[i] != want[i]) Fail(b->Name, "sample", i, want[i], got[i]);
+    }
+}
+
+static void CheckRefused(const Block_t *b, bool truncate) {
+    if (Decode(b, truncate) != NULL) Fail(b->Name, "decoded a block it should have turned down", 0, 0, 1);
+}
+
+//known answers
+
+static void CheckVectors() {
+    static const uint8_t copydata[] = {0x12, 0x3f};
+    static const uint8_t copywant[] = {0x11, 0x12, 0x13, 0x1f};
+    static const Block_t copy = {"4 bit copy", 0, 0, 8, 4, 0x10, 4, copydata, 2};
+    Check(&copy, copywant);
+
+    static const uint8_t shldata[] = {0xd2}; //11 01 00 10
+    static const uint8_t shlwant[] = {0xc1, 0x41, 0x01, 0x81};
+    static const Block_t shl = {"2 bit shift left", 0, 1, 8, 2, 0x01, 4, shldata, 1};
+    Check(&shl, shlwant);
+
+    static const uint8_t tabdata[] = {0x05, 0x39, 0x77}; //000 001 01|0 011 100 1|01 110 111
+    static const uint8_t tabtable[] = {9, 8, 7, 6, 5, 4, 3, 2};
+    static const uint8_t tabwant[] = {9, 8, 7, 6, 5, 4, 3, 2};
+    static const Block_t tab = {"3 bit table", 0, 2, 8, 3, 0, 8, tabdata, 3, tabtable, 8, 8, 3};
+    Check(&tab, tabwant);
+
+    static const uint8_t dpcmdata[] = {0x5b}; //01 01 10 11
+    static const uint8_t dpcmtable[] = {0x00, 0x01, 0xff, 0x10};
+    static const uint8_t dpcmwant[] = {0x81, 0x82, 0x81, 0x91};
+    static const Block_t dpcm = {"2 bit dpcm", 1, 0, 8, 2, 0x80, 4, dpcmdata, 1, dpcmtable, 4, 8, 2};
+    Check(&dpcm, dpcmwant);
+
+    static const uint8_t wrapdata[] = {0xe0}; //1 1 1 0 0...
+    static const uint8_t wraptable[] = {0x3f, 0x01};
+    static const uint8_t wrapwant[] = {0x3f, 0x00, 0x01, 0x00};
+    static const Block_t wrap = {"1 bit dpcm into 6 bits", 1, 0, 6, 1, 0x3e, 4, wrapdata, 1, wraptable, 2, 6, 1};
+    Check(&wrap, wrapwant);
+
+    static const Block_t notable = {"dpcm without a table", 1, 0, 8, 2, 0x80, 4, dpcmdata, 1};
+    CheckRefused(&notable, false);
+    static const Block_t othertable = {"dpcm with a table for other widths", 1, 0, 8, 2, 0x80, 4, dpcmdata, 1, dpcmtable, 4, 8, 3};
+    CheckRefused(&othertable, false);
+    static const Block_t shorttable = {"table with too few entries", 0, 2, 8, 3, 0, 8, tabdata, 3, tabtable, 7, 8, 3};
+    CheckRefused(&shorttable, false);
+    static const uint8_t widedata[] = {0, 0, 0, 0};
+    static const Block_t wide = {"9 bit codes", 0, 0, 8, 9, 0, 2, widedata, 4};
+    CheckRefused(&wide, false);
+    static const uint8_t longdata[64];
+    static const Block_t cut = {"data cut short", 0, 0, 8, 4, 0, 128, longdata, 64};
+    CheckRefused(&cut, true);
+}
+
+//random blocks against the reference
+
+static void MakeRandom(Block_t *b, uint8_t *data, uint8_t *table, uint32_t size) {
+    memset(b, 0, sizeof(*b));
+    b->CompressionType = Rand()%2;
+    b->BitsC = 1 + Rand()%8;
+    if (b->CompressionType == 0x00) {
+        b->Subtype = Rand()%3;
+        b->BitsD = (b->Subtype == 0x01)?b->BitsC + Rand()%(9-b->BitsC):1 + Rand()%8; //shift left needs the output to be at least as wide
+    } else {
+        b->BitsD = 1 + Rand()%8;
+    }
+    b->CompValue = Rand()&0xff;
+    b->UncompressedSize = size;
+    b->DataLen = ((uint64_t)size*b->BitsC+7)/8;
+    for (uint32_t i=0;i<b->DataLen;i++) data[i] = Rand();
+    b->Data = data;
+    if (b->CompressionType == 0x01 || b->Subtype == 0x02) {
+        b->TableCount = 1<<b->BitsC;
+        for (uint16_t i=0;i<b->TableCount;i++) table[i] = Rand();
+        b->Table = table;
+        b->TableBitsD = b->BitsD;
+        b->TableBitsC = b->BitsC;
+    }
+}
+
+static void CheckRandom() {
+    static uint8_t data[VGM_DECODE_BUF_SIZE];
+    static uint8_t table[256];
+    static char name[64];
+    for (uint32_t i=0;i<Rounds;i++) {
+        Block_t b;
+        uint32_t size = (Rand()%8 == 0)?1+Rand()%8:1+Rand()%VGM_DECODE_BUF_SIZE;
+        MakeRandom(&b, data, table, size);
+        snprintf(name, sizeof(name), "round %u (type %u/%u, %u->%u bits)", i, b.CompressionType, b.Subtype, b.BitsC, b.BitsD);
+        b.Name = name;
+        Check(&b, NULL);
+    }
+}
+
+//benchmark
+
+static double NowS() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec/1e9;
+}
+
+static void Bench() {
+    static uint8_t data[VGM_DECODE_BUF_SIZE];
+    static uint8_t table[256];
+    static uint8_t out[VGM_DECODE_BUF_SIZE];
+    static const struct {const char *Name; uint8_t Type; uint8_t Subtype; uint8_t BitsC;} modes[] = {
+        {"4 bit copy", 0, 0, 4},
+        {"2 bit shift left", 0, 1, 2},
+        {"3 bit table", 0, 2, 3},
+        {"4 bit dpcm", 1, 0, 4},
+        {"7 bit dpcm", 1, 0, 7},
+    };
+    for (uint8_t m=0;m<sizeof(modes)/sizeof(modes[0]);m++) {
+        Block_t b;
+        memset(&b, 0, sizeof(b));
+        b.Name = modes[m].Name;
+        b.CompressionType = modes[m].Type;
+        b.Subtype = modes[m].Subtype;
+        b.BitsC = modes[m].BitsC;
+        b.BitsD = 8;
+        b.UncompressedSize = VGM_DECODE_BUF_SIZE;
+        b.DataLen = (VGM_DECODE_BUF_SIZE*b.BitsC+7)/8;
+        for (uint32_t i=0;i<b.DataLen;i++) data[i] = Rand();
+        b.Data = data;
+        if (b.CompressionType == 0x01 || b.Subtype == 0x02) {
+            b.TableCount = 1<<b.BitsC;
+            for (uint16_t i=0;i<b.TableCount;i++) table[i] = Rand();
+            b.Table = table;
+            b.TableBitsD = b.BitsD;
+            b.TableBitsC = b.BitsC;
+        }
+        Check(&b, NULL); //writes the file once, so the timed passes only parse and decode
+        double t = NowS();
+        for (uint32_t p=0;p<BenchPasses;p++) Parse(&b);
+        double fw = NowS() - t;
+        t = NowS();
+        for (uint32_t p=0;p<BenchPasses;p++) {
+            Ref_Decode(&b, out);
+            __asm__ volatile("" : : "r"(out) : "memory");
+        }
+        double ref = NowS() - t;
+        double mb = (double)BenchPasses*VGM_DECODE_BUF_SIZE/1e6;
+        printf("%-18s VgmDecode %7.1f MB/s (incl. parse and reads), reference %7.1f MB/s\n", b.Name, mb/fw, mb/ref);
+    }
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:b:r:")) != -1) {
+        switch (opt) {
+            case 'n': Rounds = strtoul(optarg, NULL, 0); break;
+            case 'b': BenchPasses = strtoul(optarg, NULL, 0); break;
+            case 'r': Seed = strtoul(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr, "usage: %s [-n rounds] [-b benchmark passes] [-r seed]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (Seed == 0) {
+        fprintf(stderr, "seed must be nonzero\n");
+        return 1;
+    }
+    int fd = mkstemp(Path);
+    if (fd < 0) Fail("setup", "temp file", 0, 0, 0);
+    close(fd);
+    if (!TrackFile_Setup() || !VgmDecode_Setup()) Fail("setup", "trackfile / vgmdecode setup", 0, 0, 0);
+    CheckVectors();
+    printf("known answer vectors: ok\n");
+    CheckRandom();
+    printf("%u random blocks match the reference: ok\n", Rounds);
+    if (BenchPasses) Bench();
+    unlink(Path);
+    return 0;
+}
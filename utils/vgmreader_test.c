@@ -0,0 +1,266 @@
+/*
+ * vgmreader_test - host test of VgmReader's read-ahead against a simulated slow sd card
+ *
+ * build: cc -O2 -Iutils/host -Ifirmware/main -Ifirmware/components/megastream -Wl,--wrap=fread -o vgmreader_test utils/vgmreader_test.c firmware/main/vgmreader.c firmware/main/trackfile.c utils/host/host.c -lpthread
+ * usage: vgmreader_test [-n file bytes] [-l latency us] [-t card KB/s] [-s spike ms] [-k spike every n reads] [-p parse ns/byte] [-d driver KB/s] [-q queue KB] [-r seed]
+ *
+ *  - the real vgmreader.c and trackfile.c read a temp file, with every fread under them slowed down like a card: -l latency per
+ *    read, plus its length at -t KB/s, plus a -s ms spike on average every -k reads (the spikes are what made the loader go to high
+ *    priority to catch up)
+ *  - a loader thread parses through the file with the same mix of calls Loader_Main makes (Read8, Peek+Skip, Read32, the odd seek
+ *    back like a loop), checks every byte against what was written, and pays -p ns per byte for the parsing itself. what it parses
+ *    goes into a -q KB queue standing in for Driver_CommandStream
+ *  - a driver thread takes -d KB/s out of the queue in 1ms ticks. every time it finds the queue short after having been fed is one
+ *    underrun, counted the same way as Driver_CommandUnderruns / DRIVER_EVENT_COMMAND_UNDERRUN
+ *  - runs twice, without read-ahead (every refill waits on the card, so card time and parse time add up) and with it (the
+ *    read-ahead task reads the next block while the loader parses this one). both have to read back every byte right, and read-ahead
+ *    has to end up with fewer underruns and at least 9 in 10 refills coming out of the read-ahead block. the defaults are a busy vgm
+ *    on a slowish card: parsing alone keeps up, parsing plus the card doesn't
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "taskmgr.h"
+#include "trackfile.h"
+#include "vgmreader.h"
+
+static uint32_t FileBytes = 1024*1024;
+static uint32_t LatencyUs = 800;
+static uint32_t CardKBs = 2000;
+static uint32_t SpikeMs = 25;
+static uint32_t SpikeEvery = 50;
+static uint32_t ParseNs = 1500;
+static uint32_t DriverKBs = 450;
+static uint32_t QueueKB = 16;
+static uint32_t Seed = 1;
+
+static uint8_t FileByte(uint32_t pos) {
+    uint32_t x = pos*0x9e3779b1;
+    return (x ^ (x >> 15)) >> 7;
+}
+
+static uint32_t Rand(uint32_t *s) { //xorshift32
+    uint32_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *s = x;
+}
+
+static uint64_t NowUs() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1000000ULL + t.tv_nsec/1000;
+}
+
+static void Fail(const char *what, uint32_t pos) {
+    fprintf(stderr, "FAIL: %s at file offset %u\n", what, pos);
+    exit(1);
+}
+
+//the slow card. every fread in the link goes through here (-Wl,--wrap=fread)
+
+static volatile bool SlowCard = false;
+static uint32_t CardSeed = 7;
+static volatile uint32_t CardReads;
+static volatile uint64_t CardUs;
+
+size_t __real_fread(void *ptr, size_t size, size_t n, FILE *f);
+size_t __wrap_fread(void *ptr, size_t size, size_t n, FILE *f) {
+    if (SlowCard) {
+        uint64_t us = LatencyUs + (uint64_t)size*n*1000/CardKBs;
+        if (SpikeEvery && Rand(&CardSeed)%SpikeEvery == 0) us += SpikeMs*1000;
+        usleep(us);
+        CardReads++;
+        CardUs += us;
+    }
+    return __real_fread(ptr, size, n, f);
+}
+
+//loader and driver
+
+static volatile uint64_t Produced, Consumed; //bytes of parsed vgm through the stand-in command stream
+static volatile bool Done;
+
+typedef struct {
+    VgmReader_t *Reader;
+    uint64_t StallUs; //time spent in the reader's refills, waiting on the card or the read-ahead task
+    uint32_t Refills;
+} Loader_t;
+
+static void Produce(uint32_t bytes, uint64_t *due) { //parsing cost, then into the queue, waiting for room like the loader does
+    uint64_t now = NowUs()*1000;
+    if (*due < now) *due = now; //time spent waiting on the card isn't parsing time
+    *due += (uint64_t)bytes*ParseNs;
+    if (*due > now + 1000000) usleep((*due - now)/1000); //on a schedule, so sleeps running long don't add up
+    while (Produced + bytes - Consumed > QueueKB*1024ULL) usleep(1000);
+    __atomic_store_n(&Produced, Produced + bytes, __ATOMIC_RELEASE);
+}
+
+static void *LoaderThread(void *arg) {
+    Loader_t *l = arg;
+    VgmReader_t *r = l->Reader;
+    uint32_t seed = Seed;
+    uint64_t due = 0;
+    bool looped = false;
+    while (r->Pos < FileBytes) {
+        uint32_t pos = r->Pos;
+        uint32_t how = Rand(&seed)%8;
+        uint32_t len = 1;
+        uint64_t t = NowUs();
+        bool miss = (r->Pos - r->BufStart >= r->BufLen);
+        if (how < 4 || pos + 12 > FileBytes) { //command byte
+            if (VgmReader_Read8(r) != FileByte(pos)) Fail("Read8 data", pos);
+        } else if (how < 7) { //command data
+            len = 1 + Rand(&seed)%11;
+            if (pos + len > FileBytes) len = FileBytes - pos;
+            miss = (pos < r->BufStart || pos + len > r->BufStart + r->BufLen);
+            const uint8_t *p = VgmReader_Peek(r, len);
+            if (p == NULL) Fail("Peek", pos);
+            for (uint32_t i=0;i<len;i++) {
+                if (p[i] != FileByte(pos+i)) Fail("Peek data", pos+i);
+            }
+            VgmReader_Skip(r, len);
+        } else {
+            len = 4;
+            miss = (pos < r->BufStart || pos + len > r->BufStart + r->BufLen);
+            uint32_t v = VgmReader_Read32(r);
+            if (v != (FileByte(pos) | (uint32_t)FileByte(pos+1)<<8 | (uint32_t)FileByte(pos+2)<<16 | (uint32_t)FileByte(pos+3)<<24)) Fail("Read32 data", pos);
+        }
+        if (miss) {
+            l->StallUs += NowUs() - t;
+            l->Refills++;
+        }
+        if (r->Error) Fail("reader error", pos);
+        Produce(len, &due);
+        if (!looped && r->Pos > FileBytes*3/4) { //loop point, back to a quarter of the way in, once
+            VgmReader_Seek(r, FileBytes/4 + Rand(&seed)%4096);
+            looped = true;
+        }
+    }
+    Done = true;
+    return NULL;
+}
+
+typedef struct {
+    uint32_t Underruns;
+    uint32_t StarvedMs;
+} Driver_t;
+
+static void *DriverThread(void *arg) {
+    Driver_t *d = arg;
+    bool fed = false, starved = false;
+    double want = 0;
+    uint64_t next = NowUs();
+    while (!Done || Consumed < Produced) {
+        next += 1000;
+        uint64_t now = NowUs();
+        if (next > now) usleep(next - now);
+        want += DriverKBs*1024/1000.0;
+        uint64_t avail = __atomic_load_n(&Produced, __ATOMIC_ACQUIRE) - Consumed;
+        uint64_t take = (avail < (uint64_t)want)?avail:(uint64_t)want;
+        Consumed += take;
+        want -= take;
+        if (take) fed = true;
+        if (want >= 1 && fed && !Done) {
+            if (!starved) d->Underruns++;
+            starved = true;
+            d->StarvedMs++;
+            want = 0; //a starved driver doesn't catch up, it just plays late
+        } else {
+            starved = false;
+        }
+    }
+    return NULL;
+}
+
+static void Run(const char *path, bool readahead, uint32_t *underruns, uint32_t *misses, uint32_t *refills) {
+    static uint8_t bufs[2][VGMREADER_CARRY+VGMREADER_BUF_SIZE];
+    static VgmReader_t reader;
+    TrackFile_t *f = TrackFile_Open(path);
+    if (f == NULL) Fail("open", 0);
+    memset(&reader, 0, sizeof(reader));
+    if (readahead && !VgmReader_SetupReadAhead(&reader, bufs[1]+VGMREADER_CARRY)) Fail("read-ahead setup", 0);
+    VgmReader_Init(&reader, f, bufs[0]+VGMREADER_CARRY, VGMREADER_BUF_SIZE);
+    Produced = Consumed = 0;
+    Done = false;
+    CardReads = 0;
+    CardUs = 0;
+    CardSeed = 7;
+    Loader_t l = {&reader, 0, 0};
+    Driver_t d = {0, 0};
+    pthread_t lt, dt;
+    uint64_t t = NowUs();
+    SlowCard = true;
+    pthread_create(&dt, NULL, DriverThread, &d);
+    pthread_create(&lt, NULL, LoaderThread, &l);
+    pthread_join(lt, NULL);
+    pthread_join(dt, NULL);
+    SlowCard = false;
+    t = NowUs() - t;
+    if (readahead) VgmReader_StopReadAhead(&reader);
+    TrackFile_Close(f);
+    printf("%s: %.2fs, %u card reads (%.0f ms), ", readahead?"read-ahead":"sync", t/1e6, CardReads, CardUs/1e3);
+    if (readahead) printf("%u of %u refills missed the read-ahead block, ", reader.Misses, l.Refills);
+    printf("loader waited %.0f ms in refills, %u underruns (%u ms starved)\n", l.StallUs/1e3, d.Underruns, d.StarvedMs);
+    *underruns = d.Underruns;
+    *misses = reader.Misses;
+    *refills = l.Refills;
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:l:t:s:k:p:d:q:r:")) != -1) {
+        switch (opt) {
+            case 'n': FileBytes = strtoul(optarg, NULL, 0); break;
+            case 'l': LatencyUs = strtoul(optarg, NULL, 0); break;
+            case 't': CardKBs = strtoul(optarg, NULL, 0); break;
+            case 's': SpikeMs = strtoul(optarg, NULL, 0); break;
+            case 'k': SpikeEvery = strtoul(optarg, NULL, 0); break;
+            case 'p': ParseNs = strtoul(optarg, NULL, 0); break;
+            case 'd': DriverKBs = strtoul(optarg, NULL, 0); break;
+            case 'q': QueueKB = strtoul(optarg, NULL, 0); break;
+            case 'r': Seed = strtoul(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr, "usage: %s [-n file bytes] [-l latency us] [-t card KB/s] [-s spike ms] [-k spike every n reads] [-p parse ns/byte] [-d driver KB/s] [-q queue KB] [-r seed]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (Seed == 0 || CardKBs == 0 || FileBytes < 64*1024) {
+        fprintf(stderr, "seed and card speed must be nonzero, file at least 64KB\n");
+        return 1;
+    }
+
+    char path[] = "/tmp/vgmreader_testXXXXXX";
+    int fd = mkstemp(path);
+    FILE *f = (fd < 0)?NULL:fdopen(fd, "w");
+    if (f == NULL) Fail("temp file", 0);
+    for (uint32_t i=0;i<FileBytes;i++) fputc(FileByte(i), f);
+    fclose(f);
+
+    if (!TrackFile_Setup()) Fail("trackfile setup", 0);
+    Host_TaskStart(VgmReader_ReadAheadMain, &Taskmgr_Handles[TASK_READAHEAD]);
+
+    uint32_t sync, ahead, misses, refills;
+    Run(path, false, &sync, &misses, &refills);
+    Run(path, true, &ahead, &misses, &refills);
+    unlink(path);
+    if (misses*10 > refills) { //the block cache hides a broken swap from the underrun count, so check this separately
+        fprintf(stderr, "FAIL: %u of %u refills didn't come from the read-ahead block\n", misses, refills);
+        return 1;
+    }
+    if (ahead >= sync && sync > 0) {
+        fprintf(stderr, "FAIL: read-ahead didn't cut underruns (%u vs %u)\n", ahead, sync);
+        return 1;
+    }
+    printf("every byte read back right on both: ok\n");
+    return 0;
+}